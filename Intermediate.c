@@ -1,135 +1,537 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "lexer.h"
+#include "tac.h"
+#include "cfg.h"
+#include "opt.h"
+#include "x86.h"
+#include "vm.h"
+#include "jit.h"
+#include "stats.h"
+
+#define MAX_WORD_SIZE 64
+#define FLUSH_QUADS 4096   // --stream: top-level code is printed in batches of at least this many quads
+
+TacBuffer code;            // Generated three-address code
 
-#define MAX_CODE_SIZE 100
-#define MAX_INPUT_SIZE 1000
+typedef enum { BLOCK_PLAIN, BLOCK_IF, BLOCK_ELSE, BLOCK_WHILE, BLOCK_FOR, BLOCK_DO } BlockKind;
 
 typedef struct {
-    char op[10];
-    char arg1[10];
-    char arg2[10];
-    char result[10];
-} TAC;
+    BlockKind kind;
+    uint32_t endLabel;       // Placed at the closing '}' (loops: the exit)
+    uint32_t topLabel;       // Loops: start of the next iteration
+    uint32_t continueLabel;  // Loops: where continue goes
+    char* step;              // for: the step statement, run before the next iteration
+    int chained;             // An "else if": its '}' also closes the else around it
+} OpenBlock;
 
-TAC code[MAX_CODE_SIZE];
-int codeIndex = 0;
-int tempVarCount = 0;
-int labelCount = 0;
+OpenBlock *openBlocks = NULL;  // Blocks whose '}' has not been seen yet
+int openBlockCount = 0;
+int openBlockCapacity = 0;
 
-char* newTemp() {
-    static char temp[10];
-    snprintf(temp, sizeof(temp), "t%d", tempVarCount++);
-    return temp;
+Stats stats;               // Phase times and counters
+int timeReport = -1;       // Print stats at exit: 0 = table, 1 = JSON
+
+// Function to turn a word from the input into an operand, dropping the
+// punctuation that sscanf leaves attached ("(x", "10;", "5)")
+uint32_t operand(const char* word) {
+    while (*word == '(') word++;
+    uint32_t length = (uint32_t)strlen(word);
+    while (length > 0 && (word[length - 1] == ';' || word[length - 1] == ')')) length--;
+    if (length > 0 && (isdigit((unsigned char)word[0]) || word[0] == '-' || word[0] == '.')) {
+        return tacConst(&code, word, length);
+    }
+    return tacVar(&code, word, length);
 }
 
-char* newLabel() {
-    static char label[10];
-    snprintf(label, sizeof(label), "L%d", labelCount++);
-    return label;
+// Function to map an operator spelling to its opcode; TAC_NOP if unknown
+TacOp operatorCode(const char* op) {
+    static const char* const spellings[] = {"+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!="};
+    static const TacOp codes[] = {TAC_ADD, TAC_SUB, TAC_MUL, TAC_DIV, TAC_MOD,
+                                  TAC_LT, TAC_LE, TAC_GT, TAC_GE, TAC_EQ, TAC_NE};
+    for (int i = 0; i < (int)(sizeof(codes) / sizeof(codes[0])); i++) {
+        if (strcmp(op, spellings[i]) == 0) return codes[i];
+    }
+    return TAC_NOP;
 }
 
-void addCode(const char* op, const char* arg1, const char* arg2, const char* result) {
-    if (codeIndex >= MAX_CODE_SIZE) {
-        fprintf(stderr, "Error: Exceeded maximum code array size.\n");
-        return;
+// Function to map a compound assignment ("+=", "-=", ...) to its opcode;
+// TAC_NOP if op is not one
+TacOp compoundOperator(const char* op) {
+    char single[2] = {op[0], '\0'};
+    TacOp opcode = strlen(op) == 2 && op[1] == '=' ? operatorCode(single) : TAC_NOP;
+    return opcode >= TAC_ADD && opcode <= TAC_MOD ? opcode : TAC_NOP;
+}
+
+// Function to recognize "x++", "x--", "++x" and "--x", leaving the name in
+// var. Returns TAC_ADD or TAC_SUB, or TAC_NOP for anything else.
+TacOp incrementOperator(const char* line, char* var) {
+    char sign[3];
+    if (sscanf(line, "%2[+-]%63[A-Za-z0-9_]", sign, var) == 2 || sscanf(line, "%63[A-Za-z0-9_]%2[+-]", var, sign) == 2) {
+        if (strcmp(sign, "++") == 0) return TAC_ADD;
+        if (strcmp(sign, "--") == 0) return TAC_SUB;
     }
-    snprintf(code[codeIndex].op, sizeof(code[codeIndex].op), "%s", op);
-    snprintf(code[codeIndex].arg1, sizeof(code[codeIndex].arg1), "%s", arg1 ? arg1 : "");
-    snprintf(code[codeIndex].arg2, sizeof(code[codeIndex].arg2), "%s", arg2 ? arg2 : "");
-    snprintf(code[codeIndex].result, sizeof(code[codeIndex].result), "%s", result ? result : "");
-    codeIndex++;
+    return TAC_NOP;
 }
 
 void printIntermediateCode() {
     printf("\nGenerated Intermediate Code (Three-Address Code):\n");
-    for (int i = 0; i < codeIndex; i++) {
-        if (strcmp(code[i].op, "=") == 0) {
-            printf("%s = %s\n", code[i].result, code[i].arg1);
-        } else if (strcmp(code[i].op, "label") == 0) {
-            printf("%s:\n", code[i].result);
-        } else if (strcmp(code[i].op, "goto") == 0) {
-            printf("goto %s\n", code[i].result);
-        } else if (strcmp(code[i].op, "if") == 0) {
-            printf("if %s %s %s goto %s\n", code[i].arg1, code[i].result, code[i].arg2);
-        } else if (strcmp(code[i].op, "printf") == 0) {
-            printf("printf(%s)\n", code[i].arg1);
-        } else {
-            printf("%s = %s %s %s\n", code[i].result, code[i].arg1, code[i].op, code[i].arg2);
-        }
+    tacPrint(&code, stdout);
+}
+
+// Function to test whether a line starts with a keyword (followed by a
+// non-identifier character)
+int startsWith(const char* line, const char* word) {
+    size_t length = strlen(word);
+    return strncmp(line, word, length) == 0 && !isalnum((unsigned char)line[length]) && line[length] != '_';
+}
+
+// Function to skip spaces and tabs
+char* skipSpaces(char* text) {
+    while (*text == ' ' || *text == '\t') text++;
+    return text;
+}
+
+// Function to emit a jump to label taken when the condition in text ("(x > 0)",
+// "x > 0" or a single value like "(n)") has the truth value jumpIfTrue
+void emitCondition(const char* text, uint32_t label, int jumpIfTrue) {
+    char condArg1[MAX_WORD_SIZE], condArg2[MAX_WORD_SIZE], condOp[MAX_WORD_SIZE];
+    int words = sscanf(text, "%63s %63s %63s", condArg1, condOp, condArg2);
+    TacOp op = words == 3 ? operatorCode(condOp) : TAC_NOP;
+    if (op >= TAC_LT && op <= TAC_NE) {
+        tacEmitIf(&code, jumpIfTrue ? op : optNegate(op), operand(condArg1), operand(condArg2), label);
+    } else if (words >= 1) {
+        // Any other value is true when it is not zero
+        tacEmitIf(&code, jumpIfTrue ? TAC_NE : TAC_EQ, operand(condArg1), tacImm(0), label);
     }
 }
 
-void processInput(char* input) {
-    char* line = strtok(input, "\n");
-    char condArg1[10], condArg2[10], condOp[3];
-    char var[10], op[5], arg1[10], arg2[10];
-    char* endLabel;
-    char* trueLabel;
+OpenBlock* openBlock(BlockKind kind) {
+    if (openBlockCount == openBlockCapacity) {
+        openBlockCapacity = openBlockCapacity ? openBlockCapacity * 2 : 16;
+        openBlocks = internAlloc(openBlocks, (size_t)openBlockCapacity * sizeof(OpenBlock));
+    }
+    OpenBlock* block = &openBlocks[openBlockCount++];
+    memset(block, 0, sizeof(*block));
+    block->kind = kind;
+    block->endLabel = block->topLabel = block->continueLabel = TAC_NONE;
+    return block;
+}
 
-    while (line != NULL) {
-        // Trim whitespace
-        while (*line == ' ') line++;
-
-        // Match declarations like "int x = 10;" or "int x;"
-        if (sscanf(line, "int %s = %s;", var, arg1) == 2) {
-            addCode("=", arg1, NULL, var);
-        } else if (sscanf(line, "int %s;", var) == 1) {
-            addCode("=", "0", NULL, var); // Default to 0 for uninitialized variables
+// Function to find the innermost loop for break and continue; NULL outside loops
+OpenBlock* innermostLoop() {
+    for (int i = openBlockCount - 1; i >= 0; i--) {
+        if (openBlocks[i].kind == BLOCK_WHILE || openBlocks[i].kind == BLOCK_FOR || openBlocks[i].kind == BLOCK_DO) {
+            return &openBlocks[i];
         }
-        // Match if condition with or without parentheses like "if (x > 0) {"
-        else if (sscanf(line, "if %s %s %s {", condArg1, condOp, condArg2) == 3 ||
-                 sscanf(line, "if (%s %s %s {", condArg1, condOp, condArg2) == 3) {
-            trueLabel = newLabel();
-            endLabel = newLabel();
-            addCode("if", condArg1, condOp, trueLabel);      // Conditional jump to true label
-            addCode("goto", endLabel, NULL, NULL);           // Skip the true block if condition fails
-            addCode("label", NULL, NULL, trueLabel);         // True label
+    }
+    return NULL;
+}
+
+void processStatement(char* line);
+
+// Function to close the innermost block at its '}'. rest is what follows the
+// brace on the same line ("while (x > 0);" for a do loop).
+void closeBlock(const char* rest) {
+    int chained = 1;
+    while (chained && openBlockCount > 0) {
+        OpenBlock block = openBlocks[--openBlockCount];
+        chained = block.chained;
+        switch (block.kind) {
+            case BLOCK_IF:
+            case BLOCK_ELSE:
+                tacEmit(&code, TAC_LABEL, block.endLabel, TAC_NONE, TAC_NONE);
+                break;
+            case BLOCK_WHILE:
+            case BLOCK_FOR:
+                if (block.continueLabel != block.topLabel) tacEmit(&code, TAC_LABEL, block.continueLabel, TAC_NONE, TAC_NONE);
+                if (block.step != NULL) processStatement(block.step);
+                tacEmit(&code, TAC_GOTO, block.topLabel, TAC_NONE, TAC_NONE);
+                tacEmit(&code, TAC_LABEL, block.endLabel, TAC_NONE, TAC_NONE);
+                break;
+            case BLOCK_DO:
+                tacEmit(&code, TAC_LABEL, block.continueLabel, TAC_NONE, TAC_NONE);
+                if (startsWith(rest, "while")) emitCondition(rest + 5, block.topLabel, 1);
+                tacEmit(&code, TAC_LABEL, block.endLabel, TAC_NONE, TAC_NONE);
+                break;
+            case BLOCK_PLAIN:
+                break;
         }
-        // Handle printf statements
-        else if (sscanf(line, "printf(\"%[^\"]\");", arg1) == 1) {
-            addCode("printf", arg1, NULL, NULL);
+        free(block.step);
+    }
+}
+
+// Function to start the else branch of the innermost if: the true branch
+// jumps past it, and the false branch starts here. rest is what follows
+// "else" ("{" or "if (...) {").
+void openElse(char* rest) {
+    OpenBlock* block = &openBlocks[openBlockCount - 1];
+    uint32_t doneLabel = tacNewLabel(&code);
+    tacEmit(&code, TAC_GOTO, doneLabel, TAC_NONE, TAC_NONE);
+    tacEmit(&code, TAC_LABEL, block->endLabel, TAC_NONE, TAC_NONE);
+    block->kind = BLOCK_ELSE;
+    block->endLabel = doneLabel;
+    if (startsWith(rest, "if")) {
+        processStatement(rest);
+        openBlocks[openBlockCount - 1].chained = 1;
+    }
+}
+
+// Function to lower one statement or block opener
+void processStatement(char* line) {
+    char var[MAX_WORD_SIZE], op[MAX_WORD_SIZE], arg1[MAX_WORD_SIZE], arg2[MAX_WORD_SIZE];
+    line = skipSpaces(line);
+
+    // Match if condition with or without parentheses like "if (x > 0) {"
+    if (startsWith(line, "if")) {
+        OpenBlock* block = openBlock(BLOCK_IF);
+        uint32_t trueLabel = tacNewLabel(&code);
+        block->endLabel = tacNewLabel(&code);
+        emitCondition(line + 2, trueLabel, 1);                                  // Conditional jump to true label
+        tacEmit(&code, TAC_GOTO, block->endLabel, TAC_NONE, TAC_NONE);         // Skip the true block if condition fails
+        tacEmit(&code, TAC_LABEL, trueLabel, TAC_NONE, TAC_NONE);              // True label
+    }
+    // Loops like "while (i < n) {": the test at the top leaves the loop
+    else if (startsWith(line, "while")) {
+        OpenBlock* block = openBlock(BLOCK_WHILE);
+        block->topLabel = block->continueLabel = tacNewLabel(&code);
+        block->endLabel = tacNewLabel(&code);
+        tacEmit(&code, TAC_LABEL, block->topLabel, TAC_NONE, TAC_NONE);
+        emitCondition(line + 5, block->endLabel, 0);
+    }
+    // "for (init; condition; step) {", any part may be empty
+    else if (startsWith(line, "for")) {
+        char* init = strchr(line, '(');
+        char* condition = init != NULL ? strchr(init + 1, ';') : NULL;
+        char* step = condition != NULL ? strchr(condition + 1, ';') : NULL;
+        OpenBlock* block = openBlock(BLOCK_FOR);
+        block->topLabel = tacNewLabel(&code);
+        block->continueLabel = tacNewLabel(&code);
+        block->endLabel = tacNewLabel(&code);
+        if (step != NULL) {
+            *condition++ = '\0';
+            *step++ = '\0';
+            char* close = strrchr(step, ')');
+            if (close != NULL) *close = '\0';
+            block->step = internAlloc(NULL, strlen(step) + 1);
+            strcpy(block->step, step);
+            processStatement(init + 1);
         }
-        // Handle single assignments like "x = 5;"
-        else if (sscanf(line, "%s = %s;", var, arg1) == 2) {
-            addCode("=", arg1, NULL, var);
-        } 
-        // Handle arithmetic operations like "x = x + 1;"
-        else if (sscanf(line, "%s = %s %s %s;", var, arg1, op, arg2) == 4) {
-            char* temp = newTemp();
-            addCode(op, arg1, arg2, temp); // Perform operation
-            addCode("=", temp, NULL, var);  // Assign result
+        tacEmit(&code, TAC_LABEL, block->topLabel, TAC_NONE, TAC_NONE);
+        if (step != NULL && *skipSpaces(condition) != '\0') emitCondition(condition, block->endLabel, 0);
+    }
+    // "do {", closed by "} while (condition);"
+    else if (startsWith(line, "do")) {
+        OpenBlock* block = openBlock(BLOCK_DO);
+        block->topLabel = tacNewLabel(&code);
+        block->continueLabel = tacNewLabel(&code);
+        block->endLabel = tacNewLabel(&code);
+        tacEmit(&code, TAC_LABEL, block->topLabel, TAC_NONE, TAC_NONE);
+    }
+    else if (startsWith(line, "break") || startsWith(line, "continue")) {
+        OpenBlock* loop = innermostLoop();
+        if (loop != NULL) {
+            tacEmit(&code, TAC_GOTO, line[0] == 'b' ? loop->endLabel : loop->continueLabel, TAC_NONE, TAC_NONE);
         }
+    }
+    // A nested block, or a function header like "int main() {"
+    else if (line[0] == '{' || (strchr(line, '(') != NULL && line[strlen(line) - 1] == '{')) {
+        openBlock(BLOCK_PLAIN);
+    }
+    // Match declarations like "int x = 10;", "int x = a + b;" or "int x;"
+    else if (sscanf(line, "int %63s = %63s %63s %63s", var, arg1, op, arg2) == 4 && operatorCode(op) != TAC_NOP) {
+        uint32_t temp = tacNewTemp(&code);
+        tacEmit(&code, operatorCode(op), temp, operand(arg1), operand(arg2));
+        tacEmit(&code, TAC_COPY, operand(var), temp, TAC_NONE);
+    } else if (sscanf(line, "int %63s = %63s", var, arg1) == 2) {
+        tacEmit(&code, TAC_COPY, operand(var), operand(arg1), TAC_NONE);
+    } else if (sscanf(line, "int %63s", var) == 1) {
+        tacEmit(&code, TAC_COPY, operand(var), tacImm(0), TAC_NONE); // Default to 0 for uninitialized variables
+    }
+    // Handle printf statements
+    else if (sscanf(line, "printf(\"%63[^\"]\");", arg1) == 1) {
+        tacEmit(&code, TAC_PRINT, TAC_NONE, tacConst(&code, arg1, (uint32_t)strlen(arg1)), TAC_NONE);
+    }
+    // Handle arithmetic operations like "x = x + 1;"
+    else if (sscanf(line, "%63s = %63s %63s %63s", var, arg1, op, arg2) == 4 && operatorCode(op) != TAC_NOP) {
+        uint32_t temp = tacNewTemp(&code);
+        tacEmit(&code, operatorCode(op), temp, operand(arg1), operand(arg2)); // Perform operation
+        tacEmit(&code, TAC_COPY, operand(var), temp, TAC_NONE);               // Assign result
+    }
+    // Handle single assignments like "x = 5;"
+    else if (sscanf(line, "%63s = %63s", var, arg1) == 2) {
+        tacEmit(&code, TAC_COPY, operand(var), operand(arg1), TAC_NONE);
+    }
+    // Handle compound assignments like "x += 2;"
+    else if (sscanf(line, "%63s %63s %63s", var, op, arg1) == 3 && compoundOperator(op) != TAC_NOP) {
+        uint32_t temp = tacNewTemp(&code);
+        tacEmit(&code, compoundOperator(op), temp, operand(var), operand(arg1));
+        tacEmit(&code, TAC_COPY, operand(var), temp, TAC_NONE);
+    }
+    // Handle increments and decrements like "i++;" or "--i;"
+    else if (incrementOperator(line, var) != TAC_NOP) {
+        uint32_t temp = tacNewTemp(&code);
+        tacEmit(&code, incrementOperator(line, var), temp, operand(var), tacImm(1));
+        tacEmit(&code, TAC_COPY, operand(var), temp, TAC_NONE);
+    }
+
+    // Ignore unrecognized patterns silently
+}
+
+// Function to translate one line of input; next is the line after it (NULL
+// at the end). Returns 1 if next was used up too, by an else on its own line.
+int processLine(char* line, char* next) {
+    int usedNext = 0;
+    // Trim whitespace
+    line = skipSpaces(line);
 
-        // Ignore unrecognized patterns silently
-        line = strtok(NULL, "\n");
+    // A '}' closes the innermost block, unless an else follows it (on the
+    // same line or the next)
+    if (line[0] == '}') {
+        char* rest = skipSpaces(line + 1);
+        if (!startsWith(rest, "else") && rest[0] == '\0' && next != NULL && startsWith(skipSpaces(next), "else")) {
+            rest = skipSpaces(next);
+            usedNext = 1;
+        }
+        if (startsWith(rest, "else") && openBlockCount > 0 && openBlocks[openBlockCount - 1].kind == BLOCK_IF) {
+            openElse(skipSpaces(rest + 4));
+        } else {
+            closeBlock(rest);
+        }
+    } else {
+        processStatement(line);
     }
+    return usedNext;
 }
 
-int main() {
-    char input[MAX_INPUT_SIZE] = ""; // Increased input size
-    char line[100];
+void processInput(char* input) {
+    char* line = strtok(input, "\n");
 
-    printf("Enter your code as a whole block (type 'END' on a new line to finish):\n");
+    while (line != NULL) {
+        char* next = strtok(NULL, "\n");
+        if (processLine(line, next)) next = strtok(NULL, "\n");
+        line = next;
+    }
 
-    while (1) {
-        if (fgets(line, sizeof(line), stdin) == NULL) {
-            break; // Handle EOF or read error
+    // Close the blocks left open at the end of the input
+    while (openBlockCount > 0) closeBlock("");
+}
+
+// Function to read the next line that is not blank into *line, growing it
+// as needed, without its newline. Returns 0 at the end of the input or at
+// the "END" line.
+int readCodeLine(FILE* in, char** line, size_t* capacity) {
+    if (*capacity == 0) {
+        *capacity = 256;
+        *line = internAlloc(NULL, *capacity);
+    }
+    for (;;) {
+        size_t length = 0;
+        while (fgets(*line + length, (int)(*capacity - length), in) != NULL) {
+            length += strlen(*line + length);
+            if ((*line)[length - 1] == '\n') {
+                (*line)[--length] = '\0';
+                break;
+            }
+            if (length + 1 < *capacity) break;   // The last line, without a newline
+            *capacity *= 2;
+            *line = internAlloc(*line, *capacity);
         }
-        if (strcmp(line, "END\n") == 0) {
-            break;
+        if (length == 0 && feof(in)) return 0;
+        statsAdd(&stats, STAT_BYTES, length + 1);
+        if (strcmp(*line, "END") == 0) return 0;
+        if (*skipSpaces(*line) != '\0') return 1;
+    }
+}
+
+// Function to optimize and print the code generated so far, then empty the
+// buffer for the code that follows
+void flushCode(int optLevel) {
+    statsAdd(&stats, STAT_QUADS, code.count);
+    StatsClock start = statsNow();
+    optimize(&code, optLevel);
+    statsPhase(&stats, "optimize", start);
+    start = statsNow();
+    tacPrint(&code, stdout);
+    statsPhase(&stats, "printIntermediateCode", start);
+    tacReset(&code);
+}
+
+// Function to translate the input a line at a time, printing the code each
+// time it is back at the top level with FLUSH_QUADS or more quads pending.
+// A function (or top-level block) is never split, so memory is bounded by
+// the largest one rather than by the size of the program. Each piece is
+// optimized on its own, which is safe since nothing is assumed about
+// variables on entry and named variables stay live at the end.
+void processStream(FILE* in, int optLevel) {
+    char* line = NULL;
+    char* next = NULL;
+    size_t lineCapacity = 0, nextCapacity = 0;
+    int more = readCodeLine(in, &next, &nextCapacity);
+    StatsClock start = statsNow();
+    while (more) {
+        char* swapLine = line;
+        size_t swapCapacity = lineCapacity;
+        line = next;
+        lineCapacity = nextCapacity;
+        next = swapLine;
+        nextCapacity = swapCapacity;
+
+        more = readCodeLine(in, &next, &nextCapacity);
+        if (processLine(line, more ? next : NULL)) more = readCodeLine(in, &next, &nextCapacity);
+        if (openBlockCount == 0 && code.count >= FLUSH_QUADS) {
+            statsPhase(&stats, "processStream", start);
+            flushCode(optLevel);
+            start = statsNow();
         }
-        // Check for buffer overflow while concatenating
-        if (strlen(input) + strlen(line) < MAX_INPUT_SIZE) {
-            strcat(input, line);
+    }
+    while (openBlockCount > 0) closeBlock("");
+    statsPhase(&stats, "processStream", start);
+    flushCode(optLevel);
+    free(line);
+    free(next);
+}
+
+// Function to split the code into basic blocks and print the control-flow
+// graph with each block's immediate dominator
+void printControlFlowGraph() {
+    Cfg cfg;
+    cfgBuild(&cfg, &code);
+    cfgDominators(&cfg);
+    printf("\nControl-Flow Graph (%u blocks):\n", cfg.blockCount);
+    cfgPrint(&cfg, stdout);
+    cfgFree(&cfg);
+}
+
+// Function to write the code as an x86-64 assembly file
+void writeAssembly(const char* path) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error: Cannot open %s for writing\n", path);
+        exit(1);
+    }
+    x86Emit(&code, out);
+    fclose(out);
+}
+
+// Function to print the phase times and counters to stderr (run at exit)
+void printTimeReport(void) {
+    fflush(stdout);
+    statsPrint(&stats, stderr, timeReport);
+}
+
+int main(int argc, char* argv[]) {
+    Source input;
+    int showCfg = 0;
+    int optLevel = 0;
+    const char* asmPath = NULL;
+    int run = 0;
+    int jit = 0;
+    int verify = 0;
+    int stream = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cfg") == 0) {
+            showCfg = 1;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run = 1;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit = 1;
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            asmPath = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '2' && argv[i][3] == '\0') {
+            optLevel = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            timeReport = 0;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            timeReport = 1;
         } else {
-            fprintf(stderr, "Error: Input exceeds maximum size.\n");
-            break;
+            fprintf(stderr, "Usage: %s [-O0|-O1|-O2] [--cfg] [--run | --jit] [--verify] [-S FILE] [--stream] [--time-report | --stats]\n", argv[0]);
+            fprintf(stderr, "  -O1       constant and copy propagation, dead-code elimination\n");
+            fprintf(stderr, "  -O2       -O1 plus common subexpression elimination (value numbering) and loop\n");
+            fprintf(stderr, "            rotation, invariant code motion and strength reduction\n");
+            fprintf(stderr, "  --cfg     also print the basic blocks, edges and dominators\n");
+            fprintf(stderr, "  --run     execute the code in the bytecode VM\n");
+            fprintf(stderr, "  --jit     compile the code to x86-64 machine code in memory and run it\n");
+            fprintf(stderr, "  --verify  check that the optimized code behaves like the original\n");
+            fprintf(stderr, "  -S FILE   write x86-64 assembly to FILE (build it with: gcc FILE -o prog)\n");
+            fprintf(stderr, "  --stream  translate and print a piece at a time, in memory bounded by the\n");
+            fprintf(stderr, "            largest function (no --cfg, --run, --jit, --verify or -S)\n");
+            fprintf(stderr, "  --time-report  print time per phase and work counters to stderr\n");
+            fprintf(stderr, "  --stats        the same as JSON\n");
+            return 1;
         }
     }
+    if (stream && (showCfg || run || jit || verify || asmPath != NULL)) {
+        fprintf(stderr, "Error: --stream cannot be combined with --cfg, --run, --jit, --verify or -S\n");
+        return 1;
+    }
+
+    statsInit(&stats);
+    if (timeReport >= 0) atexit(printTimeReport);
+    printf("Enter your code as a whole block (type 'END' on a new line to finish):\n");
+    if (stream) {
+        tacInit(&code);
+        printf("\nGenerated Intermediate Code (Three-Address Code):\n");
+        processStream(stdin, optLevel);
+        tacFree(&code);
+        free(openBlocks);
+        return 0;
+    }
+    if (!sourceReadUntilEnd(&input, stdin)) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    statsAdd(&stats, STAT_BYTES, input.length);
 
-    processInput(input);
+    tacInit(&code);
+    StatsClock start = statsNow();
+    processInput(input.text);
+    statsPhase(&stats, "processInput", start);
+    statsAdd(&stats, STAT_QUADS, code.count);
+    VmProgram reference;
+    if (verify) vmLower(&reference, &code);
+    start = statsNow();
+    optimize(&code, optLevel);
+    statsPhase(&stats, "optimize", start);
+    start = statsNow();
     printIntermediateCode();
+    statsPhase(&stats, "printIntermediateCode", start);
+    if (showCfg) {
+        start = statsNow();
+        printControlFlowGraph();
+        statsPhase(&stats, "printControlFlowGraph", start);
+    }
+    if (asmPath != NULL) {
+        start = statsNow();
+        writeAssembly(asmPath);
+        statsPhase(&stats, "writeAssembly", start);
+    }
+    if (run) {
+        start = statsNow();
+        vmExecute(&code, stdout);
+        statsPhase(&stats, "vmExecute", start);
+    } else if (jit) {
+        start = statsNow();
+        jitExecute(&code, stdout);
+        statsPhase(&stats, "jitExecute", start);
+    }
+    int status = 0;
+    if (verify) {
+        start = statsNow();
+        status = vmVerify(&reference, &code, stdout) ? 0 : 1;
+        statsPhase(&stats, "vmVerify", start);
+        vmFree(&reference);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    tacFree(&code);
+    free(openBlocks);
+    sourceClose(&input);
+    return status;
+}
@@ -0,0 +1,427 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "lexer.h"
+#include "parser.h"
+#include "sema.h"
+#include "irgen.h"
+#include "stats.h"
+
+// Throughput benchmark for the lexer, parser, semantic pass and IR generator.
+//
+// The input is a source file or a program made up by the generator below,
+// which is deterministic: the same seed and knobs give the same bytes on
+// every machine, so results can be compared across commits. Each run lexes,
+// parses, checks and lowers the input from scratch and times every phase
+// separately as well as the whole pipeline; the best and median of the runs
+// are reported as MB/s, tokens/s and quads/s (all relative to the whole
+// input, so the phases can be compared with each other).
+//
+// Build and run:
+//   gcc -O2 -o bench bench.c
+//   ./bench --size 64M --repeat 5          benchmark a generated program
+//   ./bench --json FILE                    one JSON line, for tracking
+//   ./bench --generate 1G --depth 8 > big.c
+
+#define MAX_REPEAT 100
+#define PHASE_COUNT 5
+
+static const char *const phaseNames[PHASE_COUNT] = {"lex", "parse", "sema", "ir", "end-to-end"};
+
+typedef struct {
+    uint64_t size;            // Approximate length of the program in bytes
+    uint64_t seed;
+    int identifierPercent;    // Operands that are variables rather than numbers
+    int names;                // Distinct variables in scope everywhere
+    int commentPercent;       // Statements preceded by a comment
+    int depth;                // Maximum nesting of if/while/for blocks
+    int expressionSize;       // Binary operators per expression
+} GeneratorOptions;
+
+typedef struct {
+    FILE *out;
+    uint64_t written;
+    uint64_t state;           // splitmix64
+    const GeneratorOptions *options;
+    uint64_t declarations;    // Used to give block-local names unique numbers
+} Generator;
+
+// ---------------------------------------------------------------------------
+// Program generator
+
+static const char *const commentWords[] = {"update", "the", "running", "total", "check", "bounds",
+                                           "before", "loop", "state", "counter", "value", "next"};
+
+uint64_t randomNext(Generator *g) {
+    uint64_t z = (g->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Function to pick a number in [0, bound)
+uint32_t randomBelow(Generator *g, uint32_t bound) {
+    return (uint32_t)(randomNext(g) % bound);
+}
+
+void emit(Generator *g, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int count = vfprintf(g->out, format, args);
+    va_end(args);
+    if (count > 0) g->written += (uint64_t)count;
+}
+
+void emitIndent(Generator *g, int depth) {
+    emit(g, "%*s", 4 * (depth + 1), "");
+}
+
+void emitOperand(Generator *g) {
+    if ((int)randomBelow(g, 100) < g->options->identifierPercent) {
+        emit(g, "v%u", randomBelow(g, (uint32_t)g->options->names));
+    } else {
+        emit(g, "%u", randomBelow(g, 1000));
+    }
+}
+
+// Function to write an expression with the given number of binary operators,
+// split at a random point and parenthesized now and then
+void emitExpression(Generator *g, int operators) {
+    static const char *const spellings[] = {"+", "-", "*", "/", "+", "-", "*", "+"};
+    if (operators == 0) {
+        emitOperand(g);
+        return;
+    }
+    int left = (int)randomBelow(g, (uint32_t)operators);
+    int parenthesize = operators > 1 && randomBelow(g, 4) == 0;
+    if (parenthesize) emit(g, "(");
+    emitExpression(g, left);
+    emit(g, " %s ", spellings[randomBelow(g, 8)]);
+    emitExpression(g, operators - 1 - left);
+    if (parenthesize) emit(g, ")");
+}
+
+void emitCondition(Generator *g) {
+    static const char *const comparisons[] = {"<", "<=", ">", ">=", "==", "!="};
+    int half = g->options->expressionSize / 2;
+    emitExpression(g, half);
+    emit(g, " %s ", comparisons[randomBelow(g, 6)]);
+    emitExpression(g, half);
+}
+
+void emitComment(Generator *g, int depth) {
+    int words = 3 + (int)randomBelow(g, 8);
+    int block = randomBelow(g, 2);
+    emitIndent(g, depth);
+    emit(g, block ? "/*" : "//");
+    for (int i = 0; i < words; i++) emit(g, " %s", commentWords[randomBelow(g, 12)]);
+    emit(g, block ? " */\n" : "\n");
+}
+
+void emitStatement(Generator *g, int depth);
+
+void emitBlock(Generator *g, int depth) {
+    int count = 1 + (int)randomBelow(g, 4);
+    emit(g, "{\n");
+    if (randomBelow(g, 2)) {
+        // A block-local declaration, so that scopes have something to pop
+        emitIndent(g, depth + 1);
+        emit(g, "int t%llu = ", (unsigned long long)g->declarations++);
+        emitExpression(g, g->options->expressionSize);
+        emit(g, ";\n");
+    }
+    for (int i = 0; i < count; i++) emitStatement(g, depth + 1);
+    emitIndent(g, depth);
+    emit(g, "}");
+}
+
+// Function to write one statement at the given nesting depth
+void emitStatement(Generator *g, int depth) {
+    const GeneratorOptions *options = g->options;
+    if ((int)randomBelow(g, 100) < options->commentPercent) emitComment(g, depth);
+    emitIndent(g, depth);
+    uint32_t choice = randomBelow(g, 100);
+    if (depth < options->depth && choice < 30) {
+        if (choice < 12) {
+            emit(g, "if (");
+            emitCondition(g);
+            emit(g, ") ");
+            emitBlock(g, depth);
+            if (choice < 6) {
+                emit(g, " else ");
+                emitBlock(g, depth);
+            }
+        } else if (choice < 20) {
+            emit(g, "while (");
+            emitCondition(g);
+            emit(g, ") ");
+            emitBlock(g, depth);
+        } else {
+            emit(g, "for (int i%d = 0; i%d < %u; i%d++) ", depth, depth, 1 + randomBelow(g, 100), depth);
+            emitBlock(g, depth);
+        }
+        emit(g, "\n");
+    } else if (choice < 32) {
+        emit(g, "printf(\"step\");\n");
+    } else if (choice < 40) {
+        emit(g, "v%u++;\n", randomBelow(g, (uint32_t)options->names));
+    } else {
+        emit(g, "v%u %s ", randomBelow(g, (uint32_t)options->names), choice < 55 ? "+=" : "=");
+        emitExpression(g, options->expressionSize);
+        emit(g, ";\n");
+    }
+}
+
+// Function to write a program of about options->size bytes: every variable
+// is declared at the top of main() and statements follow until the size is
+// reached, so every name resolves and every statement can be lowered
+void generateProgram(FILE *out, const GeneratorOptions *options) {
+    Generator g = {out, 0, options->seed, options, 0};
+    emit(&g, "// Generated by bench: seed %llu, identifiers %d%%, names %d, comments %d%%, depth %d, expression %d\n",
+         (unsigned long long)options->seed, options->identifierPercent, options->names, options->commentPercent,
+         options->depth, options->expressionSize);
+    emit(&g, "int main() {\n");
+    for (int i = 0; i < options->names; i++) emit(&g, "    int v%d = %d;\n", i, i);
+    while (g.written + 20 < options->size) emitStatement(&g, 0);
+    emit(&g, "    return 0;\n}\n");
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+
+typedef struct {
+    double times[PHASE_COUNT][MAX_REPEAT];   // Wall milliseconds per phase and run
+    uint32_t tokens;
+    uint32_t quads;
+    int semanticErrors;
+    int lowered;
+} BenchResult;
+
+double milliseconds(StatsClock start, StatsClock end) {
+    return (end.wall - start.wall) / 1e6;
+}
+
+// Function to run the pipeline once on text, adding the times of run `run`.
+// Diagnostics go to sink. Returns 0 if the input does not lex or parse.
+int benchRun(const char *text, size_t length, FILE *sink, BenchResult *result, int run) {
+    InternTable names;
+    TokenStreamWriter tokens;
+    AstArena ast;
+    Parser parser;
+    Sema sema;
+    TacBuffer code;
+    IrGen gen;
+    int ok = 1;
+
+    StatsClock start = statsNow();
+    internInit(&names);
+    tokenStreamInit(&tokens, &names);
+    TokenKind error = lexerTokenize(text, length, &tokens, NULL);
+    StatsClock lexed = statsNow();
+    if (error != TK_EOF) {
+        fprintf(stderr, "Error: %s\n", error == TK_UNCLOSED_COMMENT ? "Unclosed multi-line comment" : "Unclosed string literal");
+        ok = 0;
+    }
+
+    uint32_t program = 0;
+    StatsClock parsed = lexed;
+    if (ok) {
+        astInit(&ast, tokens.tokenCount + 1);
+        parserInit(&parser, &ast, tokens.tokens, tokens.tokenCount, &names, text);
+        parser.out = sink;
+        parser.maxErrors = 100;
+        program = parseProgram(&parser);
+        parsed = statsNow();
+        if (program == 0) {
+            fprintf(stderr, "Error: Syntax analysis failed with %d error%s\n", parser.errorCount,
+                    parser.errorCount == 1 ? "" : "s");
+            ok = 0;
+        }
+    }
+
+    if (ok) {
+        semaInit(&sema, &ast, &parser);
+        semaResolve(&sema, program);
+        result->semanticErrors = sema.errorCount;
+        semaFree(&sema);
+        StatsClock checked = statsNow();
+
+        tacInit(&code);
+        irInit(&gen, &code, &ast, &parser);
+        result->lowered = irGenerate(&gen, program);
+        irFree(&gen);
+        StatsClock end = statsNow();
+        result->tokens = tokens.tokenCount;
+        result->quads = code.count;
+        tacFree(&code);
+
+        result->times[0][run] = milliseconds(start, lexed);
+        result->times[1][run] = milliseconds(lexed, parsed);
+        result->times[2][run] = milliseconds(parsed, checked);
+        result->times[3][run] = milliseconds(checked, end);
+        result->times[4][run] = milliseconds(start, end);
+    }
+    if (error == TK_EOF) astFree(&ast);
+    tokenStreamFree(&tokens);
+    internFree(&names);
+    return ok;
+}
+
+int compareTimes(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Function to print the best and median time of every phase with the
+// throughput of the best run, as a table or as one JSON object
+void benchReport(BenchResult *result, int runs, size_t length, const char *input,
+                 const GeneratorOptions *options, int json) {
+    double megabytes = length / 1e6;
+    if (json) {
+        printf("{\"input\": {\"source\": \"%s\", \"bytes\": %zu, \"tokens\": %u, \"quads\": %u", input, length,
+               result->tokens, result->quads);
+        if (options != NULL) {
+            printf(", \"seed\": %llu, \"identifierPercent\": %d, \"names\": %d, \"commentPercent\": %d, \"depth\": %d, "
+                   "\"expressionSize\": %d", (unsigned long long)options->seed, options->identifierPercent,
+                   options->names, options->commentPercent, options->depth, options->expressionSize);
+        }
+        printf("}, \"runs\": %d, \"phases\": [", runs);
+    } else {
+        printf("Input: %s, %.2f MB, %u tokens, %u quads, %d semantic error%s%s\n", input, megabytes, result->tokens,
+               result->quads, result->semanticErrors, result->semanticErrors == 1 ? "" : "s",
+               result->lowered ? "" : ", not fully lowered");
+        printf("%-12s %10s %10s %10s %12s %12s\n", "phase", "best ms", "median ms", "MB/s", "Mtokens/s", "Mquads/s");
+    }
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        double *times = result->times[p];
+        qsort(times, (size_t)runs, sizeof(double), compareTimes);
+        double best = times[0], median = times[runs / 2];
+        double seconds = best > 0 ? best / 1e3 : 1e-9;
+        if (json) {
+            printf("%s{\"name\": \"%s\", \"bestMs\": %.3f, \"medianMs\": %.3f, \"mbPerS\": %.2f, \"tokensPerS\": %.0f, "
+                   "\"quadsPerS\": %.0f}", p > 0 ? ", " : "", phaseNames[p], best, median, megabytes / seconds,
+                   result->tokens / seconds, result->quads / seconds);
+        } else {
+            printf("%-12s %10.3f %10.3f %10.1f %12.2f %12.2f\n", phaseNames[p], best, median, megabytes / seconds,
+                   result->tokens / seconds / 1e6, result->quads / seconds / 1e6);
+        }
+    }
+    if (json) printf("]}\n");
+}
+
+// Function to parse a size such as 4096, 64K, 16M or 1G (powers of 1024)
+uint64_t parseSize(const char *text) {
+    char *end;
+    uint64_t size = strtoull(text, &end, 10);
+    if (*end == 'K' || *end == 'k') size <<= 10;
+    else if (*end == 'M' || *end == 'm') size <<= 20;
+    else if (*end == 'G' || *end == 'g') size <<= 30;
+    return size;
+}
+
+void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] [SOURCE]\n", program);
+    fprintf(stderr, "  SOURCE                benchmark this file instead of a generated program\n");
+    fprintf(stderr, "  --generate SIZE       write a generated program of about SIZE bytes to stdout\n");
+    fprintf(stderr, "  --size SIZE           size of the generated program to benchmark (default 16M;\n");
+    fprintf(stderr, "                        SIZE takes a K, M or G suffix)\n");
+    fprintf(stderr, "  --seed N              generator seed (default 1)\n");
+    fprintf(stderr, "  --identifiers PCT     operands that are variables, not numbers (default 70)\n");
+    fprintf(stderr, "  --names N             distinct variables (default 64)\n");
+    fprintf(stderr, "  --comments PCT        statements preceded by a comment (default 20)\n");
+    fprintf(stderr, "  --depth N             maximum nesting of blocks (default 4)\n");
+    fprintf(stderr, "  --expression N        binary operators per expression (default 4)\n");
+    fprintf(stderr, "  --repeat N            runs to take the best and median of (default 5)\n");
+    fprintf(stderr, "  --json                print one JSON object instead of a table\n");
+}
+
+int main(int argc, char *argv[]) {
+    GeneratorOptions options = {16u << 20, 1, 70, 64, 20, 4, 4};
+    const char *path = NULL;
+    int generateOnly = 0;
+    int repeat = 5;
+    int json = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        int hasValue = i + 1 < argc;
+        if (strcmp(arg, "--generate") == 0 && hasValue) {
+            options.size = parseSize(argv[++i]);
+            generateOnly = 1;
+        } else if (strcmp(arg, "--size") == 0 && hasValue) {
+            options.size = parseSize(argv[++i]);
+        } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--identifiers") == 0 && hasValue) {
+            options.identifierPercent = atoi(argv[++i]);
+        } else if (strcmp(arg, "--names") == 0 && hasValue) {
+            options.names = atoi(argv[++i]);
+        } else if (strcmp(arg, "--comments") == 0 && hasValue) {
+            options.commentPercent = atoi(argv[++i]);
+        } else if (strcmp(arg, "--depth") == 0 && hasValue) {
+            options.depth = atoi(argv[++i]);
+        } else if (strcmp(arg, "--expression") == 0 && hasValue) {
+            options.expressionSize = atoi(argv[++i]);
+        } else if (strcmp(arg, "--repeat") == 0 && hasValue) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(arg, "--json") == 0) {
+            json = 1;
+        } else if (arg[0] != '-' && path == NULL) {
+            path = arg;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.names < 1) options.names = 1;
+    if (options.expressionSize < 0) options.expressionSize = 0;
+    if (repeat < 1) repeat = 1;
+    if (repeat > MAX_REPEAT) repeat = MAX_REPEAT;
+
+    if (generateOnly) {
+        generateProgram(stdout, &options);
+        return fflush(stdout) == 0 ? 0 : 1;
+    }
+
+    Source source = {NULL, 0, 0};
+    char *generated = NULL;
+    size_t length = 0;
+    const char *text;
+    if (path != NULL) {
+        if (!sourceOpen(&source, path)) {
+            fprintf(stderr, "Error: Cannot open '%s'\n", path);
+            return 1;
+        }
+        text = source.text;
+        length = source.length;
+    } else {
+        FILE *buffer = open_memstream(&generated, &length);
+        if (buffer == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        generateProgram(buffer, &options);
+        fclose(buffer);
+        text = generated;
+    }
+
+    FILE *sink = fopen("/dev/null", "w");
+    if (sink == NULL) sink = tmpfile();
+    BenchResult result;
+    memset(&result, 0, sizeof(result));
+    int status = 0;
+    for (int run = 0; run < repeat; run++) {
+        if (!benchRun(text, length, sink, &result, run)) {
+            status = 1;
+            break;
+        }
+    }
+    if (status == 0) benchReport(&result, repeat, length, path != NULL ? path : "generated", path != NULL ? NULL : &options, json);
+
+    if (sink != NULL) fclose(sink);
+    if (source.text != NULL) sourceClose(&source);
+    free(generated);
+    return status;
+}
@@ -0,0 +1,349 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+// On-disk compilation cache.
+//
+// Each entry is one file in the cache directory named after a 64-bit key:
+// the XXH64 hash of the source text, seeded with the hash of everything on
+// the command line that changes the result. An entry holds what a
+// compilation produced, laid out so that it can be used straight from a
+// read-only mapping (native byte order):
+//
+//   CacheHeader
+//   char output[outputBytes]         everything the compilation printed
+//                                    (diagnostics, listings, code), padded to 8
+//   TacQuad code[quadCount]          final three-address code
+//   uint32_t nameOffsets[nameCount]  its names and literals by intern id
+//   char nameData[nameBytes]         in id order, each NUL-terminated
+//
+// A hit prints the stored output and, for -S, emits assembly from the stored
+// code; nothing is lexed or parsed. Only --run still does work: the stored
+// output leaves out what the program printed (which includes its run time),
+// and a hit runs the stored code again and prints that at runOffset.
+// Entries are written to a temporary file and renamed into place, so
+// concurrent compilers never see half an entry.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "tac.h"
+
+#define CACHE_MAGIC "CCHE"
+#define CACHE_VERSION 3   // Bumped whenever the stored code for the same options changes
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t sourceLength;   // Guards against key collisions between sizes
+    uint32_t ok;             // The compilation succeeded
+    uint32_t lowered;        // code holds the final code (the IR stage ran)
+    uint64_t outputBytes;
+    uint64_t runOffset;      // Where the program's output goes (with --run)
+    uint32_t quadCount;
+    uint32_t nameCount;
+    uint32_t tempCount;
+    uint32_t labelCount;
+    uint64_t nameBytes;
+} CacheHeader;
+
+typedef struct {
+    const CacheHeader *header;
+    const char *output;
+    const TacQuad *code;
+    const uint32_t *nameOffsets;
+    const char *nameData;
+    void *base;              // Mapped entry
+    size_t size;
+} CacheEntry;
+
+#define CACHE_ALIGN(size) (((size_t)(size) + 7) & ~(size_t)7)
+
+// ---------------------------------------------------------------------------
+// Hashing (XXH64)
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxhRotate(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t xxhRead64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+static inline uint32_t xxhRead32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static inline uint64_t xxhRound(uint64_t accumulator, uint64_t input) {
+    accumulator += input * XXH_PRIME64_2;
+    return xxhRotate(accumulator, 31) * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxhMerge(uint64_t hash, uint64_t accumulator) {
+    hash ^= xxhRound(0, accumulator);
+    return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// Function to hash a buffer with XXH64 (the little-endian variant; a
+// big-endian host gets different, but still stable, keys)
+static inline uint64_t cacheHash(const void *data, size_t length, uint64_t seed) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + length;
+    uint64_t hash;
+    if (length >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        do {
+            v1 = xxhRound(v1, xxhRead64(p));
+            v2 = xxhRound(v2, xxhRead64(p + 8));
+            v3 = xxhRound(v3, xxhRead64(p + 16));
+            v4 = xxhRound(v4, xxhRead64(p + 24));
+            p += 32;
+        } while ((size_t)(end - p) >= 32);
+        hash = xxhRotate(v1, 1) + xxhRotate(v2, 7) + xxhRotate(v3, 12) + xxhRotate(v4, 18);
+        hash = xxhMerge(hash, v1);
+        hash = xxhMerge(hash, v2);
+        hash = xxhMerge(hash, v3);
+        hash = xxhMerge(hash, v4);
+    } else {
+        hash = seed + XXH_PRIME64_5;
+    }
+    hash += (uint64_t)length;
+    for (; end - p >= 8; p += 8) {
+        hash ^= xxhRound(0, xxhRead64(p));
+        hash = xxhRotate(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (end - p >= 4) {
+        hash ^= (uint64_t)xxhRead32(p) * XXH_PRIME64_1;
+        hash = xxhRotate(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= *p * XXH_PRIME64_5;
+        hash = xxhRotate(hash, 11) * XXH_PRIME64_1;
+    }
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// ---------------------------------------------------------------------------
+// Entries
+
+static inline void cachePath(char *path, size_t size, const char *dir, uint64_t key) {
+    snprintf(path, size, "%s/%016llx.cce", dir, (unsigned long long)key);
+}
+
+static inline void cacheClose(CacheEntry *entry) {
+    if (entry->base != NULL) munmap(entry->base, entry->size);
+    memset(entry, 0, sizeof(*entry));
+}
+
+// Function to check that a stored operand refers to a name, temporary or
+// label that the entry has
+static inline int cacheOperandValid(const CacheHeader *header, uint32_t operand) {
+    switch (TAC_TAG(operand)) {
+        case TAC_NONE: return operand == TAC_NONE;
+        case TAC_VAR: case TAC_CONST: return TAC_VALUE(operand) < header->nameCount;
+        case TAC_TEMP: return TAC_VALUE(operand) < header->tempCount;
+        case TAC_LABEL_REF: return TAC_VALUE(operand) < header->labelCount;
+        case TAC_IMM: return 1;
+    }
+    return 0;
+}
+
+// Function to check that a stored quad is one the code generators accept:
+// a known opcode, operands in range, a variable as the result of a value
+// and a label as the target of a jump
+static inline int cacheQuadValid(const CacheHeader *header, const TacQuad *quad) {
+    if (quad->op >= TAC_OP_COUNT || !cacheOperandValid(header, quad->result) ||
+        !cacheOperandValid(header, quad->arg1) || !cacheOperandValid(header, quad->arg2)) {
+        return 0;
+    }
+    uint32_t tag = TAC_TAG(quad->result);
+    if (tacDefines((TacOp)quad->op)) return tag == TAC_VAR || tag == TAC_TEMP;
+    if (quad->op == TAC_IF && (quad->cond < TAC_LT || quad->cond > TAC_NE)) return 0;
+    if (quad->op == TAC_LABEL || quad->op == TAC_GOTO || quad->op == TAC_IF) return tag == TAC_LABEL_REF;
+    return 1;
+}
+
+// Function to map the entry for key and check it. Returns 1 on a hit.
+static inline int cacheOpen(CacheEntry *entry, const char *dir, uint64_t key, uint64_t sourceLength) {
+    char path[4096];
+    memset(entry, 0, sizeof(*entry));
+    cachePath(path, sizeof(path), dir, key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && (size_t)info.st_size >= sizeof(CacheHeader)) {
+        void *base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            entry->base = base;
+            entry->size = info.st_size;
+        }
+    }
+    close(fd);
+    if (entry->base == NULL) return 0;
+
+    const CacheHeader *header = entry->base;
+    size_t outputBytes = CACHE_ALIGN(header->outputBytes);
+    size_t codeBytes = (size_t)header->quadCount * sizeof(TacQuad);
+    if (memcmp(header->magic, CACHE_MAGIC, 4) != 0 || header->version != CACHE_VERSION || header->key != key ||
+        header->sourceLength != sourceLength || header->runOffset > header->outputBytes ||
+        entry->size < sizeof(*header) + outputBytes + codeBytes + (size_t)header->nameCount * 4 + header->nameBytes) {
+        munmap(entry->base, entry->size);
+        memset(entry, 0, sizeof(*entry));
+        return 0;   // Stale or damaged: treated as a miss and overwritten
+    }
+    const char *data = (const char *)entry->base + sizeof(*header);
+    entry->header = header;
+    entry->output = data;
+    entry->code = (const TacQuad *)(data + outputBytes);
+    entry->nameOffsets = (const uint32_t *)(data + outputBytes + codeBytes);
+    entry->nameData = (const char *)(entry->nameOffsets + header->nameCount);
+
+    // The stored code is run and turned into assembly as it is, so a damaged
+    // entry must not send any reader outside the tables. Names are stored
+    // in id order, each ending with a NUL just before the next one starts.
+    int valid = 1;
+    for (uint32_t id = 0; valid && id < header->nameCount; id++) {
+        uint64_t end = id + 1 < header->nameCount ? entry->nameOffsets[id + 1] : header->nameBytes;
+        if (entry->nameOffsets[id] >= end || end > header->nameBytes || entry->nameData[end - 1] != '\0') {
+            valid = 0;
+        }
+    }
+    for (uint32_t i = 0; valid && i < header->quadCount; i++) {
+        valid = cacheQuadValid(header, &entry->code[i]);
+    }
+    if (!valid) {
+        cacheClose(entry);
+        return 0;   // Damaged: treated as a miss and overwritten
+    }
+    return 1;
+}
+
+// Function to rebuild the stored code as a TacBuffer. The quads stay in the
+// mapping: the buffer is read-only and must be released with cacheFreeCode()
+// before the entry is closed. Returns 0 if the entry repeats a name, which
+// would shift every later id off its text; the entry is then a miss.
+static inline int cacheCode(const CacheEntry *entry, TacBuffer *code) {
+    tacInit(code);
+    code->code = (TacQuad *)entry->code;
+    code->count = entry->header->quadCount;
+    code->capacity = entry->header->quadCount;
+    code->tempCount = entry->header->tempCount;
+    code->labelCount = entry->header->labelCount;
+    // Interning in id order gives every name its old id back. Lengths come
+    // from the offsets since literals may contain NULs.
+    for (uint32_t id = 0; id < entry->header->nameCount; id++) {
+        uint64_t end = id + 1 < entry->header->nameCount ? entry->nameOffsets[id + 1] : entry->header->nameBytes;
+        internString(&code->names, entry->nameData + entry->nameOffsets[id],
+                     (uint32_t)(end - entry->nameOffsets[id] - 1));
+    }
+    return code->names.count == entry->header->nameCount;
+}
+
+static inline void cacheFreeCode(TacBuffer *code) {
+    code->code = NULL;
+    tacFree(code);
+}
+
+// Function to write an entry for key. Returns 1 on success; a failure only
+// means the next compilation misses.
+static inline int cacheStore(const char *dir, uint64_t key, uint64_t sourceLength, int ok, int lowered,
+                             const char *output, size_t outputLength, size_t runOffset, const TacBuffer *code) {
+    char path[4096], temporary[4096];
+    mkdir(dir, 0777);   // Usually there already
+    snprintf(temporary, sizeof(temporary), "%s/.tmp-XXXXXX", dir);
+    int fd = mkstemp(temporary);
+    if (fd < 0) return 0;
+
+    const InternTable *names = &code->names;
+    uint32_t nameCount = lowered ? names->count : 0;
+    size_t nameBytes = 0;
+    for (uint32_t id = 0; id < nameCount; id++) nameBytes += internLength(names, id) + 1;
+    uint32_t *nameOffsets = internAlloc(NULL, (size_t)nameCount * sizeof(uint32_t) + nameBytes + 1);
+    char *nameData = (char *)(nameOffsets + nameCount);
+    size_t used = 0;
+    for (uint32_t id = 0; id < nameCount; id++) {
+        nameOffsets[id] = (uint32_t)used;
+        memcpy(nameData + used, internText(names, id), internLength(names, id) + 1);
+        used += internLength(names, id) + 1;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.sourceLength = sourceLength;
+    header.ok = ok;
+    header.lowered = lowered;
+    header.outputBytes = outputLength;
+    header.runOffset = runOffset;
+    header.quadCount = lowered ? code->count : 0;
+    header.nameCount = nameCount;
+    header.tempCount = code->tempCount;
+    header.labelCount = code->labelCount;
+    header.nameBytes = nameBytes;
+
+    static const char padding[8] = {0};
+    const void *parts[6] = {&header, output, padding, code->code, nameOffsets, nameData};
+    size_t sizes[6] = {sizeof(header), outputLength, CACHE_ALIGN(outputLength) - outputLength,
+                       (size_t)header.quadCount * sizeof(TacQuad), (size_t)nameCount * sizeof(uint32_t), nameBytes};
+    struct iovec vectors[6];
+    int first = 0, written = 1;
+    for (int i = 0; i < 6; i++) {
+        vectors[i].iov_base = (void *)parts[i];
+        vectors[i].iov_len = sizes[i];
+    }
+    // writev may stop short on large entries; continue where it left off
+    while (first < 6) {
+        ssize_t count = writev(fd, vectors + first, 6 - first);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            written = 0;
+            break;
+        }
+        while (first < 6 && (size_t)count >= vectors[first].iov_len) {
+            count -= vectors[first].iov_len;
+            first++;
+        }
+        if (first < 6) {
+            vectors[first].iov_base = (char *)vectors[first].iov_base + count;
+            vectors[first].iov_len -= count;
+        }
+    }
+    free(nameOffsets);
+    if (close(fd) != 0) written = 0;
+    cachePath(path, sizeof(path), dir, key);
+    if (!written || rename(temporary, path) != 0) {
+        unlink(temporary);
+        return 0;
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,314 @@
+#ifndef CFG_H
+#define CFG_H
+
+// Control-flow graph over a TAC buffer.
+//
+// cfgBuild() splits the quads into basic blocks (a block starts at the first
+// quad, at every label, and after every jump) and records the edges in
+// compressed arrays: the successors of block b are succ[succStart[b] ..
+// succStart[b + 1]), and likewise for predecessors. Block 0 is the entry.
+//
+// cfgDominators() computes immediate dominators with the iterative algorithm
+// of Cooper, Harvey and Kennedy ("A Simple, Fast Dominance Algorithm"):
+// blocks are visited in reverse postorder and idoms are intersected by
+// walking up the partial tree using postorder numbers. It converges in a
+// few passes on reducible graphs, so it runs in near-linear time. The
+// dominator tree is stored the same compressed way, together with
+// preorder/postorder numbers that answer "does a dominate b" in O(1).
+
+#include "tac.h"
+
+#define CFG_NONE 0xFFFFFFFFu
+
+typedef struct {
+    uint32_t start;      // First quad
+    uint32_t end;        // One past the last quad
+} BasicBlock;
+
+typedef struct {
+    const TacBuffer *code;
+    BasicBlock *blocks;
+    uint32_t blockCount;
+
+    uint32_t *succStart; // blockCount + 1 offsets into succ
+    uint32_t *succ;
+    uint32_t *predStart; // blockCount + 1 offsets into pred
+    uint32_t *pred;
+
+    uint32_t *labelBlock;   // Block that starts at each label, or CFG_NONE
+
+    // Filled by cfgDominators()
+    uint32_t *rpo;          // Reachable blocks in reverse postorder
+    uint32_t rpoCount;
+    uint32_t *postorder;    // Postorder number per block, CFG_NONE if unreachable
+    uint32_t *idom;         // Immediate dominator; the entry is its own, CFG_NONE if unreachable
+    uint32_t *domChildStart;
+    uint32_t *domChild;
+    uint32_t *domPre;       // Dominator tree preorder interval [domPre, domPost]
+    uint32_t *domPost;
+} Cfg;
+
+// Function to get the block a jump to this label lands in
+static inline uint32_t cfgLabelTarget(const Cfg *cfg, uint32_t label) {
+    return TAC_TAG(label) == TAC_LABEL_REF ? cfg->labelBlock[TAC_VALUE(label)] : CFG_NONE;
+}
+
+// Function to fill start[] with prefix sums of count[] (n entries), turning
+// per-block counts into offsets; start has n + 1 entries
+static inline void cfgPrefixSum(uint32_t *start, const uint32_t *count, uint32_t n) {
+    start[0] = 0;
+    for (uint32_t i = 0; i < n; i++) start[i + 1] = start[i] + count[i];
+}
+
+static inline void cfgBuild(Cfg *cfg, const TacBuffer *code) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->code = code;
+    uint32_t n = code->count;
+
+    // Find block leaders and map labels to the block they start
+    uint8_t *leader = calloc(n + 1, 1);
+    cfg->labelBlock = internAlloc(NULL, ((size_t)code->labelCount + 1) * sizeof(uint32_t));
+    memset(cfg->labelBlock, 0xFF, ((size_t)code->labelCount + 1) * sizeof(uint32_t));
+    if (leader == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    if (n > 0) leader[0] = 1;
+    for (uint32_t i = 0; i < n; i++) {
+        TacOp op = (TacOp)code->code[i].op;
+        if (op == TAC_LABEL) leader[i] = 1;
+        if ((op == TAC_GOTO || op == TAC_IF) && i + 1 < n) leader[i + 1] = 1;
+    }
+    uint32_t blockCount = 0;
+    for (uint32_t i = 0; i < n; i++) blockCount += leader[i];
+    cfg->blockCount = blockCount;
+    cfg->blocks = internAlloc(NULL, ((size_t)blockCount + 1) * sizeof(BasicBlock));
+    for (uint32_t i = 0, b = 0; i < n; i++) {
+        if (leader[i]) {
+            if (b > 0) cfg->blocks[b - 1].end = i;
+            cfg->blocks[b++].start = i;
+        }
+        if (code->code[i].op == TAC_LABEL && TAC_TAG(code->code[i].result) == TAC_LABEL_REF) {
+            cfg->labelBlock[TAC_VALUE(code->code[i].result)] = b - 1;
+        }
+    }
+    if (blockCount > 0) cfg->blocks[blockCount - 1].end = n;
+    free(leader);
+
+    // Each block has at most two successors: the jump target and the fall-through
+    uint32_t *targets = internAlloc(NULL, ((size_t)blockCount * 2 + 1) * sizeof(uint32_t));
+    uint32_t *succCount = calloc((size_t)blockCount + 1, sizeof(uint32_t));
+    uint32_t *predCount = calloc((size_t)blockCount + 1, sizeof(uint32_t));
+    if (succCount == NULL || predCount == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (uint32_t b = 0; b < blockCount; b++) {
+        const TacQuad *last = &code->code[cfg->blocks[b].end - 1];
+        uint32_t jump = CFG_NONE, fall = b + 1 < blockCount ? b + 1 : CFG_NONE;
+        if (last->op == TAC_GOTO || last->op == TAC_IF) jump = cfgLabelTarget(cfg, last->result);
+        if (last->op == TAC_GOTO) fall = CFG_NONE;
+        if (jump == fall) fall = CFG_NONE;  // if ... goto the next block
+        targets[2 * b] = jump;
+        targets[2 * b + 1] = fall;
+        for (int k = 0; k < 2; k++) {
+            uint32_t to = targets[2 * b + k];
+            if (to == CFG_NONE) continue;
+            succCount[b]++;
+            predCount[to]++;
+        }
+    }
+
+    cfg->succStart = internAlloc(NULL, ((size_t)blockCount + 1) * sizeof(uint32_t));
+    cfg->predStart = internAlloc(NULL, ((size_t)blockCount + 1) * sizeof(uint32_t));
+    cfgPrefixSum(cfg->succStart, succCount, blockCount);
+    cfgPrefixSum(cfg->predStart, predCount, blockCount);
+    cfg->succ = internAlloc(NULL, ((size_t)cfg->succStart[blockCount] + 1) * sizeof(uint32_t));
+    cfg->pred = internAlloc(NULL, ((size_t)cfg->predStart[blockCount] + 1) * sizeof(uint32_t));
+    memset(predCount, 0, (size_t)blockCount * sizeof(uint32_t));
+    for (uint32_t b = 0, s = 0; b < blockCount; b++) {
+        for (int k = 0; k < 2; k++) {
+            uint32_t to = targets[2 * b + k];
+            if (to == CFG_NONE) continue;
+            cfg->succ[s++] = to;
+            cfg->pred[cfg->predStart[to] + predCount[to]++] = b;
+        }
+    }
+    free(targets);
+    free(succCount);
+    free(predCount);
+}
+
+// Function to intersect two dominator candidates by walking up the tree
+static inline uint32_t cfgIntersect(const Cfg *cfg, uint32_t a, uint32_t b) {
+    while (a != b) {
+        while (cfg->postorder[a] < cfg->postorder[b]) a = cfg->idom[a];
+        while (cfg->postorder[b] < cfg->postorder[a]) b = cfg->idom[b];
+    }
+    return a;
+}
+
+static inline void cfgDominators(Cfg *cfg) {
+    uint32_t n = cfg->blockCount;
+    cfg->rpo = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    cfg->postorder = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    cfg->idom = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    memset(cfg->postorder, 0xFF, ((size_t)n + 1) * sizeof(uint32_t));
+    memset(cfg->idom, 0xFF, ((size_t)n + 1) * sizeof(uint32_t));
+    cfg->rpoCount = 0;
+    if (n == 0) return;
+
+    // Iterative depth-first search for postorder; the stack holds a block
+    // and how many of its successors have been visited
+    uint32_t *stack = internAlloc(NULL, (size_t)n * 2 * sizeof(uint32_t));
+    uint8_t *seen = calloc(n, 1);
+    if (seen == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    uint32_t top = 0, count = 0;
+    stack[top++] = 0;
+    stack[top++] = 0;
+    seen[0] = 1;
+    while (top > 0) {
+        uint32_t b = stack[top - 2];
+        uint32_t next = cfg->succStart[b] + stack[top - 1];
+        if (next < cfg->succStart[b + 1]) {
+            stack[top - 1]++;
+            uint32_t s = cfg->succ[next];
+            if (!seen[s]) {
+                seen[s] = 1;
+                stack[top++] = s;
+                stack[top++] = 0;
+            }
+        } else {
+            cfg->postorder[b] = count;
+            cfg->rpo[count++] = b;
+            top -= 2;
+        }
+    }
+    cfg->rpoCount = count;
+    for (uint32_t i = 0, j = count - 1; i < j; i++, j--) {
+        uint32_t t = cfg->rpo[i];
+        cfg->rpo[i] = cfg->rpo[j];
+        cfg->rpo[j] = t;
+    }
+
+    cfg->idom[0] = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t i = 1; i < count; i++) {
+            uint32_t b = cfg->rpo[i];
+            uint32_t newIdom = CFG_NONE;
+            for (uint32_t p = cfg->predStart[b]; p < cfg->predStart[b + 1]; p++) {
+                uint32_t pred = cfg->pred[p];
+                if (cfg->idom[pred] == CFG_NONE) continue;  // Not processed yet or unreachable
+                newIdom = newIdom == CFG_NONE ? pred : cfgIntersect(cfg, pred, newIdom);
+            }
+            if (cfg->idom[b] != newIdom) {
+                cfg->idom[b] = newIdom;
+                changed = 1;
+            }
+        }
+    }
+
+    // Dominator tree children, in reverse postorder
+    uint32_t *childCount = calloc((size_t)n + 1, sizeof(uint32_t));
+    if (childCount == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (uint32_t i = 1; i < count; i++) childCount[cfg->idom[cfg->rpo[i]]]++;
+    cfg->domChildStart = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    cfgPrefixSum(cfg->domChildStart, childCount, n);
+    cfg->domChild = internAlloc(NULL, ((size_t)cfg->domChildStart[n] + 1) * sizeof(uint32_t));
+    memset(childCount, 0, (size_t)n * sizeof(uint32_t));
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t b = cfg->rpo[i], parent = cfg->idom[b];
+        cfg->domChild[cfg->domChildStart[parent] + childCount[parent]++] = b;
+    }
+    free(childCount);
+
+    // Preorder/postorder numbering of the dominator tree
+    cfg->domPre = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    cfg->domPost = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    memset(cfg->domPre, 0xFF, ((size_t)n + 1) * sizeof(uint32_t));
+    memset(cfg->domPost, 0xFF, ((size_t)n + 1) * sizeof(uint32_t));
+    uint32_t clock = 0;
+    top = 0;
+    stack[top++] = 0;
+    stack[top++] = 0;
+    cfg->domPre[0] = clock++;
+    while (top > 0) {
+        uint32_t b = stack[top - 2];
+        uint32_t next = cfg->domChildStart[b] + stack[top - 1];
+        if (next < cfg->domChildStart[b + 1]) {
+            stack[top - 1]++;
+            uint32_t child = cfg->domChild[next];
+            cfg->domPre[child] = clock++;
+            stack[top++] = child;
+            stack[top++] = 0;
+        } else {
+            cfg->domPost[b] = clock++;
+            top -= 2;
+        }
+    }
+    free(stack);
+    free(seen);
+}
+
+// Function to test whether the program can end in block b: it has no
+// successor, or it is the last block and falls off the end of the code
+static inline int cfgIsExit(const Cfg *cfg, uint32_t b) {
+    if (cfg->succStart[b] == cfg->succStart[b + 1]) return 1;
+    return b + 1 == cfg->blockCount && cfg->code->code[cfg->blocks[b].end - 1].op != TAC_GOTO;
+}
+
+// Function to test whether block a dominates block b (both reachable)
+static inline int cfgDominates(const Cfg *cfg, uint32_t a, uint32_t b) {
+    return cfg->domPre[a] <= cfg->domPre[b] && cfg->domPost[b] <= cfg->domPost[a];
+}
+
+static inline void cfgFree(Cfg *cfg) {
+    free(cfg->blocks);
+    free(cfg->succStart);
+    free(cfg->succ);
+    free(cfg->predStart);
+    free(cfg->pred);
+    free(cfg->labelBlock);
+    free(cfg->rpo);
+    free(cfg->postorder);
+    free(cfg->idom);
+    free(cfg->domChildStart);
+    free(cfg->domChild);
+    free(cfg->domPre);
+    free(cfg->domPost);
+    memset(cfg, 0, sizeof(*cfg));
+}
+
+// Function to print every block with its quads, edges and immediate dominator
+static inline void cfgPrint(const Cfg *cfg, FILE *out) {
+    for (uint32_t b = 0; b < cfg->blockCount; b++) {
+        fprintf(out, "B%u:", b);
+        fputs(" preds", out);
+        for (uint32_t p = cfg->predStart[b]; p < cfg->predStart[b + 1]; p++) fprintf(out, " B%u", cfg->pred[p]);
+        fputs(" | succs", out);
+        for (uint32_t s = cfg->succStart[b]; s < cfg->succStart[b + 1]; s++) fprintf(out, " B%u", cfg->succ[s]);
+        if (cfg->idom == NULL) {
+            fputc('\n', out);
+        } else if (cfg->idom[b] == CFG_NONE) {
+            fputs(" | unreachable\n", out);
+        } else if (b == 0) {
+            fputs(" | entry\n", out);
+        } else {
+            fprintf(out, " | idom B%u\n", cfg->idom[b]);
+        }
+        for (uint32_t i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            fputs("    ", out);
+            tacPrintQuad(cfg->code, &cfg->code->code[i], out);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,525 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer.h"
+#include "parser.h"
+#include "sema.h"
+#include "irgen.h"
+#include "cfg.h"
+#include "opt.h"
+#include "x86.h"
+#include "vm.h"
+#include "workpool.h"
+#include "parlex.h"
+#include "incr.h"
+#include "cache.h"
+#include "stats.h"
+
+// Single driver for the whole pipeline: the source is read once, lexed
+// once into a token array, parsed into one AST, checked and lowered to TAC,
+// all in this process. Each stage works on the previous stage's in-memory
+// result, so nothing is re-read or re-tokenized between stages.
+//
+// Everything one input needs lives in its Compilation, so several inputs can
+// be compiled at once: with -j N the files are spread over a work-stealing
+// pool of N threads. Each compilation prints into its own buffer and the
+// buffers are written out in command-line order, so the output is the same
+// for any N. Token text goes to one lock-free intern table shared by all of
+// them; TAC names stay per compilation because their ids index dense arrays.
+// A single large input is instead lexed in chunks on the -j threads.
+//
+// With --cache DIR every compilation's output and final code are stored
+// under the hash of its source and options; compiling the same text with the
+// same options again just replays them (see cache.h).
+//
+// With --time-report (or --stats, as JSON) the time spent in each phase and
+// the work done are printed to stderr at the end, summed over all inputs.
+//
+// With --edits the input is kept open as an incremental document instead:
+// each edit from the file is applied and only the statements it touches are
+// lexed, parsed and checked again (see incr.h).
+
+typedef enum {
+    STAGE_LEX,
+    STAGE_PARSE,
+    STAGE_SEMA,
+    STAGE_IR
+} Stage;
+
+static const char *const stageNames[] = {"lex", "parse", "sema", "ir"};
+
+typedef struct {
+    const char *path;          // NULL = stdin
+    FILE *out;                 // Everything this compilation prints
+    FILE *err;                 // Errors about the input file itself
+    char *output;              // Buffer behind out when compiling in parallel
+    size_t outputLength;
+    TokenStreamWriter lexed;   // Tokens of the input
+    AstArena ast;
+    TacBuffer code;
+    int ok;
+    int lowered;               // c->code is final (and was emitted for -S)
+    size_t runStart;           // Where the program's own output lies (--run)
+    size_t runEnd;
+    int ioError;               // Failed for reasons outside the source (not cached)
+    Stats stats;               // Phase times and counters of this input
+} Compilation;
+
+// Options are set once in main() and only read after that
+Stage stopAfter = STAGE_IR;
+int optLevel = 0;
+int printTokens = 0;
+int dumpAst = 0;
+int showCfg = 0;
+int runCode = 0;
+int verifyCode = 0;
+int maxErrors = 100;
+const char *asmPath = NULL;
+const char *editsPath = NULL;
+const char *cacheDir = NULL;
+uint64_t cacheSeed = 0;    // Hash of the options that change the output
+uint32_t jobs = 1;
+uint32_t lexThreads = 1;   // Threads for lexing one input (-j with a single file)
+int timeReport = -1;       // Print stats at the end: 0 = table, 1 = JSON
+
+SharedInternTable names;   // Text of identifiers, numbers and strings by id
+
+// Function to lex the source into c->lexed. Returns 0 on a lexical error.
+int lexSource(Compilation *c, const Source *source) {
+    size_t errorOffset = 0;
+    StatsClock start = statsNow();
+    TokenKind error = lexerTokenizeParallel(source->text, source->length, &c->lexed, &errorOffset, lexThreads);
+    statsPhase(&c->stats, "lexSource", start);
+    statsAdd(&c->stats, STAT_BYTES, source->length);
+    statsAdd(&c->stats, STAT_TOKENS, c->lexed.tokenCount);
+    if (error == TK_UNCLOSED_COMMENT) {
+        fprintf(c->out, "Error: Unclosed multi-line comment\n");
+        return 0;
+    }
+    if (error == TK_UNCLOSED_STRING) {
+        fprintf(c->out, "Error: Unclosed string literal\n");
+        return 0;
+    }
+    if (printTokens) {
+        fprintf(c->out, "Tokenized Output:\n");
+        for (uint32_t i = 0; i < c->lexed.tokenCount; i++) {
+            const PackedToken *token = &c->lexed.tokens[i];
+            const char *text = token->id != TOKSTREAM_NO_STRING ? sharedInternText(&names, token->id) : tokenSpellings[token->kind];
+            const char *type = tokenTypeNames[token->kind];
+            fprintf(c->out, "Token: %s, Type: %s\n", text ? text : "", type ? type : "Unknown");
+        }
+    }
+    return 1;
+}
+
+// Function to write code as x86-64 assembly to asmPath. Returns 1 on success.
+int writeAssembly(Compilation *c, const TacBuffer *code) {
+    StatsClock start = statsNow();
+    FILE *file = fopen(asmPath, "w");
+    if (file == NULL) {
+        fprintf(c->err, "Error: Cannot open %s for writing\n", asmPath);
+        c->ioError = 1;
+        return 0;
+    }
+    x86Emit(code, file);
+    fclose(file);
+    statsPhase(&c->stats, "writeAssembly", start);
+    return 1;
+}
+
+// Function to run the stages after lexing. Returns 1 if every stage that
+// ran succeeded.
+int compileTokens(Compilation *c, const Source *source) {
+    FILE *out = c->out;
+    Parser parser;
+    StatsClock start = statsNow();
+    astInit(&c->ast, c->lexed.tokenCount + 1);
+    parserInit(&parser, &c->ast, c->lexed.tokens, c->lexed.tokenCount, NULL, source->text);
+    parser.sharedNames = &names;
+    parser.out = out;
+    parser.maxErrors = maxErrors;
+    uint32_t program = parseProgram(&parser);
+    statsPhase(&c->stats, "parseProgram", start);
+    if (program == 0) {
+        fprintf(out, "Syntax analysis failed with %d error%s.\n", parser.errorCount, parser.errorCount == 1 ? "" : "s");
+        return 0;
+    }
+    if (dumpAst) {
+        fprintf(out, "Abstract Syntax Tree:\n");
+        astDump(&parser, program);
+    }
+    if (stopAfter == STAGE_PARSE) {
+        fprintf(out, "Syntax analysis completed successfully.\n");
+        return 1;
+    }
+
+    Sema sema;
+    start = statsNow();
+    semaInit(&sema, &c->ast, &parser);
+    semaResolve(&sema, program);
+    statsPhase(&c->stats, "semaResolve", start);
+    statsAdd(&c->stats, STAT_SYMBOLS, sema.table.declared);
+    statsAdd(&c->stats, STAT_SCOPE_PUSHES, sema.table.scopesEntered);
+    statsAdd(&c->stats, STAT_SCOPE_POPS, sema.table.scopesExited);
+    int semanticErrors = sema.errorCount;
+    semaFree(&sema);
+    if (semanticErrors > 0 || stopAfter == STAGE_SEMA) {
+        fprintf(out, "%d semantic error%s.\n", semanticErrors, semanticErrors == 1 ? "" : "s");
+        return semanticErrors == 0;
+    }
+
+    IrGen gen;
+    start = statsNow();
+    irInit(&gen, &c->code, &c->ast, &parser);
+    int lowered = irGenerate(&gen, program);
+    irFree(&gen);
+    statsPhase(&c->stats, "irGenerate", start);
+    statsAdd(&c->stats, STAT_QUADS, c->code.count);
+    if (!lowered) {
+        fprintf(out, "Intermediate code generation failed.\n");
+        return 0;
+    }
+
+    VmProgram reference;
+    if (verifyCode) vmLower(&reference, &c->code);
+    start = statsNow();
+    optimize(&c->code, optLevel);
+    statsPhase(&c->stats, "optimize", start);
+    start = statsNow();
+    fprintf(out, "Generated Intermediate Code (Three-Address Code):\n");
+    tacPrint(&c->code, out);
+    statsPhase(&c->stats, "tacPrint", start);
+    if (showCfg) {
+        start = statsNow();
+        Cfg cfg;
+        cfgBuild(&cfg, &c->code);
+        cfgDominators(&cfg);
+        fprintf(out, "\nControl-Flow Graph (%u blocks):\n", cfg.blockCount);
+        cfgPrint(&cfg, out);
+        cfgFree(&cfg);
+        statsPhase(&c->stats, "cfgPrint", start);
+    }
+    c->lowered = 1;
+    int ok = asmPath == NULL || writeAssembly(c, &c->code);
+    if (runCode) {
+        start = statsNow();
+        c->runStart = (size_t)ftell(out);
+        vmExecute(&c->code, out);
+        c->runEnd = (size_t)ftell(out);
+        statsPhase(&c->stats, "vmExecute", start);
+    }
+    if (verifyCode) {
+        start = statsNow();
+        ok = vmVerify(&reference, &c->code, out) && ok;
+        vmFree(&reference);
+        statsPhase(&c->stats, "vmVerify", start);
+    }
+    return ok;
+}
+
+// Function to replay a cached compilation of a source with this key.
+// Returns 0 on a miss.
+int compileCached(Compilation *c, uint64_t key, const Source *source) {
+    CacheEntry entry;
+    if (!cacheOpen(&entry, cacheDir, key, source->length)) return 0;
+    const CacheHeader *header = entry.header;
+    c->ok = header->ok;
+    if (header->lowered && (asmPath != NULL || runCode)) {
+        // The assembly file and the program's run are redone from the stored code
+        TacBuffer code;
+        if (!cacheCode(&entry, &code)) {
+            cacheFreeCode(&code);
+            cacheClose(&entry);
+            return 0;
+        }
+        if (asmPath != NULL) c->ok = writeAssembly(c, &code) && c->ok;
+        fwrite(entry.output, 1, header->runOffset, c->out);
+        if (runCode) {
+            StatsClock start = statsNow();
+            vmExecute(&code, c->out);
+            statsPhase(&c->stats, "vmExecute", start);
+        }
+        fwrite(entry.output + header->runOffset, 1, header->outputBytes - header->runOffset, c->out);
+        cacheFreeCode(&code);
+    } else {
+        fwrite(entry.output, 1, header->outputBytes, c->out);
+    }
+    cacheClose(&entry);
+    return 1;
+}
+
+// Function to compile one input, from a file or (path NULL) from stdin
+// up to EOF or a line 'END'. Sets c->ok.
+void compile(Compilation *c) {
+    Source source;
+    statsInit(&c->stats);
+    StatsClock start = statsNow();
+    if (c->path != NULL ? !sourceOpen(&source, c->path) : !sourceReadUntilEnd(&source, stdin)) {
+        fprintf(c->err, "Error: Cannot read '%s'\n", c->path != NULL ? c->path : "stdin");
+        c->ok = 0;
+        return;
+    }
+    statsPhase(&c->stats, "readSource", start);
+    uint64_t key = 0;
+    FILE *out = c->out, *err = c->err;
+    char *output = NULL;
+    size_t outputLength = 0;
+    if (cacheDir != NULL) {
+        start = statsNow();
+        key = cacheHash(source.text, source.length, cacheSeed);
+        int hit = compileCached(c, key, &source);
+        statsPhase(&c->stats, "cacheLookup", start);
+        if (hit) {
+            sourceClose(&source);
+            return;
+        }
+        // Capture the output to store it
+        c->out = open_memstream(&output, &outputLength);
+        if (c->out == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+        if (err == out) c->err = c->out;
+    }
+    tokenStreamInitShared(&c->lexed, &names);
+    tacInit(&c->code);
+    c->ok = lexSource(c, &source);
+    if (c->ok && stopAfter == STAGE_LEX) {
+        fprintf(c->out, "Lexical analysis completed: %u tokens.\n", c->lexed.tokenCount);
+    } else if (c->ok) {
+        c->ok = compileTokens(c, &source);
+    }
+    if (cacheDir != NULL) {
+        fclose(c->out);
+        c->out = out;
+        c->err = err;
+        fwrite(output, 1, outputLength, out);
+        if (!c->ioError) {
+            // The program's own output is left out; a hit runs it again
+            size_t runAt = outputLength;
+            if (runCode && c->lowered) {
+                memmove(output + c->runStart, output + c->runEnd, outputLength - c->runEnd);
+                outputLength -= c->runEnd - c->runStart;
+                runAt = c->runStart;
+            }
+            start = statsNow();
+            cacheStore(cacheDir, key, source.length, c->ok, c->lowered, output, outputLength, runAt, &c->code);
+            statsPhase(&c->stats, "cacheStore", start);
+        }
+        free(output);
+    }
+    tacFree(&c->code);
+    astFree(&c->ast);
+    tokenStreamFree(&c->lexed);
+    sourceClose(&source);
+}
+
+// Function run by the pool for one input: compile it into a private buffer
+void compileJob(void *context, uint32_t job) {
+    Compilation *c = &((Compilation *)context)[job];
+    c->out = open_memstream(&c->output, &c->outputLength);
+    if (c->out == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    c->err = c->out;
+    compile(c);
+    fclose(c->out);
+}
+
+// Function to undo the C escapes \n, \t, \r, \\ and \" in place. Returns
+// the new length.
+size_t unescape(char *text, size_t length) {
+    size_t used = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (c == '\\' && i + 1 < length) {
+            c = text[++i];
+            if (c == 'n') c = '\n';
+            else if (c == 't') c = '\t';
+            else if (c == 'r') c = '\r';
+        }
+        text[used++] = c;
+    }
+    return used;
+}
+
+// Function to open path as an incremental document and apply the edits in
+// editsPath, one "OFFSET REMOVED TEXT" per line, printing the analysis
+// before the first edit and after each one. Work counts go to stderr.
+int runEdits(const char *path) {
+    Source source;
+    if (path == NULL || !sourceOpen(&source, path)) {
+        fprintf(stderr, "Error: Cannot read '%s'\n", path != NULL ? path : "stdin");
+        return 1;
+    }
+    FILE *edits = fopen(editsPath, "r");
+    if (edits == NULL) {
+        fprintf(stderr, "Error: Cannot read '%s'\n", editsPath);
+        sourceClose(&source);
+        return 1;
+    }
+    IncrDocument doc;
+    incrOpen(&doc, source.text, source.length);
+    sourceClose(&source);
+    int ok = incrReport(&doc, stdout);
+
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLength;
+    uint32_t count = 0;
+    while ((lineLength = getline(&line, &lineCapacity, edits)) > 0) {
+        if (line[lineLength - 1] == '\n') line[--lineLength] = '\0';
+        unsigned long offset, removed;
+        int consumed = 0;
+        if (sscanf(line, "%lu %lu%n", &offset, &removed, &consumed) != 2) {
+            fprintf(stderr, "Error: Bad edit '%s' (expected OFFSET REMOVED TEXT)\n", line);
+            ok = 0;
+            break;
+        }
+        char *text = line + consumed + (line[consumed] == ' ');
+        size_t length = unescape(text, (size_t)(line + lineLength - text));
+        incrEdit(&doc, offset, removed, text, length);
+        printf("== edit %u ==\n", ++count);
+        ok = incrReport(&doc, stdout);
+        fprintf(stderr, "edit %u: relexed %u tokens, reparsed %u, rechecked %u statements%s\n", count,
+                doc.stats.relexed, doc.stats.reparsed, doc.stats.rechecked, doc.stats.rebuilt ? " (from scratch)" : "");
+    }
+    free(line);
+    fclose(edits);
+    incrFree(&doc);
+    return ok ? 0 : 1;
+}
+
+void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] [SOURCE...]\n", program);
+    fprintf(stderr, "  SOURCE                 file to compile (default: stdin up to EOF or a line 'END')\n");
+    fprintf(stderr, "  -j N                   compile the files on N threads, or lex a single file\n");
+    fprintf(stderr, "                         in chunks on N threads (0 = one per processor)\n");
+    fprintf(stderr, "  --stop-after=STAGE     stop after lex, parse, sema or ir (default ir)\n");
+    fprintf(stderr, "  --tokens               print the tokens\n");
+    fprintf(stderr, "  --dump-ast             print the syntax tree\n");
+    fprintf(stderr, "  --max-errors N         stop after N syntax errors (default 100, 0 = no limit)\n");
+    fprintf(stderr, "  -O0, -O1, -O2          optimization level of the intermediate code\n");
+    fprintf(stderr, "  --cfg                  print the basic blocks, edges and dominators\n");
+    fprintf(stderr, "  --run                  execute the code in the bytecode VM\n");
+    fprintf(stderr, "  --verify               check that the optimized code behaves like the original\n");
+    fprintf(stderr, "  -S FILE                write x86-64 assembly to FILE (one SOURCE only)\n");
+    fprintf(stderr, "  --cache DIR            reuse the results of earlier compilations of the same\n");
+    fprintf(stderr, "                         text with the same options, kept in DIR\n");
+    fprintf(stderr, "  --time-report          print time per phase and work counters to stderr\n");
+    fprintf(stderr, "  --stats                the same as JSON\n");
+    fprintf(stderr, "  --edits FILE           apply the edits in FILE (\"OFFSET REMOVED TEXT\" per line, C\n");
+    fprintf(stderr, "                         escapes in TEXT) to SOURCE one by one, re-analyzing\n");
+    fprintf(stderr, "                         incrementally up to sema after each\n");
+}
+
+int main(int argc, char *argv[]) {
+    Stats stats;
+    statsInit(&stats);
+    Compilation *inputs = calloc((size_t)argc, sizeof(Compilation));
+    uint32_t inputCount = 0;
+    if (inputs == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--stop-after=", 13) == 0) {
+            int stage = 0;
+            while (stage <= STAGE_IR && strcmp(arg + 13, stageNames[stage]) != 0) stage++;
+            if (stage > STAGE_IR) {
+                fprintf(stderr, "Error: Unknown stage '%s' (expected lex, parse, sema or ir)\n", arg + 13);
+                return 1;
+            }
+            stopAfter = (Stage)stage;
+        } else if (strcmp(arg, "--tokens") == 0) {
+            printTokens = 1;
+        } else if (strcmp(arg, "--dump-ast") == 0) {
+            dumpAst = 1;
+        } else if (strcmp(arg, "--max-errors") == 0 && i + 1 < argc) {
+            maxErrors = atoi(argv[++i]);
+        } else if (arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '2' && arg[3] == '\0') {
+            optLevel = arg[2] - '0';
+        } else if (strcmp(arg, "--cfg") == 0) {
+            showCfg = 1;
+        } else if (strcmp(arg, "--run") == 0) {
+            runCode = 1;
+        } else if (strcmp(arg, "--verify") == 0) {
+            verifyCode = 1;
+        } else if (strcmp(arg, "-S") == 0 && i + 1 < argc) {
+            asmPath = argv[++i];
+        } else if (strcmp(arg, "--cache") == 0 && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (strcmp(arg, "--time-report") == 0) {
+            timeReport = 0;
+        } else if (strcmp(arg, "--stats") == 0) {
+            timeReport = 1;
+        } else if (strcmp(arg, "--edits") == 0 && i + 1 < argc) {
+            editsPath = argv[++i];
+        } else if (strncmp(arg, "-j", 2) == 0 && (arg[2] != '\0' || i + 1 < argc)) {
+            int count = atoi(arg[2] != '\0' ? arg + 2 : argv[++i]);
+            jobs = count > 0 ? (uint32_t)count : poolProcessorCount();
+        } else if (arg[0] != '-') {
+            inputs[inputCount++].path = arg;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (asmPath != NULL && inputCount > 1) {
+        fprintf(stderr, "Error: -S needs a single SOURCE\n");
+        return 1;
+    }
+    if (editsPath != NULL) {
+        if (inputCount != 1) {
+            fprintf(stderr, "Error: --edits needs a single SOURCE file\n");
+            return 1;
+        }
+        int status = runEdits(inputs[0].path);
+        free(inputs);
+        return status;
+    }
+    if (inputCount == 0) inputCount = 1;   // stdin
+    if (cacheDir != NULL) {
+        // The build time stands in for the compiler's own version
+        char options[256];
+        int length = snprintf(options, sizeof(options), "%s %s %d stop %d O%d tokens %d ast %d cfg %d run %d verify %d errors %d",
+                              __DATE__, __TIME__, CACHE_VERSION, (int)stopAfter, optLevel, printTokens, dumpAst,
+                              showCfg, runCode, verifyCode, maxErrors);
+        cacheSeed = cacheHash(options, (size_t)length, 0);
+    }
+    if (inputCount == 1) lexThreads = jobs;
+
+    // The scanner tables are built on first use; do it before any thread starts
+    initScannerTables();
+    sharedInternInit(&names, 1u << 20);
+    if (jobs > 1 && inputCount > 1) {
+        poolRun(inputCount, jobs, compileJob, inputs);
+    }
+    int status = 0;
+    for (uint32_t i = 0; i < inputCount; i++) {
+        Compilation *c = &inputs[i];
+        if (inputCount > 1) printf("%s== %s ==\n", i > 0 ? "\n" : "", c->path);
+        if (c->output != NULL) {
+            fwrite(c->output, 1, c->outputLength, stdout);
+            free(c->output);
+        } else {
+            c->out = stdout;
+            c->err = stderr;
+            fflush(stdout);
+            compile(c);
+        }
+        if (!c->ok) status = 1;
+        statsMerge(&stats, &c->stats);
+    }
+    if (timeReport >= 0) {
+        fflush(stdout);
+        statsPrint(&stats, stderr, timeReport);
+    }
+    sharedInternFree(&names);
+    free(inputs);
+    return status;
+}
@@ -0,0 +1,771 @@
+#ifndef INCR_H
+#define INCR_H
+
+// Incremental analysis of a document that is being edited.
+//
+// An IncrDocument keeps the text, its tokens, a syntax tree that records
+// statement spans, and the diagnostics of the last analysis. incrEdit()
+// applies one text edit and redoes only what the edit can affect:
+//
+//   - Lexing restarts at the end of the last token before the edit and stops
+//     as soon as it starts a token where an old token after the edit started;
+//     from there on it would only produce the old tokens again.
+//   - Parsing restarts at a statement boundary just before the damage, in the
+//     innermost block that encloses all of it, and stops once a statement
+//     ends where an old statement past the damage started. If the block no
+//     longer ends at its old '}', the enclosing list is reparsed instead, up
+//     to the whole program.
+//   - Name resolution rebuilds the scopes down to that list from the names
+//     the statements before it declare (their bodies are not walked again),
+//     checks the new statements, and checks the statements after them only
+//     if the new ones declare different names.
+//
+// Diagnostics are stored per statement and sorted when printed, so
+// incrReport() prints what a full run with --stop-after=sema and no error
+// limit prints for the current text. Token indices, offsets and line starts
+// after the edit are still shifted in place, a plain pass over arrays; the
+// lexing, parsing and checking are proportional to the edit. Replaced nodes
+// stay in the arena until they outnumber the live ones; the document is then
+// analyzed again from scratch, as it is while it has an unclosed comment or
+// string.
+
+#include "lexer.h"
+#include "parser.h"
+#include "sema.h"
+
+enum {
+    INCR_SYNTAX,
+    INCR_SEMANTIC
+};
+
+typedef struct {
+    uint32_t anchor;     // First token of the statement it belongs to
+    uint32_t order;      // Sort key (see DiagnosticHook)
+    uint32_t tie;        // Second sort key, set when printing
+    uint32_t seq;        // Arrival order
+    uint32_t token;      // Where it points
+    int stage;           // INCR_SYNTAX or INCR_SEMANTIC
+    char *before;        // Text before and after the location
+    char *after;
+} IncrDiagnostic;
+
+typedef struct {
+    uint32_t relexed;    // Tokens produced by the lexer
+    uint32_t reparsed;   // Tokens the parser went over
+    uint32_t rechecked;  // Statements whose names were resolved again
+    int rebuilt;         // Analyzed from scratch
+} IncrStats;
+
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+    uint32_t *lines;     // Offset of the start of every line
+    uint32_t lineCount;
+    uint32_t lineCapacity;
+
+    TokenStreamWriter tokens;
+    AstArena ast;
+    uint32_t program;    // 0 = the tree is out of date (lexical error)
+    uint32_t garbage;    // Nodes no longer reachable from program
+    TokenKind lexError;  // TK_EOF, or an unclosed comment/string
+
+    IncrDiagnostic *diagnostics;
+    uint32_t diagnosticCount;
+    uint32_t diagnosticCapacity;
+    uint32_t seq;
+    int stage;           // Stage the diagnostic hook is collecting for
+
+    IncrStats stats;     // Work done by the last edit
+} IncrDocument;
+
+// What an edit did to the token array: old tokens [k0, k1) were replaced by
+// new tokens [k0, newEnd), and later tokens moved by tokenDelta
+typedef struct {
+    uint32_t k0;
+    uint32_t k1;
+    uint32_t newEnd;
+    int64_t tokenDelta;
+    PackedToken *removed;   // Copies of the old tokens [k0, k1)
+} IncrDamage;
+
+typedef struct {
+    uint32_t *items;
+    uint32_t count;
+    uint32_t capacity;
+} IncrList;
+
+static inline void incrPush(IncrList *list, uint32_t item) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items = internAlloc(list->items, (size_t)list->capacity * sizeof(uint32_t));
+    }
+    list->items[list->count++] = item;
+}
+
+// ---------------------------------------------------------------------------
+// Diagnostics
+
+// Function used as the parser's diagnostic hook: keep a copy of the message
+static inline void incrCollect(void *context, uint32_t anchor, uint32_t order, uint32_t token,
+                               const char *before, const char *after) {
+    IncrDocument *doc = context;
+    if (doc->diagnosticCount == doc->diagnosticCapacity) {
+        doc->diagnosticCapacity = doc->diagnosticCapacity ? doc->diagnosticCapacity * 2 : 64;
+        doc->diagnostics = internAlloc(doc->diagnostics, (size_t)doc->diagnosticCapacity * sizeof(IncrDiagnostic));
+    }
+    IncrDiagnostic *diagnostic = &doc->diagnostics[doc->diagnosticCount++];
+    diagnostic->anchor = anchor;
+    diagnostic->order = order;
+    diagnostic->tie = 0;
+    diagnostic->seq = doc->seq++;
+    diagnostic->token = token;
+    diagnostic->stage = doc->stage;
+    diagnostic->before = internAlloc(NULL, strlen(before) + 1);
+    diagnostic->after = internAlloc(NULL, strlen(after) + 1);
+    strcpy(diagnostic->before, before);
+    strcpy(diagnostic->after, after);
+}
+
+// Function to drop the diagnostics of a stage that are older than seq and
+// whose statement starts in [start, end)
+static inline void incrDropDiagnostics(IncrDocument *doc, int stage, uint32_t start, uint32_t end, uint32_t seq) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < doc->diagnosticCount; i++) {
+        IncrDiagnostic *diagnostic = &doc->diagnostics[i];
+        if (diagnostic->stage == stage && diagnostic->seq < seq && diagnostic->anchor >= start &&
+            diagnostic->anchor < end) {
+            free(diagnostic->before);
+            free(diagnostic->after);
+            continue;
+        }
+        doc->diagnostics[kept++] = *diagnostic;
+    }
+    doc->diagnosticCount = kept;
+}
+
+static inline void incrClearDiagnostics(IncrDocument *doc) {
+    for (uint32_t i = 0; i < doc->diagnosticCount; i++) {
+        free(doc->diagnostics[i].before);
+        free(doc->diagnostics[i].after);
+    }
+    doc->diagnosticCount = 0;
+    doc->seq = 0;
+}
+
+// Function to set up a parser over the document's tokens that hands its
+// diagnostics to the document
+static inline void incrParser(IncrDocument *doc, Parser *parser) {
+    parserInit(parser, &doc->ast, doc->tokens.tokens, doc->tokens.tokenCount, doc->tokens.strings, doc->text);
+    parser->diagnosticHook = incrCollect;
+    parser->hookContext = doc;
+    parser->maxErrors = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Text and lines
+
+// Function to find the line start array index of the line holding offset
+static inline uint32_t incrLineOf(const IncrDocument *doc, size_t offset) {
+    uint32_t low = 0, high = doc->lineCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (doc->lines[middle] <= offset) low = middle + 1;
+        else high = middle;
+    }
+    return low - 1;
+}
+
+static inline void incrAddLine(IncrDocument *doc, uint32_t start) {
+    if (doc->lineCount == doc->lineCapacity) {
+        doc->lineCapacity = doc->lineCapacity ? doc->lineCapacity * 2 : 1024;
+        doc->lines = internAlloc(doc->lines, (size_t)doc->lineCapacity * sizeof(uint32_t));
+    }
+    doc->lines[doc->lineCount++] = start;
+}
+
+// Function to replace text[offset, offset + removed) by inserted, keeping
+// the line starts up to date
+static inline void incrEditText(IncrDocument *doc, size_t offset, size_t removed, const char *inserted,
+                                size_t length) {
+    size_t newLength = doc->length - removed + length;
+    if (newLength + 1 > doc->capacity) {
+        while (newLength + 1 > doc->capacity) doc->capacity *= 2;
+        doc->text = internAlloc(doc->text, doc->capacity);
+    }
+    memmove(doc->text + offset + length, doc->text + offset + removed, doc->length - offset - removed);
+    memcpy(doc->text + offset, inserted, length);
+    doc->text[newLength] = '\0';
+    doc->length = newLength;
+
+    // Lines starting inside the removed text go; those in the inserted text come
+    uint32_t first = incrLineOf(doc, offset) + 1;
+    uint32_t last = incrLineOf(doc, offset + removed) + 1;
+    uint32_t added = 0;
+    for (size_t i = 0; i < length; i++) added += inserted[i] == '\n';
+    uint32_t count = doc->lineCount - last;
+    while (first + added + count > doc->lineCapacity) {
+        doc->lineCapacity *= 2;
+        doc->lines = internAlloc(doc->lines, (size_t)doc->lineCapacity * sizeof(uint32_t));
+    }
+    memmove(doc->lines + first + added, doc->lines + last, (size_t)count * sizeof(uint32_t));
+    doc->lineCount = first + added + count;
+    for (uint32_t i = first + added; i < doc->lineCount; i++) doc->lines[i] += (uint32_t)(length - removed);
+    for (size_t i = 0; i < length; i++) {
+        if (inserted[i] == '\n') doc->lines[first++] = (uint32_t)(offset + i + 1);
+    }
+}
+
+// Function to print where a token is, as parserPrintLocation() does
+static inline void incrPrintLocation(const IncrDocument *doc, uint32_t token, FILE *out) {
+    const TokenStreamWriter *tokens = &doc->tokens;
+    uint32_t offset = 0;
+    if (token < tokens->tokenCount) {
+        offset = tokens->tokens[token].offset;
+    } else if (tokens->tokenCount > 0) {
+        offset = tokens->tokens[tokens->tokenCount - 1].offset + tokens->tokens[tokens->tokenCount - 1].length;
+    }
+    uint32_t line = incrLineOf(doc, offset);
+    fprintf(out, "line %u, column %u", line + 1, offset - doc->lines[line] + 1);
+}
+
+// ---------------------------------------------------------------------------
+// Statement lists
+
+static inline uint32_t incrStart(const IncrDocument *doc, uint32_t node) {
+    return doc->ast.spans[2 * node];
+}
+
+static inline uint32_t incrEnd(const IncrDocument *doc, uint32_t node) {
+    return doc->ast.spans[2 * node + 1];
+}
+
+// Function to map an old token index to where that token is now
+static inline uint32_t incrShift(const IncrDamage *damage, uint32_t index) {
+    return index >= damage->k1 ? (uint32_t)(index + damage->tokenDelta) : index;
+}
+
+// Function to parse the statements of a list from parser->current, linking
+// them into *first/*last. A block's list must end at closeBrace, the
+// program's at the end of input. With *next set (the first old statement
+// not known to be damaged), parsing stops early once it is past the damage
+// and ends a statement where an old one started: from there on it would only
+// rebuild the old statements. Returns 0 if the list no longer ends where it
+// did; otherwise *next is the first old statement to keep, or 0.
+static inline int incrParseList(IncrDocument *doc, Parser *parser, const IncrDamage *damage, int inBlock,
+                                uint32_t closeBrace, uint32_t *next, uint32_t *first, uint32_t *last) {
+    // Parse errors never escape parseRecovering() without an error limit
+    for (;;) {
+        if (inBlock && (parser->current > closeBrace || parserAt(parser, TK_EOF))) return 0;
+        if (inBlock && parserAt(parser, TK_RBRACE)) {
+            *next = 0;
+            return parser->current == closeBrace;
+        }
+        if (!inBlock && parserAt(parser, TK_EOF)) {
+            *next = 0;
+            return 1;
+        }
+        uint32_t item = parseRecovering(parser, inBlock ? parseStatement : parseTopLevel, inBlock);
+        astLink(&doc->ast, first, last, item);
+        while (*next != 0 && (incrStart(doc, *next) < damage->k1 ||
+                              incrShift(damage, incrStart(doc, *next)) < parser->current)) {
+            *next = doc->ast.nodes[*next].nextSibling;
+        }
+        if (*next != 0 && parser->current >= damage->newEnd &&
+            incrShift(damage, incrStart(doc, *next)) == parser->current) {
+            return 1;
+        }
+    }
+}
+
+// Function to find, below node, the innermost block whose contents enclose
+// the damage, pushing the path to it onto chain. depth is the parser's
+// statement depth inside node. Returns the list depth of the block's
+// statements through *listDepth, or 0 if no block encloses the damage.
+static inline uint32_t incrFindBlock(const IncrDocument *doc, const IncrDamage *damage, uint32_t node, int depth,
+                                     IncrList *chain, int *listDepth) {
+    const AstNode *nodes = doc->ast.nodes;
+    const AstNode *current = &nodes[node];
+    if (current->kind == AST_BLOCK) {
+        uint32_t end = incrEnd(doc, node);
+        if (end == 0 || incrStart(doc, node) >= damage->k0 || end <= damage->k1 ||
+            doc->tokens.tokens[incrShift(damage, end - 1)].kind != TK_RBRACE) {
+            return 0;
+        }
+        incrPush(chain, node);
+        *listDepth = depth;
+        return node;
+    }
+    if (current->kind != AST_FUNCTION && current->kind != AST_IF && current->kind != AST_WHILE &&
+        current->kind != AST_DO_WHILE && current->kind != AST_FOR && current->kind != AST_SWITCH) {
+        return 0;
+    }
+    uint32_t mark = chain->count;
+    for (;;) {
+        incrPush(chain, node);
+        // An if in the else branch continues an "else if" chain, which the
+        // parser reads in a loop at the depth of the first if
+        uint32_t elseIf = 0;
+        if (current->kind == AST_IF) {
+            uint32_t elseBranch = nodes[nodes[current->firstChild].nextSibling].nextSibling;
+            if (nodes[elseBranch].kind == AST_IF) elseIf = elseBranch;
+        }
+        for (uint32_t child = current->firstChild; child != 0 && child != elseIf; child = nodes[child].nextSibling) {
+            // A function body is parsed by parseBlock() directly, other bodies as statements
+            int inner = current->kind == AST_FUNCTION ? depth : depth + 1;
+            uint32_t block = incrFindBlock(doc, damage, child, inner, chain, listDepth);
+            if (block != 0) return block;
+        }
+        if (elseIf == 0) break;
+        node = elseIf;
+        current = &nodes[node];
+    }
+    chain->count = mark;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Names
+
+// Function to declare (with sema set) or collect the ids of (with names set)
+// the names a statement adds to the scope it is in, in source order
+static inline void incrScopeNames(const IncrDocument *doc, uint32_t node, Sema *sema, IncrList *names,
+                                  const IncrDamage *damage) {
+    const AstNode *nodes = doc->ast.nodes;
+    IncrList stack = {0};
+    incrPush(&stack, node);
+    while (stack.count > 0) {
+        const AstNode *current = &nodes[stack.items[--stack.count]];
+        switch (current->kind) {
+            case AST_DECLARATOR: case AST_PARAM: case AST_FUNCTION: {
+                uint32_t token = current->token;
+                if (names != NULL) {
+                    // Old nodes may still point at tokens the edit replaced
+                    const PackedToken *packed = damage == NULL || token < damage->k0 ? &doc->tokens.tokens[token]
+                                                : token < damage->k1 ? &damage->removed[token - damage->k0]
+                                                : &doc->tokens.tokens[incrShift(damage, token)];
+                    incrPush(names, packed->id);
+                }
+                if (sema != NULL) {
+                    const char *name = parserTokenText(sema->parser, token);
+                    symtabDeclare(&sema->table, name, (uint32_t)strlen(name), tokenSpellings[current->op]);
+                }
+                break;
+            }
+            case AST_BLOCK: case AST_FOR:
+                break;   // Own scope
+            default: {
+                if (current->kind == AST_EXPRESSION || current->kind >= AST_ASSIGN) break;   // Declares nothing
+                uint32_t first = stack.count;
+                for (uint32_t child = current->firstChild; child != 0; child = nodes[child].nextSibling) {
+                    incrPush(&stack, child);
+                }
+                for (uint32_t last = stack.count; first + 1 < last; first++, last--) {
+                    uint32_t swap = stack.items[first];
+                    stack.items[first] = stack.items[last - 1];
+                    stack.items[last - 1] = swap;
+                }
+                break;
+            }
+        }
+    }
+    free(stack.items);
+}
+
+// Function to open the scopes sema would have open at the statements of the
+// last node on chain, declaring what comes before them on the way down
+static inline void incrEnterScopes(const IncrDocument *doc, Sema *sema, const IncrList *chain) {
+    const AstNode *nodes = doc->ast.nodes;
+    for (uint32_t i = 1; i < chain->count; i++) {
+        uint32_t parent = chain->items[i - 1], node = chain->items[i];
+        for (uint32_t child = nodes[parent].firstChild; child != node; child = nodes[child].nextSibling) {
+            incrScopeNames(doc, child, sema, NULL, NULL);
+        }
+        if (nodes[node].kind == AST_FUNCTION) {
+            incrScopeNames(doc, node, sema, NULL, NULL);
+            symtabEnterScope(&sema->table);
+        } else if (nodes[node].kind == AST_FOR ||
+                   (nodes[node].kind == AST_BLOCK && nodes[parent].kind != AST_FUNCTION)) {
+            symtabEnterScope(&sema->table);   // A function body shares the parameters' scope
+        }
+    }
+}
+
+// Function to count the nodes of a subtree
+static inline uint32_t incrTreeSize(const IncrDocument *doc, uint32_t node) {
+    uint32_t size = 0;
+    IncrList stack = {0};
+    incrPush(&stack, node);
+    while (stack.count > 0) {
+        node = stack.items[--stack.count];
+        size++;
+        for (uint32_t child = doc->ast.nodes[node].firstChild; child != 0; child = doc->ast.nodes[child].nextSibling) {
+            incrPush(&stack, child);
+        }
+    }
+    free(stack.items);
+    return size;
+}
+
+// ---------------------------------------------------------------------------
+// Analysis
+
+// Function to lex, parse and check the whole text again
+static inline void incrAnalyze(IncrDocument *doc) {
+    size_t errorOffset = 0;
+    tokenStreamFree(&doc->tokens);
+    tokenStreamInit(&doc->tokens, NULL);
+    incrClearDiagnostics(doc);
+    astFree(&doc->ast);
+    doc->program = 0;
+    doc->garbage = 0;
+    doc->stats.rebuilt = 1;
+    doc->lexError = lexerTokenize(doc->text, doc->length, &doc->tokens, &errorOffset);
+    doc->stats.relexed = doc->tokens.tokenCount;
+    if (doc->lexError != TK_EOF) return;
+
+    Parser parser;
+    IncrDamage none = {0, UINT32_MAX, 0, 0, NULL};
+    uint32_t next = 0, first = 0, last = 0;
+    astInit(&doc->ast, doc->tokens.tokenCount + 1);
+    astTrackSpans(&doc->ast);
+    incrParser(doc, &parser);
+    doc->program = astNew(&doc->ast, AST_PROGRAM, 0, 0);
+    doc->stage = INCR_SYNTAX;
+    incrParseList(doc, &parser, &none, 0, 0, &next, &first, &last);
+    doc->ast.nodes[doc->program].firstChild = first;
+    doc->stats.reparsed = parser.current;
+
+    // Names are resolved even with syntax errors, so that the messages are
+    // ready (and only need updating) once the errors are fixed
+    Sema sema;
+    semaInit(&sema, &doc->ast, &parser);
+    doc->stage = INCR_SEMANTIC;
+    semaResolve(&sema, doc->program);
+    semaFree(&sema);
+    for (uint32_t item = first; item != 0; item = doc->ast.nodes[item].nextSibling) doc->stats.rechecked++;
+}
+
+// Function to re-lex after a text edit of `removed` bytes at offset
+// replaced by `inserted` bytes. Fills *damage; returns 0 on a lexical error.
+static inline int incrRelex(IncrDocument *doc, size_t offset, size_t removed, size_t inserted, IncrDamage *damage) {
+    TokenStreamWriter *tokens = &doc->tokens;
+    int64_t byteDelta = (int64_t)inserted - (int64_t)removed;
+
+    // Tokens ending before the edit are kept: the lexer never looks more than
+    // one byte past a token, and that byte is unchanged
+    uint32_t low = 0, high = tokens->tokenCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if ((size_t)tokens->tokens[middle].offset + tokens->tokens[middle].length < offset) low = middle + 1;
+        else high = middle;
+    }
+    damage->k0 = low;
+    damage->k1 = tokens->tokenCount;
+    size_t restart = low > 0 ? (size_t)tokens->tokens[low - 1].offset + tokens->tokens[low - 1].length : 0;
+
+    TokenStreamWriter fresh;
+    Lexer lexer;
+    TokenKind kind;
+    tokenStreamInit(&fresh, tokens->strings);
+    lexerInit(&lexer, doc->text + restart, doc->length - restart, 1);
+    doc->lexError = TK_EOF;
+    while ((kind = lexerNext(&lexer)) != TK_EOF) {
+        size_t start = restart + lexer.start;
+        if (kind == TK_UNCLOSED_COMMENT || kind == TK_UNCLOSED_STRING) {
+            doc->lexError = kind;
+            break;
+        }
+        if (start >= offset + inserted) {
+            // Resynchronized if an old token after the edit started here
+            size_t old = (size_t)((int64_t)start - byteDelta);
+            uint32_t lowOld = damage->k0, highOld = tokens->tokenCount;
+            while (lowOld < highOld) {
+                uint32_t middle = lowOld + (highOld - lowOld) / 2;
+                if (tokens->tokens[middle].offset < old) lowOld = middle + 1;
+                else highOld = middle;
+            }
+            if (lowOld < tokens->tokenCount && tokens->tokens[lowOld].offset == old) {
+                damage->k1 = lowOld;
+                break;
+            }
+        }
+        tokenStreamAdd(&fresh, kind, start, doc->text + start, lexer.pos - lexer.start);
+    }
+    doc->stats.relexed = fresh.tokenCount;
+
+    // Splice the new tokens in and move the rest
+    uint32_t count = tokens->tokenCount - damage->k1;
+    uint32_t total = damage->k0 + fresh.tokenCount + count;
+    damage->removed = internAlloc(NULL, (size_t)(damage->k1 - damage->k0 + 1) * sizeof(PackedToken));
+    if (damage->k1 > damage->k0) {
+        memcpy(damage->removed, tokens->tokens + damage->k0, (size_t)(damage->k1 - damage->k0) * sizeof(PackedToken));
+    }
+    if (total > tokens->tokenCapacity) {
+        tokens->tokenCapacity = total + total / 2 + 1024;
+        tokens->tokens = internAlloc(tokens->tokens, (size_t)tokens->tokenCapacity * sizeof(PackedToken));
+    }
+    if (count > 0) {
+        memmove(tokens->tokens + damage->k0 + fresh.tokenCount, tokens->tokens + damage->k1,
+                (size_t)count * sizeof(PackedToken));
+    }
+    if (fresh.tokenCount > 0) {
+        memcpy(tokens->tokens + damage->k0, fresh.tokens, (size_t)fresh.tokenCount * sizeof(PackedToken));
+    }
+    for (uint32_t i = damage->k0 + fresh.tokenCount; i < total; i++) {
+        tokens->tokens[i].offset = (uint32_t)(tokens->tokens[i].offset + byteDelta);
+    }
+    tokens->tokenCount = total;
+    damage->newEnd = damage->k0 + fresh.tokenCount;
+    damage->tokenDelta = (int64_t)damage->newEnd - damage->k1;
+    tokenStreamFree(&fresh);
+    return doc->lexError == TK_EOF;
+}
+
+// Function to reparse and recheck after the tokens changed as damage says
+static inline void incrReparse(IncrDocument *doc, const IncrDamage *damage) {
+    AstNode *nodes;
+    IncrList chain = {0}, levels = {0};
+    Parser parser;
+    incrParser(doc, &parser);
+    doc->stage = INCR_SYNTAX;
+
+    // Path from the program down to the innermost block around the damage;
+    // levels holds the chain length and list depth at each candidate list
+    int depth = 0;
+    incrPush(&chain, doc->program);
+    incrPush(&levels, chain.count);
+    incrPush(&levels, 0);
+    for (uint32_t owner = doc->program;;) {
+        nodes = doc->ast.nodes;
+        uint32_t item = nodes[owner].firstChild;
+        while (item != 0 && !(incrStart(doc, item) < damage->k0 && incrEnd(doc, item) > damage->k1)) {
+            item = nodes[item].nextSibling;
+        }
+        if (item == 0) break;
+        int listDepth = 0;
+        int inner = nodes[item].kind == AST_FUNCTION ? depth : depth + 1;
+        uint32_t block = incrFindBlock(doc, damage, item, inner, &chain, &listDepth);
+        if (block == 0) break;
+        incrPush(&levels, chain.count);
+        incrPush(&levels, (uint32_t)listDepth);
+        owner = block;
+        depth = listDepth;
+    }
+
+    // Try the innermost list first; the program's list always succeeds
+    uint32_t diagnosticMark = doc->diagnosticCount, nodeMark = doc->ast.count, seqMark = doc->seq;
+    uint32_t owner = 0, before = 0, replaced = 0, start = 0, next = 0, first = 0, last = 0;
+    int inBlock = 0;
+    for (uint32_t level = levels.count / 2; level-- > 0;) {
+        chain.count = levels.items[2 * level];
+        owner = chain.items[chain.count - 1];
+        inBlock = owner != doc->program;
+        nodes = doc->ast.nodes;
+
+        // Restart at the last statement that starts two tokens or more before
+        // the damage: the one before it cannot have looked at the damage
+        before = replaced = 0;
+        start = inBlock ? incrStart(doc, owner) + 1 : 0;
+        for (uint32_t item = nodes[owner].firstChild; item != 0 && incrStart(doc, item) + 2 <= damage->k0;
+             item = nodes[item].nextSibling) {
+            if (replaced != 0) before = replaced;
+            replaced = item;
+            start = incrStart(doc, item);
+        }
+        if (replaced == 0) replaced = nodes[owner].firstChild;
+        uint32_t closeBrace = inBlock ? incrShift(damage, incrEnd(doc, owner) - 1) : 0;
+        parser.current = start;
+        parser.depth = (int)levels.items[2 * level + 1];
+        next = replaced;
+        first = last = 0;
+        if (incrParseList(doc, &parser, damage, inBlock, closeBrace, &next, &first, &last)) break;
+
+        // The block's end moved: drop what this attempt produced
+        for (uint32_t i = diagnosticMark; i < doc->diagnosticCount; i++) {
+            free(doc->diagnostics[i].before);
+            free(doc->diagnostics[i].after);
+        }
+        doc->diagnosticCount = diagnosticMark;
+    }
+    doc->stats.reparsed = parser.current - start;
+
+    // Names the replaced statements declared, then unlink them
+    IncrList oldNames = {0}, newNames = {0};
+    uint32_t oldEnd = next != 0 ? incrStart(doc, next) : inBlock ? incrEnd(doc, owner) - 1 : UINT32_MAX;
+    for (uint32_t item = replaced; item != next; item = doc->ast.nodes[item].nextSibling) {
+        incrScopeNames(doc, item, NULL, &oldNames, damage);
+        doc->garbage += incrTreeSize(doc, item);
+    }
+    doc->garbage += doc->ast.count - nodeMark;   // Failed attempts (new items are subtracted below)
+    nodes = doc->ast.nodes;
+    if (last != 0) nodes[last].nextSibling = next;
+    else first = next;
+    if (before != 0) nodes[before].nextSibling = first;
+    else nodes[owner].firstChild = first;
+
+    // Move what was kept to the new token indices
+    for (uint32_t i = 1; i < nodeMark; i++) {
+        if (nodes[i].token >= damage->k1) nodes[i].token = incrShift(damage, nodes[i].token);
+        uint32_t *span = &doc->ast.spans[2 * i];
+        if (span[1] != 0 && span[0] >= damage->k1) span[0] = incrShift(damage, span[0]);
+        if (span[1] != 0 && span[1] >= damage->k1) span[1] = incrShift(damage, span[1]);
+    }
+    incrDropDiagnostics(doc, INCR_SYNTAX, start, oldEnd, seqMark);
+    incrDropDiagnostics(doc, INCR_SEMANTIC, start, oldEnd, seqMark);
+    for (uint32_t i = 0; i < doc->diagnosticCount; i++) {
+        IncrDiagnostic *diagnostic = &doc->diagnostics[i];
+        if (diagnostic->seq >= seqMark) continue;   // Already in new indices
+        if (diagnostic->anchor >= damage->k1) diagnostic->anchor = incrShift(damage, diagnostic->anchor);
+        if (diagnostic->token >= damage->k1 && diagnostic->token != PARSER_NO_TOKEN) diagnostic->token = incrShift(damage, diagnostic->token);
+        if ((diagnostic->order + 1) / 2 >= damage->k1) diagnostic->order += (uint32_t)(2 * damage->tokenDelta);
+    }
+
+    // Check the new statements in the scopes they are in, and the ones after
+    // them as well when the new ones declare different names
+    Sema sema;
+    semaInit(&sema, &doc->ast, &parser);
+    doc->stage = INCR_SEMANTIC;
+    incrEnterScopes(doc, &sema, &chain);
+    nodes = doc->ast.nodes;
+    for (uint32_t item = nodes[owner].firstChild; item != 0 && item != first; item = nodes[item].nextSibling) {
+        incrScopeNames(doc, item, &sema, NULL, NULL);
+    }
+    uint32_t item = first;
+    for (; item != next; item = nodes[item].nextSibling) {
+        incrScopeNames(doc, item, NULL, &newNames, NULL);
+        doc->garbage -= incrTreeSize(doc, item);
+        semaResolve(&sema, item);
+        doc->stats.rechecked++;
+    }
+    if (item != 0 && (oldNames.count != newNames.count || (oldNames.count > 0 &&
+                      memcmp(oldNames.items, newNames.items, (size_t)oldNames.count * sizeof(uint32_t)) != 0))) {
+        uint32_t end = inBlock ? incrEnd(doc, owner) : UINT32_MAX;
+        incrDropDiagnostics(doc, INCR_SEMANTIC, incrStart(doc, item), end, doc->seq);
+        for (; item != 0; item = nodes[item].nextSibling) {
+            semaResolve(&sema, item);
+            doc->stats.rechecked++;
+        }
+    }
+    semaFree(&sema);
+    free(oldNames.items);
+    free(newNames.items);
+    free(chain.items);
+    free(levels.items);
+}
+
+// Function to start a document with the given text and analyze it
+static inline void incrOpen(IncrDocument *doc, const char *text, size_t length) {
+    memset(doc, 0, sizeof(*doc));
+    doc->capacity = length + 1 > 4096 ? length + 1 : 4096;
+    doc->text = internAlloc(NULL, doc->capacity);
+    memcpy(doc->text, text, length);
+    doc->text[length] = '\0';
+    doc->length = length;
+    incrAddLine(doc, 0);
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n') incrAddLine(doc, (uint32_t)(i + 1));
+    }
+    tokenStreamInit(&doc->tokens, NULL);
+    incrAnalyze(doc);
+}
+
+// Function to replace `removed` bytes at offset by inserted[0 .. length) and
+// bring tokens, tree and diagnostics up to date. Out-of-range edits are
+// clipped to the text.
+static inline void incrEdit(IncrDocument *doc, size_t offset, size_t removed, const char *inserted, size_t length) {
+    if (offset > doc->length) offset = doc->length;
+    if (removed > doc->length - offset) removed = doc->length - offset;
+    memset(&doc->stats, 0, sizeof(doc->stats));
+    incrEditText(doc, offset, removed, inserted, length);
+    if (doc->program == 0) {
+        incrAnalyze(doc);   // Nothing up to date to build on
+        return;
+    }
+    IncrDamage damage;
+    if (!incrRelex(doc, offset, removed, length, &damage)) {
+        doc->program = 0;
+    } else {
+        incrReparse(doc, &damage);
+        if (doc->garbage > doc->ast.count / 2 && doc->ast.count > 4096) {
+            IncrStats stats = doc->stats;
+            incrAnalyze(doc);   // Mostly dead nodes: start over with a compact tree
+            doc->stats.relexed += stats.relexed;
+        }
+    }
+    free(damage.removed);
+}
+
+static inline int incrCompare(const void *a, const void *b) {
+    const IncrDiagnostic *x = *(const IncrDiagnostic *const *)a, *y = *(const IncrDiagnostic *const *)b;
+    if (x->order != y->order) return x->order < y->order ? -1 : 1;
+    if (x->tie != y->tie) return x->tie < y->tie ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Function to print the diagnostics of one stage in source order. Returns
+// how many were printed.
+static inline int incrPrintStage(IncrDocument *doc, int stage, FILE *out) {
+    IncrDiagnostic **sorted = internAlloc(NULL, ((size_t)doc->diagnosticCount + 1) * sizeof(IncrDiagnostic *));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < doc->diagnosticCount; i++) {
+        IncrDiagnostic *diagnostic = &doc->diagnostics[i];
+        if (diagnostic->stage != stage) continue;
+        // Syntax errors at one token come from neighbouring statements; the
+        // earlier statement's come first, except at the end of input where
+        // they all come from one reparse
+        diagnostic->tie = stage == INCR_SYNTAX && diagnostic->token < doc->tokens.tokenCount ? diagnostic->anchor : 0;
+        sorted[count++] = diagnostic;
+    }
+    qsort(sorted, count, sizeof(IncrDiagnostic *), incrCompare);
+    int printed = 0;
+    const IncrDiagnostic *previous = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        const IncrDiagnostic *diagnostic = sorted[i];
+        if (stage == INCR_SYNTAX && previous != NULL && previous->token == diagnostic->token &&
+            diagnostic->token < doc->tokens.tokenCount) {
+            continue;   // The parser reports one error per token
+        }
+        fputs(diagnostic->before, out);
+        if (diagnostic->token != PARSER_NO_TOKEN) incrPrintLocation(doc, diagnostic->token, out);
+        fputs(diagnostic->after, out);
+        previous = diagnostic;
+        printed++;
+    }
+    free(sorted);
+    return printed;
+}
+
+// Function to print the result of analyzing the current text, as the
+// compiler driver prints it with --stop-after=sema --max-errors 0. Returns 1
+// if there were no errors.
+static inline int incrReport(IncrDocument *doc, FILE *out) {
+    if (doc->lexError == TK_UNCLOSED_COMMENT) {
+        fprintf(out, "Error: Unclosed multi-line comment\n");
+        return 0;
+    }
+    if (doc->lexError == TK_UNCLOSED_STRING) {
+        fprintf(out, "Error: Unclosed string literal\n");
+        return 0;
+    }
+    int errors = incrPrintStage(doc, INCR_SYNTAX, out);
+    if (errors > 0) {
+        fprintf(out, "Syntax analysis failed with %d error%s.\n", errors, errors == 1 ? "" : "s");
+        return 0;
+    }
+    errors = incrPrintStage(doc, INCR_SEMANTIC, out);
+    fprintf(out, "%d semantic error%s.\n", errors, errors == 1 ? "" : "s");
+    return errors == 0;
+}
+
+static inline void incrFree(IncrDocument *doc) {
+    incrClearDiagnostics(doc);
+    free(doc->diagnostics);
+    free(doc->text);
+    free(doc->lines);
+    tokenStreamFree(&doc->tokens);
+    astFree(&doc->ast);
+    memset(doc, 0, sizeof(*doc));
+}
+
+#endif
@@ -0,0 +1,428 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+// String interning table.
+//
+// Each distinct string is copied once into an arena of large blocks and
+// given a stable integer id (0, 1, 2, ... in insertion order). Lookups go
+// through an open-addressing hash of ids with linear probing, so memory grows
+// with the number of distinct strings, not with how often they occur.
+// Interned text never moves: pointers from internText() stay valid until
+// internFree(), which releases the whole arena at once.
+//
+// SharedInternTable is the same idea for many threads at once. It never
+// takes a lock: slots are claimed with compare-and-swap, ids come from an
+// atomic counter, entries live in chunks that are installed on first use, and
+// text is bump-allocated from the current arena block with an atomic add.
+// When its slot array is half full, the thread that notices publishes one
+// twice the size and copies the ids over while the others carry on; see
+// sharedInternGrow().
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define INTERN_BLOCK_SIZE (64 * 1024)
+#define INTERN_NONE 0xFFFFFFFFu
+
+typedef struct InternBlock {
+    struct InternBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} InternBlock;
+
+typedef struct {
+    const char *text;   // NUL-terminated copy in the arena
+    uint32_t length;
+    uint32_t hash;
+} InternEntry;
+
+typedef struct {
+    InternBlock *blocks;     // Newest block first
+    InternEntry *entries;    // Indexed by id
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *slots;         // id + 1 per slot, 0 = empty
+    uint32_t slotCount;      // Power of two, kept at least twice count
+} InternTable;
+
+static inline void *internAlloc(void *array, size_t size) {
+    array = realloc(array, size);
+    if (array == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+static inline uint32_t internHash(const char *text, uint32_t length) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static inline void internInit(InternTable *table) {
+    memset(table, 0, sizeof(*table));
+    table->slotCount = 256;
+    table->slots = calloc(table->slotCount, sizeof(uint32_t));
+    if (table->slots == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+}
+
+static inline void internFree(InternTable *table) {
+    InternBlock *block = table->blocks;
+    while (block != NULL) {
+        InternBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(table->entries);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+// Function to copy text into the arena, opening a new block when needed
+static inline const char *internStore(InternTable *table, const char *text, uint32_t length) {
+    InternBlock *block = table->blocks;
+    if (block == NULL || block->size - block->used < (size_t)length + 1) {
+        size_t size = (size_t)length + 1 > INTERN_BLOCK_SIZE ? (size_t)length + 1 : INTERN_BLOCK_SIZE;
+        block = internAlloc(NULL, sizeof(InternBlock) + size);
+        block->used = 0;
+        block->size = size;
+        block->next = table->blocks;
+        table->blocks = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    block->used += (size_t)length + 1;
+    return copy;
+}
+
+// Function to double the slot array and re-insert every id
+static inline void internRehash(InternTable *table) {
+    uint32_t newCount = table->slotCount * 2;
+    uint32_t *slots = calloc(newCount, sizeof(uint32_t));
+    if (slots == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (uint32_t id = 0; id < table->count; id++) {
+        uint32_t slot = table->entries[id].hash & (newCount - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (newCount - 1);
+        slots[slot] = id + 1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slotCount = newCount;
+}
+
+// Function to look text up without adding it. Returns INTERN_NONE if absent.
+static inline uint32_t internFind(const InternTable *table, const char *text, uint32_t length) {
+    uint32_t hash = internHash(text, length);
+    uint32_t mask = table->slotCount - 1;
+    for (uint32_t slot = hash & mask; table->slots[slot] != 0; slot = (slot + 1) & mask) {
+        const InternEntry *entry = &table->entries[table->slots[slot] - 1];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            return table->slots[slot] - 1;
+        }
+    }
+    return INTERN_NONE;
+}
+
+// Function to return the id of text, storing it on first sight
+static inline uint32_t internString(InternTable *table, const char *text, uint32_t length) {
+    uint32_t hash = internHash(text, length);
+    uint32_t mask = table->slotCount - 1;
+    uint32_t slot = hash & mask;
+    for (; table->slots[slot] != 0; slot = (slot + 1) & mask) {
+        const InternEntry *entry = &table->entries[table->slots[slot] - 1];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            return table->slots[slot] - 1;
+        }
+    }
+
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 256;
+        table->entries = internAlloc(table->entries, table->capacity * sizeof(InternEntry));
+    }
+    uint32_t id = table->count++;
+    table->entries[id].text = internStore(table, text, length);
+    table->entries[id].length = length;
+    table->entries[id].hash = hash;
+    table->slots[slot] = id + 1;
+
+    if (table->count * 2 > table->slotCount) internRehash(table);
+    return id;
+}
+
+static inline const char *internText(const InternTable *table, uint32_t id) {
+    return table->entries[id].text;
+}
+
+static inline uint32_t internLength(const InternTable *table, uint32_t id) {
+    return table->entries[id].length;
+}
+
+// ---------------------------------------------------------------------------
+// Shared table for concurrent use
+
+#define SHARED_INTERN_CHUNK_BITS 12
+#define SHARED_INTERN_CHUNK_SIZE (1u << SHARED_INTERN_CHUNK_BITS)
+#define SHARED_INTERN_MAX_CHUNKS 19   // Chunk k holds 2^k times as many ids as chunk 0
+#define SHARED_INTERN_MAX_IDS (1u << 30)   // More than a source with 32-bit offsets can hold
+#define SHARED_INTERN_CLOSED 0xFFFFFFFFu   // Slot left empty when its array moved on
+
+typedef struct SharedInternBlock {
+    struct SharedInternBlock *next;
+    atomic_size_t used;
+    size_t size;
+    char data[];
+} SharedInternBlock;
+
+// One slot array. Once next is set the array is moving there: empty slots
+// are closed instead of claimed, and the ids in it are copied over.
+typedef struct SharedInternSlots {
+    _Atomic(struct SharedInternSlots *) next;   // Array twice the size, or NULL
+    atomic_int moved;                           // Every id is in next as well
+    uint32_t slotCount;                         // Power of two
+    atomic_uint slots[];                        // id + 1 per slot, 0 = empty
+} SharedInternSlots;
+
+typedef struct {
+    _Atomic(SharedInternBlock *) blocks;              // Newest block first
+    _Atomic(InternEntry *) chunks[SHARED_INTERN_MAX_CHUNKS];  // Entries by id, in doubling chunks
+    atomic_uint count;                                // Ids handed out
+    SharedInternSlots *firstSlots;                    // Every array, linked by next
+    _Atomic(SharedInternSlots *) slots;               // Oldest array not yet moved
+} SharedInternTable;
+
+static inline SharedInternSlots *sharedInternSlotsNew(uint32_t slotCount) {
+    SharedInternSlots *array = calloc(1, sizeof(SharedInternSlots) + (size_t)slotCount * sizeof(atomic_uint));
+    if (array == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    atomic_init(&array->next, NULL);
+    atomic_init(&array->moved, 0);
+    array->slotCount = slotCount;
+    return array;
+}
+
+// Function to set up a table for about `capacity` distinct strings; it grows
+// past that as needed. Must run before other threads use the table.
+static inline void sharedInternInit(SharedInternTable *table, uint32_t capacity) {
+    uint32_t slotCount = 1024;
+    while (slotCount / 2 < capacity && slotCount < (1u << 31)) slotCount *= 2;
+    atomic_init(&table->blocks, NULL);
+    for (uint32_t i = 0; i < SHARED_INTERN_MAX_CHUNKS; i++) atomic_init(&table->chunks[i], NULL);
+    atomic_init(&table->count, 0);
+    table->firstSlots = sharedInternSlotsNew(slotCount);
+    atomic_init(&table->slots, table->firstSlots);
+}
+
+// Function to release the table once no thread uses it any more
+static inline void sharedInternFree(SharedInternTable *table) {
+    SharedInternBlock *block = atomic_load(&table->blocks);
+    while (block != NULL) {
+        SharedInternBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    for (uint32_t i = 0; i < SHARED_INTERN_MAX_CHUNKS; i++) free(atomic_load(&table->chunks[i]));
+    SharedInternSlots *array = table->firstSlots;
+    while (array != NULL) {
+        SharedInternSlots *next = atomic_load(&array->next);
+        free(array);
+        array = next;
+    }
+    table->firstSlots = NULL;
+}
+
+// Function to copy text into the arena. A thread that finds the current block
+// full opens a new one holding its text; if another thread got there first,
+// it drops its block and tries again.
+static inline const char *sharedInternStore(SharedInternTable *table, const char *text, uint32_t length) {
+    size_t need = (size_t)length + 1;
+    for (;;) {
+        SharedInternBlock *block = atomic_load_explicit(&table->blocks, memory_order_acquire);
+        if (block != NULL) {
+            size_t offset = atomic_fetch_add_explicit(&block->used, need, memory_order_relaxed);
+            if (offset + need <= block->size) {
+                memcpy(block->data + offset, text, length);
+                block->data[offset + length] = '\0';
+                return block->data + offset;
+            }
+        }
+        size_t size = need > INTERN_BLOCK_SIZE ? need : INTERN_BLOCK_SIZE;
+        SharedInternBlock *fresh = internAlloc(NULL, sizeof(SharedInternBlock) + size);
+        atomic_init(&fresh->used, need);
+        fresh->size = size;
+        fresh->next = block;
+        memcpy(fresh->data, text, length);
+        fresh->data[length] = '\0';
+        if (atomic_compare_exchange_strong_explicit(&table->blocks, &block, fresh,
+                                                    memory_order_release, memory_order_relaxed)) {
+            return fresh->data;
+        }
+        free(fresh);
+    }
+}
+
+// Function to find the chunk of an id: chunk k starts at id
+// SHARED_INTERN_CHUNK_SIZE * (2^k - 1)
+static inline uint32_t sharedInternChunkOf(uint32_t id) {
+    uint32_t scaled = (id >> SHARED_INTERN_CHUNK_BITS) + 1;
+#if defined(__GNUC__)
+    return 31 - (uint32_t)__builtin_clz(scaled);
+#else
+    uint32_t chunk = 0;
+    while (scaled >>= 1) chunk++;
+    return chunk;
+#endif
+}
+
+static inline uint32_t sharedInternChunkStart(uint32_t chunk) {
+    return (SHARED_INTERN_CHUNK_SIZE << chunk) - SHARED_INTERN_CHUNK_SIZE;
+}
+
+// Function to get the entry of an id, installing its chunk if needed
+static inline InternEntry *sharedInternEntry(SharedInternTable *table, uint32_t id) {
+    uint32_t k = sharedInternChunkOf(id);
+    _Atomic(InternEntry *) *chunk = &table->chunks[k];
+    InternEntry *entries = atomic_load_explicit(chunk, memory_order_acquire);
+    if (entries == NULL) {
+        InternEntry *fresh = internAlloc(NULL, ((size_t)SHARED_INTERN_CHUNK_SIZE << k) * sizeof(InternEntry));
+        if (atomic_compare_exchange_strong_explicit(chunk, &entries, fresh,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            entries = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    return &entries[id - sharedInternChunkStart(k)];
+}
+
+// Function to add an id to array or, once it is moving, to the array after
+// it. The id must not be in them yet.
+static inline void sharedInternPlace(SharedInternTable *table, SharedInternSlots *array, uint32_t id) {
+    uint32_t hash = sharedInternEntry(table, id)->hash;
+    for (;; array = atomic_load_explicit(&array->next, memory_order_acquire)) {
+        uint32_t mask = array->slotCount - 1;
+        for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+            uint32_t seen = atomic_load_explicit(&array->slots[slot], memory_order_acquire);
+            if (seen == 0) {
+                uint32_t claim = atomic_load_explicit(&array->next, memory_order_acquire) == NULL ? id + 1
+                                                                                                 : SHARED_INTERN_CLOSED;
+                if (atomic_compare_exchange_strong_explicit(&array->slots[slot], &seen, claim,
+                                                            memory_order_acq_rel, memory_order_acquire)) {
+                    if (claim != SHARED_INTERN_CLOSED) return;
+                    seen = SHARED_INTERN_CLOSED;
+                }
+            }
+            if (seen == SHARED_INTERN_CLOSED) break;
+        }
+    }
+}
+
+// Function to move array's ids to a new array twice its size. The thread
+// that publishes the new array copies every id; meanwhile lookups still find
+// the old ids in array, and new strings go to the new one. Closing each
+// empty slot before moving on keeps a string from being added to both.
+static inline void sharedInternGrow(SharedInternTable *table, SharedInternSlots *array) {
+    SharedInternSlots *expected = NULL;
+    SharedInternSlots *bigger = sharedInternSlotsNew(array->slotCount * 2);
+    if (!atomic_compare_exchange_strong_explicit(&array->next, &expected, bigger,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        free(bigger);
+        return;
+    }
+    for (uint32_t slot = 0; slot < array->slotCount; slot++) {
+        uint32_t seen = 0;
+        if (!atomic_compare_exchange_strong_explicit(&array->slots[slot], &seen, SHARED_INTERN_CLOSED,
+                                                     memory_order_acq_rel, memory_order_acquire) &&
+            seen != SHARED_INTERN_CLOSED) {
+            sharedInternPlace(table, bigger, seen - 1);
+        }
+    }
+    atomic_store_explicit(&array->moved, 1, memory_order_release);
+    // Later lookups can start past every array whose ids have all moved
+    SharedInternSlots *head = atomic_load_explicit(&table->slots, memory_order_acquire);
+    while (atomic_load_explicit(&head->moved, memory_order_acquire)) {
+        SharedInternSlots *next = atomic_load_explicit(&head->next, memory_order_acquire);
+        if (atomic_compare_exchange_strong_explicit(&table->slots, &head, next,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            head = next;
+        }
+    }
+}
+
+// Function to hand out a new id for text and fill in its entry
+static inline uint32_t sharedInternReserve(SharedInternTable *table, const char *text, uint32_t length,
+                                           uint32_t hash) {
+    uint32_t id = atomic_fetch_add_explicit(&table->count, 1, memory_order_relaxed);
+    if (id >= SHARED_INTERN_MAX_IDS) {
+        fprintf(stderr, "Error: Too many distinct strings (%u)\n", id);
+        exit(1);
+    }
+    InternEntry *entry = sharedInternEntry(table, id);
+    entry->text = sharedInternStore(table, text, length);
+    entry->length = length;
+    entry->hash = hash;
+    return id;
+}
+
+// Function to return the id of text, storing it on first sight. Safe to call
+// from any number of threads. The entry is filled in before its slot is
+// published, so a thread that sees the id also sees the text. When two
+// threads add the same new string at once, the loser's reserved id is simply
+// never handed out. A closed slot ends the string's run in one array, and
+// the search goes on in the next.
+static inline uint32_t sharedInternString(SharedInternTable *table, const char *text, uint32_t length) {
+    uint32_t hash = internHash(text, length);
+    uint32_t id = INTERN_NONE;
+    SharedInternSlots *array = atomic_load_explicit(&table->slots, memory_order_acquire);
+    for (;; array = atomic_load_explicit(&array->next, memory_order_acquire)) {
+        uint32_t mask = array->slotCount - 1;
+        for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+            uint32_t seen = atomic_load_explicit(&array->slots[slot], memory_order_acquire);
+            if (seen == 0) {
+                if (atomic_load_explicit(&array->next, memory_order_acquire) == NULL && array->slotCount < (1u << 31) &&
+                    atomic_load_explicit(&table->count, memory_order_relaxed) >= array->slotCount / 2) {
+                    sharedInternGrow(table, array);
+                }
+                uint32_t claim = SHARED_INTERN_CLOSED;
+                if (atomic_load_explicit(&array->next, memory_order_acquire) == NULL) {
+                    if (id == INTERN_NONE) id = sharedInternReserve(table, text, length, hash);
+                    claim = id + 1;
+                }
+                if (atomic_compare_exchange_strong_explicit(&array->slots[slot], &seen, claim,
+                                                            memory_order_acq_rel, memory_order_acquire)) {
+                    if (claim != SHARED_INTERN_CLOSED) return id;
+                    seen = SHARED_INTERN_CLOSED;
+                }
+            }
+            if (seen == SHARED_INTERN_CLOSED) break;
+            const InternEntry *entry = sharedInternEntry(table, seen - 1);
+            if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+                return seen - 1;
+            }
+        }
+    }
+}
+
+// Function to get the text of an id returned by sharedInternString()
+static inline const char *sharedInternText(const SharedInternTable *table, uint32_t id) {
+    uint32_t k = sharedInternChunkOf(id);
+    const InternEntry *entries = atomic_load_explicit(&table->chunks[k], memory_order_acquire);
+    return entries[id - sharedInternChunkStart(k)].text;
+}
+
+#endif
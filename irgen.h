@@ -0,0 +1,490 @@
+#ifndef IRGEN_H
+#define IRGEN_H
+
+// Lowering of the syntax tree to three-address code.
+//
+// irGenerate() lowers the top-level declarations and statements in order,
+// then the body of main(). Conditions are lowered as jumps (a comparison
+// becomes one conditional jump, && and || short-circuit), and each loop
+// gets a top label, a continue label and an exit label:
+//
+//   while (c) s        top: if !c goto exit; s; goto top; exit:
+//   do s while (c);    top: s; continue: if c goto top; exit:
+//   for (i; c; n) s    i; top: if !c goto exit; s; continue: n; goto top; exit:
+//
+// Every declaration gets a TAC variable named after it; a declaration that
+// shadows a visible one of the same name is renamed "name.N" so the two
+// never share storage. TAC has no calls, pointers or arrays, so anything
+// that needs them (other than printf of a string literal) is reported as
+// unsupported, with its location, and lowering carries on.
+//
+// Chains that lean left ("a + b + c", "a && b && c", "else if") can be far
+// longer than the parser's nesting limit, so they are lowered in loops that
+// keep their pending nodes or labels on gen->chain rather than by recursion.
+
+#include "symtab.h"
+#include "parser.h"
+#include "tac.h"
+
+typedef struct {
+    TacBuffer *code;
+    const AstArena *ast;
+    Parser *parser;          // Token text and locations for diagnostics
+    SymbolTable scopes;      // Declarations visible at the current point
+    uint32_t *operands;      // TAC variable of each symbol, by stack position
+    uint32_t operandCapacity;
+    uint32_t renameCount;
+    uint32_t breakLabel;     // Targets of break/continue/return, TAC_NONE outside
+    uint32_t continueLabel;
+    uint32_t returnLabel;
+    uint32_t *chain;         // Nodes or labels of the chains being lowered, innermost last
+    uint32_t chainCount;
+    uint32_t chainCapacity;
+    int errorCount;
+} IrGen;
+
+static inline void irInit(IrGen *gen, TacBuffer *code, const AstArena *ast, Parser *parser) {
+    memset(gen, 0, sizeof(*gen));
+    gen->code = code;
+    gen->ast = ast;
+    gen->parser = parser;
+    symtabInit(&gen->scopes);
+}
+
+static inline void irFree(IrGen *gen) {
+    symtabFree(&gen->scopes);
+    free(gen->operands);
+    free(gen->chain);
+    memset(gen, 0, sizeof(*gen));
+}
+
+static inline void irUnsupported(IrGen *gen, const char *what, uint32_t token) {
+    fprintf(gen->parser->out, "Error: %s is not supported in intermediate code (", what);
+    parserPrintLocation(gen->parser, token);
+    fprintf(gen->parser->out, ")\n");
+    gen->errorCount++;
+}
+
+static inline void irChainPush(IrGen *gen, uint32_t item) {
+    if (gen->chainCount == gen->chainCapacity) {
+        gen->chainCapacity = gen->chainCapacity ? gen->chainCapacity * 2 : 64;
+        gen->chain = internAlloc(gen->chain, (size_t)gen->chainCapacity * sizeof(uint32_t));
+    }
+    gen->chain[gen->chainCount++] = item;
+}
+
+static inline void irLabel(IrGen *gen, uint32_t label) {
+    tacEmit(gen->code, TAC_LABEL, label, TAC_NONE, TAC_NONE);
+}
+
+static inline void irGoto(IrGen *gen, uint32_t label) {
+    tacEmit(gen->code, TAC_GOTO, label, TAC_NONE, TAC_NONE);
+}
+
+// Function to declare a name in the current scope and return its variable
+static inline uint32_t irDeclare(IrGen *gen, uint32_t token) {
+    const char *name = parserTokenText(gen->parser, token);
+    uint32_t length = (uint32_t)strlen(name);
+    uint32_t operand;
+    if (symtabLookup(&gen->scopes, name, length) == NULL) {
+        operand = tacVar(gen->code, name, length);
+    } else {
+        char renamed[96];
+        int renamedLength = snprintf(renamed, sizeof(renamed), "%.80s.%u", name, ++gen->renameCount);
+        operand = tacVar(gen->code, renamed, (uint32_t)renamedLength);
+    }
+    const Symbol *symbol = symtabDeclare(&gen->scopes, name, length, "int");
+    if (symbol == NULL) return operand;  // Redeclared in the same scope; reported by sema
+    uint32_t slot = (uint32_t)(symbol - gen->scopes.symbols);
+    if (slot >= gen->operandCapacity) {
+        gen->operandCapacity = gen->operandCapacity ? gen->operandCapacity * 2 : 64;
+        while (slot >= gen->operandCapacity) gen->operandCapacity *= 2;
+        gen->operands = internAlloc(gen->operands, (size_t)gen->operandCapacity * sizeof(uint32_t));
+    }
+    gen->operands[slot] = operand;
+    return operand;
+}
+
+// Function to get the variable a name refers to; undeclared names (already
+// reported by sema) get a variable of their own name
+static inline uint32_t irLookup(IrGen *gen, uint32_t token) {
+    const char *name = parserTokenText(gen->parser, token);
+    uint32_t length = (uint32_t)strlen(name);
+    const Symbol *symbol = symtabLookup(&gen->scopes, name, length);
+    if (symbol == NULL) return tacVar(gen->code, name, length);
+    return gen->operands[symbol - gen->scopes.symbols];
+}
+
+static inline TacOp irBinaryOp(TokenKind kind) {
+    switch (kind) {
+        case TK_PLUS: return TAC_ADD;
+        case TK_MINUS: return TAC_SUB;
+        case TK_STAR: return TAC_MUL;
+        case TK_SLASH: return TAC_DIV;
+        case TK_LT: return TAC_LT;
+        case TK_LE: return TAC_LE;
+        case TK_GT: return TAC_GT;
+        case TK_GE: return TAC_GE;
+        case TK_EQ: return TAC_EQ;
+        case TK_NE: return TAC_NE;
+        default: return TAC_NOP;
+    }
+}
+
+// Function to get the comparison that is true exactly when op is false
+static inline TacOp irNegate(TacOp op) {
+    static const TacOp negated[TAC_OP_COUNT] = {
+        [TAC_LT] = TAC_GE, [TAC_LE] = TAC_GT, [TAC_GT] = TAC_LE,
+        [TAC_GE] = TAC_LT, [TAC_EQ] = TAC_NE, [TAC_NE] = TAC_EQ,
+    };
+    return negated[op];
+}
+
+static inline uint32_t irExpression(IrGen *gen, uint32_t index);
+
+// Function to jump to label when the condition's truth equals jumpIfTrue,
+// and fall through otherwise
+static inline void irBranch(IrGen *gen, uint32_t index, uint32_t label, int jumpIfTrue) {
+    const AstNode *nodes = gen->ast->nodes;
+    const AstNode *node = &nodes[index];
+    uint32_t left = node->firstChild;
+    if (node->kind == AST_BINARY && (node->op == TK_AND || node->op == TK_OR)) {
+        // The terms of "a && b && c" are the bottom left operand, then the
+        // right operands from the bottom up
+        uint32_t base = gen->chainCount, term = index;
+        while (nodes[term].kind == AST_BINARY && nodes[term].op == node->op) {
+            irChainPush(gen, term);
+            term = nodes[term].firstChild;
+        }
+        // "a && b" jumps on true only if both are; "a || b" jumps on false
+        // only if both are. Then every term but the last skips past the
+        // last one when it settles the answer the other way.
+        int both = (node->op == TK_AND) == jumpIfTrue;
+        uint32_t skip = both ? tacNewLabel(gen->code) : label;
+        while (gen->chainCount > base) {
+            irBranch(gen, term, skip, both ? !jumpIfTrue : jumpIfTrue);
+            uint32_t parent = gen->chain[--gen->chainCount];
+            term = nodes[nodes[parent].firstChild].nextSibling;
+        }
+        irBranch(gen, term, label, jumpIfTrue);
+        if (both) irLabel(gen, skip);
+        return;
+    }
+    if (node->kind == AST_UNARY && node->op == TK_NOT) {
+        irBranch(gen, left, label, !jumpIfTrue);
+        return;
+    }
+    TacOp op = node->kind == AST_BINARY ? irBinaryOp((TokenKind)node->op) : TAC_NOP;
+    if (op >= TAC_LT && op <= TAC_NE) {
+        uint32_t a = irExpression(gen, left);
+        uint32_t b = irExpression(gen, gen->ast->nodes[left].nextSibling);
+        tacEmitIf(gen->code, jumpIfTrue ? op : irNegate(op), a, b, label);
+        return;
+    }
+    uint32_t value = irExpression(gen, index);
+    tacEmitIf(gen->code, jumpIfTrue ? TAC_NE : TAC_EQ, value, tacImm(0), label);
+}
+
+// Function to get the variable an assignment or increment writes
+static inline uint32_t irTarget(IrGen *gen, uint32_t index) {
+    const AstNode *node = &gen->ast->nodes[index];
+    if (node->kind == AST_IDENTIFIER) return irLookup(gen, node->token);
+    irUnsupported(gen, node->kind == AST_INDEX ? "Array indexing" : node->kind == AST_MEMBER ? "Member access"
+                                                                                            : "Pointer access",
+                  node->token);
+    return tacNewTemp(gen->code);
+}
+
+// Function to lower "printf("...")", the only call TAC can express
+static inline void irCall(IrGen *gen, uint32_t index) {
+    const AstNode *nodes = gen->ast->nodes;
+    uint32_t callee = nodes[index].firstChild;
+    uint32_t argument = nodes[callee].nextSibling;
+    if (nodes[callee].kind != AST_IDENTIFIER || strcmp(parserTokenText(gen->parser, nodes[callee].token), "printf") != 0) {
+        irUnsupported(gen, "Function call", nodes[index].token);
+        return;
+    }
+    if (argument == 0 || nodes[argument].kind != AST_STRING || nodes[argument].nextSibling != 0) {
+        irUnsupported(gen, "printf with arguments other than one string literal", nodes[index].token);
+        return;
+    }
+    const char *text = parserTokenText(gen->parser, nodes[argument].token);
+    uint32_t length = (uint32_t)strlen(text);
+    if (length >= 2) {
+        text++;
+        length -= 2;  // Strip the quotes
+    }
+    tacEmit(gen->code, TAC_PRINT, TAC_NONE, tacConst(gen->code, text, length), TAC_NONE);
+}
+
+// Function to lower an expression and return the operand holding its value
+static inline uint32_t irExpression(IrGen *gen, uint32_t index) {
+    const AstNode *node = &gen->ast->nodes[index];
+    uint32_t left = node->firstChild;
+    uint32_t right = left != 0 ? gen->ast->nodes[left].nextSibling : 0;
+    TacBuffer *code = gen->code;
+    switch (node->kind) {
+        case AST_NUMBER: {
+            const char *text = parserTokenText(gen->parser, node->token);
+            return tacConst(code, text, (uint32_t)strlen(text));
+        }
+        case AST_IDENTIFIER:
+            return irLookup(gen, node->token);
+        case AST_ASSIGN: {
+            uint32_t target = irTarget(gen, left);
+            uint32_t value = irExpression(gen, right);
+            if (node->op != TK_ASSIGN) {
+                static const TacOp compound[TK_COUNT] = {
+                    [TK_PLUS_ASSIGN] = TAC_ADD, [TK_MINUS_ASSIGN] = TAC_SUB,
+                    [TK_STAR_ASSIGN] = TAC_MUL, [TK_SLASH_ASSIGN] = TAC_DIV,
+                };
+                uint32_t temp = tacNewTemp(code);
+                tacEmit(code, compound[node->op], temp, target, value);
+                value = temp;
+            }
+            tacEmit(code, TAC_COPY, target, value, TAC_NONE);
+            return target;
+        }
+        case AST_BINARY: {
+            TacOp op = irBinaryOp((TokenKind)node->op);
+            if (op == TAC_NOP && node->op != TK_AND && node->op != TK_OR) {
+                irUnsupported(gen, "Bitwise operator", node->token);
+                return tacImm(0);
+            }
+            if (op != TAC_NOP) {
+                // Lower the left operands of "a + b + c" from the bottom up
+                const AstNode *nodes = gen->ast->nodes;
+                uint32_t base = gen->chainCount, bottom = index;
+                while (nodes[bottom].kind == AST_BINARY && irBinaryOp((TokenKind)nodes[bottom].op) != TAC_NOP) {
+                    irChainPush(gen, bottom);
+                    bottom = nodes[bottom].firstChild;
+                }
+                uint32_t value = irExpression(gen, bottom);
+                while (gen->chainCount > base) {
+                    uint32_t parent = gen->chain[--gen->chainCount];
+                    uint32_t b = irExpression(gen, nodes[nodes[parent].firstChild].nextSibling);
+                    uint32_t temp = tacNewTemp(code);
+                    tacEmit(code, irBinaryOp((TokenKind)nodes[parent].op), temp, value, b);
+                    value = temp;
+                }
+                return value;
+            }
+            // && and || as values: 0, then 1 unless the condition jumps past it
+            uint32_t temp = tacNewTemp(code);
+            uint32_t done = tacNewLabel(code);
+            tacEmit(code, TAC_COPY, temp, tacImm(0), TAC_NONE);
+            irBranch(gen, index, done, 0);
+            tacEmit(code, TAC_COPY, temp, tacImm(1), TAC_NONE);
+            irLabel(gen, done);
+            return temp;
+        }
+        case AST_UNARY: {
+            if (node->op == TK_AMP || node->op == TK_STAR) {
+                irUnsupported(gen, node->op == TK_AMP ? "Address-of" : "Pointer access", node->token);
+                return tacImm(0);
+            }
+            uint32_t value = irExpression(gen, left);
+            if (node->op == TK_PLUS) return value;
+            uint32_t temp = tacNewTemp(code);
+            tacEmit(code, node->op == TK_MINUS ? TAC_NEG : TAC_NOT, temp, value, TAC_NONE);
+            return temp;
+        }
+        case AST_PREFIX:
+        case AST_POSTFIX: {
+            uint32_t target = irTarget(gen, left);
+            uint32_t old = target;
+            if (node->kind == AST_POSTFIX) {
+                old = tacNewTemp(code);
+                tacEmit(code, TAC_COPY, old, target, TAC_NONE);
+            }
+            uint32_t temp = tacNewTemp(code);
+            tacEmit(code, node->op == TK_PLUS ? TAC_ADD : TAC_SUB, temp, target, tacImm(1));
+            tacEmit(code, TAC_COPY, target, temp, TAC_NONE);
+            return old;
+        }
+        case AST_TERNARY: {
+            uint32_t otherwise = tacNewLabel(code), done = tacNewLabel(code);
+            uint32_t temp = tacNewTemp(code);
+            irBranch(gen, left, otherwise, 0);
+            tacEmit(code, TAC_COPY, temp, irExpression(gen, right), TAC_NONE);
+            irGoto(gen, done);
+            irLabel(gen, otherwise);
+            tacEmit(code, TAC_COPY, temp, irExpression(gen, gen->ast->nodes[right].nextSibling), TAC_NONE);
+            irLabel(gen, done);
+            return temp;
+        }
+        case AST_CALL:
+            irCall(gen, index);
+            return tacImm(0);
+        case AST_STRING:
+            irUnsupported(gen, "String value", node->token);
+            return tacImm(0);
+        default:
+            irUnsupported(gen, astKindNames[node->kind], node->token);
+            return tacImm(0);
+    }
+}
+
+static inline void irStatement(IrGen *gen, uint32_t index);
+
+static inline void irChildren(IrGen *gen, uint32_t index) {
+    for (uint32_t child = gen->ast->nodes[index].firstChild; child != 0; child = gen->ast->nodes[child].nextSibling) {
+        irStatement(gen, child);
+    }
+}
+
+// Function to lower a loop body with break and continue bound to its labels
+static inline void irLoopBody(IrGen *gen, uint32_t body, uint32_t exitLabel, uint32_t continueLabel) {
+    uint32_t outerBreak = gen->breakLabel, outerContinue = gen->continueLabel;
+    gen->breakLabel = exitLabel;
+    gen->continueLabel = continueLabel;
+    irStatement(gen, body);
+    gen->breakLabel = outerBreak;
+    gen->continueLabel = outerContinue;
+}
+
+static inline void irStatement(IrGen *gen, uint32_t index) {
+    const AstNode *nodes = gen->ast->nodes;
+    const AstNode *node = &nodes[index];
+    uint32_t first = node->firstChild;
+    uint32_t second = first != 0 ? nodes[first].nextSibling : 0;
+    TacBuffer *code = gen->code;
+    switch (node->kind) {
+        case AST_DECLARATION:
+            for (uint32_t declarator = first; declarator != 0; declarator = nodes[declarator].nextSibling) {
+                if (nodes[declarator].flags & AST_FLAG_ARRAY) {
+                    irUnsupported(gen, "Array", nodes[declarator].token);
+                    continue;
+                }
+                // As in C, the name is in scope in its own initializer
+                uint32_t variable = irDeclare(gen, nodes[declarator].token);
+                uint32_t value = nodes[declarator].firstChild ? irExpression(gen, nodes[declarator].firstChild) : tacImm(0);
+                tacEmit(code, TAC_COPY, variable, value, TAC_NONE);
+            }
+            break;
+        case AST_BLOCK:
+            symtabEnterScope(&gen->scopes);
+            irChildren(gen, index);
+            symtabExitScope(&gen->scopes);
+            break;
+        case AST_EXPRESSION:
+            irExpression(gen, first);
+            break;
+        case AST_IF: {
+            // Each if of an "else if" chain ends at its own done label; they
+            // all come after the last branch, innermost first
+            uint32_t base = gen->chainCount;
+            for (;;) {
+                uint32_t otherwise = tacNewLabel(code);
+                uint32_t elseBranch = nodes[second].nextSibling;
+                irBranch(gen, first, otherwise, 0);
+                irStatement(gen, second);
+                if (elseBranch == 0) {
+                    irLabel(gen, otherwise);
+                    break;
+                }
+                uint32_t done = tacNewLabel(code);
+                irGoto(gen, done);
+                irLabel(gen, otherwise);
+                irChainPush(gen, done);
+                if (nodes[elseBranch].kind != AST_IF) {
+                    irStatement(gen, elseBranch);
+                    break;
+                }
+                first = nodes[elseBranch].firstChild;
+                second = nodes[first].nextSibling;
+            }
+            while (gen->chainCount > base) irLabel(gen, gen->chain[--gen->chainCount]);
+            break;
+        }
+        case AST_WHILE: {
+            uint32_t top = tacNewLabel(code), exit = tacNewLabel(code);
+            irLabel(gen, top);
+            irBranch(gen, first, exit, 0);
+            irLoopBody(gen, second, exit, top);
+            irGoto(gen, top);
+            irLabel(gen, exit);
+            break;
+        }
+        case AST_DO_WHILE: {
+            uint32_t top = tacNewLabel(code), next = tacNewLabel(code), exit = tacNewLabel(code);
+            irLabel(gen, top);
+            irLoopBody(gen, first, exit, next);
+            irLabel(gen, next);
+            irBranch(gen, second, top, 1);
+            irLabel(gen, exit);
+            break;
+        }
+        case AST_FOR: {
+            uint32_t step = nodes[second].nextSibling;
+            uint32_t body = nodes[step].nextSibling;
+            uint32_t top = tacNewLabel(code), next = tacNewLabel(code), exit = tacNewLabel(code);
+            symtabEnterScope(&gen->scopes);
+            if (nodes[first].kind == AST_DECLARATION || nodes[first].kind == AST_EMPTY) irStatement(gen, first);
+            else irExpression(gen, first);
+            irLabel(gen, top);
+            if (nodes[second].kind != AST_EMPTY) irBranch(gen, second, exit, 0);
+            irLoopBody(gen, body, exit, next);
+            irLabel(gen, next);
+            if (nodes[step].kind != AST_EMPTY) irExpression(gen, step);
+            irGoto(gen, top);
+            irLabel(gen, exit);
+            symtabExitScope(&gen->scopes);
+            break;
+        }
+        case AST_BREAK:
+        case AST_CONTINUE: {
+            uint32_t label = node->kind == AST_BREAK ? gen->breakLabel : gen->continueLabel;
+            if (label == TAC_NONE) irUnsupported(gen, node->kind == AST_BREAK ? "'break' outside a loop" : "'continue' outside a loop", node->token);
+            else irGoto(gen, label);
+            break;
+        }
+        case AST_RETURN:
+            if (gen->returnLabel == TAC_NONE) {
+                irUnsupported(gen, "'return' outside main", node->token);
+                break;
+            }
+            if (first != 0) irExpression(gen, first);
+            irGoto(gen, gen->returnLabel);
+            break;
+        case AST_EMPTY:
+            break;
+        default:
+            // Expressions used as statements arrive wrapped; anything left is
+            // a construct TAC has no form for (switch, case, nested functions)
+            irUnsupported(gen, astKindNames[node->kind], node->token);
+            break;
+    }
+}
+
+// Function to lower a whole program: top-level items in order, then main().
+// Returns 1 if every construct could be lowered.
+static inline int irGenerate(IrGen *gen, uint32_t program) {
+    const AstNode *nodes = gen->ast->nodes;
+    uint32_t mainFunction = 0;
+    for (uint32_t item = nodes[program].firstChild; item != 0; item = nodes[item].nextSibling) {
+        if (nodes[item].kind != AST_FUNCTION) {
+            irStatement(gen, item);
+        } else if (strcmp(parserTokenText(gen->parser, nodes[item].token), "main") == 0) {
+            mainFunction = item;
+        } else {
+            fprintf(gen->parser->out, "Warning: function '%s' is not lowered; only main() is (", parserTokenText(gen->parser, nodes[item].token));
+            parserPrintLocation(gen->parser, nodes[item].token);
+            fprintf(gen->parser->out, ")\n");
+        }
+    }
+    if (mainFunction != 0) {
+        gen->returnLabel = tacNewLabel(gen->code);
+        symtabEnterScope(&gen->scopes);
+        for (uint32_t child = nodes[mainFunction].firstChild; child != 0; child = nodes[child].nextSibling) {
+            if (nodes[child].kind == AST_PARAM) tacEmit(gen->code, TAC_COPY, irDeclare(gen, nodes[child].token), tacImm(0), TAC_NONE);
+            else irStatement(gen, child);
+        }
+        symtabExitScope(&gen->scopes);
+        irLabel(gen, gen->returnLabel);
+        gen->returnLabel = TAC_NONE;
+    }
+    return gen->errorCount == 0;
+}
+
+#endif
@@ -0,0 +1,531 @@
+#ifndef JIT_H
+#define JIT_H
+
+// In-memory x86-64 JIT: encodes a TAC buffer straight into machine code and
+// calls it, with no assembler, linker or child process involved.
+//
+// Registers are assigned as in the assembly backend (x86.h): the linear-scan
+// allocator in regalloc.h places variables in the same ten registers or in
+// 4-byte stack slots, and %eax, %ecx, %edx and %r11 are scratch. Quads are
+// encoded in order into a growable buffer. A jump leaves its rel32 field
+// zero and records a fix-up, patched once every label's offset is known.
+// The finished code is copied into fresh pages mapped writable, which are
+// then switched to read-and-execute before the first call; no page is ever
+// writable and executable at once.
+//
+// The generated function is
+//     uint32_t run(int32_t *values, FILE *out)
+// It stores the final value of every named variable into values (indexed by
+// name id) and returns JIT_NO_FAULT, or the VM instruction number of a
+// division by zero. Results match vm.h: arithmetic wraps, x / -1 and x % -1
+// do not trap, and printf quads call jitPrint(), the runtime routine that
+// writes the string (its escapes decoded beforehand, as the VM does).
+//
+// Frame layout after the prologue (%rsp is 16-byte aligned):
+//   -8(%rbp) .. -40(%rbp)   saved %rbx, %r12 .. %r15
+//   -48(%rbp)               values
+//   -56(%rbp)               out
+//   -60(%rbp) downwards     spill slots, then save slots for calls
+//
+// Off x86-64, or without mmap, jitCompile() fails and callers fall back to
+// the VM.
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#include <time.h>
+#include "x86.h"
+#include "vm.h"
+
+#define JIT_NO_FAULT 0xFFFFFFFFu
+#define JIT_IMUL -1             // jitAlu() extension for imul, which has no /digit form
+
+// Hardware numbers of the allocatable registers, in x86Regs32 order
+static const uint8_t jitRegs[X86_REG_COUNT] = {3, 12, 13, 14, 15, 6, 7, 8, 9, 10};
+
+enum { JIT_RAX = 0, JIT_RCX = 1, JIT_RDX = 2, JIT_RBP = 5, JIT_RSI = 6, JIT_RDI = 7, JIT_R11 = 11 };
+
+// Condition codes: the low nibble of jcc and setcc
+static const uint8_t jitConditions[TAC_OP_COUNT] = {
+    [TAC_LT] = 0xC, [TAC_LE] = 0xE, [TAC_GT] = 0xF,
+    [TAC_GE] = 0xD, [TAC_EQ] = 0x4, [TAC_NE] = 0x5,
+};
+
+typedef enum { JIT_REG, JIT_MEM, JIT_IMM } JitKind;
+
+typedef struct {
+    JitKind kind;
+    uint8_t reg;         // Register, or base register of a memory operand
+    int32_t value;       // Displacement or immediate
+} JitOperand;
+
+typedef struct {
+    uint32_t at;         // Offset of the rel32 field
+    uint32_t label;
+} JitFixup;
+
+typedef uint32_t (*JitFunction)(int32_t *values, FILE *out);
+
+typedef struct {
+    uint8_t *code;       // Executable mapping
+    size_t mapped;       // Bytes mapped
+    uint32_t size;       // Bytes of machine code
+    JitFunction entry;
+    char *strings;       // Printed strings with their escapes decoded
+    uint8_t *isNamed;    // Per name id: a program variable, not a literal
+    uint32_t nameCount;
+} JitProgram;
+
+typedef struct {
+    const TacBuffer *code;
+    RegAlloc ra;
+    uint8_t *bytes;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *labelAt;   // Offset of each label; one more for the fault exit
+    JitFixup *fixups;
+    uint32_t fixupCount;
+    uint32_t fixupCapacity;
+    uint32_t saveSlot;   // First of the slots used to save registers around calls
+} JitCompiler;
+
+// Runtime routine behind printf quads
+static inline void jitPrint(FILE *out, const char *text) {
+    if (out != NULL) fputs(text, out);
+}
+
+static inline void jitByte(JitCompiler *jit, uint32_t byte) {
+    if (jit->count == jit->capacity) {
+        jit->capacity = jit->capacity ? jit->capacity * 2 : 4096;
+        jit->bytes = internAlloc(jit->bytes, jit->capacity);
+    }
+    jit->bytes[jit->count++] = (uint8_t)byte;
+}
+
+static inline void jitInt32(JitCompiler *jit, uint32_t value) {
+    for (int k = 0; k < 4; k++) jitByte(jit, value >> (8 * k));
+}
+
+static inline void jitInt64(JitCompiler *jit, uint64_t value) {
+    jitInt32(jit, (uint32_t)value);
+    jitInt32(jit, (uint32_t)(value >> 32));
+}
+
+static inline JitOperand jitReg(uint8_t reg) {
+    return (JitOperand){JIT_REG, reg, 0};
+}
+
+static inline JitOperand jitMem(uint8_t base, int32_t displacement) {
+    return (JitOperand){JIT_MEM, base, displacement};
+}
+
+static inline int jitSame(JitOperand a, JitOperand b) {
+    return a.kind == b.kind && a.reg == b.reg && a.value == b.value;
+}
+
+static inline int jitIsByte(int32_t value) {
+    return value >= -128 && value <= 127;
+}
+
+// Function to emit an instruction whose opcode (one byte, or two when above
+// 0xFF) is followed by a ModRM byte: reg goes in the reg field (a register
+// or an opcode extension), rm is a register or [base + displacement], and
+// wide selects 64-bit operands. The only bases used are %rbp and %r11,
+// which never need a SIB byte.
+static inline void jitModRm(JitCompiler *jit, int wide, uint32_t opcode, int reg, JitOperand rm) {
+    uint32_t rex = (wide ? 8u : 0u) | (reg >= 8 ? 4u : 0u) | (rm.reg >= 8 ? 1u : 0u);
+    if (rex != 0) jitByte(jit, 0x40 | rex);
+    if (opcode > 0xFF) jitByte(jit, opcode >> 8);
+    jitByte(jit, opcode);
+    uint32_t fields = (uint32_t)(reg & 7) << 3 | (rm.reg & 7u);
+    if (rm.kind == JIT_REG) {
+        jitByte(jit, 0xC0 | fields);
+    } else if (jitIsByte(rm.value)) {
+        jitByte(jit, 0x40 | fields);
+        jitByte(jit, (uint32_t)rm.value);
+    } else {
+        jitByte(jit, 0x80 | fields);
+        jitInt32(jit, (uint32_t)rm.value);
+    }
+}
+
+static inline void jitPush(JitCompiler *jit, uint8_t reg) {
+    if (reg >= 8) jitByte(jit, 0x41);
+    jitByte(jit, 0x50 | (reg & 7u));
+}
+
+static inline void jitPop(JitCompiler *jit, uint8_t reg) {
+    if (reg >= 8) jitByte(jit, 0x41);
+    jitByte(jit, 0x58 | (reg & 7u));
+}
+
+// Function to load a 64-bit constant (an address) into a register
+static inline void jitMoveAddress(JitCompiler *jit, uint8_t reg, uint64_t address) {
+    jitByte(jit, reg >= 8 ? 0x49 : 0x48);
+    jitByte(jit, 0xB8 | (reg & 7u));
+    jitInt64(jit, address);
+}
+
+// Function to copy src to dst, going through %eax when both are in memory
+static inline void jitMove(JitCompiler *jit, JitOperand dst, JitOperand src) {
+    if (jitSame(dst, src)) return;
+    if (src.kind == JIT_IMM) {
+        if (dst.kind == JIT_REG) {
+            if (dst.reg >= 8) jitByte(jit, 0x41);
+            jitByte(jit, 0xB8 | (dst.reg & 7u));
+        } else {
+            jitModRm(jit, 0, 0xC7, 0, dst);
+        }
+        jitInt32(jit, (uint32_t)src.value);
+    } else if (dst.kind == JIT_MEM && src.kind == JIT_MEM) {
+        jitMove(jit, jitReg(JIT_RAX), src);
+        jitMove(jit, dst, jitReg(JIT_RAX));
+    } else if (dst.kind == JIT_REG) {
+        jitModRm(jit, 0, 0x8B, dst.reg, src);
+    } else {
+        jitModRm(jit, 0, 0x89, src.reg, dst);
+    }
+}
+
+// Function to emit target = target op src for add (/0), sub (/5), cmp (/7)
+// or JIT_IMUL, using the short immediate forms where the value fits a byte
+static inline void jitAlu(JitCompiler *jit, int extension, uint8_t target, JitOperand src) {
+    if (src.kind != JIT_IMM) {
+        if (extension == JIT_IMUL) jitModRm(jit, 0, 0x0FAF, target, src);
+        else jitModRm(jit, 0, 0x03 + 8u * (uint32_t)extension, target, src);
+        return;
+    }
+    int small = jitIsByte(src.value);
+    if (extension == JIT_IMUL) jitModRm(jit, 0, small ? 0x6B : 0x69, target, jitReg(target));
+    else jitModRm(jit, 0, small ? 0x83 : 0x81, extension, jitReg(target));
+    if (small) jitByte(jit, (uint32_t)src.value);
+    else jitInt32(jit, (uint32_t)src.value);
+}
+
+// Function to emit a jump to a label (cond < 0: unconditional), leaving the
+// displacement for jitFixups()
+static inline void jitJump(JitCompiler *jit, int cond, uint32_t label) {
+    if (cond < 0) {
+        jitByte(jit, 0xE9);
+    } else {
+        jitByte(jit, 0x0F);
+        jitByte(jit, 0x80 | (uint32_t)cond);
+    }
+    if (jit->fixupCount == jit->fixupCapacity) {
+        jit->fixupCapacity = jit->fixupCapacity ? jit->fixupCapacity * 2 : 256;
+        jit->fixups = internAlloc(jit->fixups, (size_t)jit->fixupCapacity * sizeof(JitFixup));
+    }
+    jit->fixups[jit->fixupCount++] = (JitFixup){jit->count, label};
+    jitInt32(jit, 0);
+}
+
+// Function to emit a short forward jump within one quad's code; returns
+// where its displacement goes, for jitLand()
+static inline uint32_t jitSkip(JitCompiler *jit, int cond) {
+    jitByte(jit, cond < 0 ? 0xEB : 0x70 | (uint32_t)cond);
+    jitByte(jit, 0);
+    return jit->count - 1;
+}
+
+static inline void jitLand(JitCompiler *jit, uint32_t at) {
+    jit->bytes[at] = (uint8_t)(jit->count - at - 1);
+}
+
+// Function to get where an operand's value is: register, stack slot or immediate
+static inline JitOperand jitLocation(JitCompiler *jit, uint32_t operand) {
+    uint32_t var = tacVarIndex(jit->code, operand);
+    if (var != RA_NONE) {
+        if (jit->ra.reg[var] != RA_SPILLED) return jitReg(jitRegs[jit->ra.reg[var]]);
+        return jitMem(JIT_RBP, -(int32_t)(60 + 4 * jit->ra.slot[var]));
+    }
+    if (TAC_TAG(operand) != TAC_CONST) return (JitOperand){JIT_IMM, 0, tacImmValue(operand)};
+    // Non-integer literals run as their integer part, as in the VM
+    double value = strtod(internText(&jit->code->names, TAC_VALUE(operand)), NULL);
+    int32_t truncated = value >= 2147483647.0 ? 2147483647 : value <= -2147483648.0 ? (-2147483647 - 1) : (int32_t)value;
+    return (JitOperand){JIT_IMM, 0, truncated};
+}
+
+// Function to save (or restore) the caller-saved registers that hold values
+// live at position i, around a call
+static inline void jitSaveCallerRegs(JitCompiler *jit, uint32_t i, int restore) {
+    for (uint32_t var = 0; var < jit->ra.varCount; var++) {
+        int reg = jit->ra.reg[var];
+        if (reg < X86_CALLEE_SAVED || jit->ra.start[var] > i || jit->ra.end[var] < i) continue;
+        JitOperand slot = jitMem(JIT_RBP, -(int32_t)(60 + 4 * (jit->saveSlot + (uint32_t)(reg - X86_CALLEE_SAVED))));
+        if (restore) jitMove(jit, jitReg(jitRegs[reg]), slot);
+        else jitMove(jit, slot, jitReg(jitRegs[reg]));
+    }
+}
+
+// Function to encode quad i; vmIndex is its instruction number in the VM,
+// reported on division by zero, and text the string it prints
+static inline void jitEmitQuad(JitCompiler *jit, uint32_t i, uint32_t vmIndex, const char *text) {
+    const TacQuad *quad = &jit->code->code[i];
+    TacOp op = (TacOp)quad->op;
+    JitOperand dst = {JIT_IMM, 0, 0}, a = dst, b = dst;
+    JitOperand eax = jitReg(JIT_RAX), ecx = jitReg(JIT_RCX), edx = jitReg(JIT_RDX);
+    static const int extensions[TAC_OP_COUNT] = {[TAC_ADD] = 0, [TAC_SUB] = 5, [TAC_MUL] = JIT_IMUL};
+    if (tacDefines(op)) dst = jitLocation(jit, quad->result);
+    if (op != TAC_LABEL && op != TAC_GOTO && op != TAC_PRINT && quad->arg1 != TAC_NONE) a = jitLocation(jit, quad->arg1);
+    if (quad->arg2 != TAC_NONE) b = jitLocation(jit, quad->arg2);
+
+    switch (op) {
+        case TAC_NOP:
+            break;
+        case TAC_COPY:
+            jitMove(jit, dst, a);
+            break;
+        case TAC_ADD: case TAC_SUB: case TAC_MUL: {
+            // Work in the destination register unless it also holds arg2
+            uint8_t target = dst.kind == JIT_REG && !jitSame(dst, b) ? dst.reg : JIT_RAX;
+            jitMove(jit, jitReg(target), a);
+            jitAlu(jit, extensions[op], target, b);
+            jitMove(jit, dst, jitReg(target));
+            break;
+        }
+        case TAC_DIV: case TAC_MOD: {
+            jitMove(jit, eax, a);
+            jitMove(jit, ecx, b);
+            uint32_t notZero = 0, notMinusOne = 0, done = 0;
+            if (b.kind != JIT_IMM || b.value == 0) {
+                if (b.kind != JIT_IMM) {
+                    jitModRm(jit, 0, 0x85, JIT_RCX, ecx);          // test %ecx, %ecx
+                    notZero = jitSkip(jit, jitConditions[TAC_NE]);
+                }
+                jitMove(jit, eax, (JitOperand){JIT_IMM, 0, (int32_t)vmIndex});
+                jitJump(jit, -1, jit->code->labelCount);
+                if (b.kind == JIT_IMM) break;
+                jitLand(jit, notZero);
+            }
+            // idiv traps on INT_MIN / -1; x / -1 is -x and x % -1 is 0
+            if (b.kind != JIT_IMM || b.value == -1) {
+                if (b.kind != JIT_IMM) {
+                    jitAlu(jit, 7, JIT_RCX, (JitOperand){JIT_IMM, 0, -1});
+                    notMinusOne = jitSkip(jit, jitConditions[TAC_NE]);
+                }
+                jitModRm(jit, 0, 0xF7, 3, eax);                     // neg %eax
+                jitModRm(jit, 0, 0x31, JIT_RDX, edx);               // xor %edx, %edx
+                if (b.kind != JIT_IMM) {
+                    done = jitSkip(jit, -1);
+                    jitLand(jit, notMinusOne);
+                }
+            }
+            if (b.kind != JIT_IMM || b.value != -1) {
+                jitByte(jit, 0x99);                                 // cltd
+                jitModRm(jit, 0, 0xF7, 7, ecx);                     // idiv %ecx
+                if (b.kind != JIT_IMM) jitLand(jit, done);
+            }
+            jitMove(jit, dst, op == TAC_DIV ? eax : edx);
+            break;
+        }
+        case TAC_LT: case TAC_LE: case TAC_GT: case TAC_GE: case TAC_EQ: case TAC_NE:
+            jitMove(jit, ecx, a);
+            jitModRm(jit, 0, 0x31, JIT_RAX, eax);                   // xor %eax, %eax
+            jitAlu(jit, 7, JIT_RCX, b);
+            jitModRm(jit, 0, 0x0F90 | jitConditions[op], 0, eax);   // setcc %al
+            jitMove(jit, dst, eax);
+            break;
+        case TAC_NEG:
+            jitMove(jit, eax, a);
+            jitModRm(jit, 0, 0xF7, 3, eax);
+            jitMove(jit, dst, eax);
+            break;
+        case TAC_NOT:
+            jitMove(jit, ecx, a);
+            jitModRm(jit, 0, 0x31, JIT_RAX, eax);
+            jitModRm(jit, 0, 0x85, JIT_RCX, ecx);
+            jitModRm(jit, 0, 0x0F90 | jitConditions[TAC_EQ], 0, eax);
+            jitMove(jit, dst, eax);
+            break;
+        case TAC_LABEL:
+            jit->labelAt[TAC_VALUE(quad->result)] = jit->count;
+            break;
+        case TAC_GOTO:
+            jitJump(jit, -1, TAC_VALUE(quad->result));
+            break;
+        case TAC_IF:
+            // cmp needs its first operand in a register
+            if (a.kind != JIT_REG) {
+                jitMove(jit, eax, a);
+                a = eax;
+            }
+            jitAlu(jit, 7, a.reg, b);
+            jitJump(jit, jitConditions[quad->cond], TAC_VALUE(quad->result));
+            break;
+        case TAC_PRINT:
+            jitSaveCallerRegs(jit, i, 0);
+            jitModRm(jit, 1, 0x8B, JIT_RDI, jitMem(JIT_RBP, -56));
+            jitMoveAddress(jit, JIT_RSI, (uint64_t)(uintptr_t)text);
+            jitMoveAddress(jit, JIT_RAX, (uint64_t)(uintptr_t)jitPrint);
+            jitModRm(jit, 0, 0xFF, 2, eax);                         // call *%rax
+            jitSaveCallerRegs(jit, i, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+static inline void jitFree(JitProgram *program) {
+#if JIT_SUPPORTED
+    if (program->code != NULL) munmap(program->code, program->mapped);
+#endif
+    free(program->strings);
+    free(program->isNamed);
+    memset(program, 0, sizeof(*program));
+}
+
+// Function to compile the code into program. Returns 1 on success, or 0 if
+// this platform has no JIT or the executable pages could not be mapped.
+static inline int jitCompile(JitProgram *program, const TacBuffer *code) {
+    memset(program, 0, sizeof(*program));
+#if !JIT_SUPPORTED
+    (void)code;
+    return 0;
+#else
+    JitCompiler jit;
+    memset(&jit, 0, sizeof(jit));
+    jit.code = code;
+
+    Cfg cfg;
+    cfgBuild(&cfg, code);
+    raLiveness(&jit.ra, code, &cfg);
+    raLinearScan(&jit.ra, code->count, X86_REG_COUNT);
+    cfgFree(&cfg);
+    jit.saveSlot = jit.ra.slotCount;
+    uint32_t frameSize = (((16 + (jit.saveSlot + X86_REG_COUNT - X86_CALLEE_SAVED) * 4) + 15) & ~15u) + 8;
+    jit.labelAt = internAlloc(NULL, ((size_t)code->labelCount + 1) * sizeof(uint32_t));
+
+    // Decode the printed strings first so the buffer no longer moves when
+    // their addresses are built into the code
+    uint32_t printCount = 0, stringCapacity = 0, stringUsed = 0;
+    for (uint32_t i = 0; i < code->count; i++) printCount += code->code[i].op == TAC_PRINT;
+    uint32_t *stringStart = internAlloc(NULL, ((size_t)printCount + 1) * sizeof(uint32_t));
+    printCount = 0;
+    for (uint32_t i = 0; i < code->count; i++) {
+        if (code->code[i].op != TAC_PRINT) continue;
+        const char *text = internText(&code->names, TAC_VALUE(code->code[i].arg1));
+        stringStart[printCount++] = vmAddString(&program->strings, &stringCapacity, &stringUsed, text);
+    }
+
+    // Prologue: save the callee-saved registers and both arguments
+    jitPush(&jit, JIT_RBP);
+    jitModRm(&jit, 1, 0x89, 4, jitReg(JIT_RBP));                    // mov %rsp, %rbp
+    static const uint8_t saved[X86_CALLEE_SAVED] = {3, 12, 13, 14, 15};
+    for (int k = 0; k < X86_CALLEE_SAVED; k++) jitPush(&jit, saved[k]);
+    jitModRm(&jit, 1, 0x81, 5, jitReg(4));                          // sub $frameSize, %rsp
+    jitInt32(&jit, frameSize);
+    jitModRm(&jit, 1, 0x89, JIT_RDI, jitMem(JIT_RBP, -48));
+    jitModRm(&jit, 1, 0x89, JIT_RSI, jitMem(JIT_RBP, -56));
+
+    // Variables read before any assignment start out as 0
+    for (uint32_t var = 0; var < jit.ra.varCount; var++) {
+        if (jit.ra.liveAtEntry[var]) jitMove(&jit, jitLocation(&jit, tacVarOperand(code, var)), (JitOperand){JIT_IMM, 0, 0});
+    }
+
+    uint32_t vmIndex = 0;
+    printCount = 0;
+    for (uint32_t i = 0; i < code->count; i++) {
+        TacOp op = (TacOp)code->code[i].op;
+        const char *text = op == TAC_PRINT ? program->strings + stringStart[printCount++] : NULL;
+        jitEmitQuad(&jit, i, vmIndex, text);
+        if (op != TAC_NOP && op != TAC_LABEL) vmIndex++;
+    }
+
+    // Store the named variables through values and return JIT_NO_FAULT; a
+    // division by zero arrives at the fault exit with its number in %eax
+    jitModRm(&jit, 1, 0x8B, JIT_R11, jitMem(JIT_RBP, -48));
+    for (uint32_t var = 0; var < code->names.count; var++) {
+        if (!jit.ra.isNamed[var] || jit.ra.start[var] == RA_NONE) continue;
+        JitOperand value = jitLocation(&jit, tacVarOperand(code, var));
+        if (value.kind != JIT_REG) {
+            jitMove(&jit, jitReg(JIT_RAX), value);
+            value = jitReg(JIT_RAX);
+        }
+        jitModRm(&jit, 0, 0x89, value.reg, jitMem(JIT_R11, (int32_t)(4 * var)));
+    }
+    jitMove(&jit, jitReg(JIT_RAX), (JitOperand){JIT_IMM, 0, (int32_t)JIT_NO_FAULT});
+    jit.labelAt[code->labelCount] = jit.count;
+    jitModRm(&jit, 1, 0x8D, 4, jitMem(JIT_RBP, -40));               // lea -40(%rbp), %rsp
+    for (int k = X86_CALLEE_SAVED - 1; k >= 0; k--) jitPop(&jit, saved[k]);
+    jitPop(&jit, JIT_RBP);
+    jitByte(&jit, 0xC3);
+
+    for (uint32_t f = 0; f < jit.fixupCount; f++) {
+        uint32_t at = jit.fixups[f].at;
+        uint32_t displacement = jit.labelAt[jit.fixups[f].label] - (at + 4);
+        memcpy(jit.bytes + at, &displacement, 4);
+    }
+
+    // Map the code writable, copy it in, then make it executable
+    program->size = jit.count;
+    program->mapped = ((size_t)jit.count + 4095) & ~(size_t)4095;
+    void *pages = mmap(NULL, program->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    int ok = pages != MAP_FAILED;
+    if (ok) {
+        memcpy(pages, jit.bytes, jit.count);
+        program->code = pages;
+        ok = mprotect(pages, program->mapped, PROT_READ | PROT_EXEC) == 0;
+        memcpy(&program->entry, &pages, sizeof(pages));
+    }
+    program->isNamed = jit.ra.isNamed;
+    program->nameCount = code->names.count;
+    jit.ra.isNamed = NULL;
+
+    raFree(&jit.ra);
+    free(jit.bytes);
+    free(jit.labelAt);
+    free(jit.fixups);
+    free(stringStart);
+    if (!ok) jitFree(program);
+    return ok;
+#endif
+}
+
+// Function to run a compiled program; values needs one zeroed entry per
+// name id. Returns JIT_NO_FAULT or the instruction that divided by zero.
+static inline uint32_t jitRun(const JitProgram *program, int32_t *values, FILE *out) {
+    uint32_t fault = program->entry(values, out);
+    if (out != NULL) fflush(out);
+    return fault;
+}
+
+// Function to compile the code to machine code, run it and print what it
+// printed, the final variable values and the time taken, all to out; falls
+// back to the VM where there is no JIT
+static inline void jitExecute(const TacBuffer *code, FILE *out) {
+    JitProgram program;
+    clock_t start = clock();
+    if (!jitCompile(&program, code)) {
+        fprintf(stderr, "Warning: no JIT on this platform, running in the VM\n");
+        vmExecute(code, out);
+        return;
+    }
+    double compileTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+    int32_t *values = calloc((size_t)program.nameCount + 1, sizeof(int32_t));
+    if (values == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    fprintf(out, "\nProgram Output:\n");
+    start = clock();
+    uint32_t fault = jitRun(&program, values, out);
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    fprintf(out, "\n");
+    if (fault != JIT_NO_FAULT) {
+        fprintf(out, "Runtime error: division by zero at instruction %u\n", fault);
+    } else {
+        for (uint32_t var = 0; var < program.nameCount; var++) {
+            if (program.isNamed[var]) fprintf(out, "%s = %d\n", internText(&code->names, var), values[var]);
+        }
+    }
+    fprintf(out, "(%u bytes of machine code compiled in %.3f ms, run in %.3f ms)\n", program.size,
+                 compileTime * 1000.0, elapsed * 1000.0);
+    free(values);
+    jitFree(&program);
+}
+
+#endif
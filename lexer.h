@@ -0,0 +1,558 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+// Table-driven scanner shared by every stage.
+//
+// Each input byte is mapped to a byte class and fed through one DFA
+// transition table, so scanning costs one table lookup per byte. States that
+// loop over long runs (whitespace, comments, string literals) hand off to
+// SIMD kernels. A Lexer works over a (pointer, length) buffer and can stop
+// mid-token at the end of a buffer and resume when more input arrives.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "tokstream.h"
+
+// SSE2/AVX2 kernels are used for long runs of skipped bytes when the compiler
+// can target x86; everything else uses the scalar versions.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LEXER_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Byte classes: every input byte is mapped to one of these before it is fed
+// to the DFA, so the transition table stays small. The end of the input is
+// given by its length, so NUL bytes are ordinary control characters.
+enum {
+    C_SPACE, C_NEWLINE, C_CONTROL, C_ALPHA, C_DIGIT, C_UNDERSCORE, C_DOT,
+    C_EQ, C_PLUS, C_MINUS, C_STAR, C_SLASH, C_LT, C_GT, C_BANG, C_AMP, C_PIPE,
+    C_SEMI, C_LPAREN, C_RPAREN, C_LBRACE, C_RBRACE, C_LBRACKET, C_RBRACKET,
+    C_COMMA, C_COLON, C_QUESTION, C_QUOTE, C_OTHER,
+    NUM_CLASSES
+};
+
+// DFA states. S_REJECT is 0 so that missing table entries stop the scan.
+enum {
+    S_REJECT, S_START, S_SKIP, S_IDENT, S_NUMBER, S_DOT,
+    S_EQ, S_EQ_EQ, S_PLUS, S_PLUS_EQ, S_MINUS, S_MINUS_EQ, S_STAR, S_STAR_EQ,
+    S_SLASH, S_SLASH_EQ, S_LINE_COMMENT, S_BLOCK_COMMENT, S_BLOCK_STAR, S_BLOCK_END,
+    S_LT, S_LE, S_GT, S_GE, S_BANG, S_NE, S_AMP, S_AMP_AMP, S_PIPE, S_PIPE_PIPE,
+    S_SEMI, S_LPAREN, S_RPAREN, S_LBRACE, S_RBRACE, S_LBRACKET, S_RBRACKET,
+    S_COMMA, S_COLON, S_QUESTION, S_STRING, S_STRING_END, S_UNKNOWN,
+    NUM_STATES
+};
+
+// Token kind reported when the DFA stops in a given state
+static const unsigned char acceptKind[NUM_STATES] = {
+    [S_SKIP] = TK_SKIP, [S_IDENT] = TK_IDENTIFIER, [S_NUMBER] = TK_NUMBER, [S_DOT] = TK_DOT,
+    [S_EQ] = TK_ASSIGN, [S_EQ_EQ] = TK_EQ, [S_PLUS] = TK_PLUS, [S_PLUS_EQ] = TK_PLUS_ASSIGN,
+    [S_MINUS] = TK_MINUS, [S_MINUS_EQ] = TK_MINUS_ASSIGN, [S_STAR] = TK_STAR,
+    [S_STAR_EQ] = TK_STAR_ASSIGN, [S_SLASH] = TK_SLASH, [S_SLASH_EQ] = TK_SLASH_ASSIGN,
+    [S_LINE_COMMENT] = TK_SKIP, [S_BLOCK_COMMENT] = TK_UNCLOSED_COMMENT,
+    [S_BLOCK_STAR] = TK_UNCLOSED_COMMENT, [S_BLOCK_END] = TK_SKIP,
+    [S_LT] = TK_LT, [S_LE] = TK_LE, [S_GT] = TK_GT, [S_GE] = TK_GE,
+    [S_BANG] = TK_NOT, [S_NE] = TK_NE, [S_AMP] = TK_AMP, [S_AMP_AMP] = TK_AND,
+    [S_PIPE] = TK_PIPE, [S_PIPE_PIPE] = TK_OR, [S_SEMI] = TK_SEMICOLON,
+    [S_LPAREN] = TK_LPAREN, [S_RPAREN] = TK_RPAREN, [S_LBRACE] = TK_LBRACE,
+    [S_RBRACE] = TK_RBRACE, [S_LBRACKET] = TK_LBRACKET, [S_RBRACKET] = TK_RBRACKET,
+    [S_COMMA] = TK_COMMA, [S_COLON] = TK_COLON, [S_QUESTION] = TK_QUESTION,
+    [S_STRING] = TK_UNCLOSED_STRING, [S_STRING_END] = TK_STRING, [S_UNKNOWN] = TK_UNKNOWN,
+};
+
+static unsigned char byteClass[256];
+static unsigned char transitions[NUM_STATES][NUM_CLASSES];
+
+// States that loop on most bytes. Entering one of these hands the scan to a
+// kernel that jumps straight to the next byte that can leave the state.
+enum { RUN_NONE, RUN_BLANK, RUN_LINE, RUN_BLOCK, RUN_STRING };
+static const unsigned char runKind[NUM_STATES] = {
+    [S_SKIP] = RUN_BLANK, [S_LINE_COMMENT] = RUN_LINE,
+    [S_BLOCK_COMMENT] = RUN_BLOCK, [S_STRING] = RUN_STRING,
+};
+
+// Kernels selected once by initScannerTables() from the CPU features
+static size_t (*skipBlanks)(const char* input, size_t pos, size_t length);
+static size_t (*findByte)(const char* input, size_t pos, size_t length, char target);
+
+// Keywords are found with a perfect hash on (first char, last char, length),
+// so each identifier costs one table probe and at most one memcmp.
+typedef struct {
+    const char *name;
+    TokenKind kind;
+} Keyword;
+
+#define KEYWORD_HASH(text, length) \
+    (((unsigned char)(text)[0] + 7 * (unsigned char)(text)[(length) - 1] + (length)) & 31)
+
+static const Keyword keywordTable[32] = {
+    [24] = {"int", TK_INT}, [23] = {"float", TK_FLOAT}, [5] = {"char", TK_CHAR},
+    [21] = {"if", TK_IF}, [12] = {"else", TK_ELSE}, [31] = {"while", TK_WHILE},
+    [7] = {"for", TK_FOR}, [15] = {"do", TK_DO}, [26] = {"return", TK_RETURN},
+    [20] = {"break", TK_BREAK}, [14] = {"continue", TK_CONTINUE},
+    [17] = {"switch", TK_SWITCH}, [10] = {"case", TK_CASE},
+};
+
+typedef struct {
+    const char *input;
+    size_t length;
+    size_t pos;      // Scan position in input
+    size_t start;    // Start of the last token returned
+    int state;       // DFA state to resume in; S_START between tokens
+    int atEnd;       // No more input follows this buffer
+} Lexer;
+
+// Function to skip whitespace and control characters one byte at a time
+static inline size_t skipBlanksScalar(const char* input, size_t pos, size_t length) {
+    while (pos < length && byteClass[(unsigned char)input[pos]] <= C_CONTROL) {  // space, newline, control
+        pos++;
+    }
+    return pos;
+}
+
+// Function to find the next occurrence of target one byte at a time
+static inline size_t findByteScalar(const char* input, size_t pos, size_t length, char target) {
+    while (pos < length && input[pos] != target) {
+        pos++;
+    }
+    return pos;
+}
+
+#ifdef LEXER_SIMD
+// Printable non-space bytes (33..126) end a blank run. As signed bytes,
+// everything from 128 up is negative, so two signed compares cover it.
+__attribute__((target("sse2")))
+static inline size_t skipBlanksSSE2(const char* input, size_t pos, size_t length) {
+    const __m128i low = _mm_set1_epi8(32);
+    const __m128i high = _mm_set1_epi8(127);
+    while (pos + 16 <= length) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(input + pos));
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(chunk, low), _mm_cmplt_epi8(chunk, high));
+        int mask = _mm_movemask_epi8(printable);
+        if (mask != 0) return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return skipBlanksScalar(input, pos, length);
+}
+
+__attribute__((target("sse2")))
+static inline size_t findByteSSE2(const char* input, size_t pos, size_t length, char target) {
+    const __m128i needle = _mm_set1_epi8(target);
+    while (pos + 16 <= length) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(input + pos));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0) return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return findByteScalar(input, pos, length, target);
+}
+
+__attribute__((target("avx2")))
+static inline size_t skipBlanksAVX2(const char* input, size_t pos, size_t length) {
+    const __m256i low = _mm256_set1_epi8(32);
+    const __m256i high = _mm256_set1_epi8(127);
+    while (pos + 32 <= length) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(input + pos));
+        __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, low), _mm256_cmpgt_epi8(high, chunk));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(printable);
+        if (mask != 0) return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return skipBlanksScalar(input, pos, length);
+}
+
+__attribute__((target("avx2")))
+static inline size_t findByteAVX2(const char* input, size_t pos, size_t length, char target) {
+    const __m256i needle = _mm256_set1_epi8(target);
+    while (pos + 32 <= length) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(input + pos));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask != 0) return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return findByteScalar(input, pos, length, target);
+}
+#endif
+
+// Function to pick the widest kernels the running CPU supports
+static inline void selectScanKernels(void) {
+    skipBlanks = skipBlanksScalar;
+    findByte = findByteScalar;
+#ifdef LEXER_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        skipBlanks = skipBlanksAVX2;
+        findByte = findByteAVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        skipBlanks = skipBlanksSSE2;
+        findByte = findByteSSE2;
+    }
+#endif
+}
+
+// Function to advance over the bytes that keep the DFA in a looping state.
+// Returns the position of the first byte that may leave the state.
+static inline size_t skipRun(int state, const char* input, size_t pos, size_t length) {
+    switch (runKind[state]) {
+        case RUN_BLANK: return skipBlanks(input, pos, length);
+        case RUN_LINE: return findByte(input, pos, length, '\n');
+        case RUN_BLOCK: return findByte(input, pos, length, '*');
+        case RUN_STRING: return findByte(input, pos, length, '"');
+        default: return pos;
+    }
+}
+
+// Function to build the byte-class and transition tables (runs once)
+static inline void initScannerTables(void) {
+    static int initialized = 0;
+    if (initialized) return;
+    initialized = 1;
+    selectScanKernels();
+
+    for (int c = 0; c < 256; c++) {
+        if (c == '\n') byteClass[c] = C_NEWLINE;
+        else if (isspace(c)) byteClass[c] = C_SPACE;
+        else if (c < 32 || c > 126) byteClass[c] = C_CONTROL;
+        else if (isalpha(c)) byteClass[c] = C_ALPHA;
+        else if (isdigit(c)) byteClass[c] = C_DIGIT;
+        else byteClass[c] = C_OTHER;
+    }
+    byteClass['_'] = C_UNDERSCORE; byteClass['.'] = C_DOT; byteClass['='] = C_EQ;
+    byteClass['+'] = C_PLUS; byteClass['-'] = C_MINUS; byteClass['*'] = C_STAR;
+    byteClass['/'] = C_SLASH; byteClass['<'] = C_LT; byteClass['>'] = C_GT;
+    byteClass['!'] = C_BANG; byteClass['&'] = C_AMP; byteClass['|'] = C_PIPE;
+    byteClass[';'] = C_SEMI; byteClass['('] = C_LPAREN; byteClass[')'] = C_RPAREN;
+    byteClass['{'] = C_LBRACE; byteClass['}'] = C_RBRACE; byteClass['['] = C_LBRACKET;
+    byteClass[']'] = C_RBRACKET; byteClass[','] = C_COMMA; byteClass[':'] = C_COLON;
+    byteClass['?'] = C_QUESTION; byteClass['"'] = C_QUOTE;
+
+    // Single-byte tokens and the first byte of every longer token
+    unsigned char *start = transitions[S_START];
+    for (int cls = 0; cls < NUM_CLASSES; cls++) start[cls] = S_UNKNOWN;
+    start[C_SPACE] = start[C_NEWLINE] = start[C_CONTROL] = S_SKIP;
+    start[C_ALPHA] = S_IDENT; start[C_DIGIT] = S_NUMBER; start[C_DOT] = S_DOT;
+    start[C_EQ] = S_EQ; start[C_PLUS] = S_PLUS; start[C_MINUS] = S_MINUS;
+    start[C_STAR] = S_STAR; start[C_SLASH] = S_SLASH; start[C_LT] = S_LT;
+    start[C_GT] = S_GT; start[C_BANG] = S_BANG; start[C_AMP] = S_AMP;
+    start[C_PIPE] = S_PIPE; start[C_SEMI] = S_SEMI; start[C_LPAREN] = S_LPAREN;
+    start[C_RPAREN] = S_RPAREN; start[C_LBRACE] = S_LBRACE; start[C_RBRACE] = S_RBRACE;
+    start[C_LBRACKET] = S_LBRACKET; start[C_RBRACKET] = S_RBRACKET;
+    start[C_COMMA] = S_COMMA; start[C_COLON] = S_COLON; start[C_QUESTION] = S_QUESTION;
+    start[C_QUOTE] = S_STRING;
+
+    // Whitespace and control characters are skipped as one run
+    transitions[S_SKIP][C_SPACE] = transitions[S_SKIP][C_NEWLINE] = S_SKIP;
+    transitions[S_SKIP][C_CONTROL] = S_SKIP;
+
+    transitions[S_IDENT][C_ALPHA] = transitions[S_IDENT][C_DIGIT] = S_IDENT;
+    transitions[S_IDENT][C_UNDERSCORE] = S_IDENT;
+    transitions[S_NUMBER][C_DIGIT] = transitions[S_NUMBER][C_DOT] = S_NUMBER;
+    transitions[S_DOT][C_DIGIT] = S_NUMBER;
+
+    // Two-character operators
+    transitions[S_EQ][C_EQ] = S_EQ_EQ;
+    transitions[S_PLUS][C_EQ] = S_PLUS_EQ;
+    transitions[S_MINUS][C_EQ] = S_MINUS_EQ;
+    transitions[S_STAR][C_EQ] = S_STAR_EQ;
+    transitions[S_SLASH][C_EQ] = S_SLASH_EQ;
+    transitions[S_LT][C_EQ] = S_LE;
+    transitions[S_GT][C_EQ] = S_GE;
+    transitions[S_BANG][C_EQ] = S_NE;
+    transitions[S_AMP][C_AMP] = S_AMP_AMP;
+    transitions[S_PIPE][C_PIPE] = S_PIPE_PIPE;
+
+    // Comments: "//" runs to the newline, "/*" runs to the closing "*/"
+    transitions[S_SLASH][C_SLASH] = S_LINE_COMMENT;
+    transitions[S_SLASH][C_STAR] = S_BLOCK_COMMENT;
+    for (int cls = 0; cls < NUM_CLASSES; cls++) {
+        transitions[S_LINE_COMMENT][cls] = S_LINE_COMMENT;
+        transitions[S_BLOCK_COMMENT][cls] = S_BLOCK_COMMENT;
+        transitions[S_BLOCK_STAR][cls] = S_BLOCK_COMMENT;
+        transitions[S_STRING][cls] = S_STRING;
+    }
+    transitions[S_LINE_COMMENT][C_NEWLINE] = S_REJECT;
+    transitions[S_BLOCK_COMMENT][C_STAR] = S_BLOCK_STAR;
+    transitions[S_BLOCK_STAR][C_STAR] = S_BLOCK_STAR;
+    transitions[S_BLOCK_STAR][C_SLASH] = S_BLOCK_END;
+
+    // String literals run to the closing quote (no escape sequences)
+    transitions[S_STRING][C_QUOTE] = S_STRING_END;
+}
+
+// Function to classify an identifier as a keyword or a plain identifier
+static inline TokenKind keywordKind(const char* text, int length) {
+    if (length < 2 || length > 8) return TK_IDENTIFIER;
+    const Keyword *keyword = &keywordTable[KEYWORD_HASH(text, length)];
+    if (keyword->name != NULL && strlen(keyword->name) == (size_t)length &&
+        memcmp(keyword->name, text, length) == 0) {
+        return keyword->kind;
+    }
+    return TK_IDENTIFIER;
+}
+
+// Function to point a lexer at a buffer. With atEnd == 0 the buffer may end
+// mid-token and more input is expected later.
+static inline void lexerInit(Lexer *lexer, const char *input, size_t length, int atEnd) {
+    initScannerTables();
+    lexer->input = input;
+    lexer->length = length;
+    lexer->pos = 0;
+    lexer->start = 0;
+    lexer->state = S_START;
+    lexer->atEnd = atEnd;
+}
+
+// Function to run the DFA from pos until no transition applies. Advances pos
+// past the longest match, sets start, and returns the token kind (keywords
+// resolved). If the buffer ends mid-token and more input will follow, the
+// DFA state is saved and TK_INCOMPLETE is returned.
+static inline TokenKind lexerScan(Lexer *lexer) {
+    const char *input = lexer->input;
+    size_t length = lexer->length;
+    size_t pos = lexer->pos;
+    int state = lexer->state;
+    int next;
+    if (state == S_START) lexer->start = pos;
+    lexer->state = S_START;
+    while (pos < length && (next = transitions[state][byteClass[(unsigned char)input[pos]]]) != S_REJECT) {
+        state = next;
+        pos++;
+        if (runKind[state] != RUN_NONE) pos = skipRun(state, input, pos, length);
+    }
+    lexer->pos = pos;
+    if (state == S_START) return TK_EOF;
+    if (pos == length && !lexer->atEnd) {
+        lexer->state = state;
+        return TK_INCOMPLETE;
+    }
+    if (state == S_IDENT) return keywordKind(input + lexer->start, (int)(pos - lexer->start));
+    return (TokenKind)acceptKind[state];
+}
+
+// Function to return the next real token, skipping whitespace and comments.
+// The token text is input[start .. pos).
+static inline TokenKind lexerNext(Lexer *lexer) {
+    TokenKind kind;
+    while ((kind = lexerScan(lexer)) == TK_SKIP) {
+    }
+    return kind;
+}
+
+// Function to say whether a state saved at a buffer edge belongs to text
+// that produces no token (whitespace or a comment)
+static inline int lexerStateIsSkip(int state) {
+    return acceptKind[state] == TK_SKIP || acceptKind[state] == TK_UNCLOSED_COMMENT;
+}
+
+// Function to tokenize a whole buffer into a token stream writer. Returns
+// TK_EOF on success, or TK_UNCLOSED_COMMENT / TK_UNCLOSED_STRING; *errorOffset
+// is then set to where the unterminated comment or string starts.
+static inline TokenKind lexerTokenize(const char *text, size_t length, TokenStreamWriter *writer,
+                                      size_t *errorOffset) {
+    Lexer lexer;
+    TokenKind kind;
+    lexerInit(&lexer, text, length, 1);
+    while ((kind = lexerNext(&lexer)) != TK_EOF) {
+        if (kind == TK_UNCLOSED_COMMENT || kind == TK_UNCLOSED_STRING) {
+            if (errorOffset != NULL) *errorOffset = lexer.start;
+            return kind;
+        }
+        tokenStreamAdd(writer, kind, lexer.start, text + lexer.start, lexer.pos - lexer.start);
+    }
+    return TK_EOF;
+}
+
+// ---------------------------------------------------------------------------
+// Pull lexing
+//
+// A TokenCursor lexes on demand instead of filling a token array: tokens are
+// numbered from 0 as they are produced and only the last CURSOR_RING_SIZE
+// stay available, in a fixed ring, so memory does not grow with the input.
+// Tokens are source slices (offset and length); nothing is interned, so
+// their id is always TOKSTREAM_NO_STRING and cursorText() copies the text
+// out when a message needs it.
+
+#define CURSOR_RING_SIZE 16   // Power of two; more than any lookahead in use
+
+typedef struct {
+    Lexer lexer;
+    PackedToken ring[CURSOR_RING_SIZE];
+    uint32_t count;           // Tokens lexed so far
+    uint32_t position;        // Next token of cursorNext()
+    size_t end;               // End of the last token lexed
+    int done;                 // The end of the input (or a lexical error) was reached
+    TokenKind error;          // TK_EOF, or TK_UNCLOSED_COMMENT / TK_UNCLOSED_STRING
+    size_t errorOffset;
+    char *text[CURSOR_RING_SIZE];   // cursorText() copies, per slot
+    uint32_t textCapacity[CURSOR_RING_SIZE];
+} TokenCursor;
+
+static inline void cursorInit(TokenCursor *cursor, const char *text, size_t length) {
+    memset(cursor, 0, sizeof(*cursor));
+    lexerInit(&cursor->lexer, text, length, 1);
+    cursor->error = TK_EOF;
+}
+
+static inline void cursorFree(TokenCursor *cursor) {
+    for (int i = 0; i < CURSOR_RING_SIZE; i++) free(cursor->text[i]);
+    memset(cursor, 0, sizeof(*cursor));
+}
+
+// Function to lex one more token into the ring. Returns 0 at the end of the
+// input or at an unclosed comment or string.
+static inline int cursorFill(TokenCursor *cursor) {
+    if (cursor->done) return 0;
+    Lexer *lexer = &cursor->lexer;
+    TokenKind kind = lexerNext(lexer);
+    if (kind == TK_EOF || kind == TK_UNCLOSED_COMMENT || kind == TK_UNCLOSED_STRING) {
+        if (kind != TK_EOF) {
+            cursor->error = kind;
+            cursor->errorOffset = lexer->start;
+        }
+        cursor->done = 1;
+        return 0;
+    }
+    tokenStreamCheckRange(lexer->start, lexer->pos - lexer->start);
+    PackedToken *token = &cursor->ring[cursor->count & (CURSOR_RING_SIZE - 1)];
+    token->kind = (uint8_t)kind;
+    token->offset = (uint32_t)lexer->start;
+    token->length = (uint32_t)(lexer->pos - lexer->start);
+    token->id = TOKSTREAM_NO_STRING;
+    cursor->end = lexer->pos;
+    cursor->count++;
+    return 1;
+}
+
+// Function to get token number index, lexing up to it if needed. Returns
+// NULL past the end of the input or if the token has left the ring.
+static inline const PackedToken *cursorToken(TokenCursor *cursor, uint32_t index) {
+    while (index >= cursor->count) {
+        if (!cursorFill(cursor)) return NULL;
+    }
+    if (cursor->count - index > CURSOR_RING_SIZE) return NULL;
+    return &cursor->ring[index & (CURSOR_RING_SIZE - 1)];
+}
+
+// Function to look k tokens ahead of the cursor without consuming anything
+// (k < CURSOR_RING_SIZE). Returns NULL past the end.
+static inline const PackedToken *cursorPeek(TokenCursor *cursor, uint32_t k) {
+    return cursorToken(cursor, cursor->position + k);
+}
+
+// Function to consume and return the next token, or NULL at the end
+static inline const PackedToken *cursorNext(TokenCursor *cursor) {
+    const PackedToken *token = cursorToken(cursor, cursor->position);
+    if (token != NULL) cursor->position++;
+    return token;
+}
+
+// Function to get the text of token number index as a NUL-terminated string
+// that stays valid until its ring slot is reused. Returns NULL like
+// cursorToken().
+static inline const char *cursorText(TokenCursor *cursor, uint32_t index) {
+    const PackedToken *token = cursorToken(cursor, index);
+    if (token == NULL) return NULL;
+    uint32_t slot = index & (CURSOR_RING_SIZE - 1);
+    if (token->length + 1 > cursor->textCapacity[slot]) {
+        cursor->textCapacity[slot] = token->length + 16;
+        cursor->text[slot] = internAlloc(cursor->text[slot], cursor->textCapacity[slot]);
+    }
+    memcpy(cursor->text[slot], cursor->lexer.input + token->offset, token->length);
+    cursor->text[slot][token->length] = '\0';
+    return cursor->text[slot];
+}
+
+// ---------------------------------------------------------------------------
+// Source input
+
+typedef struct {
+    char *text;
+    size_t length;
+    int mapped;      // text is a read-only file mapping
+} Source;
+
+// Function to load a whole file, mapping it into memory when possible.
+// Returns 1 on success.
+static inline int sourceOpen(Source *source, const char *path) {
+    memset(source, 0, sizeof(*source));
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        char *text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text != MAP_FAILED) {
+            madvise(text, info.st_size, MADV_SEQUENTIAL);
+            source->text = text;
+            source->length = info.st_size;
+            source->mapped = 1;
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+#endif
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return 0;
+    size_t capacity = 1 << 16;
+    source->text = malloc(capacity);
+    size_t bytesRead;
+    while (source->text != NULL &&
+           (bytesRead = fread(source->text + source->length, 1, capacity - source->length, file)) > 0) {
+        source->length += bytesRead;
+        if (source->length == capacity) {
+            char *grown = realloc(source->text, capacity *= 2);
+            if (grown == NULL) free(source->text);
+            source->text = grown;
+        }
+    }
+    fclose(file);
+    if (source->text == NULL) source->length = 0;
+    return source->text != NULL;
+}
+
+// Function to read a stream up to a line containing only "END" (or EOF),
+// the input convention of the interactive tools. Returns 1 on success.
+static inline int sourceReadUntilEnd(Source *source, FILE *stream) {
+    memset(source, 0, sizeof(*source));
+    size_t capacity = 1 << 16;
+    char line[4096];
+    int atLineStart = 1;
+    source->text = malloc(capacity);
+    while (source->text != NULL && fgets(line, sizeof(line), stream) != NULL) {
+        size_t lineLength = strlen(line);
+        if (atLineStart && (strcmp(line, "END\n") == 0 || strcmp(line, "END") == 0)) break;
+        while (source->length + lineLength + 1 > capacity) capacity *= 2;
+        char *grown = realloc(source->text, capacity);
+        if (grown == NULL) free(source->text);
+        source->text = grown;
+        if (source->text == NULL) break;
+        memcpy(source->text + source->length, line, lineLength);
+        source->length += lineLength;
+        atLineStart = (lineLength > 0 && line[lineLength - 1] == '\n');
+    }
+    if (source->text == NULL) return 0;
+    source->text[source->length] = '\0';
+    return 1;
+}
+
+static inline void sourceClose(Source *source) {
+#ifndef _WIN32
+    if (source->mapped) {
+        munmap(source->text, source->length);
+    } else
+#endif
+    {
+        free(source->text);
+    }
+    memset(source, 0, sizeof(*source));
+}
+
+#endif
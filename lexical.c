@@ -1,246 +1,279 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-
-#define MAX_INPUT_LENGTH 1024
-#define MAX_TOKEN_LENGTH 20
-#define MAX_SYMBOLS 100
+#include "lexer.h"
+#include "parlex.h"
+#include "stats.h"
 
-typedef struct {
-    char name[MAX_TOKEN_LENGTH];
-    char type[MAX_TOKEN_LENGTH];
-} Symbol;
+#define STREAM_CHUNK_SIZE (64 * 1024)
 
-Symbol symbolTable[MAX_SYMBOLS];
-int symbolCount = 0;
+// Symbol table: every distinct identifier is interned once and keeps the
+// same id for the rest of the run
+InternTable symbolTable;
 
-int pos = 0;
+Lexer lexer;                 // Scanner over the current buffer
+size_t bufferOffset = 0;     // Source offset of the current buffer's first byte
+TokenStreamWriter *tokenWriter = NULL;  // Set when emitting a binary token stream
+uint32_t lexThreads = 1;     // Threads for lexing a mapped file (-j)
+Stats stats;                 // Phase times and counters
+int timeReport = -1;         // Print stats at exit: 0 = table, 1 = JSON
 
-void skipWhitespace(char* input);
-void addSymbol(char* name, char* type);
-void lexicalAnalysis(char* input);
+uint32_t addSymbol(const char* name, int length);
+void printToken(TokenKind kind, const char* text, int length);
+size_t lexBuffer(const char* input, size_t length, int atEnd, size_t resumePos);
+void lexicalAnalysis(const char* input, size_t length);
+void lexicalAnalysisParallel(const char* input, size_t length);
+void lexicalAnalysisStream(FILE* stream);
+int lexicalAnalysisFile(const char* path);
+void printTimeReport(void);
 
-void skipWhitespace(char* input) {
-    while (isspace(input[pos])) {
-        pos++;
-    }
+// Function to add an identifier to the symbol table and return its id
+uint32_t addSymbol(const char* name, int length) {
+    return internString(&symbolTable, name, (uint32_t)length);
 }
 
-void addSymbol(char* name, char* type) {
-    strcpy(symbolTable[symbolCount].name, name);
-    strcpy(symbolTable[symbolCount].type, type);
-    symbolCount++;
+// Function to print one token (or report an unclosed comment or string and
+// stop)
+void printToken(TokenKind kind, const char* text, int length) {
+    switch (kind) {
+        case TK_IDENTIFIER:
+            printf("Token: %.*s, Type: Identifier\n", length, text);
+            addSymbol(text, length);
+            break;
+        case TK_UNKNOWN:
+            printf("Unknown token: %c\n", text[0]);
+            break;
+        case TK_UNCLOSED_COMMENT:
+            printf("Error: Unclosed multi-line comment\n");
+            exit(1);
+        case TK_UNCLOSED_STRING:
+            printf("Error: Unclosed string literal\n");
+            exit(1);
+        default:
+            printf("Token: %.*s, Type: %s\n", length, text, tokenTypeNames[kind]);
+            break;
+    }
 }
 
-void lexicalAnalysis(char* input) {
-    printf("\nLexical Analysis:\n");
-    while (input[pos] != '\0') {
-        skipWhitespace(input);
+// Function to tokenize input[0..length). When atEnd is 0 the buffer may stop
+// in the middle of a token; that token is left unconsumed and the return
+// value (bytes consumed) tells the caller where it starts. resumePos skips
+// the bytes of a token carried over from the previous buffer.
+size_t lexBuffer(const char* input, size_t length, int atEnd, size_t resumePos) {
+    int state = lexer.state;  // Kept across buffers
+    lexerInit(&lexer, input, length, atEnd);
+    lexer.state = state;
+    lexer.pos = resumePos;
+    while (1) {
+        TokenKind kind = lexerScan(&lexer);
+        size_t start = lexer.start;
+        int tokenLength = (int)(lexer.pos - start);
 
-        // Ensure we are not at the end of input before processing
-        if (input[pos] == '\0') break;
-
-        // Handle single-line comments
-        if (input[pos] == '/' && input[pos + 1] == '/') {
-            while (input[pos] != '\n' && input[pos] != '\0') {
-                pos++;  // Skip the comment
-            }
-            continue;  // Move to the next iteration
+        if (kind == TK_EOF) return lexer.pos;
+        if (kind == TK_INCOMPLETE) {
+            // Comments and whitespace produce no text, so only their state is kept
+            return lexerStateIsSkip(lexer.state) ? lexer.pos : start;
         }
+        if (kind < TK_SKIP) statsAdd(&stats, STAT_TOKENS, 1);
 
-        // Handle multi-line comments
-        if (input[pos] == '/' && input[pos + 1] == '*') {
-            pos += 2;  // Skip the "/*"
-            while (input[pos] != '*' || input[pos + 1] != '/') {
-                if (input[pos] == '\0') {
-                    printf("Error: Unclosed multi-line comment\n");
-                    exit(1);
-                }
-                pos++;  // Skip the comment
+        if (tokenWriter != NULL && kind < TK_SKIP) {
+            if (kind == TK_IDENTIFIER) {
+                // The writer shares the symbol table, so the stream id is the symbol id
+                // (numbers and string literals are interned into it as well)
+                uint32_t id = addSymbol(input + start, tokenLength);
+                tokenStreamAddId(tokenWriter, kind, bufferOffset + start, tokenLength, id);
+            } else {
+                tokenStreamAdd(tokenWriter, kind, bufferOffset + start, input + start, tokenLength);
             }
-            pos += 2;  // Skip the "*/"
-            continue;  // Move to the next iteration
+            continue;
         }
 
-        if (isalpha(input[pos])) {  // Check for identifiers or keywords
-            char identifier[MAX_TOKEN_LENGTH];
-            int i = 0;
-            while (isalnum(input[pos]) || input[pos] == '_') {
-                identifier[i++] = input[pos++];
-            }
-            identifier[i] = '\0';
-
-            // Check if it's a keyword or an identifier
-            if (strcmp(identifier, "int") == 0 || strcmp(identifier, "float") == 0 || strcmp(identifier, "char") == 0 ||
-                strcmp(identifier, "if") == 0 || strcmp(identifier, "else") == 0 || 
-                strcmp(identifier, "while") == 0 || strcmp(identifier, "for") == 0 || 
-                strcmp(identifier, "do") == 0 || strcmp(identifier, "return") == 0 ||
-                strcmp(identifier, "break") == 0 || strcmp(identifier, "continue") == 0 ||
-                strcmp(identifier, "switch") == 0 || strcmp(identifier, "case") == 0) {
-                printf("Token: %s, Type: Keyword\n", identifier);
-            } else {
-                printf("Token: %s, Type: Identifier\n", identifier);
-                addSymbol(identifier, "unknown");  // Add to symbol table with unknown type
-            }
-        } else if (isdigit(input[pos]) || (input[pos] == '.' && isdigit(input[pos + 1]))) {  // Check for numbers
-            char number[MAX_TOKEN_LENGTH];
-            int i = 0;
-            while (isdigit(input[pos]) || input[pos] == '.') {
-                number[i++] = input[pos++];
-            }
-            number[i] = '\0';
-            printf("Token: %s, Type: Number\n", number);
-        } else if (input[pos] == '=') {
-            if (input[pos + 1] == '=') {
-                printf("Token: ==, Type: Comparison Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: =, Type: Assignment Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == '+') {
-            if (input[pos + 1] == '=') {
-                printf("Token: +=, Type: Compound Assignment Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: +, Type: Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == '-') {
-            if (input[pos + 1] == '=') {
-                printf("Token: -=, Type: Compound Assignment Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: -, Type: Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == '*') {
-            if (input[pos + 1] == '=') {
-                printf("Token: *=, Type: Compound Assignment Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: *, Type: Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == '/') {
-            if (input[pos + 1] == '=') {
-                printf("Token: /=, Type: Compound Assignment Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: /, Type: Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == ';') {
-            printf("Token: ;, Type: Semicolon\n");
-            pos++;
-        } else if (input[pos] == '(') {
-            printf("Token: (, Type: Left Parenthesis\n");
-            pos++;
-        } else if (input[pos] == ')') {
-            printf("Token: ), Type: Right Parenthesis\n");
-            pos++;
-        } else if (input[pos] == '{') {
-            printf("Token: {, Type: Left Brace\n");
-            pos++;
-        } else if (input[pos] == '}') {
-            printf("Token: }, Type: Right Brace\n");
-            pos++;
-        } else if (input[pos] == '[') {
-            printf("Token: [, Type: Left Bracket\n");
-            pos++;
-        } else if (input[pos] == ']') {
-            printf("Token: ], Type: Right Bracket\n");
-            pos++;
-        } else if (input[pos] == '<') {
-            if (input[pos + 1] == '=') {
-                printf("Token: <=, Type: Comparison Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: <, Type: Comparison Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == '>') {
-            if (input[pos + 1] == '=') {
-                printf("Token: >=, Type: Comparison Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: >, Type: Comparison Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == '!') {
-            if (input[pos + 1] == '=') {
-                printf("Token: !=, Type: Comparison Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: !, Type: Logical Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == '&') {
-            if (input[pos + 1] == '&') {
-                printf("Token: &&, Type: Logical Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: &, Type: Bitwise Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == '|') {
-            if (input[pos + 1] == '|') {
-                printf("Token: ||, Type: Logical Operator\n");
-                pos += 2;
-            } else {
-                printf("Token: |, Type: Bitwise Operator\n");
-                pos++;
-            }
-        } else if (input[pos] == ',') {
-            printf("Token: ,, Type: Comma\n");
-            pos++;
-        } else if (input[pos] == '.') {
-            printf("Token: ., Type: Dot\n");
-            pos++;
-        } else if (input[pos] == ':') {
-            printf("Token: :, Type: Colon\n");
-            pos++;
-        } else if (input[pos] == '?') {
-            printf("Token: ?, Type: Question Mark\n");
-            pos++;
-        } else if (input[pos] == '"') {  // Handle string literals
-            pos++; // skip the opening quote
-            char stringLiteral[MAX_INPUT_LENGTH];
-            int i = 0;
-            while (input[pos] != '"' && input[pos] != '\0') {
-                stringLiteral[i++] = input[pos++];
-            }
-            if (input[pos] == '"') {
-                stringLiteral[i] = '\0'; // close the string
-                printf("Token: \"%s\", Type: String Literal\n", stringLiteral);
-                pos++; // skip the closing quote
-            } else {
-                printf("Error: Unclosed string literal\n");
+        if (kind != TK_SKIP) printToken(kind, input + start, tokenLength);
+    }
+}
+
+// Function to tokenize a complete in-memory source of the given length
+void lexicalAnalysis(const char* input, size_t length) {
+    if (tokenWriter == NULL) printf("\nLexical Analysis:\n");
+    bufferOffset = 0;
+    lexer.state = S_START;
+    statsAdd(&stats, STAT_BYTES, length);
+    lexBuffer(input, length, 1, 0);
+}
+
+// Function to tokenize a complete in-memory source in chunks on lexThreads
+// threads (see parlex.h), then emit or print the tokens in order
+void lexicalAnalysisParallel(const char* input, size_t length) {
+    statsAdd(&stats, STAT_BYTES, length);
+    if (tokenWriter != NULL) {
+        TokenKind error = lexerTokenizeParallel(input, length, tokenWriter, NULL, lexThreads);
+        statsAdd(&stats, STAT_TOKENS, tokenWriter->tokenCount);
+        if (error != TK_EOF) printToken(error, NULL, 0);
+        return;
+    }
+    TokenStreamWriter tokens;
+    tokenStreamInit(&tokens, NULL);
+    printf("\nLexical Analysis:\n");
+    TokenKind error = lexerTokenizeParallel(input, length, &tokens, NULL, lexThreads);
+    statsAdd(&stats, STAT_TOKENS, tokens.tokenCount);
+    for (uint32_t i = 0; i < tokens.tokenCount; i++) {
+        const PackedToken *token = &tokens.tokens[i];
+        printToken((TokenKind)token->kind, input + token->offset, (int)token->length);
+    }
+    if (error != TK_EOF) printToken(error, NULL, 0);
+    tokenStreamFree(&tokens);
+}
+
+// Function to tokenize a stream chunk by chunk. A token cut by the end of a
+// chunk is moved to the front of the buffer and scanning resumes from the
+// saved DFA state, so memory use is bounded by the longest token.
+void lexicalAnalysisStream(FILE* stream) {
+    size_t capacity = STREAM_CHUNK_SIZE;
+    size_t kept = 0;  // Bytes of a partial token carried into the next read
+    char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+
+    if (tokenWriter == NULL) printf("\nLexical Analysis:\n");
+    lexer.state = S_START;
+    bufferOffset = 0;
+    while (1) {
+        if (kept == capacity) {  // A single token fills the buffer; grow it
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            if (buffer == NULL) {
+                fprintf(stderr, "Error: Out of memory\n");
                 exit(1);
             }
-        } else if (input[pos] < 32 || input[pos] > 126) {  // Check for control characters
-            // Skip control characters but don't output
-            pos++;
-        } else {
-            printf("Unknown token: %c\n", input[pos]);
-            pos++;
         }
+        size_t bytesRead = fread(buffer + kept, 1, capacity - kept, stream);
+        statsAdd(&stats, STAT_BYTES, bytesRead);
+        size_t length = kept + bytesRead;
+        int atEnd = (bytesRead == 0);
+
+        size_t consumed = lexBuffer(buffer, length, atEnd, kept);
+        if (atEnd) break;
+
+        kept = length - consumed;
+        bufferOffset += consumed;
+        memmove(buffer, buffer + consumed, kept);
+    }
+    free(buffer);
+}
+
+// Function to tokenize a file by mapping it into memory (no copy is made).
+// Falls back to the streaming reader when the file cannot be mapped.
+int lexicalAnalysisFile(const char* path) {
+    Source source;
+    if (sourceOpen(&source, path) && source.mapped) {
+        if (lexThreads > 1) lexicalAnalysisParallel(source.text, source.length);
+        else lexicalAnalysis(source.text, source.length);
+        sourceClose(&source);
+        return 1;
+    }
+    if (source.text != NULL) sourceClose(&source);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", path);
+        return 0;
     }
+    lexicalAnalysisStream(file);
+    fclose(file);
+    return 1;
 }
 
-int main() {
-    char input[MAX_INPUT_LENGTH] = ""; // Initialize input to an empty string
-    char line[MAX_INPUT_LENGTH];
+// Function to print the phase times and counters to stderr once. Also run
+// at exit, so that a lexical error, which exits early, is reported as well.
+void printTimeReport(void) {
+    if (timeReport < 0) return;
+    stats.counters[STAT_SYMBOLS] = symbolTable.count;
+    fflush(stdout);
+    statsPrint(&stats, stderr, timeReport);
+    timeReport = -1;
+}
 
-    printf("Enter a program (end with EOF (Ctrl+D on Unix or Ctrl+Z on Windows)): \n");
+// Function to print command-line usage
+void printUsage(const char* program) {
+    fprintf(stderr, "Usage: %s [--emit-tokens OUT] [-j N] [--time-report | --stats] [FILE]\n", program);
+    fprintf(stderr, "  FILE               source to tokenize (memory-mapped); stdin if omitted\n");
+    fprintf(stderr, "  --emit-tokens OUT  write a binary token stream to OUT ('-' for stdout)\n");
+    fprintf(stderr, "                     instead of printing one line per token\n");
+    fprintf(stderr, "  -j N               lex FILE in chunks on N threads (0 = one per processor)\n");
+    fprintf(stderr, "  --time-report      print time per phase and work counters to stderr\n");
+    fprintf(stderr, "  --stats            the same as JSON\n");
+}
 
-    // Read multiple lines of input until EOF
-    while (fgets(line, sizeof(line), stdin)) {
-        strncat(input, line, MAX_INPUT_LENGTH - strlen(input) - 1);
+int main(int argc, char* argv[]) {
+    const char *path = NULL;
+    const char *tokensPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--emit-tokens") == 0 && i + 1 < argc) {
+            tokensPath = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            int count = atoi(argv[++i]);
+            lexThreads = count > 0 ? (uint32_t)count : poolProcessorCount();
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            timeReport = 0;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            timeReport = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            path = argv[i];
+        }
     }
 
-    lexicalAnalysis(input);
+    statsInit(&stats);
+    internInit(&symbolTable);
+    if (timeReport >= 0) atexit(printTimeReport);
+    TokenStreamWriter writer;
+    if (tokensPath != NULL) {
+        tokenStreamInit(&writer, &symbolTable);
+        tokenWriter = &writer;
+    }
+
+    // With a file argument the source is memory-mapped instead of read from stdin
+    if (path != NULL) {
+        StatsClock start = statsNow();
+        if (!lexicalAnalysisFile(path)) return 1;
+        statsPhase(&stats, "lexicalAnalysis", start);
+    } else {
+        if (tokenWriter == NULL) {
+            printf("Enter a program (end with EOF (Ctrl+D on Unix or Ctrl+Z on Windows)): \n");
+        }
+        StatsClock start = statsNow();
+        lexicalAnalysisStream(stdin);
+        statsPhase(&stats, "lexicalAnalysis", start);
+    }
+
+    if (tokenWriter != NULL) {
+        StatsClock start = statsNow();
+        int fd = 1;
+        if (strcmp(tokensPath, "-") == 0) {
+            fflush(stdout);
+        } else {
+#ifndef _WIN32
+            fd = open(tokensPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+            fd = _open(tokensPath, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#endif
+        }
+        if (fd < 0 || !tokenStreamWrite(&writer, fd)) {
+            fprintf(stderr, "Error: Cannot write token stream to '%s'\n", tokensPath);
+            return 1;
+        }
+        if (fd != 1) close(fd);
+        tokenStreamFree(&writer);
+        statsPhase(&stats, "emitTokens", start);
+    }
+    printTimeReport();   // While the symbol table still exists
+    internFree(&symbolTable);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1363 @@
+#ifndef OPT_H
+#define OPT_H
+
+// SSA-based optimizer for TAC.
+//
+// The pipeline, selected by optimization level:
+//
+//   -O1  temp coalescing ("t = a op b; x = t" becomes "x = a op b"),
+//        sparse conditional constant propagation, copy propagation and
+//        dead-code elimination
+//   -O2  the above plus global value numbering (common subexpressions),
+//        loop rotation, loop-invariant code motion and strength reduction
+//        of induction variables, followed by another round of the SSA passes
+//
+// SSA form is built as a side structure rather than by renaming the code:
+// every definition, phi and initial variable value is an SSA value, and each
+// operand records the value that reaches it. Phis are placed at iterated
+// dominance frontiers for variables that are live across blocks (named
+// variables always are, since their final values are the program's result).
+//
+// Rewriting walks the dominator tree tracking which SSA value each variable
+// currently holds. An operand is replaced by a constant, or by another
+// variable only when that variable provably holds the same value at that
+// point. The code therefore never needs phi copies to leave SSA form.
+
+#include "cfg.h"
+
+#define OPT_NONE 0xFFFFFFFFu
+#define OPT_KEY_VALUE 7u   // Operand tag used for value numbers in GVN keys
+
+enum { SSA_DEF, SSA_PHI, SSA_ENTRY };
+enum { LAT_TOP, LAT_CONST, LAT_BOTTOM };
+
+typedef struct {
+    uint8_t kind;        // SSA_DEF, SSA_PHI or SSA_ENTRY (value on entry)
+    uint8_t lattice;     // Constant propagation state
+    uint8_t live;
+    uint32_t var;        // Variable index
+    uint32_t block;
+    uint32_t where;      // Quad (SSA_DEF) or phi (SSA_PHI) index
+    uint32_t number;     // Value number: the first dominating equal value
+    int32_t constant;
+} SsaValue;
+
+typedef struct {
+    uint32_t block;
+    uint32_t var;
+    uint32_t value;
+    uint32_t args;       // Start in phiArgs; one argument per predecessor
+} SsaPhi;
+
+typedef struct {
+    uint64_t key[2];
+    uint32_t value;
+    uint32_t next;
+} OptExpr;
+
+typedef struct {
+    TacBuffer *code;
+    Cfg cfg;
+    int level;
+
+    uint32_t nameCount;    // Variables are names (TAC_VAR) then temporaries
+    uint32_t varCount;
+    uint8_t *isGlobal;     // Live across a block boundary
+    uint8_t *isNamed;
+
+    SsaValue *values;
+    uint32_t valueCount;
+    uint32_t valueCapacity;
+    uint32_t *entryValue;  // Per variable, created on first use
+
+    SsaPhi *phis;
+    uint32_t phiCount;
+    uint32_t phiCapacity;
+    uint32_t *phiArgs;
+    uint32_t phiArgCount;
+    uint32_t phiArgCapacity;
+    uint32_t *blockPhiStart;   // Phis of block b: blockPhis[blockPhiStart[b] ..]
+    uint32_t *blockPhis;
+
+    uint32_t *defValue;    // Per quad
+    uint32_t *quadBlock;   // Per quad
+    uint32_t *useValue;    // Per quad, two slots (arg1, arg2)
+
+    uint32_t *current;     // Value each variable holds during a walk
+    uint32_t *undo;        // (var, previous value) pairs
+    uint32_t undoCount;
+    uint32_t undoCapacity;
+
+    // Constant propagation
+    uint32_t *userStart;   // Users of value v: users[userStart[v] ..]
+    uint32_t *users;       // Quad index, or phi index | 0x80000000
+    uint32_t *predEdge;    // Succ slot of the edge behind each pred slot
+    uint8_t *edgeExec;
+    uint8_t *blockExec;
+    uint32_t *work;
+    uint32_t workCount;
+    uint32_t workCapacity;
+
+    // Value numbering
+    OptExpr *exprs;
+    uint32_t exprCount;
+    uint32_t exprCapacity;
+    uint32_t *exprBuckets;
+    uint32_t exprBucketCount;
+
+    uint32_t *roots;       // Values live at program exit
+    uint32_t rootCount;
+    uint32_t rootCapacity;
+} Optimizer;
+
+static inline uint32_t optExprBucket(const Optimizer *opt, uint64_t key0, uint64_t key1) {
+    uint64_t hash = key0 * 0x9E3779B97F4A7C15ull ^ key1;
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 32;
+    return (uint32_t)hash & (opt->exprBucketCount - 1);
+}
+
+// Function to grow an array of uint32_t so that index count is valid
+static inline uint32_t *optGrow(uint32_t *array, uint32_t count, uint32_t *capacity) {
+    if (count >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        array = internAlloc(array, (size_t)*capacity * sizeof(uint32_t));
+    }
+    return array;
+}
+
+static inline void *optZeroed(size_t count, size_t size) {
+    void *array = calloc(count ? count : 1, size);
+    if (array == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+static inline uint32_t optVarIndex(const Optimizer *opt, uint32_t operand) {
+    return tacVarIndex(opt->code, operand);
+}
+
+static inline uint32_t optVarOperand(const Optimizer *opt, uint32_t var) {
+    return tacVarOperand(opt->code, var);
+}
+
+// ---------------------------------------------------------------------------
+// Cleanup passes on plain TAC
+
+// Function to drop NOPs, keeping the quads in order
+static inline void optCompact(TacBuffer *code) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < code->count; i++) {
+        if (code->code[i].op != TAC_NOP) code->code[kept++] = code->code[i];
+    }
+    code->count = kept;
+}
+
+// Function to fold "t = a op b; x = t" into "x = a op b" when t is a
+// temporary defined and used exactly once
+static inline void optCoalesceTemps(TacBuffer *code) {
+    uint8_t *uses = optZeroed(code->tempCount, 1);
+    uint8_t *defs = optZeroed(code->tempCount, 1);
+    for (uint32_t i = 0; i < code->count; i++) {
+        const TacQuad *quad = &code->code[i];
+        uint32_t operands[2] = {quad->arg1, quad->arg2};
+        for (int k = 0; k < 2; k++) {
+            if (TAC_TAG(operands[k]) == TAC_TEMP && uses[TAC_VALUE(operands[k])] < 2) uses[TAC_VALUE(operands[k])]++;
+        }
+        if (tacDefines((TacOp)quad->op) && TAC_TAG(quad->result) == TAC_TEMP && defs[TAC_VALUE(quad->result)] < 2) {
+            defs[TAC_VALUE(quad->result)]++;
+        }
+    }
+    for (uint32_t i = 0; i + 1 < code->count; i++) {
+        TacQuad *quad = &code->code[i], *next = &code->code[i + 1];
+        if (tacDefines((TacOp)quad->op) && TAC_TAG(quad->result) == TAC_TEMP && next->op == TAC_COPY &&
+            next->arg1 == quad->result && defs[TAC_VALUE(quad->result)] == 1 && uses[TAC_VALUE(quad->result)] == 1) {
+            quad->result = next->result;
+            next->op = TAC_NOP;
+            i++;
+        }
+    }
+    free(uses);
+    free(defs);
+    optCompact(code);
+}
+
+// Function to remove jumps to the very next quad and labels nobody jumps to
+static inline void optCleanJumps(TacBuffer *code) {
+    for (uint32_t i = 0; i + 1 < code->count; i++) {
+        const TacQuad *quad = &code->code[i], *next = &code->code[i + 1];
+        if ((quad->op == TAC_GOTO || quad->op == TAC_IF) && next->op == TAC_LABEL && next->result == quad->result) {
+            code->code[i].op = TAC_NOP;  // A conditional jump here has pure operands
+        }
+    }
+    uint8_t *used = optZeroed(code->labelCount, 1);
+    for (uint32_t i = 0; i < code->count; i++) {
+        const TacQuad *quad = &code->code[i];
+        if (quad->op == TAC_GOTO || quad->op == TAC_IF) used[TAC_VALUE(quad->result)] = 1;
+    }
+    for (uint32_t i = 0; i < code->count; i++) {
+        if (code->code[i].op == TAC_LABEL && !used[TAC_VALUE(code->code[i].result)]) code->code[i].op = TAC_NOP;
+    }
+    free(used);
+    optCompact(code);
+}
+
+// ---------------------------------------------------------------------------
+// SSA construction
+
+static inline uint32_t optNewValue(Optimizer *opt, int kind, uint32_t var, uint32_t block, uint32_t where) {
+    if (opt->valueCount == opt->valueCapacity) {
+        opt->valueCapacity = opt->valueCapacity ? opt->valueCapacity * 2 : 1024;
+        opt->values = internAlloc(opt->values, (size_t)opt->valueCapacity * sizeof(SsaValue));
+    }
+    SsaValue *value = &opt->values[opt->valueCount];
+    value->kind = (uint8_t)kind;
+    value->lattice = kind == SSA_ENTRY ? LAT_BOTTOM : LAT_TOP;
+    value->live = 0;
+    value->var = var;
+    value->block = block;
+    value->where = where;
+    value->number = opt->valueCount;
+    value->constant = 0;
+    return opt->valueCount++;
+}
+
+// Function to get the value a variable holds during the current walk
+static inline uint32_t optCurrent(Optimizer *opt, uint32_t var) {
+    if (opt->current[var] != OPT_NONE) return opt->current[var];
+    if (opt->entryValue[var] == OPT_NONE) opt->entryValue[var] = optNewValue(opt, SSA_ENTRY, var, 0, 0);
+    return opt->entryValue[var];
+}
+
+static inline void optSetCurrent(Optimizer *opt, uint32_t var, uint32_t value) {
+    opt->undo = optGrow(opt->undo, opt->undoCount + 1, &opt->undoCapacity);
+    opt->undo[opt->undoCount++] = var;
+    opt->undo[opt->undoCount++] = opt->current[var];
+    opt->current[var] = value;
+}
+
+// Function to find variables live across blocks and where phis are needed
+static inline void optPlacePhis(Optimizer *opt) {
+    const TacBuffer *code = opt->code;
+    Cfg *cfg = &opt->cfg;
+    uint32_t n = cfg->blockCount;
+
+    // A variable is global if some block reads it before writing it
+    uint32_t *lastDefBlock = internAlloc(NULL, ((size_t)opt->varCount + 1) * sizeof(uint32_t));
+    memset(lastDefBlock, 0xFF, ((size_t)opt->varCount + 1) * sizeof(uint32_t));
+    for (uint32_t b = 0; b < n; b++) {
+        for (uint32_t i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            const TacQuad *quad = &code->code[i];
+            if (quad->op == TAC_LABEL || quad->op == TAC_GOTO) continue;
+            uint32_t operands[2] = {quad->arg1, quad->arg2};
+            for (int k = 0; k < 2; k++) {
+                uint32_t var = optVarIndex(opt, operands[k]);
+                if (var != OPT_NONE && lastDefBlock[var] != b) opt->isGlobal[var] = 1;
+            }
+            uint32_t def = tacDefines((TacOp)quad->op) ? optVarIndex(opt, quad->result) : OPT_NONE;
+            if (def != OPT_NONE) lastDefBlock[def] = b;
+        }
+    }
+
+    // Dominance frontiers (Cooper, Harvey, Kennedy), as pairs then grouped.
+    // A walk stops at a block an earlier predecessor's walk already gave b,
+    // as everything above it has b too; otherwise a join of n short-circuit
+    // terms would produce n^2 / 2 pairs.
+    uint32_t *pairs = NULL, pairCount = 0, pairCapacity = 0;
+    uint32_t *frontierOf = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    memset(frontierOf, 0xFF, ((size_t)n + 1) * sizeof(uint32_t));
+    for (uint32_t b = 0; b < n; b++) {
+        if (cfg->idom[b] == CFG_NONE || cfg->predStart[b + 1] - cfg->predStart[b] < 2) continue;
+        for (uint32_t p = cfg->predStart[b]; p < cfg->predStart[b + 1]; p++) {
+            uint32_t runner = cfg->pred[p];
+            if (cfg->idom[runner] == CFG_NONE) continue;
+            while (runner != cfg->idom[b] && frontierOf[runner] != b) {
+                frontierOf[runner] = b;
+                pairs = optGrow(pairs, pairCount + 1, &pairCapacity);
+                pairs[pairCount++] = runner;
+                pairs[pairCount++] = b;
+                runner = cfg->idom[runner];
+            }
+        }
+    }
+    free(frontierOf);
+    uint32_t *dfStart = optZeroed((size_t)n + 1, sizeof(uint32_t));
+    uint32_t *df = internAlloc(NULL, ((size_t)pairCount / 2 + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < pairCount; i += 2) dfStart[pairs[i] + 1]++;
+    for (uint32_t b = 0; b < n; b++) dfStart[b + 1] += dfStart[b];
+    uint32_t *fill = optZeroed((size_t)n + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < pairCount; i += 2) df[dfStart[pairs[i]] + fill[pairs[i]]++] = pairs[i + 1];
+    free(pairs);
+
+    // Definition blocks of each global variable, grouped by variable
+    uint32_t *defStart = optZeroed((size_t)opt->varCount + 1, sizeof(uint32_t));
+    for (uint32_t b = 0; b < n; b++) {
+        if (cfg->idom[b] == CFG_NONE) continue;
+        for (uint32_t i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            uint32_t def = tacDefines((TacOp)code->code[i].op) ? optVarIndex(opt, code->code[i].result) : OPT_NONE;
+            if (def != OPT_NONE && opt->isGlobal[def]) defStart[def + 1]++;
+        }
+    }
+    for (uint32_t v = 0; v < opt->varCount; v++) defStart[v + 1] += defStart[v];
+    uint32_t *defBlocks = internAlloc(NULL, ((size_t)defStart[opt->varCount] + 1) * sizeof(uint32_t));
+    memset(lastDefBlock, 0, ((size_t)opt->varCount + 1) * sizeof(uint32_t));
+    for (uint32_t b = 0; b < n; b++) {
+        if (cfg->idom[b] == CFG_NONE) continue;
+        for (uint32_t i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            uint32_t def = tacDefines((TacOp)code->code[i].op) ? optVarIndex(opt, code->code[i].result) : OPT_NONE;
+            if (def != OPT_NONE && opt->isGlobal[def]) defBlocks[defStart[def] + lastDefBlock[def]++] = b;
+        }
+    }
+
+    // Iterated dominance frontier per variable; stamps avoid clearing per variable
+    uint32_t *hasPhi = optZeroed((size_t)n + 1, sizeof(uint32_t));
+    uint32_t *queued = optZeroed((size_t)n + 1, sizeof(uint32_t));
+    uint32_t *queue = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    uint32_t *phiBlockCount = optZeroed((size_t)n + 1, sizeof(uint32_t));
+    for (uint32_t var = 0; var < opt->varCount; var++) {
+        if (!opt->isGlobal[var]) continue;
+        uint32_t stamp = var + 1, head = 0, tail = 0;
+        for (uint32_t d = defStart[var]; d < defStart[var + 1]; d++) {
+            if (queued[defBlocks[d]] != stamp) {
+                queued[defBlocks[d]] = stamp;
+                queue[tail++] = defBlocks[d];
+            }
+        }
+        while (head < tail) {
+            uint32_t b = queue[head++];
+            for (uint32_t f = dfStart[b]; f < dfStart[b + 1]; f++) {
+                uint32_t join = df[f];
+                if (hasPhi[join] == stamp) continue;
+                hasPhi[join] = stamp;
+                if (opt->phiCount == opt->phiCapacity) {
+                    opt->phiCapacity = opt->phiCapacity ? opt->phiCapacity * 2 : 256;
+                    opt->phis = internAlloc(opt->phis, (size_t)opt->phiCapacity * sizeof(SsaPhi));
+                }
+                SsaPhi *phi = &opt->phis[opt->phiCount];
+                uint32_t predCount = cfg->predStart[join + 1] - cfg->predStart[join];
+                phi->block = join;
+                phi->var = var;
+                phi->value = optNewValue(opt, SSA_PHI, var, join, opt->phiCount);
+                phi->args = opt->phiArgCount;
+                for (uint32_t k = 0; k < predCount; k++) {
+                    opt->phiArgs = optGrow(opt->phiArgs, opt->phiArgCount, &opt->phiArgCapacity);
+                    opt->phiArgs[opt->phiArgCount++] = OPT_NONE;
+                }
+                opt->phiCount++;
+                phiBlockCount[join]++;
+                if (queued[join] != stamp) {
+                    queued[join] = stamp;
+                    queue[tail++] = join;
+                }
+            }
+        }
+    }
+
+    opt->blockPhiStart = optZeroed((size_t)n + 1, sizeof(uint32_t));
+    cfgPrefixSum(opt->blockPhiStart, phiBlockCount, n);
+    opt->blockPhis = internAlloc(NULL, ((size_t)opt->phiCount + 1) * sizeof(uint32_t));
+    memset(phiBlockCount, 0, ((size_t)n + 1) * sizeof(uint32_t));
+    for (uint32_t p = 0; p < opt->phiCount; p++) {
+        uint32_t b = opt->phis[p].block;
+        opt->blockPhis[opt->blockPhiStart[b] + phiBlockCount[b]++] = p;
+    }
+
+    free(lastDefBlock);
+    free(dfStart);
+    free(df);
+    free(fill);
+    free(defStart);
+    free(defBlocks);
+    free(hasPhi);
+    free(queued);
+    free(queue);
+    free(phiBlockCount);
+}
+
+// ---------------------------------------------------------------------------
+// Dominator-tree walks
+
+enum { OPT_RENAME, OPT_REWRITE };
+
+static inline void optRenameBlock(Optimizer *opt, uint32_t b);
+static inline void optRewriteBlock(Optimizer *opt, uint32_t b);
+
+// Function to visit the dominator tree depth-first, undoing each block's
+// changes to current[] (and to the expression table) when leaving it
+static inline void optWalk(Optimizer *opt, int mode) {
+    Cfg *cfg = &opt->cfg;
+    if (cfg->blockCount == 0) return;
+    memset(opt->current, 0xFF, (size_t)opt->varCount * sizeof(uint32_t));
+    opt->undoCount = 0;
+    uint32_t *stack = internAlloc(NULL, (size_t)cfg->blockCount * 4 * sizeof(uint32_t));
+    uint32_t top = 0;
+    stack[top++] = 0;
+    stack[top++] = 0;
+    stack[top++] = opt->undoCount;
+    stack[top++] = opt->exprCount;
+    if (mode == OPT_RENAME) optRenameBlock(opt, 0);
+    else optRewriteBlock(opt, 0);
+    while (top > 0) {
+        uint32_t b = stack[top - 4];
+        uint32_t next = cfg->domChildStart[b] + stack[top - 3];
+        if (next < cfg->domChildStart[b + 1]) {
+            stack[top - 3]++;
+            uint32_t child = cfg->domChild[next];
+            if (mode == OPT_REWRITE && !opt->blockExec[child]) continue;
+            stack[top++] = child;
+            stack[top++] = 0;
+            stack[top++] = opt->undoCount;
+            stack[top++] = opt->exprCount;
+            if (mode == OPT_RENAME) optRenameBlock(opt, child);
+            else optRewriteBlock(opt, child);
+        } else {
+            // Leave b: restore variables and drop its expressions
+            uint32_t undoMark = stack[top - 2], exprMark = stack[top - 1];
+            while (opt->undoCount > undoMark) {
+                opt->undoCount -= 2;
+                opt->current[opt->undo[opt->undoCount]] = opt->undo[opt->undoCount + 1];
+            }
+            while (opt->exprCount > exprMark) {
+                const OptExpr *expr = &opt->exprs[--opt->exprCount];
+                opt->exprBuckets[optExprBucket(opt, expr->key[0], expr->key[1])] = expr->next;
+            }
+            top -= 4;
+        }
+    }
+    free(stack);
+}
+
+static inline void optRenameBlock(Optimizer *opt, uint32_t b) {
+    const Cfg *cfg = &opt->cfg;
+    const TacBuffer *code = opt->code;
+    for (uint32_t p = opt->blockPhiStart[b]; p < opt->blockPhiStart[b + 1]; p++) {
+        const SsaPhi *phi = &opt->phis[opt->blockPhis[p]];
+        optSetCurrent(opt, phi->var, phi->value);
+    }
+    for (uint32_t i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+        const TacQuad *quad = &code->code[i];
+        if (quad->op != TAC_LABEL && quad->op != TAC_GOTO) {
+            uint32_t var1 = optVarIndex(opt, quad->arg1), var2 = optVarIndex(opt, quad->arg2);
+            if (var1 != OPT_NONE) opt->useValue[2 * i] = optCurrent(opt, var1);
+            if (var2 != OPT_NONE) opt->useValue[2 * i + 1] = optCurrent(opt, var2);
+        }
+        uint32_t def = tacDefines((TacOp)quad->op) ? optVarIndex(opt, quad->result) : OPT_NONE;
+        if (def != OPT_NONE) {
+            opt->defValue[i] = optNewValue(opt, SSA_DEF, def, b, i);
+            optSetCurrent(opt, def, opt->defValue[i]);
+        }
+    }
+    // Fill this block's slot in the phis of its successors
+    for (uint32_t s = cfg->succStart[b]; s < cfg->succStart[b + 1]; s++) {
+        uint32_t succ = cfg->succ[s], slot = 0;
+        while (cfg->pred[cfg->predStart[succ] + slot] != b) slot++;
+        for (uint32_t p = opt->blockPhiStart[succ]; p < opt->blockPhiStart[succ + 1]; p++) {
+            const SsaPhi *phi = &opt->phis[opt->blockPhis[p]];
+            opt->phiArgs[phi->args + slot] = optCurrent(opt, phi->var);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Sparse conditional constant propagation (Wegman and Zadeck)
+
+static inline void optPush(Optimizer *opt, uint32_t item) {
+    opt->work = optGrow(opt->work, opt->workCount, &opt->workCapacity);
+    opt->work[opt->workCount++] = item;
+}
+
+// Function to lower a value in the lattice, queueing it when it changes
+static inline void optLower(Optimizer *opt, uint32_t v, int lattice, int32_t constant) {
+    SsaValue *value = &opt->values[v];
+    if (lattice == LAT_CONST && value->lattice == LAT_CONST && value->constant != constant) lattice = LAT_BOTTOM;
+    if (lattice <= value->lattice) return;
+    value->lattice = (uint8_t)lattice;
+    value->constant = constant;
+    optPush(opt, v);
+}
+
+// Function to get the lattice state of an operand
+static inline int optOperandLattice(const Optimizer *opt, uint32_t operand, uint32_t value, int32_t *constant) {
+    if (TAC_TAG(operand) == TAC_IMM) {
+        *constant = tacImmValue(operand);
+        return LAT_CONST;
+    }
+    if (value == OPT_NONE) return LAT_BOTTOM;  // Literal that is not an immediate
+    *constant = opt->values[value].constant;
+    return opt->values[value].lattice;
+}
+
+// Function to evaluate an operation on constants. Returns 0 if the result is
+// not known at compile time or does not fit an immediate.
+static inline int optFold(TacOp op, int32_t a, int32_t b, int32_t *result) {
+    int64_t value;
+    switch (op) {
+        case TAC_COPY: value = a; break;
+        case TAC_ADD: value = (int64_t)a + b; break;
+        case TAC_SUB: value = (int64_t)a - b; break;
+        case TAC_MUL: value = (int64_t)a * b; break;
+        case TAC_DIV: if (b == 0) return 0; value = (int64_t)a / b; break;
+        case TAC_MOD: if (b == 0) return 0; value = (int64_t)a % b; break;
+        case TAC_LT: value = a < b; break;
+        case TAC_LE: value = a <= b; break;
+        case TAC_GT: value = a > b; break;
+        case TAC_GE: value = a >= b; break;
+        case TAC_EQ: value = a == b; break;
+        case TAC_NE: value = a != b; break;
+        case TAC_NEG: value = -(int64_t)a; break;
+        case TAC_NOT: value = !a; break;
+        default: return 0;
+    }
+    if (value < TAC_IMM_MIN || value > TAC_IMM_MAX) return 0;
+    *result = (int32_t)value;
+    return 1;
+}
+
+// Function to evaluate a quad's operands: LAT_CONST with the folded result,
+// LAT_TOP if an operand is still unknown, LAT_BOTTOM otherwise
+static inline int optEvaluate(const Optimizer *opt, uint32_t i, TacOp op, int32_t *result) {
+    const TacQuad *quad = &opt->code->code[i];
+    int32_t a = 0, b = 0;
+    int latticeA = optOperandLattice(opt, quad->arg1, opt->useValue[2 * i], &a);
+    int latticeB = (op == TAC_COPY || op == TAC_NEG || op == TAC_NOT) ? LAT_CONST
+                   : optOperandLattice(opt, quad->arg2, opt->useValue[2 * i + 1], &b);
+    if (latticeA == LAT_BOTTOM || latticeB == LAT_BOTTOM) return LAT_BOTTOM;
+    if (latticeA == LAT_TOP || latticeB == LAT_TOP) return LAT_TOP;
+    return optFold(op, a, b, result) ? LAT_CONST : LAT_BOTTOM;
+}
+
+static inline void optMarkEdge(Optimizer *opt, uint32_t b, uint32_t target) {
+    for (uint32_t s = opt->cfg.succStart[b]; s < opt->cfg.succStart[b + 1]; s++) {
+        if (opt->cfg.succ[s] == target && !opt->edgeExec[s]) {
+            opt->edgeExec[s] = 1;
+            optPush(opt, 0x80000000u | s);
+        }
+    }
+}
+
+static inline void optVisitPhi(Optimizer *opt, uint32_t p) {
+    const SsaPhi *phi = &opt->phis[p];
+    const Cfg *cfg = &opt->cfg;
+    int lattice = LAT_TOP;
+    int32_t constant = 0;
+    for (uint32_t k = cfg->predStart[phi->block]; k < cfg->predStart[phi->block + 1]; k++) {
+        if (!opt->edgeExec[opt->predEdge[k]]) continue;
+        const SsaValue *arg = &opt->values[opt->phiArgs[phi->args + (k - cfg->predStart[phi->block])]];
+        if (arg->lattice == LAT_TOP) continue;
+        if (arg->lattice == LAT_BOTTOM || (lattice == LAT_CONST && arg->constant != constant)) {
+            lattice = LAT_BOTTOM;
+            break;
+        }
+        lattice = LAT_CONST;
+        constant = arg->constant;
+    }
+    if (lattice != LAT_TOP) optLower(opt, phi->value, lattice, constant);
+}
+
+static inline void optVisitQuad(Optimizer *opt, uint32_t i) {
+    int32_t result = 0;
+    if (opt->defValue[i] != OPT_NONE) {
+        int lattice = optEvaluate(opt, i, (TacOp)opt->code->code[i].op, &result);
+        if (lattice != LAT_TOP) optLower(opt, opt->defValue[i], lattice, result);
+    }
+}
+
+// Function to decide which successors of block b a conditional jump reaches
+static inline void optVisitBranch(Optimizer *opt, uint32_t b) {
+    const Cfg *cfg = &opt->cfg;
+    uint32_t last = cfg->blocks[b].end - 1;
+    const TacQuad *quad = &opt->code->code[last];
+    if (quad->op != TAC_IF) {
+        for (uint32_t s = cfg->succStart[b]; s < cfg->succStart[b + 1]; s++) optMarkEdge(opt, b, cfg->succ[s]);
+        return;
+    }
+    int32_t taken = 0;
+    int lattice = optEvaluate(opt, last, (TacOp)quad->cond, &taken);
+    if (lattice == LAT_TOP) return;
+    uint32_t jump = cfgLabelTarget(cfg, quad->result);
+    uint32_t fall = b + 1 < cfg->blockCount ? b + 1 : CFG_NONE;
+    if (lattice == LAT_BOTTOM || jump == fall) {
+        for (uint32_t s = cfg->succStart[b]; s < cfg->succStart[b + 1]; s++) optMarkEdge(opt, b, cfg->succ[s]);
+    } else {
+        optMarkEdge(opt, b, taken ? jump : fall);
+    }
+}
+
+static inline void optPropagateConstants(Optimizer *opt) {
+    const Cfg *cfg = &opt->cfg;
+    uint32_t n = cfg->blockCount;
+    if (n == 0) return;
+
+    // Users of each value, and the succ slot behind each pred slot
+    opt->userStart = optZeroed((size_t)opt->valueCount + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < 2 * opt->code->count; i++) {
+        if (opt->useValue[i] != OPT_NONE) opt->userStart[opt->useValue[i] + 1]++;
+    }
+    for (uint32_t p = 0; p < opt->phiCount; p++) {
+        uint32_t count = cfg->predStart[opt->phis[p].block + 1] - cfg->predStart[opt->phis[p].block];
+        for (uint32_t k = 0; k < count; k++) {
+            uint32_t v = opt->phiArgs[opt->phis[p].args + k];
+            if (v != OPT_NONE) opt->userStart[v + 1]++;
+        }
+    }
+    for (uint32_t v = 0; v < opt->valueCount; v++) opt->userStart[v + 1] += opt->userStart[v];
+    opt->users = internAlloc(NULL, ((size_t)opt->userStart[opt->valueCount] + 1) * sizeof(uint32_t));
+    uint32_t *fill = optZeroed((size_t)opt->valueCount + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < 2 * opt->code->count; i++) {
+        uint32_t v = opt->useValue[i];
+        if (v != OPT_NONE) opt->users[opt->userStart[v] + fill[v]++] = i / 2;
+    }
+    for (uint32_t p = 0; p < opt->phiCount; p++) {
+        uint32_t count = cfg->predStart[opt->phis[p].block + 1] - cfg->predStart[opt->phis[p].block];
+        for (uint32_t k = 0; k < count; k++) {
+            uint32_t v = opt->phiArgs[opt->phis[p].args + k];
+            if (v != OPT_NONE) opt->users[opt->userStart[v] + fill[v]++] = 0x80000000u | p;
+        }
+    }
+    free(fill);
+    opt->predEdge = internAlloc(NULL, ((size_t)cfg->predStart[n] + 1) * sizeof(uint32_t));
+    for (uint32_t b = 0; b < n; b++) {
+        for (uint32_t s = cfg->succStart[b]; s < cfg->succStart[b + 1]; s++) {
+            uint32_t succ = cfg->succ[s], slot = cfg->predStart[succ];
+            while (cfg->pred[slot] != b) slot++;
+            opt->predEdge[slot] = s;
+        }
+    }
+    opt->edgeExec = optZeroed((size_t)cfg->succStart[n] + 1, 1);
+    opt->blockExec = optZeroed((size_t)n + 1, 1);
+
+    // Work items: a value whose lattice dropped, or (top bit set) an edge
+    // that became executable. The entry block is reached unconditionally.
+    int first = 1;
+    while (first || opt->workCount > 0) {
+        uint32_t b = 0;
+        if (first) {
+            first = 0;
+        } else {
+            uint32_t item = opt->work[--opt->workCount];
+            if (!(item & 0x80000000u)) {
+                for (uint32_t u = opt->userStart[item]; u < opt->userStart[item + 1]; u++) {
+                    uint32_t user = opt->users[u];
+                    if (user & 0x80000000u) {
+                        if (opt->blockExec[opt->phis[user & 0x7FFFFFFFu].block]) optVisitPhi(opt, user & 0x7FFFFFFFu);
+                    } else {
+                        uint32_t block = opt->quadBlock[user];
+                        if (!opt->blockExec[block]) continue;
+                        optVisitQuad(opt, user);
+                        if (user == cfg->blocks[block].end - 1) optVisitBranch(opt, block);
+                    }
+                }
+                continue;
+            }
+            // Edge item: re-evaluate the target's phis, and its body on first visit
+            uint32_t slot = item & 0x7FFFFFFFu;
+            b = cfg->succ[slot];
+            if (opt->blockExec[b]) {
+                for (uint32_t p = opt->blockPhiStart[b]; p < opt->blockPhiStart[b + 1]; p++) {
+                    optVisitPhi(opt, opt->blockPhis[p]);
+                }
+                continue;
+            }
+        }
+        opt->blockExec[b] = 1;
+        for (uint32_t p = opt->blockPhiStart[b]; p < opt->blockPhiStart[b + 1]; p++) optVisitPhi(opt, opt->blockPhis[p]);
+        for (uint32_t i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) optVisitQuad(opt, i);
+        optVisitBranch(opt, b);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Value numbering, copy propagation and rewriting
+
+// Function to describe an operand for value numbering: immediates and
+// literals stand for themselves, variables for their value number
+static inline uint32_t optKey(const Optimizer *opt, uint32_t operand, uint32_t value) {
+    if (value == OPT_NONE) return operand;
+    const SsaValue *ssa = &opt->values[value];
+    if (ssa->lattice == LAT_CONST) return tacImm(ssa->constant);
+    return TAC_OPERAND(OPT_KEY_VALUE, ssa->number);
+}
+
+static inline uint32_t optLookupExpr(Optimizer *opt, uint64_t key0, uint64_t key1, uint32_t value) {
+    uint32_t bucket = optExprBucket(opt, key0, key1);
+    for (uint32_t e = opt->exprBuckets[bucket]; e != OPT_NONE; e = opt->exprs[e].next) {
+        if (opt->exprs[e].key[0] == key0 && opt->exprs[e].key[1] == key1) return opt->exprs[e].value;
+    }
+    if (opt->exprCount == opt->exprCapacity) {
+        opt->exprCapacity = opt->exprCapacity ? opt->exprCapacity * 2 : 1024;
+        opt->exprs = internAlloc(opt->exprs, (size_t)opt->exprCapacity * sizeof(OptExpr));
+    }
+    OptExpr *expr = &opt->exprs[opt->exprCount];
+    expr->key[0] = key0;
+    expr->key[1] = key1;
+    expr->value = value;
+    expr->next = opt->exprBuckets[bucket];
+    opt->exprBuckets[bucket] = opt->exprCount++;
+    return value;
+}
+
+// Function to check that the variable holding value v still holds it in
+// block b at the current point of the walk
+static inline int optAvailable(Optimizer *opt, uint32_t v, uint32_t b) {
+    const SsaValue *value = &opt->values[v];
+    if (!opt->isGlobal[value->var] && value->block != b) return 0;
+    return optCurrent(opt, value->var) == v;
+}
+
+// Function to rewrite one operand slot of quad i
+static inline void optRewriteOperand(Optimizer *opt, uint32_t i, int slot, uint32_t b) {
+    TacQuad *quad = &opt->code->code[i];
+    uint32_t *operand = slot == 0 ? &quad->arg1 : &quad->arg2;
+    uint32_t v = opt->useValue[2 * i + slot];
+    if (v == OPT_NONE) return;
+    const SsaValue *value = &opt->values[v];
+    if (value->lattice == LAT_CONST) {
+        *operand = tacImm(value->constant);
+        opt->useValue[2 * i + slot] = OPT_NONE;
+    } else if (value->number != v && optAvailable(opt, value->number, b)) {
+        *operand = optVarOperand(opt, opt->values[value->number].var);
+        opt->useValue[2 * i + slot] = value->number;
+    }
+}
+
+static inline void optRewriteBlock(Optimizer *opt, uint32_t b) {
+    const Cfg *cfg = &opt->cfg;
+    TacBuffer *code = opt->code;
+    for (uint32_t p = opt->blockPhiStart[b]; p < opt->blockPhiStart[b + 1]; p++) {
+        const SsaPhi *phi = &opt->phis[opt->blockPhis[p]];
+        SsaValue *value = &opt->values[phi->value];
+        // A phi whose reachable arguments are all the same value is that value
+        uint32_t same = OPT_NONE;
+        for (uint32_t k = cfg->predStart[b]; k < cfg->predStart[b + 1]; k++) {
+            if (!opt->edgeExec[opt->predEdge[k]]) continue;
+            uint32_t arg = opt->values[opt->phiArgs[phi->args + (k - cfg->predStart[b])]].number;
+            if (same == OPT_NONE) same = arg;
+            else if (same != arg) same = phi->value;
+        }
+        if (same != OPT_NONE && same != phi->value && opt->values[same].block != b) value->number = same;
+        optSetCurrent(opt, phi->var, phi->value);
+    }
+
+    for (uint32_t i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+        TacQuad *quad = &code->code[i];
+        if (quad->op == TAC_LABEL || quad->op == TAC_GOTO) continue;
+        optRewriteOperand(opt, i, 0, b);
+        optRewriteOperand(opt, i, 1, b);
+
+        if (quad->op == TAC_IF) {
+            // Fold the jump when constant propagation found only one way out
+            uint32_t jump = cfgLabelTarget(cfg, quad->result), jumpExec = 0, otherExec = 0;
+            for (uint32_t s = cfg->succStart[b]; s < cfg->succStart[b + 1]; s++) {
+                if (cfg->succ[s] == jump) jumpExec |= opt->edgeExec[s];
+                else otherExec |= opt->edgeExec[s];
+            }
+            if (b + 1 == cfg->blockCount) {
+                // Falling off the end of the code is a way out too, though not an edge
+                int32_t taken = 0;
+                otherExec |= optEvaluate(opt, i, (TacOp)quad->cond, &taken) != LAT_CONST || !taken;
+            }
+            if (!(jumpExec && otherExec)) {
+                quad->op = jumpExec && cfg->succStart[b + 1] - cfg->succStart[b] > 1 ? TAC_GOTO : TAC_NOP;
+                quad->arg1 = quad->arg2 = TAC_NONE;
+                opt->useValue[2 * i] = opt->useValue[2 * i + 1] = OPT_NONE;
+            }
+            continue;
+        }
+        uint32_t v = opt->defValue[i];
+        if (v == OPT_NONE) continue;
+        SsaValue *value = &opt->values[v];
+        if (value->lattice == LAT_CONST) {
+            quad->op = TAC_COPY;
+            quad->arg1 = tacImm(value->constant);
+            quad->arg2 = TAC_NONE;
+            opt->useValue[2 * i] = opt->useValue[2 * i + 1] = OPT_NONE;
+        } else {
+            uint32_t key1 = optKey(opt, quad->arg1, opt->useValue[2 * i]);
+            uint32_t key2 = optKey(opt, quad->arg2, opt->useValue[2 * i + 1]);
+            if (quad->op == TAC_COPY) {
+                if (TAC_TAG(key1) == OPT_KEY_VALUE) value->number = TAC_VALUE(key1);
+            } else if (opt->level >= 2) {
+                TacOp op = (TacOp)quad->op;
+                if ((op == TAC_ADD || op == TAC_MUL || op == TAC_EQ || op == TAC_NE) && key1 > key2) {
+                    uint32_t t = key1;
+                    key1 = key2;
+                    key2 = t;
+                }
+                value->number = optLookupExpr(opt, op, ((uint64_t)key1 << 32) | key2, v);
+            }
+            uint32_t leader = value->number;
+            if (leader != v && optAvailable(opt, leader, b)) {
+                if (opt->values[leader].var == value->var) {
+                    quad->op = TAC_NOP;  // The variable already holds this value
+                    continue;
+                } else {
+                    quad->op = TAC_COPY;
+                    quad->arg1 = optVarOperand(opt, opt->values[leader].var);
+                    quad->arg2 = TAC_NONE;
+                    opt->useValue[2 * i] = leader;
+                    opt->useValue[2 * i + 1] = OPT_NONE;
+                }
+            }
+        }
+        optSetCurrent(opt, value->var, v);
+    }
+
+    // Named variables are the program's result: their final values are live
+    if (cfgIsExit(cfg, b)) {
+        for (uint32_t var = 0; var < opt->nameCount; var++) {
+            if (!opt->isNamed[var]) continue;
+            opt->roots = optGrow(opt->roots, opt->rootCount, &opt->rootCapacity);
+            opt->roots[opt->rootCount++] = optCurrent(opt, var);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Dead-code elimination
+
+static inline void optMarkLive(Optimizer *opt, uint32_t v) {
+    if (v == OPT_NONE || opt->values[v].live) return;
+    opt->values[v].live = 1;
+    optPush(opt, v);
+}
+
+static inline void optEliminateDeadCode(Optimizer *opt) {
+    TacBuffer *code = opt->code;
+    const Cfg *cfg = &opt->cfg;
+    opt->workCount = 0;
+
+    // Quads in blocks that can never run go away entirely
+    for (uint32_t b = 0; b < cfg->blockCount; b++) {
+        if (opt->blockExec[b]) continue;
+        for (uint32_t i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) code->code[i].op = TAC_NOP;
+    }
+
+    for (uint32_t i = 0; i < code->count; i++) {
+        TacOp op = (TacOp)code->code[i].op;
+        uint32_t divisor = code->code[i].arg2;
+        if (op == TAC_IF || op == TAC_PRINT) {
+            optMarkLive(opt, opt->useValue[2 * i]);
+            optMarkLive(opt, opt->useValue[2 * i + 1]);
+        } else if ((op == TAC_DIV || op == TAC_MOD) && (TAC_TAG(divisor) != TAC_IMM || tacImmValue(divisor) == 0)) {
+            // A division that may fault matters even when its result is unused
+            optMarkLive(opt, opt->defValue[i]);
+        }
+    }
+    for (uint32_t r = 0; r < opt->rootCount; r++) optMarkLive(opt, opt->roots[r]);
+
+    while (opt->workCount > 0) {
+        uint32_t v = opt->work[--opt->workCount];
+        const SsaValue *value = &opt->values[v];
+        if (value->kind == SSA_DEF) {
+            if (code->code[value->where].op == TAC_NOP) {
+                // Dropped because the variable already held this value: that
+                // earlier value is what actually reaches the uses
+                if (value->number != v) optMarkLive(opt, value->number);
+                continue;
+            }
+            optMarkLive(opt, opt->useValue[2 * value->where]);
+            optMarkLive(opt, opt->useValue[2 * value->where + 1]);
+        } else if (value->kind == SSA_PHI) {
+            // Only arguments arriving over edges that can run matter
+            const SsaPhi *phi = &opt->phis[value->where];
+            for (uint32_t k = cfg->predStart[phi->block]; k < cfg->predStart[phi->block + 1]; k++) {
+                if (opt->edgeExec[opt->predEdge[k]]) optMarkLive(opt, opt->phiArgs[phi->args + (k - cfg->predStart[phi->block])]);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < code->count; i++) {
+        uint32_t v = opt->defValue[i];
+        if (v != OPT_NONE && tacDefines((TacOp)code->code[i].op) && !opt->values[v].live) code->code[i].op = TAC_NOP;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Loop optimizations (-O2)
+//
+// These run on plain TAC once the SSA passes are done. Rotation comes first:
+//
+//   top: if c goto exit; body; goto top        top: if c goto exit
+//                                        =>    body: body; if !c goto body
+//
+// so an iteration takes one jump instead of two, and the loop is entered
+// only by falling through its guard. That gives every rotated loop a place
+// in front of its first block where code runs once before the loop starts.
+// Natural loops are then found from back edges (a jump to a block that
+// dominates the jumping block). For each loop, innermost first, invariant
+// computations move in front of it. A multiplication of a basic induction
+// variable (one whose only update in the loop is "i = i + c") by a constant
+// is replaced by a running sum that is bumped next to that update.
+
+typedef struct {
+    uint32_t key;        // 2 * quad to go in front of it, 2 * quad + 1 to go after it
+    uint32_t order;      // Keeps insertions at one place in the order they were made
+    TacQuad quad;
+} OptInsert;
+
+typedef struct {
+    uint32_t var;        // Induction variable
+    int32_t factor;
+    uint32_t sum;        // Temporary holding var * factor
+} OptReduced;
+
+// Function to get the comparison that is true exactly when op is false
+static inline TacOp optNegate(TacOp op) {
+    static const TacOp negated[TAC_OP_COUNT] = {
+        [TAC_LT] = TAC_GE, [TAC_LE] = TAC_GT, [TAC_GT] = TAC_LE,
+        [TAC_GE] = TAC_LT, [TAC_EQ] = TAC_NE, [TAC_NE] = TAC_EQ,
+    };
+    return negated[op];
+}
+
+// Function to append a copy of a quad, keeping its condition and flags
+static inline void optEmitQuad(TacBuffer *code, const TacQuad *quad) {
+    uint32_t index = tacEmit(code, (TacOp)quad->op, quad->result, quad->arg1, quad->arg2);
+    code->code[index].cond = quad->cond;
+    code->code[index].flags = quad->flags;
+}
+
+// Function to rotate every loop whose first block is just a label and an
+// exit test. Every later "goto top" becomes the negated test, jumping back
+// to a new label after the guard. Returns 1 if any loop was rotated.
+static inline int optRotateLoops(TacBuffer *code) {
+    uint32_t n = code->count, labelCount = code->labelCount;
+    uint32_t *header = internAlloc(NULL, ((size_t)labelCount + 1) * sizeof(uint32_t));
+    uint32_t *body = internAlloc(NULL, ((size_t)labelCount + 1) * sizeof(uint32_t));
+    memset(header, 0xFF, ((size_t)labelCount + 1) * sizeof(uint32_t));
+    memset(body, 0xFF, ((size_t)labelCount + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i + 1 < n; i++) {
+        const TacQuad *label = &code->code[i], *test = &code->code[i + 1];
+        // Literals are not rotated: negating a comparison is only exact for integers
+        if (label->op == TAC_LABEL && test->op == TAC_IF && test->result != label->result &&
+            TAC_TAG(test->arg1) != TAC_CONST && TAC_TAG(test->arg2) != TAC_CONST) {
+            header[TAC_VALUE(label->result)] = i;
+        }
+    }
+    int rotated = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const TacQuad *quad = &code->code[i];
+        uint32_t label = TAC_VALUE(quad->result);
+        if (quad->op == TAC_GOTO && header[label] != OPT_NONE && header[label] < i && body[label] == OPT_NONE) {
+            body[label] = TAC_VALUE(tacNewLabel(code));
+            rotated = 1;
+        }
+    }
+    if (!rotated) {
+        free(header);
+        free(body);
+        return 0;
+    }
+
+    // Rebuild the code with the body labels and the rotated back edges
+    TacQuad *old = code->code;
+    code->code = NULL;
+    code->count = 0;
+    code->capacity = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const TacQuad *quad = &old[i];
+        uint32_t label = TAC_VALUE(quad->result);
+        if (quad->op == TAC_GOTO && header[label] < i && body[label] != OPT_NONE) {
+            const TacQuad *test = &old[header[label] + 1];
+            tacEmitIf(code, optNegate((TacOp)test->cond), test->arg1, test->arg2, TAC_OPERAND(TAC_LABEL_REF, body[label]));
+            // The test failing means leaving the loop, unless its exit is next anyway
+            if (i + 1 == n || old[i + 1].op != TAC_LABEL || old[i + 1].result != test->result) {
+                tacEmit(code, TAC_GOTO, test->result, TAC_NONE, TAC_NONE);
+            }
+            continue;
+        }
+        optEmitQuad(code, quad);
+        if (i > 0 && old[i - 1].op == TAC_LABEL && header[TAC_VALUE(old[i - 1].result)] == i - 1 &&
+            body[TAC_VALUE(old[i - 1].result)] != OPT_NONE) {
+            tacEmit(code, TAC_LABEL, TAC_OPERAND(TAC_LABEL_REF, body[TAC_VALUE(old[i - 1].result)]), TAC_NONE, TAC_NONE);
+        }
+    }
+    free(old);
+    free(header);
+    free(body);
+    return 1;
+}
+
+static inline int optCompareInserts(const void *a, const void *b) {
+    const OptInsert *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static inline void optAddInsert(OptInsert **inserts, uint32_t *count, uint32_t *capacity, uint32_t key,
+                                TacOp op, uint32_t result, uint32_t arg1, uint32_t arg2) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *inserts = internAlloc(*inserts, (size_t)*capacity * sizeof(OptInsert));
+    }
+    OptInsert *insert = &(*inserts)[*count];
+    memset(insert, 0, sizeof(*insert));
+    insert->key = key;
+    insert->order = (*count)++;
+    insert->quad.op = (uint8_t)op;
+    insert->quad.result = result;
+    insert->quad.arg1 = arg1;
+    insert->quad.arg2 = arg2;
+}
+
+// Function to tell whether an operand keeps its value through the loop: a
+// literal, a variable the loop never writes, or one written only by a quad
+// already moved in front of this loop
+static inline int optLoopInvariant(const TacBuffer *code, uint32_t operand, const uint32_t *defCount,
+                                   const uint32_t *defQuad, const uint32_t *movedBy, uint32_t loop) {
+    uint32_t var = tacVarIndex(code, operand);
+    if (var == OPT_NONE) return 1;
+    return defCount[var] == 0 || (defCount[var] == 1 && movedBy[defQuad[var]] == loop);
+}
+
+// Function to run invariant code motion and strength reduction once over
+// every natural loop, rebuilding the code if anything moved. Returns 1 if
+// anything changed.
+static inline int optLoopPass(TacBuffer *code) {
+    Cfg cfg;
+    cfgBuild(&cfg, code);
+    cfgDominators(&cfg);
+    uint32_t n = code->count, blockCount = cfg.blockCount, varCount = tacVarCount(code);
+
+    // Back edges, grouped by the header they jump to
+    uint32_t *latchCount = optZeroed((size_t)blockCount + 1, sizeof(uint32_t));
+    uint32_t headerCount = 0;
+    for (uint32_t b = 0; b < blockCount; b++) {
+        if (cfg.idom[b] == CFG_NONE) continue;
+        for (uint32_t s = cfg.succStart[b]; s < cfg.succStart[b + 1]; s++) {
+            if (cfgDominates(&cfg, cfg.succ[s], b) && latchCount[cfg.succ[s]]++ == 0) headerCount++;
+        }
+    }
+    uint32_t *latchStart = internAlloc(NULL, ((size_t)blockCount + 1) * sizeof(uint32_t));
+    uint32_t *latches = internAlloc(NULL, ((size_t)cfg.succStart[blockCount] + 1) * sizeof(uint32_t));
+    cfgPrefixSum(latchStart, latchCount, blockCount);
+    memset(latchCount, 0, (size_t)blockCount * sizeof(uint32_t));
+    for (uint32_t b = 0; b < blockCount; b++) {
+        if (cfg.idom[b] == CFG_NONE) continue;
+        for (uint32_t s = cfg.succStart[b]; s < cfg.succStart[b + 1]; s++) {
+            uint32_t h = cfg.succ[s];
+            if (cfgDominates(&cfg, h, b)) latches[latchStart[h] + latchCount[h]++] = b;
+        }
+    }
+
+    // Headers, innermost loop first: a loop's header dominates the headers
+    // of the loops inside it, so those come first in dominator tree postorder
+    uint32_t *headers = internAlloc(NULL, ((size_t)blockCount * 2 + 1) * sizeof(uint32_t));
+    memset(headers, 0xFF, ((size_t)blockCount * 2 + 1) * sizeof(uint32_t));
+    for (uint32_t b = 0; b < blockCount; b++) {
+        if (latchCount[b] > 0) headers[cfg.domPost[b]] = b;
+    }
+    headerCount = 0;
+    for (uint32_t k = 0; k < blockCount * 2; k++) {
+        if (headers[k] != OPT_NONE) headers[headerCount++] = headers[k];
+    }
+
+    uint32_t *quadBlock = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    for (uint32_t b = 0; b < blockCount; b++) {
+        for (uint32_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) quadBlock[i] = b;
+    }
+    uint32_t *inLoop = optZeroed((size_t)blockCount + 1, sizeof(uint32_t));   // Loop number + 1
+    uint32_t *members = internAlloc(NULL, ((size_t)blockCount + 1) * sizeof(uint32_t));
+    uint32_t *exits = internAlloc(NULL, ((size_t)blockCount + 1) * sizeof(uint32_t));
+    uint32_t *defCount = optZeroed((size_t)varCount + 1, sizeof(uint32_t));
+    uint32_t *defQuad = internAlloc(NULL, ((size_t)varCount + 1) * sizeof(uint32_t));
+    uint8_t *badUse = optZeroed((size_t)varCount + 1, 1);
+    uint32_t *movedBy = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));   // Loop that rewrote the quad
+    memset(movedBy, 0xFF, ((size_t)n + 1) * sizeof(uint32_t));
+    OptInsert *inserts = NULL;
+    uint32_t insertCount = 0, insertCapacity = 0;
+    OptReduced *reduced = NULL;
+    uint32_t reducedCapacity = 0;
+
+    for (uint32_t loop = 0; loop < headerCount; loop++) {
+        uint32_t h = headers[loop], memberCount = 0, exitCount = 0, reducedCount = 0;
+        // The body: every block that reaches a latch without passing the header
+        inLoop[h] = loop + 1;
+        members[memberCount++] = h;
+        for (uint32_t k = latchStart[h]; k < latchStart[h] + latchCount[h]; k++) {
+            uint32_t next = memberCount;
+            if (inLoop[latches[k]] == loop + 1) continue;
+            inLoop[latches[k]] = loop + 1;
+            members[memberCount++] = latches[k];
+            while (next < memberCount) {
+                uint32_t b = members[next++];
+                for (uint32_t p = cfg.predStart[b]; p < cfg.predStart[b + 1]; p++) {
+                    uint32_t pred = cfg.pred[p];
+                    if (inLoop[pred] == loop + 1 || cfg.idom[pred] == CFG_NONE) continue;
+                    inLoop[pred] = loop + 1;
+                    members[memberCount++] = pred;
+                }
+            }
+        }
+
+        // Code can go in front of the header only if the loop is entered
+        // solely by falling into it from the block before
+        uint32_t start = cfg.blocks[h].start;
+        int entered = code->code[start].op == TAC_LABEL;
+        for (uint32_t p = cfg.predStart[h]; entered && p < cfg.predStart[h + 1]; p++) {
+            uint32_t pred = cfg.pred[p];
+            if (inLoop[pred] == loop + 1) continue;
+            const TacQuad *last = &code->code[cfg.blocks[pred].end - 1];
+            if (pred + 1 != h || ((last->op == TAC_GOTO || last->op == TAC_IF) && last->result == code->code[start].result)) {
+                entered = 0;
+            }
+        }
+        if (!entered) continue;
+
+        for (uint32_t m = 0; m < memberCount; m++) {
+            uint32_t b = members[m];
+            int exit = cfgIsExit(&cfg, b);   // Also when it falls off the end of the code
+            for (uint32_t s = cfg.succStart[b]; !exit && s < cfg.succStart[b + 1]; s++) exit = inLoop[cfg.succ[s]] != loop + 1;
+            if (exit) exits[exitCount++] = b;
+            for (uint32_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+                uint32_t var = tacDefines((TacOp)code->code[i].op) ? tacVarIndex(code, code->code[i].result) : OPT_NONE;
+                if (var == OPT_NONE) continue;
+                defCount[var]++;
+                defQuad[var] = i;
+            }
+        }
+        // A definition can only move if it comes before every use in the loop
+        for (uint32_t m = 0; m < memberCount; m++) {
+            uint32_t b = members[m];
+            for (uint32_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+                uint32_t operands[2] = {code->code[i].arg1, code->code[i].arg2};
+                for (int k = 0; k < 2; k++) {
+                    uint32_t var = tacVarIndex(code, operands[k]);
+                    if (var == OPT_NONE || defCount[var] != 1) continue;
+                    uint32_t d = defQuad[var];
+                    if (quadBlock[d] == b ? d >= i : !cfgDominates(&cfg, quadBlock[d], b)) badUse[var] = 1;
+                }
+            }
+        }
+
+        // Invariant code motion: repeat until nothing more moves, since moving
+        // one quad can make the quads that use its result invariant too
+        int moved = 1;
+        while (moved) {
+            moved = 0;
+            for (uint32_t m = 0; m < memberCount; m++) {
+                uint32_t b = members[m];
+                for (uint32_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+                    const TacQuad *quad = &code->code[i];
+                    TacOp op = (TacOp)quad->op;
+                    if (movedBy[i] != OPT_NONE || !tacDefines(op)) continue;
+                    uint32_t var = tacVarIndex(code, quad->result);
+                    if (var == OPT_NONE || defCount[var] != 1 || badUse[var]) continue;
+                    // Division may only run early when it cannot fail
+                    if ((op == TAC_DIV || op == TAC_MOD) &&
+                        (TAC_TAG(quad->arg2) != TAC_IMM || tacImmValue(quad->arg2) == 0 || tacImmValue(quad->arg2) == -1)) {
+                        continue;
+                    }
+                    if (!optLoopInvariant(code, quad->arg1, defCount, defQuad, movedBy, loop) ||
+                        !optLoopInvariant(code, quad->arg2, defCount, defQuad, movedBy, loop)) {
+                        continue;
+                    }
+                    // Its value must be the one the loop leaves behind on every exit
+                    uint32_t e = 0;
+                    while (e < exitCount && cfgDominates(&cfg, b, exits[e])) e++;
+                    if (e < exitCount) continue;
+                    movedBy[i] = loop;
+                    optAddInsert(&inserts, &insertCount, &insertCapacity, 2 * start, op, quad->result, quad->arg1, quad->arg2);
+                    moved = 1;
+                }
+            }
+        }
+
+        // Strength reduction: "j = i * k" becomes "j = s", where s starts as
+        // i * k in front of the loop and grows by c * k wherever i grows by c
+        for (uint32_t m = 0; m < memberCount; m++) {
+            uint32_t b = members[m];
+            for (uint32_t i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+                const TacQuad *quad = &code->code[i];
+                if (quad->op != TAC_MUL || movedBy[i] != OPT_NONE) continue;
+                uint32_t induction = TAC_TAG(quad->arg2) == TAC_IMM ? quad->arg1 : quad->arg2;
+                uint32_t factor = induction == quad->arg1 ? quad->arg2 : quad->arg1;
+                uint32_t var = tacVarIndex(code, induction);
+                if (TAC_TAG(factor) != TAC_IMM || var == OPT_NONE || defCount[var] != 1) continue;
+                uint32_t d = defQuad[var];
+                const TacQuad *update = &code->code[d];
+                int64_t step;
+                if (update->op == TAC_ADD && update->arg1 == induction && TAC_TAG(update->arg2) == TAC_IMM) {
+                    step = tacImmValue(update->arg2);
+                } else if (update->op == TAC_ADD && update->arg2 == induction && TAC_TAG(update->arg1) == TAC_IMM) {
+                    step = tacImmValue(update->arg1);
+                } else if (update->op == TAC_SUB && update->arg1 == induction && TAC_TAG(update->arg2) == TAC_IMM) {
+                    step = -(int64_t)tacImmValue(update->arg2);
+                } else {
+                    continue;
+                }
+                step *= tacImmValue(factor);
+                if (movedBy[d] != OPT_NONE || step < TAC_IMM_MIN || step > TAC_IMM_MAX) continue;
+
+                uint32_t r = 0;
+                while (r < reducedCount && (reduced[r].var != var || reduced[r].factor != tacImmValue(factor))) r++;
+                if (r == reducedCount) {
+                    if (reducedCount == reducedCapacity) {
+                        reducedCapacity = reducedCapacity ? reducedCapacity * 2 : 16;
+                        reduced = internAlloc(reduced, (size_t)reducedCapacity * sizeof(OptReduced));
+                    }
+                    reduced[r].var = var;
+                    reduced[r].factor = tacImmValue(factor);
+                    reduced[r].sum = tacNewTemp(code);
+                    reducedCount++;
+                    optAddInsert(&inserts, &insertCount, &insertCapacity, 2 * start, TAC_MUL, reduced[r].sum, induction, factor);
+                    optAddInsert(&inserts, &insertCount, &insertCapacity, 2 * d + 1, TAC_ADD, reduced[r].sum, reduced[r].sum,
+                                 tacImm((int32_t)step));
+                }
+                movedBy[i] = loop;
+                optAddInsert(&inserts, &insertCount, &insertCapacity, 2 * i, TAC_COPY, quad->result, reduced[r].sum, TAC_NONE);
+            }
+        }
+
+        for (uint32_t m = 0; m < memberCount; m++) {
+            for (uint32_t i = cfg.blocks[members[m]].start; i < cfg.blocks[members[m]].end; i++) {
+                uint32_t var = tacDefines((TacOp)code->code[i].op) ? tacVarIndex(code, code->code[i].result) : OPT_NONE;
+                if (var == OPT_NONE) continue;
+                defCount[var] = 0;
+                badUse[var] = 0;
+            }
+        }
+    }
+
+    // Rebuild the code with every rewritten quad in its new place
+    if (insertCount > 0) {
+        qsort(inserts, insertCount, sizeof(OptInsert), optCompareInserts);
+        TacQuad *old = code->code;
+        uint32_t next = 0;
+        code->code = NULL;
+        code->count = 0;
+        code->capacity = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            for (; next < insertCount && inserts[next].key == 2 * i; next++) optEmitQuad(code, &inserts[next].quad);
+            if (movedBy[i] == OPT_NONE) optEmitQuad(code, &old[i]);
+            for (; next < insertCount && inserts[next].key == 2 * i + 1; next++) optEmitQuad(code, &inserts[next].quad);
+        }
+        free(old);
+    }
+
+    cfgFree(&cfg);
+    free(latchCount);
+    free(latchStart);
+    free(latches);
+    free(headers);
+    free(quadBlock);
+    free(inLoop);
+    free(members);
+    free(exits);
+    free(defCount);
+    free(defQuad);
+    free(badUse);
+    free(movedBy);
+    free(inserts);
+    free(reduced);
+    return insertCount > 0;
+}
+
+// ---------------------------------------------------------------------------
+// Driver
+
+static inline void optFree(Optimizer *opt) {
+    cfgFree(&opt->cfg);
+    free(opt->isGlobal);
+    free(opt->isNamed);
+    free(opt->values);
+    free(opt->entryValue);
+    free(opt->phis);
+    free(opt->phiArgs);
+    free(opt->blockPhiStart);
+    free(opt->blockPhis);
+    free(opt->defValue);
+    free(opt->quadBlock);
+    free(opt->useValue);
+    free(opt->current);
+    free(opt->undo);
+    free(opt->userStart);
+    free(opt->users);
+    free(opt->predEdge);
+    free(opt->edgeExec);
+    free(opt->blockExec);
+    free(opt->work);
+    free(opt->exprs);
+    free(opt->exprBuckets);
+    free(opt->roots);
+    memset(opt, 0, sizeof(*opt));
+}
+
+// Function to run the SSA passes of a level over the code
+static inline void optRunSsa(TacBuffer *code, int level) {
+    Optimizer opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.code = code;
+    opt.level = level;
+    opt.nameCount = code->names.count;
+    opt.varCount = tacVarCount(code);
+    // The entry block must not be a jump target, or a loop right at the
+    // start would get no phis for the values it is entered with; a leading
+    // nop gives the entry a block of its own (optCompact drops it again)
+    if (code->count > 0 && code->code[0].op == TAC_LABEL) {
+        tacEmit(code, TAC_NOP, TAC_NONE, TAC_NONE, TAC_NONE);
+        memmove(code->code + 1, code->code, (size_t)(code->count - 1) * sizeof(TacQuad));
+        memset(&code->code[0], 0, sizeof(TacQuad));
+    }
+    cfgBuild(&opt.cfg, code);
+    cfgDominators(&opt.cfg);
+
+    opt.isGlobal = optZeroed((size_t)opt.varCount + 1, 1);
+    opt.isNamed = optZeroed((size_t)opt.nameCount + 1, 1);
+    for (uint32_t i = 0; i < code->count; i++) {
+        const TacQuad *quad = &code->code[i];
+        uint32_t operands[3] = {quad->result, quad->arg1, quad->arg2};
+        for (int k = 0; k < 3; k++) {
+            if (TAC_TAG(operands[k]) == TAC_VAR) opt.isNamed[TAC_VALUE(operands[k])] = 1;
+        }
+    }
+    for (uint32_t var = 0; var < opt.nameCount; var++) opt.isGlobal[var] = opt.isNamed[var];
+
+    opt.entryValue = internAlloc(NULL, ((size_t)opt.varCount + 1) * sizeof(uint32_t));
+    opt.current = internAlloc(NULL, ((size_t)opt.varCount + 1) * sizeof(uint32_t));
+    memset(opt.entryValue, 0xFF, ((size_t)opt.varCount + 1) * sizeof(uint32_t));
+    opt.defValue = internAlloc(NULL, ((size_t)code->count + 1) * sizeof(uint32_t));
+    opt.useValue = internAlloc(NULL, ((size_t)code->count * 2 + 2) * sizeof(uint32_t));
+    memset(opt.defValue, 0xFF, ((size_t)code->count + 1) * sizeof(uint32_t));
+    memset(opt.useValue, 0xFF, ((size_t)code->count * 2 + 2) * sizeof(uint32_t));
+
+    opt.quadBlock = internAlloc(NULL, ((size_t)code->count + 1) * sizeof(uint32_t));
+    for (uint32_t b = 0; b < opt.cfg.blockCount; b++) {
+        for (uint32_t i = opt.cfg.blocks[b].start; i < opt.cfg.blocks[b].end; i++) opt.quadBlock[i] = b;
+    }
+
+    optPlacePhis(&opt);
+    optWalk(&opt, OPT_RENAME);
+    optPropagateConstants(&opt);
+
+    opt.exprBucketCount = 1024;
+    while (opt.exprBucketCount < code->count) opt.exprBucketCount *= 2;
+    opt.exprBuckets = internAlloc(NULL, (size_t)opt.exprBucketCount * sizeof(uint32_t));
+    memset(opt.exprBuckets, 0xFF, (size_t)opt.exprBucketCount * sizeof(uint32_t));
+    optWalk(&opt, OPT_REWRITE);
+
+    optEliminateDeadCode(&opt);
+    optFree(&opt);
+    optCompact(code);
+    optCleanJumps(code);
+}
+
+#define OPT_LOOP_ROUNDS 8   // Each round moves code out of one more level of nesting
+
+// Function to optimize code in place at the given level (0 does nothing)
+static inline void optimize(TacBuffer *code, int level) {
+    if (level <= 0) return;
+    optCoalesceTemps(code);
+    optRunSsa(code, level);
+    if (level < 2) return;
+    int changed = optRotateLoops(code);
+    for (int round = 0; round < OPT_LOOP_ROUNDS && optLoopPass(code); round++) changed = 1;
+    // Clean up after them: copies left by strength reduction propagate, and
+    // what became dead goes
+    if (changed) optRunSsa(code, level);
+}
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef PARLEX_H
+#define PARLEX_H
+
+// Parallel lexing of one large buffer.
+//
+// The buffer is cut into chunks just after newlines and every chunk is lexed
+// on its own thread as if it started outside any comment or string. That
+// guess only fails where a block comment, a string or some other token runs
+// across a cut. A serial pass then walks the chunks in order: where the
+// previous chunk ended cleanly the speculative tokens are taken as they are;
+// otherwise the text is re-lexed from the start of the unfinished token until
+// the re-lexer begins a token at the same offset as the speculative lexer,
+// after which both would do the same and the rest of the chunk is reused.
+// The result is token for token the stream lexerTokenize() produces, with
+// strings interned in the same order.
+
+#include "lexer.h"
+#include "workpool.h"
+
+#define PARLEX_MIN_CHUNK (256 * 1024)   // Smaller pieces are not worth a thread
+
+typedef struct {
+    const char *text;         // Whole buffer; offsets below are into it
+    size_t start;
+    size_t end;
+    int last;
+    TokenStreamWriter tokens; // Speculative tokens with whole-buffer offsets
+    size_t pending;           // Start of the token cut by the chunk end, or end
+    TokenKind error;          // TK_EOF, or an unclosed comment/string (last chunk)
+    size_t errorOffset;
+} LexChunk;
+
+// Function run by the pool: lex one chunk from the start state
+static inline void parlexChunk(void *context, uint32_t index) {
+    LexChunk *chunk = &((LexChunk *)context)[index];
+    const char *input = chunk->text + chunk->start;
+    Lexer lexer;
+    TokenKind kind;
+    lexerInit(&lexer, input, chunk->end - chunk->start, chunk->last);
+    chunk->pending = chunk->end;
+    chunk->error = TK_EOF;
+    while ((kind = lexerNext(&lexer)) != TK_EOF) {
+        if (kind == TK_INCOMPLETE) {
+            chunk->pending = chunk->start + lexer.start;
+            break;
+        }
+        if (kind == TK_UNCLOSED_COMMENT || kind == TK_UNCLOSED_STRING) {
+            chunk->error = kind;
+            chunk->errorOffset = chunk->start + lexer.start;
+            break;
+        }
+        tokenStreamAdd(&chunk->tokens, kind, chunk->start + lexer.start, input + lexer.start,
+                       lexer.pos - lexer.start);
+    }
+}
+
+// Function to find the speculative token that starts at offset. Returns its
+// index, or the token count if none does.
+static inline uint32_t parlexFindToken(const TokenStreamWriter *tokens, size_t offset) {
+    uint32_t low = 0, high = tokens->tokenCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (tokens->tokens[middle].offset < offset) low = middle + 1;
+        else high = middle;
+    }
+    return low < tokens->tokenCount && tokens->tokens[low].offset == offset ? low : tokens->tokenCount;
+}
+
+// Function to re-lex from resume, which lies before the chunk, until the
+// lexer starts a token where a speculative one starts. Returns the index of
+// the first speculative token to keep and updates *resume to where the next
+// chunk must pick up. Returns TK_EOF or an error kind through *error.
+static inline uint32_t parlexResync(LexChunk *chunk, TokenStreamWriter *writer, size_t *resume,
+                                    TokenKind *error, size_t *errorOffset) {
+    const char *input = chunk->text + *resume;
+    size_t base = *resume;
+    Lexer lexer;
+    TokenKind kind;
+    lexerInit(&lexer, input, chunk->end - base, chunk->last);
+    *resume = chunk->end;
+    while ((kind = lexerNext(&lexer)) != TK_EOF) {
+        size_t start = base + lexer.start;
+        if (kind == TK_INCOMPLETE) {
+            *resume = start;
+            break;
+        }
+        if (kind == TK_UNCLOSED_COMMENT || kind == TK_UNCLOSED_STRING) {
+            *error = kind;
+            *errorOffset = start;
+            break;
+        }
+        if (start >= chunk->start) {
+            uint32_t match = parlexFindToken(&chunk->tokens, start);
+            if (match < chunk->tokens.tokenCount) {
+                *resume = chunk->pending;
+                *error = chunk->error;
+                *errorOffset = chunk->errorOffset;
+                return match;
+            }
+        }
+        tokenStreamAdd(writer, kind, start, input + lexer.start, lexer.pos - lexer.start);
+    }
+    return chunk->tokens.tokenCount;
+}
+
+// Function to append a chunk's tokens from index `from` on. Ids from a
+// chunk's private table are re-interned in the writer's table in token
+// order, which keeps the ids the serial lexer would have given.
+static inline void parlexAppend(TokenStreamWriter *writer, const LexChunk *chunk, uint32_t from) {
+    const TokenStreamWriter *tokens = &chunk->tokens;
+    uint32_t *map = NULL;
+    if (writer->shared == NULL && tokens->strings->count > 0) {
+        map = internAlloc(NULL, (size_t)tokens->strings->count * sizeof(uint32_t));
+        memset(map, 0xFF, (size_t)tokens->strings->count * sizeof(uint32_t));
+    }
+    for (uint32_t i = from; i < tokens->tokenCount; i++) {
+        const PackedToken *token = &tokens->tokens[i];
+        uint32_t id = token->id;
+        if (id != TOKSTREAM_NO_STRING && map != NULL) {
+            if (map[id] == INTERN_NONE) {
+                map[id] = internString(writer->strings, internText(tokens->strings, id), internLength(tokens->strings, id));
+            }
+            id = map[id];
+        }
+        tokenStreamAddId(writer, (TokenKind)token->kind, token->offset, token->length, id);
+    }
+    free(map);
+}
+
+// Function to tokenize a whole buffer like lexerTokenize(), using up to
+// `threads` threads. Small buffers, or threads <= 1, are lexed serially.
+static inline TokenKind lexerTokenizeParallel(const char *text, size_t length, TokenStreamWriter *writer,
+                                              size_t *errorOffset, uint32_t threads) {
+    uint32_t chunkCount = threads * 4;   // Several per thread so stealing can even out the load
+    if (chunkCount > length / PARLEX_MIN_CHUNK) chunkCount = (uint32_t)(length / PARLEX_MIN_CHUNK);
+    if (threads <= 1 || chunkCount < 2) return lexerTokenize(text, length, writer, errorOffset);
+
+    initScannerTables();   // Before the threads, which would otherwise race to build them
+    LexChunk *chunks = internAlloc(NULL, (size_t)chunkCount * sizeof(LexChunk));
+    size_t start = 0;
+    uint32_t count = 0;
+    while (count < chunkCount && start < length) {
+        size_t end = count + 1 == chunkCount ? length : (size_t)((double)length * (count + 1) / chunkCount);
+        if (end < start) end = start;
+        const char *newline = end < length ? memchr(text + end, '\n', length - end) : NULL;
+        end = newline != NULL ? (size_t)(newline - text) + 1 : length;
+        LexChunk *chunk = &chunks[count++];
+        chunk->text = text;
+        chunk->start = start;
+        chunk->end = end;
+        chunk->last = end == length;
+        if (writer->shared != NULL) tokenStreamInitShared(&chunk->tokens, writer->shared);
+        else tokenStreamInit(&chunk->tokens, NULL);
+        start = end;
+    }
+    poolRun(count, threads, parlexChunk, chunks);
+
+    // Reserve room for every speculative token so appending never reallocates
+    size_t total = (size_t)writer->tokenCount;
+    for (uint32_t i = 0; i < count; i++) total += chunks[i].tokens.tokenCount;
+    if (total > writer->tokenCapacity) {
+        writer->tokenCapacity = (uint32_t)total + 1024;
+        writer->tokens = internAlloc(writer->tokens, (size_t)writer->tokenCapacity * sizeof(PackedToken));
+    }
+
+    size_t resume = 0;
+    TokenKind error = TK_EOF;
+    for (uint32_t i = 0; i < count && error == TK_EOF; i++) {
+        LexChunk *chunk = &chunks[i];
+        uint32_t from = 0;
+        if (resume == chunk->start) {
+            resume = chunk->pending;
+            error = chunk->error;
+            if (errorOffset != NULL) *errorOffset = chunk->errorOffset;
+        } else {
+            size_t offset = 0;
+            from = parlexResync(chunk, writer, &resume, &error, &offset);
+            if (errorOffset != NULL) *errorOffset = offset;
+        }
+        parlexAppend(writer, chunk, from);
+    }
+    for (uint32_t i = 0; i < count; i++) tokenStreamFree(&chunks[i].tokens);
+    free(chunks);
+    return error;
+}
+
+#endif
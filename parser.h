@@ -0,0 +1,958 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+// Recursive-descent parser with Pratt-style expression parsing.
+//
+// The parser reads a token array (as produced by the lexer or loaded from a
+// binary token stream) and builds an abstract syntax tree. Nodes live in one
+// growable array and refer to each other by index, so the tree is a single
+// allocation: building it is a bump of the node count and freeing it is one
+// free(). Index 0 is the null node.
+//
+// Children are kept as a first-child / next-sibling list in source order:
+//
+//   AST_PROGRAM      functions and statements
+//   AST_FUNCTION     op = return type, token = name; AST_PARAM..., AST_BLOCK
+//   AST_PARAM        op = type, token = name
+//   AST_BLOCK        statements
+//   AST_DECLARATION  op = type; AST_DECLARATOR...
+//   AST_DECLARATOR   token = name; [size or AST_EMPTY if AST_FLAG_ARRAY] [initializer]
+//   AST_IF           condition, then, [else]
+//   AST_WHILE        condition, body
+//   AST_DO_WHILE     body, condition
+//   AST_FOR          init, condition, step (AST_EMPTY when omitted), body
+//   AST_SWITCH       value, body
+//   AST_CASE         value
+//   AST_RETURN       [value]
+//   AST_EXPRESSION   expression
+//   AST_ASSIGN       op = = += -= *= /=; target, value
+//   AST_BINARY       op = operator; left, right
+//   AST_UNARY        op = ! - + & *; operand
+//   AST_PREFIX       op = TK_PLUS (++) or TK_MINUS (--); operand
+//   AST_POSTFIX      op = TK_PLUS (++) or TK_MINUS (--); operand
+//   AST_TERNARY      condition, then, else
+//   AST_CALL         callee, arguments...
+//   AST_INDEX        array, index
+//   AST_MEMBER       token = member name; object
+//   AST_IDENTIFIER, AST_NUMBER, AST_STRING   token = the literal
+//
+// The lexer has no "++" token, so two adjacent '+' (or '-') tokens are read
+// as an increment (or decrement).
+//
+// Errors do not stop the parse. A missing ';' is reported and assumed
+// present; any other error abandons the current statement and skips ahead to
+// the next ';' or '}' (panic mode), so one pass reports every error, each
+// with its line and column, up to maxErrors.
+//
+// Nesting is limited to PARSER_MAX_DEPTH: every statement, operand,
+// conditional or postfix link that wraps another one counts a level. Chains
+// that grow to the left ("a + b + c", "else if ... else if") are built in a
+// loop and count once, so later passes walk them in loops as well.
+//
+// Instead of a token array the parser can pull tokens from a TokenCursor,
+// which lexes on demand and keeps only the last few. It only ever looks a
+// couple of tokens ahead and never goes back, so this works for a plain
+// syntax check. With discardItems also set, each top-level item's nodes are
+// dropped once it has parsed, and memory no longer grows with the input.
+// Later stages need the whole token array, so they cannot run that way.
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include "lexer.h"
+#include "intern.h"
+
+#define PARSER_MAX_DEPTH 2000
+#define PARSER_LOOKAHEAD 3   // Tokens from the current one that may be peeked at
+#define PARSER_NO_TOKEN 0xFFFFFFFFu   // Diagnostic token of a message with no location
+
+typedef enum {
+    AST_NONE,
+    AST_PROGRAM, AST_FUNCTION, AST_PARAM, AST_BLOCK, AST_DECLARATION, AST_DECLARATOR,
+    AST_IF, AST_WHILE, AST_DO_WHILE, AST_FOR, AST_SWITCH, AST_CASE, AST_RETURN,
+    AST_BREAK, AST_CONTINUE, AST_EXPRESSION, AST_EMPTY,
+    AST_ASSIGN, AST_BINARY, AST_UNARY, AST_PREFIX, AST_POSTFIX, AST_TERNARY,
+    AST_CALL, AST_INDEX, AST_MEMBER, AST_IDENTIFIER, AST_NUMBER, AST_STRING,
+    AST_KIND_COUNT
+} AstKind;
+
+static const char *const astKindNames[AST_KIND_COUNT] = {
+    "None", "Program", "Function", "Param", "Block", "Declaration", "Declarator",
+    "If", "While", "DoWhile", "For", "Switch", "Case", "Return",
+    "Break", "Continue", "Expression", "Empty",
+    "Assign", "Binary", "Unary", "Prefix", "Postfix", "Ternary",
+    "Call", "Index", "Member", "Identifier", "Number", "String",
+};
+
+#define AST_FLAG_ARRAY 1   // Declarator has [size]
+#define AST_FLAG_ERROR 2   // Placeholder (AST_EMPTY) for a statement that failed to parse
+
+typedef struct {
+    uint8_t kind;          // AstKind
+    uint8_t op;            // TokenKind of the operator or declared type
+    uint16_t flags;
+    uint32_t token;        // Index of the token this node is named after
+    uint32_t firstChild;   // 0 when the node has no children
+    uint32_t nextSibling;  // 0 for the last child
+} AstNode;
+
+typedef struct {
+    AstNode *nodes;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *spans;       // Optional: first token and one past the last token of
+                           // every statement and block, 2 per node (0, 0 for others)
+} AstArena;
+
+// Receives diagnostics in place of printing them: the message is `before`,
+// the location of `token`, then `after`. anchor is the first token of the
+// statement being parsed or checked; sorting by order (then arrival) gives
+// the order a single pass would have printed them in. A hook also gets the
+// follow-on syntax errors at the token of the previous one, which are not
+// printed otherwise. token is PARSER_NO_TOKEN when the message has no
+// location (the error limit notice); then it is just before and after.
+typedef void (*DiagnosticHook)(void *context, uint32_t anchor, uint32_t order, uint32_t token,
+                               const char *before, const char *after);
+
+typedef struct {
+    const PackedToken *tokens;
+    uint32_t tokenCount;
+    uint32_t tokenMask;         // Index mask: all ones for an array, ring size - 1 for a cursor
+    TokenCursor *cursor;        // Lexes ahead as the parser advances when set
+    int discardItems;           // Drop top-level items once parsed (check only)
+    uint32_t current;
+    const InternTable *names;   // Text of identifiers, numbers and strings by id
+    const SharedInternTable *sharedNames;   // Used instead of names when set
+    const char *source;         // Original text when available (may be NULL)
+
+    AstArena *ast;
+    FILE *out;                  // Diagnostics and dumps (stdout unless changed)
+    DiagnosticHook diagnosticHook;   // Collects diagnostics instead of out when set
+    void *hookContext;
+    uint32_t anchor;            // First token of the statement being parsed
+    int errorCount;
+    int maxErrors;              // Stop after this many errors; 0 = no limit
+    int stopped;                // Set once maxErrors is reached
+    uint32_t lastErrorToken;    // Suppresses a second error at the same token
+    int depth;
+    jmp_buf bail;               // Unwinds to the innermost recovery point
+
+    // Line tracking for diagnostics; errors arrive in source order, so the
+    // source is only scanned forward from the last reported position
+    uint32_t lineCursor;
+    uint32_t lineStart;
+    int line;
+} Parser;
+
+// ---------------------------------------------------------------------------
+// Arena
+
+static inline void astInit(AstArena *arena, uint32_t expectedNodes) {
+    arena->capacity = expectedNodes > 16 ? expectedNodes : 16;
+    arena->nodes = internAlloc(NULL, (size_t)arena->capacity * sizeof(AstNode));
+    memset(&arena->nodes[0], 0, sizeof(AstNode));  // The null node
+    arena->count = 1;
+    arena->spans = NULL;
+}
+
+// Function to start recording statement spans (for incremental reparsing)
+static inline void astTrackSpans(AstArena *arena) {
+    arena->spans = internAlloc(NULL, (size_t)arena->capacity * 2 * sizeof(uint32_t));
+    memset(arena->spans, 0, (size_t)arena->count * 2 * sizeof(uint32_t));
+}
+
+static inline void astFree(AstArena *arena) {
+    free(arena->nodes);
+    free(arena->spans);
+    memset(arena, 0, sizeof(*arena));
+}
+
+static inline uint32_t astNew(AstArena *arena, AstKind kind, int op, uint32_t token) {
+    if (arena->count == arena->capacity) {
+        arena->capacity *= 2;
+        arena->nodes = internAlloc(arena->nodes, (size_t)arena->capacity * sizeof(AstNode));
+        if (arena->spans != NULL) {
+            arena->spans = internAlloc(arena->spans, (size_t)arena->capacity * 2 * sizeof(uint32_t));
+        }
+    }
+    if (arena->spans != NULL) {
+        arena->spans[2 * arena->count] = 0;
+        arena->spans[2 * arena->count + 1] = 0;
+    }
+    AstNode *node = &arena->nodes[arena->count];
+    node->kind = (uint8_t)kind;
+    node->op = (uint8_t)op;
+    node->flags = 0;
+    node->token = token;
+    node->firstChild = 0;
+    node->nextSibling = 0;
+    return arena->count++;
+}
+
+// Function to append child to a list being built; first/last track the ends
+static inline void astLink(AstArena *arena, uint32_t *first, uint32_t *last, uint32_t child) {
+    if (*first == 0) {
+        *first = child;
+    } else {
+        arena->nodes[*last].nextSibling = child;
+    }
+    *last = child;
+}
+
+static inline uint32_t astNode2(AstArena *arena, AstKind kind, int op, uint32_t token,
+                                uint32_t a, uint32_t b) {
+    uint32_t node = astNew(arena, kind, op, token);
+    arena->nodes[node].firstChild = a;
+    arena->nodes[a].nextSibling = b;
+    return node;
+}
+
+// ---------------------------------------------------------------------------
+// Token access
+
+// Function to get a token by index, or NULL past the end of the input. With
+// a cursor, tokens is its ring: the lookahead is always lexed, and of the
+// indices below tokenCount only the last CURSOR_RING_SIZE are still valid.
+static inline const PackedToken *parserToken(const Parser *parser, uint32_t index) {
+    return index < parser->tokenCount ? &parser->tokens[index & parser->tokenMask] : NULL;
+}
+
+// Function to lex from the cursor until the lookahead of the current token
+// is available (or the input ends)
+static inline void parserPull(Parser *parser) {
+    TokenCursor *cursor = parser->cursor;
+    while (cursor->count < parser->current + PARSER_LOOKAHEAD && cursorFill(cursor)) {
+    }
+    parser->tokenCount = cursor->count;
+}
+
+static inline TokenKind parserPeek(const Parser *parser, uint32_t ahead) {
+    const PackedToken *token = parserToken(parser, parser->current + ahead);
+    return token != NULL ? (TokenKind)token->kind : TK_EOF;
+}
+
+static inline int parserAt(const Parser *parser, TokenKind kind) {
+    return parserPeek(parser, 0) == kind;
+}
+
+static inline uint32_t parserAdvance(Parser *parser) {
+    uint32_t index = parser->current;
+    if (index < parser->tokenCount) parser->current++;
+    if (parser->cursor != NULL) parserPull(parser);
+    return index;
+}
+
+// Function to check for an increment/decrement: the same sign twice with no
+// gap between the two tokens
+static inline int parserAtDouble(const Parser *parser, TokenKind sign) {
+    const PackedToken *first = parserToken(parser, parser->current);
+    const PackedToken *second = parserToken(parser, parser->current + 1);
+    return second != NULL && first->kind == sign && second->kind == sign && first->offset + 1 == second->offset;
+}
+
+// Function to get the text of a token for messages and dumps
+static inline const char *parserTokenText(const Parser *parser, uint32_t index) {
+    const PackedToken *token = parserToken(parser, index);
+    if (token == NULL) return "end of input";
+    if (parser->cursor != NULL) {
+        return tokenSpellings[token->kind] ? tokenSpellings[token->kind] : cursorText(parser->cursor, index);
+    }
+    if (token->id != TOKSTREAM_NO_STRING && parser->sharedNames != NULL) {
+        return sharedInternText(parser->sharedNames, token->id);
+    }
+    if (token->id != TOKSTREAM_NO_STRING && parser->names != NULL && token->id < parser->names->count) {
+        return internText(parser->names, token->id);
+    }
+    return tokenSpellings[token->kind] ? tokenSpellings[token->kind] : "?";
+}
+
+// Function to find the source offset of a token; end of input maps to the
+// end of the last token
+static inline uint32_t parserTokenOffset(const Parser *parser, uint32_t index) {
+    const PackedToken *token = parserToken(parser, index);
+    if (token != NULL) return token->offset;
+    if (parser->cursor != NULL) return (uint32_t)parser->cursor->end;
+    if (parser->tokenCount == 0) return 0;
+    const PackedToken *last = &parser->tokens[parser->tokenCount - 1];
+    return last->offset + last->length;
+}
+
+// Function to print where a token is: line and column when the source text is
+// known, otherwise the byte offset
+static inline void parserPrintLocation(Parser *parser, uint32_t index) {
+    uint32_t offset = parserTokenOffset(parser, index);
+    if (parser->source == NULL) {
+        fprintf(parser->out, "offset %u", offset);
+        return;
+    }
+    if (offset < parser->lineCursor) {
+        parser->lineCursor = 0;
+        parser->lineStart = 0;
+        parser->line = 1;
+    }
+    for (; parser->lineCursor < offset; parser->lineCursor++) {
+        if (parser->source[parser->lineCursor] == '\n') {
+            parser->line++;
+            parser->lineStart = parser->lineCursor + 1;
+        }
+    }
+    fprintf(parser->out, "line %d, column %u", parser->line, offset - parser->lineStart + 1);
+}
+
+// Function to format text into a new allocation (for diagnostics)
+static inline char *parserFormatV(const char *format, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    char *text = internAlloc(NULL, (size_t)(length > 0 ? length : 0) + 1);
+    vsnprintf(text, (size_t)(length > 0 ? length : 0) + 1, format, args);
+    return text;
+}
+
+static inline char *parserFormat(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    char *text = parserFormatV(format, args);
+    va_end(args);
+    return text;
+}
+
+// Function to emit one diagnostic: before, the location of token, after.
+// Goes to the diagnostic hook when one is set, otherwise to out.
+static inline void parserDiagnostic(Parser *parser, uint32_t order, uint32_t token, const char *before,
+                                    const char *after) {
+    if (parser->diagnosticHook != NULL) {
+        parser->diagnosticHook(parser->hookContext, parser->anchor, order, token, before, after);
+        return;
+    }
+    fputs(before, parser->out);
+    if (token != PARSER_NO_TOKEN) parserPrintLocation(parser, token);
+    fputs(after, parser->out);
+}
+
+// Function to report a syntax error at the current token without unwinding.
+// Once maxErrors have been reported the parse is abandoned.
+static inline void parserReportV(Parser *parser, const char *format, va_list args) {
+    uint32_t index = parser->current;
+    if (parser->errorCount > 0 && index == parser->lastErrorToken && parserToken(parser, index) != NULL &&
+        parser->diagnosticHook == NULL) {
+        return;  // Follow-on error from the same token
+    }
+    char *message = parserFormatV(format, args);
+    char *after = parserFormat("): %s\n", message);
+    parserDiagnostic(parser, 2 * index, index, "Syntax Error (", after);
+    free(after);
+    free(message);
+    parser->lastErrorToken = index;
+    if (++parser->errorCount == parser->maxErrors) {
+        char *notice = parserFormat("Too many errors, stopping after %d.\n", parser->errorCount);
+        parserDiagnostic(parser, 2 * index + 1, PARSER_NO_TOKEN, notice, "");
+        free(notice);
+        parser->stopped = 1;
+        longjmp(parser->bail, 1);
+    }
+}
+
+static inline void parserReport(Parser *parser, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    parserReportV(parser, format, args);
+    va_end(args);
+}
+
+// Function to report a syntax error and abandon the current statement
+static inline void parserError(Parser *parser, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    parserReportV(parser, format, args);
+    va_end(args);
+    longjmp(parser->bail, 1);
+}
+
+static inline uint32_t parserExpect(Parser *parser, TokenKind kind, const char *context) {
+    if (!parserAt(parser, kind)) {
+        if (parserAt(parser, TK_EOF) && kind == TK_SEMICOLON) {
+            parserError(parser, "Missing semicolon at the end of the statement.");
+        }
+        if (parserAt(parser, TK_EOF) && kind == TK_RBRACE) {
+            parserError(parser, "Unmatched opening brace '{'");
+        }
+        if (kind == TK_SEMICOLON) {
+            // Carry on as if the ';' were there; the next token starts a new statement
+            parserReport(parser, "Expected ';' %s but found '%s'", context, parserTokenText(parser, parser->current));
+            return parser->current;
+        }
+        if (tokenSpellings[kind] == NULL) {
+            parserError(parser, "Expected %s %s but found '%s'", kind == TK_IDENTIFIER ? "a name" : "a literal",
+                        context, parserTokenText(parser, parser->current));
+        }
+        parserError(parser, "Expected '%s' %s but found '%s'", tokenSpellings[kind], context,
+                    parserTokenText(parser, parser->current));
+    }
+    return parserAdvance(parser);
+}
+
+static inline int isTypeKeyword(TokenKind kind) {
+    return kind == TK_INT || kind == TK_FLOAT || kind == TK_CHAR;
+}
+
+static inline void parserEnter(Parser *parser) {
+    if (++parser->depth > PARSER_MAX_DEPTH) {
+        parserError(parser, "Nesting is too deep");
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Expressions
+
+static inline uint32_t parseExpression(Parser *parser);
+static inline uint32_t parseAssignment(Parser *parser);
+static inline uint32_t parseStatement(Parser *parser);
+static inline uint32_t parseRecovering(Parser *parser, uint32_t (*parseItem)(Parser *), int inBlock);
+
+// Binding power of binary operators; 0 means "not a binary operator"
+static inline int binaryPrecedence(TokenKind kind) {
+    switch (kind) {
+        case TK_OR: return 1;
+        case TK_AND: return 2;
+        case TK_PIPE: return 3;
+        case TK_AMP: return 4;
+        case TK_EQ: case TK_NE: return 5;
+        case TK_LT: case TK_LE: case TK_GT: case TK_GE: return 6;
+        case TK_PLUS: case TK_MINUS: return 7;
+        case TK_STAR: case TK_SLASH: return 8;
+        default: return 0;
+    }
+}
+
+static inline uint32_t parsePrimary(Parser *parser) {
+    switch (parserPeek(parser, 0)) {
+        case TK_IDENTIFIER:
+            return astNew(parser->ast, AST_IDENTIFIER, 0, parserAdvance(parser));
+        case TK_NUMBER:
+            return astNew(parser->ast, AST_NUMBER, 0, parserAdvance(parser));
+        case TK_STRING:
+            return astNew(parser->ast, AST_STRING, 0, parserAdvance(parser));
+        case TK_LPAREN: {
+            parserAdvance(parser);
+            uint32_t inner = parseExpression(parser);
+            parserExpect(parser, TK_RPAREN, "to close '('");
+            return inner;
+        }
+        case TK_EOF:
+            parserError(parser, "Unexpected end of input in expression");
+            break;
+        default:
+            parserError(parser, "Unexpected '%s' in expression", parserTokenText(parser, parser->current));
+    }
+    return 0;
+}
+
+// Each call, index, member or increment wraps the node before it, so every
+// link of the chain counts as one level of nesting
+static inline uint32_t parsePostfix(Parser *parser) {
+    AstArena *ast = parser->ast;
+    int depth = parser->depth;
+    uint32_t node = parsePrimary(parser);
+    while (1) {
+        if (parserAt(parser, TK_LPAREN)) {
+            parserEnter(parser);
+            uint32_t call = astNew(ast, AST_CALL, 0, parserAdvance(parser));
+            uint32_t first = 0, last = 0;
+            astLink(ast, &first, &last, node);
+            if (!parserAt(parser, TK_RPAREN)) {
+                do {
+                    astLink(ast, &first, &last, parseAssignment(parser));
+                } while (parserAt(parser, TK_COMMA) && parserAdvance(parser));
+            }
+            parserExpect(parser, TK_RPAREN, "after call arguments");
+            ast->nodes[call].firstChild = first;
+            node = call;
+        } else if (parserAt(parser, TK_LBRACKET)) {
+            parserEnter(parser);
+            uint32_t token = parserAdvance(parser);
+            uint32_t index = parseExpression(parser);
+            parserExpect(parser, TK_RBRACKET, "after array index");
+            node = astNode2(ast, AST_INDEX, 0, token, node, index);
+        } else if (parserAt(parser, TK_DOT)) {
+            parserEnter(parser);
+            parserAdvance(parser);
+            uint32_t name = parserExpect(parser, TK_IDENTIFIER, "after '.'");
+            uint32_t member = astNew(ast, AST_MEMBER, 0, name);
+            ast->nodes[member].firstChild = node;
+            node = member;
+        } else if (parserAtDouble(parser, TK_PLUS) || parserAtDouble(parser, TK_MINUS)) {
+            parserEnter(parser);
+            TokenKind sign = parserPeek(parser, 0);
+            uint32_t token = parserAdvance(parser);
+            parserAdvance(parser);
+            uint32_t step = astNew(ast, AST_POSTFIX, sign, token);
+            ast->nodes[step].firstChild = node;
+            node = step;
+        } else {
+            parser->depth = depth;
+            return node;
+        }
+    }
+}
+
+static inline uint32_t parseUnary(Parser *parser) {
+    TokenKind kind = parserPeek(parser, 0);
+    if (parserAtDouble(parser, TK_PLUS) || parserAtDouble(parser, TK_MINUS)) {
+        uint32_t token = parserAdvance(parser);
+        parserAdvance(parser);
+        parserEnter(parser);
+        uint32_t operand = parseUnary(parser);
+        parser->depth--;
+        uint32_t node = astNew(parser->ast, AST_PREFIX, kind, token);
+        parser->ast->nodes[node].firstChild = operand;
+        return node;
+    }
+    if (kind == TK_NOT || kind == TK_MINUS || kind == TK_PLUS || kind == TK_AMP || kind == TK_STAR) {
+        uint32_t token = parserAdvance(parser);
+        parserEnter(parser);
+        uint32_t operand = parseUnary(parser);
+        parser->depth--;
+        uint32_t node = astNew(parser->ast, AST_UNARY, kind, token);
+        parser->ast->nodes[node].firstChild = operand;
+        return node;
+    }
+    return parsePostfix(parser);
+}
+
+// Function to parse binary operators by precedence climbing
+static inline uint32_t parseBinary(Parser *parser, int minPrecedence) {
+    uint32_t left = parseUnary(parser);
+    while (1) {
+        TokenKind op = parserPeek(parser, 0);
+        int precedence = binaryPrecedence(op);
+        if (precedence == 0 || precedence < minPrecedence) return left;
+        uint32_t token = parserAdvance(parser);
+        parserEnter(parser);
+        uint32_t right = parseBinary(parser, precedence + 1);
+        parser->depth--;
+        left = astNode2(parser->ast, AST_BINARY, op, token, left, right);
+    }
+}
+
+static inline uint32_t parseTernary(Parser *parser) {
+    uint32_t condition = parseBinary(parser, 1);
+    if (!parserAt(parser, TK_QUESTION)) return condition;
+    uint32_t token = parserAdvance(parser);
+    parserEnter(parser);
+    uint32_t thenValue = parseExpression(parser);
+    parserExpect(parser, TK_COLON, "in conditional expression");
+    uint32_t elseValue = parseTernary(parser);
+    parser->depth--;
+    uint32_t node = astNode2(parser->ast, AST_TERNARY, 0, token, condition, thenValue);
+    parser->ast->nodes[thenValue].nextSibling = elseValue;
+    return node;
+}
+
+static inline int isAssignmentOperator(TokenKind kind) {
+    return kind == TK_ASSIGN || kind == TK_PLUS_ASSIGN || kind == TK_MINUS_ASSIGN ||
+           kind == TK_STAR_ASSIGN || kind == TK_SLASH_ASSIGN;
+}
+
+static inline uint32_t parseAssignment(Parser *parser) {
+    parserEnter(parser);
+    uint32_t target = parseTernary(parser);
+    TokenKind op = parserPeek(parser, 0);
+    if (isAssignmentOperator(op)) {
+        AstKind targetKind = (AstKind)parser->ast->nodes[target].kind;
+        if (targetKind != AST_IDENTIFIER && targetKind != AST_INDEX && targetKind != AST_MEMBER &&
+            !(targetKind == AST_UNARY && parser->ast->nodes[target].op == TK_STAR)) {
+            parserError(parser, "Invalid assignment target before '%s'", tokenSpellings[op]);
+        }
+        uint32_t token = parserAdvance(parser);
+        uint32_t value = parseAssignment(parser);
+        target = astNode2(parser->ast, AST_ASSIGN, op, token, target, value);
+    }
+    parser->depth--;
+    return target;
+}
+
+static inline uint32_t parseExpression(Parser *parser) {
+    return parseAssignment(parser);
+}
+
+// ---------------------------------------------------------------------------
+// Statements
+
+// Function to parse "type name [size] = value, ..." up to (not including) ';'
+static inline uint32_t parseDeclaration(Parser *parser) {
+    AstArena *ast = parser->ast;
+    TokenKind type = parserPeek(parser, 0);
+    uint32_t declaration = astNew(ast, AST_DECLARATION, type, parserAdvance(parser));
+    uint32_t first = 0, last = 0;
+    do {
+        uint32_t name = parserExpect(parser, TK_IDENTIFIER, "in declaration");
+        uint32_t declarator = astNew(ast, AST_DECLARATOR, type, name);
+        uint32_t childFirst = 0, childLast = 0;
+        if (parserAt(parser, TK_LBRACKET)) {
+            uint32_t token = parserAdvance(parser);
+            ast->nodes[declarator].flags |= AST_FLAG_ARRAY;
+            uint32_t size = parserAt(parser, TK_RBRACKET) ? astNew(ast, AST_EMPTY, 0, token)
+                                                          : parseExpression(parser);
+            parserExpect(parser, TK_RBRACKET, "after array size");
+            astLink(ast, &childFirst, &childLast, size);
+        }
+        if (parserAt(parser, TK_ASSIGN)) {
+            parserAdvance(parser);
+            astLink(ast, &childFirst, &childLast, parseAssignment(parser));
+        }
+        ast->nodes[declarator].firstChild = childFirst;
+        astLink(ast, &first, &last, declarator);
+    } while (parserAt(parser, TK_COMMA) && parserAdvance(parser));
+    ast->nodes[declaration].firstChild = first;
+    return declaration;
+}
+
+static inline uint32_t parseBlock(Parser *parser) {
+    AstArena *ast = parser->ast;
+    uint32_t block = astNew(ast, AST_BLOCK, 0, parserExpect(parser, TK_LBRACE, "to open block"));
+    uint32_t first = 0, last = 0;
+    while (!parserAt(parser, TK_RBRACE)) {
+        if (parserAt(parser, TK_EOF)) parserError(parser, "Unmatched opening brace '{'");
+        uint32_t statement = parseRecovering(parser, parseStatement, 1);
+        if (statement != 0) astLink(ast, &first, &last, statement);
+    }
+    parserAdvance(parser);
+    ast->nodes[block].firstChild = first;
+    if (ast->spans != NULL) {
+        ast->spans[2 * block] = ast->nodes[block].token;
+        ast->spans[2 * block + 1] = parser->current;
+    }
+    return block;
+}
+
+static inline uint32_t parseCondition(Parser *parser, const char *keyword) {
+    if (!parserAt(parser, TK_LPAREN)) {
+        parserError(parser, "Expected '(' after '%s' but found '%s'", keyword,
+                    parserTokenText(parser, parser->current));
+    }
+    parserAdvance(parser);
+    uint32_t condition = parseExpression(parser);
+    parserExpect(parser, TK_RPAREN, "after condition");
+    return condition;
+}
+
+// Function to parse an optional expression followed by terminator
+static inline uint32_t parseOptionalExpression(Parser *parser, TokenKind terminator, const char *context) {
+    uint32_t node = parserAt(parser, terminator) ? astNew(parser->ast, AST_EMPTY, 0, parser->current)
+                                                 : parseExpression(parser);
+    parserExpect(parser, terminator, context);
+    return node;
+}
+
+static inline uint32_t parseStatement(Parser *parser) {
+    AstArena *ast = parser->ast;
+    TokenKind kind = parserPeek(parser, 0);
+    uint32_t node;
+    parserEnter(parser);
+
+    switch (kind) {
+        case TK_INT: case TK_FLOAT: case TK_CHAR:
+            node = parseDeclaration(parser);
+            parserExpect(parser, TK_SEMICOLON, "after declaration");
+            break;
+        case TK_LBRACE:
+            node = parseBlock(parser);
+            break;
+        case TK_IF: {
+            // An "else if" chain is read in this loop rather than by nesting
+            // calls, so its ifs sit at the depth of the first one
+            uint32_t token = parserAdvance(parser);
+            uint32_t condition = parseCondition(parser, "if");
+            uint32_t thenBranch = parseStatement(parser);
+            node = astNode2(ast, AST_IF, 0, token, condition, thenBranch);
+            while (parserAt(parser, TK_ELSE)) {
+                parserAdvance(parser);
+                uint32_t elseBranch;
+                if (parserAt(parser, TK_IF)) {
+                    token = parserAdvance(parser);
+                    condition = parseCondition(parser, "if");
+                    uint32_t elseThen = parseStatement(parser);
+                    elseBranch = astNode2(ast, AST_IF, 0, token, condition, elseThen);
+                    ast->nodes[thenBranch].nextSibling = elseBranch;
+                    thenBranch = elseThen;
+                } else {
+                    elseBranch = parseStatement(parser);
+                    ast->nodes[thenBranch].nextSibling = elseBranch;
+                    break;
+                }
+            }
+            break;
+        }
+        case TK_WHILE: {
+            uint32_t token = parserAdvance(parser);
+            uint32_t condition = parseCondition(parser, "while");
+            node = astNode2(ast, AST_WHILE, 0, token, condition, parseStatement(parser));
+            break;
+        }
+        case TK_DO: {
+            uint32_t token = parserAdvance(parser);
+            uint32_t body = parseStatement(parser);
+            parserExpect(parser, TK_WHILE, "after do body");
+            uint32_t condition = parseCondition(parser, "while");
+            parserExpect(parser, TK_SEMICOLON, "after do-while");
+            node = astNode2(ast, AST_DO_WHILE, 0, token, body, condition);
+            break;
+        }
+        case TK_FOR: {
+            uint32_t token = parserAdvance(parser);
+            parserExpect(parser, TK_LPAREN, "after 'for'");
+            uint32_t init;
+            if (isTypeKeyword(parserPeek(parser, 0))) {
+                init = parseDeclaration(parser);
+                parserExpect(parser, TK_SEMICOLON, "after for initializer");
+            } else {
+                init = parseOptionalExpression(parser, TK_SEMICOLON, "after for initializer");
+            }
+            uint32_t condition = parseOptionalExpression(parser, TK_SEMICOLON, "after for condition");
+            uint32_t step = parseOptionalExpression(parser, TK_RPAREN, "after for step");
+            uint32_t body = parseStatement(parser);
+            node = astNode2(ast, AST_FOR, 0, token, init, condition);
+            ast->nodes[condition].nextSibling = step;
+            ast->nodes[step].nextSibling = body;
+            break;
+        }
+        case TK_SWITCH: {
+            uint32_t token = parserAdvance(parser);
+            uint32_t value = parseCondition(parser, "switch");
+            node = astNode2(ast, AST_SWITCH, 0, token, value, parseStatement(parser));
+            break;
+        }
+        case TK_CASE: {
+            uint32_t token = parserAdvance(parser);
+            uint32_t value = parseExpression(parser);
+            parserExpect(parser, TK_COLON, "after case value");
+            node = astNew(ast, AST_CASE, 0, token);
+            ast->nodes[node].firstChild = value;
+            break;
+        }
+        case TK_RETURN: {
+            node = astNew(ast, AST_RETURN, 0, parserAdvance(parser));
+            if (!parserAt(parser, TK_SEMICOLON)) {
+                uint32_t value = parseExpression(parser);
+                ast->nodes[node].firstChild = value;
+            }
+            parserExpect(parser, TK_SEMICOLON, "after return");
+            break;
+        }
+        case TK_BREAK: case TK_CONTINUE:
+            node = astNew(ast, kind == TK_BREAK ? AST_BREAK : AST_CONTINUE, 0, parserAdvance(parser));
+            parserExpect(parser, TK_SEMICOLON, kind == TK_BREAK ? "after 'break'" : "after 'continue'");
+            break;
+        case TK_SEMICOLON:
+            node = astNew(ast, AST_EMPTY, 0, parserAdvance(parser));
+            break;
+        case TK_RBRACE:
+            parserError(parser, "Unmatched closing brace '}'");
+            break;
+        case TK_ELSE:
+            parserError(parser, "'else' without a matching 'if'");
+            break;
+        case TK_UNKNOWN:
+            parserError(parser, "Unknown token '%s'", parserTokenText(parser, parser->current));
+            break;
+        default:
+            node = astNew(ast, AST_EXPRESSION, 0, parser->current);
+            uint32_t expression = parseExpression(parser);
+            ast->nodes[node].firstChild = expression;
+            parserExpect(parser, TK_SEMICOLON, "after expression");
+            break;
+    }
+    parser->depth--;
+    return node;
+}
+
+// Function to parse "type name(params) { ... }"
+static inline uint32_t parseFunction(Parser *parser) {
+    AstArena *ast = parser->ast;
+    TokenKind type = parserPeek(parser, 0);
+    parserAdvance(parser);
+    uint32_t function = astNew(ast, AST_FUNCTION, type, parserAdvance(parser));
+    uint32_t first = 0, last = 0;
+    parserAdvance(parser);  // '('
+    if (!parserAt(parser, TK_RPAREN)) {
+        do {
+            TokenKind paramType = parserPeek(parser, 0);
+            if (!isTypeKeyword(paramType)) {
+                parserError(parser, "Expected parameter type but found '%s'", parserTokenText(parser, parser->current));
+            }
+            parserAdvance(parser);
+            uint32_t name = parserExpect(parser, TK_IDENTIFIER, "as parameter name");
+            astLink(ast, &first, &last, astNew(ast, AST_PARAM, paramType, name));
+        } while (parserAt(parser, TK_COMMA) && parserAdvance(parser));
+    }
+    parserExpect(parser, TK_RPAREN, "after parameters");
+    astLink(ast, &first, &last, parseBlock(parser));
+    ast->nodes[function].firstChild = first;
+    return function;
+}
+
+// ---------------------------------------------------------------------------
+// Error recovery
+
+// Function to skip the rest of a statement after an error: up to and
+// including the next ';' outside braces, or a whole braced body (plus any
+// 'else' that follows it). A '}' that closes an enclosing block is left for
+// that block unless nothing has been consumed yet.
+static inline void parserSynchronize(Parser *parser, uint32_t start, int inBlock) {
+    int nesting = 0;
+    while (!parserAt(parser, TK_EOF)) {
+        TokenKind kind = parserPeek(parser, 0);
+        if (kind == TK_LBRACE) {
+            nesting++;
+        } else if (kind == TK_RBRACE) {
+            if (nesting == 0) {
+                if (!inBlock || parser->current == start) parserAdvance(parser);
+                return;
+            }
+            if (--nesting == 0) {
+                parserAdvance(parser);
+                if (!parserAt(parser, TK_ELSE)) return;
+            }
+        } else if (kind == TK_SEMICOLON && nesting == 0) {
+            parserAdvance(parser);
+            return;
+        }
+        parserAdvance(parser);
+    }
+}
+
+// Function to parse one item and, if it reports an error, synchronize and
+// return 0 instead of a node. Each call is a recovery point: errors inside
+// nested blocks are caught by the innermost one.
+static inline uint32_t parseRecovering(Parser *parser, uint32_t (*parseItem)(Parser *), int inBlock) {
+    jmp_buf outer;
+    uint32_t start = parser->current;
+    uint32_t anchor = parser->anchor;
+    int depth = parser->depth;
+    uint32_t node;
+    memcpy(outer, parser->bail, sizeof(jmp_buf));
+    parser->anchor = start;
+    if (setjmp(parser->bail) != 0) {
+        memcpy(parser->bail, outer, sizeof(jmp_buf));
+        parser->depth = depth;
+        if (parser->stopped) longjmp(parser->bail, 1);
+        parserSynchronize(parser, start, inBlock);
+        // With spans kept, a placeholder remembers which tokens the statement covered
+        node = parser->ast->spans != NULL ? astNew(parser->ast, AST_EMPTY, 0, start) : 0;
+        if (node != 0) parser->ast->nodes[node].flags = AST_FLAG_ERROR;
+    } else {
+        node = parseItem(parser);
+        memcpy(parser->bail, outer, sizeof(jmp_buf));
+    }
+    parser->anchor = anchor;
+    if (node != 0 && parser->ast->spans != NULL) {
+        parser->ast->spans[2 * node] = start;
+        parser->ast->spans[2 * node + 1] = parser->current;
+    }
+    return node;
+}
+
+static inline uint32_t parseTopLevel(Parser *parser) {
+    if (isTypeKeyword(parserPeek(parser, 0)) && parserPeek(parser, 1) == TK_IDENTIFIER &&
+        parserPeek(parser, 2) == TK_LPAREN) {
+        return parseFunction(parser);
+    }
+    return parseStatement(parser);
+}
+
+// Function to parse a whole token array into parser->ast. Returns the
+// program node, or 0 if any syntax error was reported.
+static inline uint32_t parseProgram(Parser *parser) {
+    AstArena *ast = parser->ast;
+    uint32_t program = astNew(ast, AST_PROGRAM, 0, 0);
+    uint32_t first = 0, last = 0;
+    parser->current = 0;
+    parser->depth = 0;
+    if (setjmp(parser->bail) != 0) {
+        return 0;  // maxErrors reached
+    }
+    while (!parserAt(parser, TK_EOF)) {
+        uint32_t item = parseRecovering(parser, parseTopLevel, 0);
+        if (parser->discardItems) {
+            ast->count = program + 1;
+        } else if (item != 0) {
+            astLink(ast, &first, &last, item);
+        }
+    }
+    ast->nodes[program].firstChild = first;
+    return parser->errorCount == 0 ? program : 0;
+}
+
+static inline void parserInit(Parser *parser, AstArena *ast, const PackedToken *tokens, uint32_t tokenCount,
+                              const InternTable *names, const char *source) {
+    memset(parser, 0, sizeof(*parser));
+    parser->line = 1;
+    parser->tokens = tokens;
+    parser->tokenCount = tokenCount;
+    parser->tokenMask = 0xFFFFFFFFu;
+    parser->names = names;
+    parser->source = source;
+    parser->ast = ast;
+    parser->out = stdout;
+}
+
+// Function to make the parser pull its tokens from a cursor instead
+static inline void parserUseCursor(Parser *parser, TokenCursor *cursor) {
+    parser->cursor = cursor;
+    parser->tokens = cursor->ring;
+    parser->tokenCount = cursor->count;
+    parser->tokenMask = CURSOR_RING_SIZE - 1;
+    parserPull(parser);
+}
+
+// Function to print a subtree, one node per line, indented by depth.
+// Iterative so that very deep trees cannot overflow the stack.
+static inline void astDump(const Parser *parser, uint32_t root) {
+    const AstNode *nodes = parser->ast->nodes;
+    uint32_t *stack = internAlloc(NULL, (size_t)parser->ast->count * 2 * sizeof(uint32_t));
+    int top = 0;
+    stack[top++] = root;
+    stack[top++] = 0;
+    while (top > 0) {
+        uint32_t depth = stack[--top];
+        uint32_t index = stack[--top];
+        const AstNode *node = &nodes[index];
+        fprintf(parser->out, "%*s%s", (int)depth * 2, "", astKindNames[node->kind]);
+        switch (node->kind) {
+            case AST_FUNCTION: case AST_PARAM: case AST_DECLARATOR:
+                fprintf(parser->out, " %s : %s", parserTokenText(parser, node->token), tokenSpellings[node->op]);
+                break;
+            case AST_DECLARATION:
+                fprintf(parser->out, " %s", tokenSpellings[node->op]);
+                break;
+            case AST_IDENTIFIER: case AST_NUMBER: case AST_STRING: case AST_MEMBER:
+                fprintf(parser->out, " %s", parserTokenText(parser, node->token));
+                break;
+            case AST_ASSIGN: case AST_BINARY: case AST_UNARY:
+                fprintf(parser->out, " %s", tokenSpellings[node->op]);
+                break;
+            case AST_PREFIX: case AST_POSTFIX:
+                fprintf(parser->out, " %s", node->op == TK_PLUS ? "++" : "--");
+                break;
+        }
+        fprintf(parser->out, "\n");
+
+        // Push children in reverse so they print in source order
+        int childStart = top;
+        for (uint32_t child = node->firstChild; child != 0; child = nodes[child].nextSibling) {
+            stack[top++] = child;
+            stack[top++] = depth + 1;
+        }
+        for (int i = childStart, j = top - 2; i < j; i += 2, j -= 2) {
+            uint32_t childIndex = stack[i], childDepth = stack[i + 1];
+            stack[i] = stack[j];
+            stack[i + 1] = stack[j + 1];
+            stack[j] = childIndex;
+            stack[j + 1] = childDepth;
+        }
+    }
+    free(stack);
+}
+
+#endif
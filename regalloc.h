@@ -0,0 +1,257 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+// Liveness analysis and linear-scan register allocation over TAC.
+//
+// Every variable gets one live interval [start, end] of quad positions in
+// code order. Liveness is found per variable by path exploration: from each
+// use that is not preceded by a definition in its block, walk predecessor
+// blocks backwards until a definition is reached, marking the blocks the
+// value is live into and out of. This costs time proportional to the live
+// ranges themselves and needs no per-block bitsets. Holes in a range are not
+// tracked, so intervals are conservative.
+//
+// Named variables are the program's result, so they are treated as used at
+// the end of every exit block. A variable that is live into the entry block
+// is read before any assignment and must be zero-initialized.
+//
+// raLinearScan() is the algorithm of Poletto and Sarkar: intervals are
+// visited by increasing start; when no register is free, whichever of the
+// current interval and the active ones ends last is spilled to a stack slot.
+
+#include "cfg.h"
+
+#define RA_NONE 0xFFFFFFFFu
+#define RA_SPILLED -1
+
+typedef struct {
+    uint32_t varCount;
+    uint32_t *start;        // First position per variable, RA_NONE if unused
+    uint32_t *end;          // Last position per variable
+    uint8_t *liveAtEntry;   // Read before being assigned on some path
+    uint8_t *isNamed;
+    int *reg;               // Register index, or RA_SPILLED
+    uint32_t *slot;         // Stack slot of a spilled variable
+    uint32_t slotCount;
+} RegAlloc;
+
+static inline void raExtend(RegAlloc *ra, uint32_t var, uint32_t from, uint32_t to) {
+    if (ra->start[var] == RA_NONE || from < ra->start[var]) ra->start[var] = from;
+    if (ra->end[var] == RA_NONE || to > ra->end[var]) ra->end[var] = to;
+}
+
+// Function to mark var live into block b and walk back to its definitions
+static inline void raExplore(RegAlloc *ra, const Cfg *cfg, const uint32_t *defStamp, uint32_t *liveStamp,
+                             uint32_t *stack, uint32_t var, uint32_t b) {
+    uint32_t stamp = var + 1, top = 0;
+    if (liveStamp[b] == stamp) return;
+    liveStamp[b] = stamp;
+    stack[top++] = b;
+    while (top > 0) {
+        b = stack[--top];
+        raExtend(ra, var, cfg->blocks[b].start, cfg->blocks[b].start);
+        if (b == 0) ra->liveAtEntry[var] = 1;
+        for (uint32_t p = cfg->predStart[b]; p < cfg->predStart[b + 1]; p++) {
+            uint32_t pred = cfg->pred[p];
+            raExtend(ra, var, cfg->blocks[pred].end - 1, cfg->blocks[pred].end - 1);
+            if (defStamp[pred] == stamp || liveStamp[pred] == stamp) continue;
+            liveStamp[pred] = stamp;
+            stack[top++] = pred;
+        }
+    }
+}
+
+static inline void raLiveness(RegAlloc *ra, const TacBuffer *code, const Cfg *cfg) {
+    uint32_t n = cfg->blockCount;
+    ra->varCount = tacVarCount(code);
+    size_t vars = (size_t)ra->varCount + 1;
+    ra->start = internAlloc(NULL, vars * sizeof(uint32_t));
+    ra->end = internAlloc(NULL, vars * sizeof(uint32_t));
+    memset(ra->start, 0xFF, vars * sizeof(uint32_t));
+    memset(ra->end, 0xFF, vars * sizeof(uint32_t));
+    ra->liveAtEntry = calloc(vars, 1);
+    ra->isNamed = calloc(vars, 1);
+    uint32_t *defStamp = calloc((size_t)n + 1, sizeof(uint32_t));    // Block defines var + 1
+    uint32_t *liveStamp = calloc((size_t)n + 1, sizeof(uint32_t));   // var + 1 is live into block
+    uint32_t *stack = internAlloc(NULL, ((size_t)n + 1) * sizeof(uint32_t));
+    if (ra->liveAtEntry == NULL || ra->isNamed == NULL || defStamp == NULL || liveStamp == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < code->count; i++) {
+        const TacQuad *quad = &code->code[i];
+        uint32_t operands[3] = {quad->result, quad->arg1, quad->arg2};
+        for (int k = 0; k < 3; k++) {
+            if (TAC_TAG(operands[k]) == TAC_VAR) ra->isNamed[TAC_VALUE(operands[k])] = 1;
+        }
+    }
+
+    // Upward-exposed uses, grouped by variable so each is explored in turn:
+    // (var, block) pairs collected per block, then bucketed by variable
+    uint32_t *exposedStart = calloc(vars + 1, sizeof(uint32_t));
+    uint32_t *lastDefBlock = internAlloc(NULL, vars * sizeof(uint32_t));
+    uint32_t *lastUseBlock = internAlloc(NULL, vars * sizeof(uint32_t));
+    uint32_t *defsStart = calloc(vars + 1, sizeof(uint32_t));
+    if (exposedStart == NULL || defsStart == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t *exposed = pass ? internAlloc(NULL, ((size_t)exposedStart[ra->varCount] + 1) * sizeof(uint32_t)) : NULL;
+        uint32_t *defs = pass ? internAlloc(NULL, ((size_t)defsStart[ra->varCount] + 1) * sizeof(uint32_t)) : NULL;
+        uint32_t *fillExposed = pass ? calloc(vars, sizeof(uint32_t)) : NULL;
+        uint32_t *fillDefs = pass ? calloc(vars, sizeof(uint32_t)) : NULL;
+        memset(lastDefBlock, 0xFF, vars * sizeof(uint32_t));
+        memset(lastUseBlock, 0xFF, vars * sizeof(uint32_t));
+        for (uint32_t b = 0; b < n; b++) {
+            int isExit = cfgIsExit(cfg, b);
+            for (uint32_t i = cfg->blocks[b].start; i <= cfg->blocks[b].end; i++) {
+                uint32_t uses[2] = {RA_NONE, RA_NONE};
+                uint32_t def = RA_NONE;
+                if (i < cfg->blocks[b].end) {
+                    const TacQuad *quad = &code->code[i];
+                    if (quad->op != TAC_LABEL && quad->op != TAC_GOTO) {
+                        uses[0] = tacVarIndex(code, quad->arg1);
+                        uses[1] = tacVarIndex(code, quad->arg2);
+                    }
+                    if (tacDefines((TacOp)quad->op)) def = tacVarIndex(code, quad->result);
+                }
+                for (int k = 0; k < 2; k++) {
+                    uint32_t var = uses[k];
+                    if (var == RA_NONE) continue;
+                    if (pass == 0) raExtend(ra, var, i, i);
+                    if (lastDefBlock[var] != b && lastUseBlock[var] != b) {
+                        lastUseBlock[var] = b;
+                        if (pass == 0) exposedStart[var + 1]++;
+                        else exposed[exposedStart[var] + fillExposed[var]++] = b;
+                    }
+                }
+                if (def != RA_NONE) {
+                    if (pass == 0) raExtend(ra, def, i, i);
+                    if (lastDefBlock[def] != b) {
+                        if (pass == 0) defsStart[def + 1]++;
+                        else defs[defsStart[def] + fillDefs[def]++] = b;
+                    }
+                    lastDefBlock[def] = b;
+                }
+                if (i == cfg->blocks[b].end && isExit) {
+                    // Exit: every named variable is read here
+                    for (uint32_t var = 0; var < code->names.count; var++) {
+                        if (!ra->isNamed[var]) continue;
+                        if (pass == 0) raExtend(ra, var, i - 1, i - 1);
+                        if (lastDefBlock[var] == b || lastUseBlock[var] == b) continue;
+                        lastUseBlock[var] = b;
+                        if (pass == 0) exposedStart[var + 1]++;
+                        else exposed[exposedStart[var] + fillExposed[var]++] = b;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for (uint32_t v = 0; v < ra->varCount; v++) {
+                exposedStart[v + 1] += exposedStart[v];
+                defsStart[v + 1] += defsStart[v];
+            }
+            continue;
+        }
+        for (uint32_t var = 0; var < ra->varCount; var++) {
+            uint32_t stamp = var + 1;
+            for (uint32_t d = defsStart[var]; d < defsStart[var + 1]; d++) defStamp[defs[d]] = stamp;
+            for (uint32_t e = exposedStart[var]; e < exposedStart[var + 1]; e++) {
+                raExplore(ra, cfg, defStamp, liveStamp, stack, var, exposed[e]);
+            }
+        }
+        free(exposed);
+        free(defs);
+        free(fillExposed);
+        free(fillDefs);
+    }
+    free(exposedStart);
+    free(defsStart);
+    free(lastDefBlock);
+    free(lastUseBlock);
+    free(defStamp);
+    free(liveStamp);
+    free(stack);
+}
+
+static inline void raLinearScan(RegAlloc *ra, uint32_t positions, int regCount) {
+    size_t vars = (size_t)ra->varCount + 1;
+    ra->reg = internAlloc(NULL, vars * sizeof(int));
+    ra->slot = internAlloc(NULL, vars * sizeof(uint32_t));
+    memset(ra->slot, 0xFF, vars * sizeof(uint32_t));
+    ra->slotCount = 0;
+
+    // Order intervals by start with a counting sort over positions
+    uint32_t *byStart = internAlloc(NULL, vars * sizeof(uint32_t));
+    uint32_t *bucket = calloc((size_t)positions + 2, sizeof(uint32_t));
+    if (bucket == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    uint32_t count = 0;
+    for (uint32_t v = 0; v < ra->varCount; v++) {
+        ra->reg[v] = RA_SPILLED;
+        if (ra->start[v] != RA_NONE) bucket[ra->start[v] + 1]++;
+    }
+    for (uint32_t p = 0; p <= positions; p++) bucket[p + 1] += bucket[p];
+    for (uint32_t v = 0; v < ra->varCount; v++) {
+        if (ra->start[v] != RA_NONE) byStart[bucket[ra->start[v]]++] = v;
+    }
+    count = bucket[positions];
+    free(bucket);
+
+    uint32_t active[32];    // Sorted by increasing end
+    int activeCount = 0;
+    int freeRegs[32], freeCount = 0;
+    for (int r = regCount - 1; r >= 0; r--) freeRegs[freeCount++] = r;
+
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t v = byStart[k];
+        // Expire intervals that ended before this one starts
+        int kept = 0;
+        for (int a = 0; a < activeCount; a++) {
+            if (ra->end[active[a]] < ra->start[v]) freeRegs[freeCount++] = ra->reg[active[a]];
+            else active[kept++] = active[a];
+        }
+        activeCount = kept;
+
+        uint32_t assigned = v;
+        if (freeCount > 0) {
+            ra->reg[v] = freeRegs[--freeCount];
+        } else {
+            uint32_t victim = active[activeCount - 1];
+            if (ra->end[victim] > ra->end[v]) {
+                ra->reg[v] = ra->reg[victim];
+                ra->reg[victim] = RA_SPILLED;
+                ra->slot[victim] = ra->slotCount++;
+                activeCount--;
+            } else {
+                ra->slot[v] = ra->slotCount++;
+                assigned = RA_NONE;
+            }
+        }
+        if (assigned != RA_NONE) {
+            int a = activeCount++;
+            while (a > 0 && ra->end[active[a - 1]] > ra->end[v]) {
+                active[a] = active[a - 1];
+                a--;
+            }
+            active[a] = v;
+        }
+    }
+    free(byStart);
+}
+
+static inline void raFree(RegAlloc *ra) {
+    free(ra->start);
+    free(ra->end);
+    free(ra->liveAtEntry);
+    free(ra->isNamed);
+    free(ra->reg);
+    free(ra->slot);
+    memset(ra, 0, sizeof(*ra));
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef SEMA_H
+#define SEMA_H
+
+// Name resolution over the syntax tree.
+//
+// semaResolve() walks the AST once, opening a scope for every function,
+// block and for-statement, declaring names as their declarators are reached
+// and reporting each identifier that is used without a visible declaration
+// (with its line and column). Calling an undeclared function is accepted as
+// an implicit declaration, as for printf.
+//
+// When the tree records statement spans, each diagnostic is tagged with the
+// statement it came from (see DiagnosticHook), so a statement can be checked
+// again on its own and its messages replaced.
+
+#include "symtab.h"
+#include "parser.h"
+
+// Pending steps of the walk. It keeps its own stack instead of recursing, so
+// a long expression cannot overflow the C stack.
+typedef enum {
+    SEMA_VISIT,          // Resolve the subtree at node
+    SEMA_CHILDREN,       // Resolve node's children in the current scope
+    SEMA_DECLARE,        // Declare node's name (a declarator or parameter)
+    SEMA_EXIT_SCOPE,
+    SEMA_END_SPAN        // Leave the statement span of node; anchor is the outer one
+} SemaStep;
+
+typedef struct {
+    SemaStep step;
+    uint32_t node;
+    uint32_t anchor;
+} SemaWork;
+
+typedef struct {
+    SymbolTable table;
+    const AstArena *ast;
+    Parser *parser;          // Token text and locations for diagnostics
+    int errorCount;
+    uint32_t order;          // Sort key of diagnostics from the current statement
+    SemaWork *work;          // Steps of the walk still to do
+    uint32_t workCount;
+    uint32_t workCapacity;
+} Sema;
+
+static inline void semaInit(Sema *sema, const AstArena *ast, Parser *parser) {
+    symtabInit(&sema->table);
+    sema->ast = ast;
+    sema->parser = parser;
+    sema->errorCount = 0;
+    sema->order = 0;
+    sema->work = NULL;
+    sema->workCount = 0;
+    sema->workCapacity = 0;
+}
+
+static inline void semaFree(Sema *sema) {
+    symtabFree(&sema->table);
+    free(sema->work);
+}
+
+// Function to print a name-related error with the location of its token
+static inline void semaReport(Sema *sema, const char *message, uint32_t token) {
+    char *before = parserFormat("%s: %s (", message, parserTokenText(sema->parser, token));
+    parserDiagnostic(sema->parser, sema->order, token, before, ")\n");
+    free(before);
+    sema->errorCount++;
+}
+
+static inline void semaDeclare(Sema *sema, uint32_t token, TokenKind type) {
+    const char *name = parserTokenText(sema->parser, token);
+    if (symtabDeclare(&sema->table, name, (uint32_t)strlen(name), tokenSpellings[type]) == NULL) {
+        char *before = parserFormat("Error: Variable '%s' is already declared in this scope (", name);
+        parserDiagnostic(sema->parser, sema->order, token, before, ")\n");
+        free(before);
+        sema->errorCount++;
+    }
+}
+
+static inline void semaPush(Sema *sema, SemaStep step, uint32_t node, uint32_t anchor) {
+    if (sema->workCount == sema->workCapacity) {
+        sema->workCapacity = sema->workCapacity ? sema->workCapacity * 2 : 64;
+        sema->work = internAlloc(sema->work, (size_t)sema->workCapacity * sizeof(SemaWork));
+    }
+    sema->work[sema->workCount++] = (SemaWork){step, node, anchor};
+}
+
+// Function to reverse the steps pushed since first, so that steps pushed in
+// source order are taken in source order
+static inline void semaReverse(Sema *sema, uint32_t first) {
+    for (uint32_t last = sema->workCount; first + 1 < last; first++, last--) {
+        SemaWork swap = sema->work[first];
+        sema->work[first] = sema->work[last - 1];
+        sema->work[last - 1] = swap;
+    }
+}
+
+// Function to queue child and the siblings after it
+static inline void semaPushSiblings(Sema *sema, uint32_t child) {
+    uint32_t first = sema->workCount;
+    for (; child != 0; child = sema->ast->nodes[child].nextSibling) {
+        semaPush(sema, SEMA_VISIT, child, 0);
+    }
+    semaReverse(sema, first);
+}
+
+// Function to start on one node: act on it now and queue what comes after
+static inline void semaVisit(Sema *sema, uint32_t index) {
+    const AstNode *nodes = sema->ast->nodes;
+    const AstNode *node = &nodes[index];
+    uint32_t child = node->firstChild;
+    switch (node->kind) {
+        case AST_FUNCTION: {
+            // The name is visible in its own body; parameters share the body's scope
+            semaDeclare(sema, node->token, (TokenKind)node->op);
+            symtabEnterScope(&sema->table);
+            semaPush(sema, SEMA_EXIT_SCOPE, index, 0);
+            uint32_t first = sema->workCount;
+            for (; child != 0; child = nodes[child].nextSibling) {
+                semaPush(sema, nodes[child].kind == AST_PARAM ? SEMA_DECLARE : SEMA_CHILDREN, child, 0);
+            }
+            semaReverse(sema, first);
+            break;
+        }
+        case AST_BLOCK:
+        case AST_FOR:
+            symtabEnterScope(&sema->table);
+            semaPush(sema, SEMA_EXIT_SCOPE, index, 0);
+            semaPushSiblings(sema, child);
+            break;
+        case AST_DECLARATOR: {
+            // The array size is evaluated before the name exists, the initializer after
+            uint32_t size = 0;
+            if ((node->flags & AST_FLAG_ARRAY) && child != 0) {
+                size = child;
+                child = nodes[child].nextSibling;
+            }
+            if (child != 0) semaPush(sema, SEMA_VISIT, child, 0);
+            semaPush(sema, SEMA_DECLARE, index, 0);
+            if (size != 0) semaPush(sema, SEMA_VISIT, size, 0);
+            break;
+        }
+        case AST_IDENTIFIER: {
+            const char *name = parserTokenText(sema->parser, node->token);
+            if (symtabLookup(&sema->table, name, (uint32_t)strlen(name)) == NULL) {
+                semaReport(sema, "undeclared variable", node->token);
+            }
+            break;
+        }
+        case AST_CALL:
+            // Calling an undeclared function is an implicit declaration (printf etc.)
+            semaPushSiblings(sema, nodes[child].kind == AST_IDENTIFIER ? nodes[child].nextSibling : child);
+            break;
+        default:
+            semaPushSiblings(sema, child);
+            break;
+    }
+}
+
+// Function to resolve the names used in a subtree, tagging diagnostics with
+// the statement span they fall in: a statement's own messages sort by its
+// first token, and messages of its parent that follow it by its last token
+static inline void semaResolve(Sema *sema, uint32_t index) {
+    uint32_t base = sema->workCount;
+    semaPush(sema, SEMA_VISIT, index, 0);
+    while (sema->workCount > base) {
+        SemaWork work = sema->work[--sema->workCount];
+        const uint32_t *span = sema->ast->spans != NULL ? &sema->ast->spans[2 * work.node] : NULL;
+        switch (work.step) {
+            case SEMA_VISIT:
+                if (span != NULL && span[1] != 0) {
+                    semaPush(sema, SEMA_END_SPAN, work.node, sema->parser->anchor);
+                    sema->parser->anchor = span[0];
+                    sema->order = 2 * span[0];
+                }
+                semaVisit(sema, work.node);
+                break;
+            case SEMA_CHILDREN:
+                semaPushSiblings(sema, sema->ast->nodes[work.node].firstChild);
+                break;
+            case SEMA_DECLARE:
+                semaDeclare(sema, sema->ast->nodes[work.node].token, (TokenKind)sema->ast->nodes[work.node].op);
+                break;
+            case SEMA_EXIT_SCOPE:
+                symtabExitScope(&sema->table);
+                break;
+            case SEMA_END_SPAN:
+                sema->order = 2 * span[1] - 1;
+                sema->parser->anchor = work.anchor;
+                break;
+        }
+    }
+}
+
+#endif
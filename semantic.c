@@ -1,23 +1,22 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include "symtab.h"
+#include "sema.h"
+#include "stats.h"
 
-#define MAX_SYMBOLS 100
-#define MAX_LINES 100
 #define MAX_LINE_LENGTH 100
 
-typedef struct {
-    char name[30];
-    char type[10];
-    int scopeDepth;
-} Symbol;
-
-Symbol symbolTable[MAX_SYMBOLS];
-int symbolCount = 0;
-int currentScope = 0;
+SymbolTable symbolTable;   // Declarations visible in the current scope
 
-char programLines[MAX_LINES][MAX_LINE_LENGTH];
+char (*programLines)[MAX_LINE_LENGTH] = NULL;
 int lineCount = 0;
+int lineCapacity = 0;
+
+Stats stats;               // Phase times and counters
+int timeReport = -1;       // Print stats at exit: 0 = table, 1 = JSON
 
 const char *keywords[] = {"int", "float", "char", "if", "else", "for", "while"};
 int isKeyword(const char *word) {
@@ -29,34 +28,22 @@ int isKeyword(const char *word) {
 
 // Function to add a symbol to the symbol table
 void addSymbol(char *name, char *type) {
-    for (int i = 0; i < symbolCount; i++) {
-        if (strcmp(symbolTable[i].name, name) == 0 && symbolTable[i].scopeDepth == currentScope) {
-            printf("Error: Variable '%s' is already declared in this scope\n", name);
-            return;
-        }
+    if (symtabDeclare(&symbolTable, name, (uint32_t)strlen(name), type) == NULL) {
+        printf("Error: Variable '%s' is already declared in this scope\n", name);
+        return;
     }
-    Symbol newSymbol;
-    strcpy(newSymbol.name, name);
-    strcpy(newSymbol.type, type);
-    newSymbol.scopeDepth = currentScope;
-    symbolTable[symbolCount++] = newSymbol;
     printf("declared variable: %s\n", name);
 }
 
 // Function to check if a variable is declared
 int isDeclared(char *name) {
     if (isKeyword(name)) return 1; // Skip keywords as they are not variables
-    for (int i = symbolCount - 1; i >= 0; i--) {
-        if (strcmp(symbolTable[i].name, name) == 0 && symbolTable[i].scopeDepth <= currentScope) {
-            return 1; // Found the variable
-        }
-    }
-    return 0; // Variable not declared
+    return symtabLookup(&symbolTable, name, (uint32_t)strlen(name)) != NULL;
 }
 
 // Function to handle variable declaration
 void declareVariable(char *line) {
-    char type[10], name[30];
+    char type[MAX_LINE_LENGTH], name[MAX_LINE_LENGTH];
     if (sscanf(line, "%s %s =", type, name) == 2) {
         if (isKeyword(type)) {
             addSymbol(name, type);
@@ -66,7 +53,7 @@ void declareVariable(char *line) {
 
 // Function to handle variable assignment and usage
 void useVariable(char *line) {
-    char name[30];
+    char name[MAX_LINE_LENGTH];
     if (sscanf(line, "%s =", name) == 1) {
         if (!isDeclared(name)) {
             printf("undeclared variable: %s\n", name);
@@ -82,13 +69,13 @@ void analyzeLine(char *line) {
         useVariable(line);
     } else if (strstr(line, "if") == line || strstr(line, "for") == line || strstr(line, "while") == line) {
         printf("Entering new scope (conditional/loop)\n");
-        currentScope++;
+        symtabEnterScope(&symbolTable);
     } else if (strcmp(line, "{") == 0) {
         printf("Entering new block scope\n");
-        currentScope++;
+        symtabEnterScope(&symbolTable);
     } else if (strcmp(line, "}") == 0) {
         printf("Exiting block scope\n");
-        currentScope--;
+        symtabExitScope(&symbolTable);
     } else {
         printf("Unknown command: %s\n", line);
     }
@@ -96,31 +83,183 @@ void analyzeLine(char *line) {
 
 // Function to analyze the stored program lines
 void analyzeProgram() {
+    StatsClock start = statsNow();
     for (int i = 0; i < lineCount; i++) {
         char *line = programLines[i];
         analyzeLine(line);
     }
+    statsPhase(&stats, "analyzeProgram", start);
+}
+
+// Function to add a symbol table's work to the counters
+void countSymbols(const SymbolTable *table) {
+    statsAdd(&stats, STAT_SYMBOLS, table->declared);
+    statsAdd(&stats, STAT_SCOPE_PUSHES, table->scopesEntered);
+    statsAdd(&stats, STAT_SCOPE_POPS, table->scopesExited);
+}
+
+// ---------------------------------------------------------------------------
+// Token mode: resolve names over the syntax tree instead of matching lines.
+// Declarations, uses and scopes are handled in a single walk of the AST.
+
+InternTable tokenNames;    // Text of identifiers and literals by token id
+TokenStreamWriter lexed;
+AstArena ast;
+Parser parser;
+
+// Function to parse tokens and resolve every name. Returns 0 on syntax errors.
+int analyzeTokens(const PackedToken *tokens, uint32_t tokenCount, const char *source) {
+    StatsClock start = statsNow();
+    astInit(&ast, tokenCount + 1);
+    parserInit(&parser, &ast, tokens, tokenCount, &tokenNames, source);
+    parser.maxErrors = 100;
+    uint32_t program = parseProgram(&parser);
+    statsPhase(&stats, "parseProgram", start);
+    statsAdd(&stats, STAT_TOKENS, tokenCount);
+    if (program == 0) {
+        printf("Semantic analysis skipped: %d syntax error%s.\n", parser.errorCount, parser.errorCount == 1 ? "" : "s");
+        return 0;
+    }
+    Sema sema;
+    start = statsNow();
+    semaInit(&sema, &ast, &parser);
+    semaResolve(&sema, program);
+    statsPhase(&stats, "semaResolve", start);
+    printf("%d semantic error%s.\n", sema.errorCount, sema.errorCount == 1 ? "" : "s");
+    countSymbols(&sema.table);
+    semaFree(&sema);
+    return 1;
+}
+
+// Function to run token mode on a source file
+int analyzeFile(const char *path) {
+    Source source;
+    if (!sourceOpen(&source, path)) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", path);
+        return 0;
+    }
+    size_t errorOffset = 0;
+    StatsClock start = statsNow();
+    tokenStreamInit(&lexed, &tokenNames);
+    TokenKind error = lexerTokenize(source.text, source.length, &lexed, &errorOffset);
+    statsPhase(&stats, "tokenize", start);
+    statsAdd(&stats, STAT_BYTES, source.length);
+    int ok = 0;
+    if (error == TK_UNCLOSED_COMMENT) {
+        printf("Error: Unclosed multi-line comment\n");
+    } else if (error == TK_UNCLOSED_STRING) {
+        printf("Error: Unclosed string literal\n");
+    } else {
+        ok = analyzeTokens(lexed.tokens, lexed.tokenCount, source.text);
+    }
+    tokenStreamFree(&lexed);
+    sourceClose(&source);
+    return ok;
+}
+
+// Function to run token mode on a binary token stream written by the lexer.
+// Stream ids index the interned names directly because they are added in order.
+int analyzeTokenStream(const char *path) {
+    TokenStream stream;
+    if (!tokenStreamOpen(path, &stream)) {
+        fprintf(stderr, "Error: Cannot read token stream '%s'\n", path);
+        return 0;
+    }
+    StatsClock start = statsNow();
+    for (uint32_t id = 0; id < stream.stringCount; id++) {
+        const char *text = stream.stringData + stream.stringOffsets[id];
+        internString(&tokenNames, text, tokenStreamLength(&stream, id));
+    }
+    statsPhase(&stats, "loadTokens", start);
+    // A repeated string would shift every later id off its text
+    if (tokenNames.count != stream.stringCount) {
+        fprintf(stderr, "Error: '%s' is not a valid token stream\n", path);
+        tokenStreamClose(&stream);
+        return 0;
+    }
+    int ok = analyzeTokens(stream.tokens, stream.tokenCount, NULL);
+    tokenStreamClose(&stream);
+    return ok;
 }
 
 // Function to read program lines until "END"
 void readProgram() {
+    StatsClock start = statsNow();
     printf("Enter your program (type 'END' to finish):\n");
     while (1) {
-        fgets(programLines[lineCount], sizeof(programLines[lineCount]), stdin);
+        if (lineCount == lineCapacity) {
+            lineCapacity = lineCapacity ? lineCapacity * 2 : 256;
+            programLines = internAlloc(programLines, (size_t)lineCapacity * sizeof(*programLines));
+        }
+        if (fgets(programLines[lineCount], sizeof(programLines[lineCount]), stdin) == NULL) break;
         
         // Remove newline character
         programLines[lineCount][strcspn(programLines[lineCount], "\n")] = 0;
 
         if (strcmp(programLines[lineCount], "END") == 0) break;
         
+        statsAdd(&stats, STAT_BYTES, strlen(programLines[lineCount]) + 1);
         lineCount++;
     }
+    statsPhase(&stats, "readProgram", start);
+}
+
+// Function to print the phase times and counters to stderr once (also run
+// at exit)
+void printTimeReport(void) {
+    if (timeReport < 0) return;
+    fflush(stdout);
+    statsPrint(&stats, stderr, timeReport);
+    timeReport = -1;
 }
 
-int main() {
+void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [--time-report | --stats] [--tokens FILE | SOURCE]\n", program);
+    fprintf(stderr, "  SOURCE         lex and parse this file, then resolve its names\n");
+    fprintf(stderr, "  --tokens FILE  resolve names in a binary token stream from the lexer\n");
+    fprintf(stderr, "  (no argument)  line-by-line analysis of stdin up to a line 'END'\n");
+    fprintf(stderr, "  --time-report  print time per phase and work counters to stderr\n");
+    fprintf(stderr, "  --stats        the same as JSON\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *tokensPath = NULL;
+    const char *sourcePath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tokens") == 0 && i + 1 < argc) {
+            tokensPath = argv[++i];
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            timeReport = 0;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            timeReport = 1;
+        } else if (argv[i][0] != '-' && sourcePath == NULL) {
+            sourcePath = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    statsInit(&stats);
+    if (timeReport >= 0) atexit(printTimeReport);
     printf("Starting Semantic Analysis...\n");
-    readProgram();
-    analyzeProgram();
+    symtabInit(&symbolTable);
+    if (tokensPath != NULL || sourcePath != NULL) {
+        internInit(&tokenNames);
+        int ok = tokensPath != NULL ? analyzeTokenStream(tokensPath) : analyzeFile(sourcePath);
+        astFree(&ast);
+        internFree(&tokenNames);
+        if (!ok) {
+            symtabFree(&symbolTable);
+            return 1;
+        }
+    } else {
+        readProgram();
+        analyzeProgram();
+        countSymbols(&symbolTable);
+        free(programLines);
+    }
     printf("Semantic Analysis Completed.\n");
+    symtabFree(&symbolTable);
     return 0;
 }
@@ -0,0 +1,184 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Per-phase timing and work counters for --time-report and --stats.
+//
+// A program keeps one Stats, brackets each phase with statsNow() and
+// statsPhase(), and adds to the counters as data passes through. Phases are
+// named after the functions they time and accumulate over repeated calls.
+// Wall time comes from the monotonic clock and CPU time from the calling
+// thread's clock, so a compilation running on a pool thread is charged only
+// for its own work; Stats of several threads are combined with statsMerge().
+// Reading the clocks costs a few tens of nanoseconds per phase, so the data
+// is always collected and only printed on request.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#define STATS_MAX_PHASES 16
+
+typedef enum {
+    STAT_BYTES,          // Source bytes scanned
+    STAT_TOKENS,
+    STAT_SYMBOLS,        // Symbol table entries (declarations, or distinct identifiers for the lexer)
+    STAT_SCOPE_PUSHES,
+    STAT_SCOPE_POPS,
+    STAT_QUADS,          // Three-address instructions generated
+    STAT_COUNTER_COUNT
+} StatCounter;
+
+static const char *const statLabels[] = {"bytes scanned", "tokens", "symbols", "scope pushes", "scope pops", "TAC quads"};
+static const char *const statKeys[] = {"bytes", "tokens", "symbols", "scopePushes", "scopePops", "quads"};
+
+typedef struct {
+    uint64_t wall;       // Nanoseconds
+    uint64_t cpu;
+} StatsClock;
+
+typedef struct {
+    const char *name;    // Static string; phases are matched by text
+    uint32_t calls;
+    uint64_t wall;
+    uint64_t cpu;
+} StatsPhase;
+
+typedef struct {
+    StatsPhase phases[STATS_MAX_PHASES];   // In order of first use
+    uint32_t phaseCount;
+    uint64_t counters[STAT_COUNTER_COUNT];
+    StatsClock start;    // Process clocks at statsInit(), for the totals
+} Stats;
+
+static inline uint64_t statsNanoseconds(const struct timespec *time) {
+    return (uint64_t)time->tv_sec * 1000000000u + (uint64_t)time->tv_nsec;
+}
+
+// Function to read the wall clock and this thread's CPU clock
+static inline StatsClock statsNow(void) {
+    StatsClock now;
+    struct timespec time;
+#ifndef _WIN32
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    now.wall = statsNanoseconds(&time);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    now.cpu = statsNanoseconds(&time);
+#else
+    timespec_get(&time, TIME_UTC);
+    now.wall = statsNanoseconds(&time);
+    now.cpu = (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+    return now;
+}
+
+// Function to read the wall clock and the CPU time of the whole process
+static inline StatsClock statsProcessNow(void) {
+    StatsClock now = statsNow();
+#ifndef _WIN32
+    struct timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    now.cpu = statsNanoseconds(&time);
+#endif
+    return now;
+}
+
+static inline void statsInit(Stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->start = statsProcessNow();
+}
+
+// Function to find a phase by name, adding it on first use. Returns NULL
+// once the table is full.
+static inline StatsPhase *statsFindPhase(Stats *stats, const char *name) {
+    for (uint32_t i = 0; i < stats->phaseCount; i++) {
+        if (strcmp(stats->phases[i].name, name) == 0) return &stats->phases[i];
+    }
+    if (stats->phaseCount == STATS_MAX_PHASES) return NULL;
+    StatsPhase *phase = &stats->phases[stats->phaseCount++];
+    memset(phase, 0, sizeof(*phase));
+    phase->name = name;
+    return phase;
+}
+
+// Function to charge the time since start to a phase
+static inline void statsPhase(Stats *stats, const char *name, StatsClock start) {
+    StatsClock now = statsNow();
+    StatsPhase *phase = statsFindPhase(stats, name);
+    if (phase == NULL) return;
+    phase->calls++;
+    phase->wall += now.wall - start.wall;
+    phase->cpu += now.cpu - start.cpu;
+}
+
+static inline void statsAdd(Stats *stats, StatCounter counter, uint64_t amount) {
+    stats->counters[counter] += amount;
+}
+
+// Function to add the phases and counters of from into stats
+static inline void statsMerge(Stats *stats, const Stats *from) {
+    for (uint32_t i = 0; i < from->phaseCount; i++) {
+        StatsPhase *phase = statsFindPhase(stats, from->phases[i].name);
+        if (phase == NULL) continue;
+        phase->calls += from->phases[i].calls;
+        phase->wall += from->phases[i].wall;
+        phase->cpu += from->phases[i].cpu;
+    }
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) stats->counters[i] += from->counters[i];
+}
+
+// Function to get the peak resident memory of the process in KiB (0 if unknown)
+static inline uint64_t statsPeakMemory(void) {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss / 1024;   // Bytes on macOS
+#else
+    return (uint64_t)usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Function to print the report, as a table or (json set) as one JSON object.
+// Totals are for the whole process; with several threads the phase times
+// add up to more than the total wall time.
+static inline void statsPrint(const Stats *stats, FILE *out, int json) {
+    StatsClock now = statsProcessNow();
+    double totalWall = (now.wall - stats->start.wall) / 1e6;
+    double totalCpu = (now.cpu - stats->start.cpu) / 1e6;
+    uint64_t peakMemory = statsPeakMemory();
+    if (json) {
+        fprintf(out, "{\"phases\": [");
+        for (uint32_t i = 0; i < stats->phaseCount; i++) {
+            const StatsPhase *phase = &stats->phases[i];
+            fprintf(out, "%s{\"name\": \"%s\", \"calls\": %u, \"wallMs\": %.3f, \"cpuMs\": %.3f}", i > 0 ? ", " : "",
+                    phase->name, phase->calls, phase->wall / 1e6, phase->cpu / 1e6);
+        }
+        fprintf(out, "], \"total\": {\"wallMs\": %.3f, \"cpuMs\": %.3f}, \"counters\": {", totalWall, totalCpu);
+        for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+            fprintf(out, "\"%s\": %llu, ", statKeys[i], (unsigned long long)stats->counters[i]);
+        }
+        fprintf(out, "\"peakMemoryKiB\": %llu}}\n", (unsigned long long)peakMemory);
+        return;
+    }
+    fprintf(out, "\nTime report:\n");
+    fprintf(out, "  %-24s %8s %12s %12s\n", "phase", "calls", "wall ms", "cpu ms");
+    for (uint32_t i = 0; i < stats->phaseCount; i++) {
+        const StatsPhase *phase = &stats->phases[i];
+        fprintf(out, "  %-24s %8u %12.3f %12.3f\n", phase->name, phase->calls, phase->wall / 1e6, phase->cpu / 1e6);
+    }
+    fprintf(out, "  %-24s %8s %12.3f %12.3f\n", "total", "", totalWall, totalCpu);
+    fprintf(out, "Counters:\n");
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        fprintf(out, "  %-24s %12llu\n", statLabels[i], (unsigned long long)stats->counters[i]);
+    }
+    fprintf(out, "  %-24s %12llu\n", "peak memory (KiB)", (unsigned long long)peakMemory);
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+// Scoped symbol table.
+//
+// Names are interned, so each distinct name has a small integer id. For every
+// id the table keeps the index of its innermost visible declaration, and each
+// declaration remembers the one it shadows. Declared symbols sit on a single
+// stack in declaration order, which makes the scopes contiguous:
+//
+//   - lookup is one intern probe plus an array read,
+//   - declare checks the innermost binding's depth for a redeclaration,
+//   - leaving a scope pops its symbols off the top of the stack and restores
+//     the bindings they shadowed, so stale entries never match again.
+
+#include "intern.h"
+
+#define SYMTAB_NONE 0xFFFFFFFFu
+
+typedef struct {
+    uint32_t name;       // Interned name id
+    uint32_t type;       // Interned type name id
+    int scopeDepth;
+    uint32_t shadowed;   // Previous binding of the same name, or SYMTAB_NONE
+} Symbol;
+
+typedef struct {
+    InternTable names;   // Names and type names
+    Symbol *symbols;     // Stack of visible declarations, innermost last
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *bindings;  // Innermost symbol per name id, or SYMTAB_NONE
+    uint32_t bindingCapacity;
+    int scopeDepth;
+    uint64_t declared;   // Work counters (see stats.h)
+    uint64_t scopesEntered;
+    uint64_t scopesExited;
+} SymbolTable;
+
+static inline void symtabInit(SymbolTable *table) {
+    memset(table, 0, sizeof(*table));
+    internInit(&table->names);
+}
+
+static inline void symtabFree(SymbolTable *table) {
+    internFree(&table->names);
+    free(table->symbols);
+    free(table->bindings);
+    memset(table, 0, sizeof(*table));
+}
+
+// Function to intern a name, making room for its binding slot
+static inline uint32_t symtabName(SymbolTable *table, const char *name, uint32_t length) {
+    uint32_t id = internString(&table->names, name, length);
+    if (id >= table->bindingCapacity) {
+        uint32_t capacity = table->bindingCapacity ? table->bindingCapacity : 256;
+        while (capacity <= id) capacity *= 2;
+        table->bindings = internAlloc(table->bindings, capacity * sizeof(uint32_t));
+        memset(table->bindings + table->bindingCapacity, 0xFF,
+               (capacity - table->bindingCapacity) * sizeof(uint32_t));
+        table->bindingCapacity = capacity;
+    }
+    return id;
+}
+
+// Function to find the innermost visible declaration of a name, or NULL
+static inline const Symbol *symtabLookup(const SymbolTable *table, const char *name, uint32_t length) {
+    uint32_t id = internFind(&table->names, name, length);
+    if (id == INTERN_NONE || id >= table->bindingCapacity || table->bindings[id] == SYMTAB_NONE) {
+        return NULL;
+    }
+    return &table->symbols[table->bindings[id]];
+}
+
+// Function to declare a name in the current scope. Returns NULL (and declares
+// nothing) if the name is already declared in this same scope.
+static inline const Symbol *symtabDeclare(SymbolTable *table, const char *name, uint32_t length,
+                                          const char *type) {
+    uint32_t id = symtabName(table, name, length);
+    uint32_t previous = table->bindings[id];
+    if (previous != SYMTAB_NONE && table->symbols[previous].scopeDepth == table->scopeDepth) {
+        return NULL;
+    }
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 256;
+        table->symbols = internAlloc(table->symbols, table->capacity * sizeof(Symbol));
+    }
+    Symbol *symbol = &table->symbols[table->count];
+    symbol->name = id;
+    symbol->type = internString(&table->names, type, (uint32_t)strlen(type));
+    symbol->scopeDepth = table->scopeDepth;
+    symbol->shadowed = previous;
+    table->bindings[id] = table->count++;
+    table->declared++;
+    return symbol;
+}
+
+static inline void symtabEnterScope(SymbolTable *table) {
+    table->scopeDepth++;
+    table->scopesEntered++;
+}
+
+// Function to leave the current scope, dropping all of its declarations at
+// once. A stray '}' at the top level has no scope to leave and is ignored,
+// so the global declarations stay.
+static inline void symtabExitScope(SymbolTable *table) {
+    if (table->scopeDepth == 0) return;
+    table->scopeDepth--;
+    table->scopesExited++;
+    while (table->count > 0 && table->symbols[table->count - 1].scopeDepth > table->scopeDepth) {
+        const Symbol *symbol = &table->symbols[--table->count];
+        table->bindings[symbol->name] = symbol->shadowed;
+    }
+}
+
+static inline const char *symtabText(const SymbolTable *table, uint32_t id) {
+    return internText(&table->names, id);
+}
+
+#endif
@@ -1,241 +1,310 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include "parser.h"
+#include "stats.h"
 
-#define MAX_TOKENS 100
-
-typedef struct {
-    char token[50];
-    char type[20];
-} Token;
+// Tokens of the current input: lexed in-process into `lexed`, or mapped
+// straight from a binary token stream file
+const PackedToken *tokens = NULL;
+uint32_t token_count = 0;
+InternTable names;          // Text of identifiers, numbers and strings by id
+TokenStreamWriter lexed;
+const char *source_text = NULL;
 
-Token tokens[MAX_TOKENS];
-int token_count = 0;
+AstArena ast;               // Syntax tree built by syntax_analysis()
+uint32_t ast_root = 0;
+int max_errors = 100;       // Cap on reported syntax errors; 0 = no limit
+Stats stats;                // Phase times and counters
+int time_report = -1;       // Print stats at exit: 0 = table, 1 = JSON
 
-void add_token(const char *token, const char *type) {
-    if (token_count < MAX_TOKENS) {
-        strcpy(tokens[token_count].token, token);
-        strcpy(tokens[token_count].type, type);
-        token_count++;
+// Tokenize the source with the shared lexer. Returns 0 on a lexical error.
+int tokenize(const char *code, size_t length) {
+    size_t error_offset = 0;
+    StatsClock start = statsNow();
+    tokenStreamInit(&lexed, &names);
+    TokenKind error = lexerTokenize(code, length, &lexed, &error_offset);
+    statsPhase(&stats, "tokenize", start);
+    statsAdd(&stats, STAT_BYTES, length);
+    statsAdd(&stats, STAT_TOKENS, lexed.tokenCount);
+    tokens = lexed.tokens;
+    token_count = lexed.tokenCount;
+    source_text = code;
+    if (error == TK_UNCLOSED_COMMENT) {
+        printf("Error: Unclosed multi-line comment\n");
+        return 0;
+    }
+    if (error == TK_UNCLOSED_STRING) {
+        printf("Error: Unclosed string literal\n");
+        return 0;
     }
+    return 1;
 }
-void tokenize(const char *code) {
-    char buffer[50];
-    int buf_index = 0;
-    token_count = 0;
-    int in_comment = 0; // Flag to track if we are inside a comment
-
-    for (int i = 0; i < strlen(code); i++) {
-        char ch = code[i];
-
-        // Handle single-line comments
-        if (ch == '/' && code[i + 1] == '/') {
-            break; // Ignore the rest of the line
-        }
 
-        // Handle multi-line comments
-        if (ch == '/' && code[i + 1] == '*') {
-            in_comment = 1; // Start of multi-line comment
-            i += 2; // Skip the "/*"
-            continue; // Continue to the next character
-        }
-        if (in_comment) {
-            if (ch == '*' && code[i + 1] == '/') {
-                in_comment = 0; // End of multi-line comment
-                i += 2; // Skip the "*/"
-            }
-            continue; // Skip characters while inside a comment
-        }
-
-        if (isspace(ch)) {
-            continue; // Skip whitespace
-        }
-
-        if (isalpha(ch)) { // Handle identifiers and keywords
-            buffer[buf_index++] = ch;
-            while (isalnum(code[i + 1])) {
-                buffer[buf_index++] = code[++i];
-            }
-            buffer[buf_index] = '\0';
-
-            // Check for keywords
-            if (strcmp(buffer, "int") == 0 || strcmp(buffer, "float") == 0 || 
-                strcmp(buffer, "char") == 0 || strcmp(buffer, "if") == 0 || 
-                strcmp(buffer, "while") == 0 || strcmp(buffer, "else") == 0) {
-                add_token(buffer, "Keyword");
-            } else {
-                add_token(buffer, "Identifier");
-            }
-            buf_index = 0;
-        } else if (isdigit(ch) || (ch == '.' && isdigit(code[i + 1]))) { // Handle numbers
-            buffer[buf_index++] = ch;
-            while (isdigit(code[i + 1]) || code[i + 1] == '.') {
-                buffer[buf_index++] = code[++i];
-            }
-            buffer[buf_index] = '\0';
-            add_token(buffer, "Number");
-            buf_index = 0;
-        } else { // Handle operators and symbols
-            buffer[buf_index++] = ch; // Add current character to buffer
-            buffer[buf_index] = '\0';
-
-            // Check if the character is an operator or symbol
-            if (ch == '=' || ch == '+' || ch == '-' || ch == '*' || ch == '/' || 
-                ch == '>' || ch == '<') {
-                add_token(buffer, "Operator");
-            } else if (ch == ';' || ch == '(' || ch == ')' || ch == '{' || ch == '}') {
-                add_token(buffer, "Symbol");
-            }
-            buf_index = 0; // Reset buffer index
-        }
+// Use the tokens of a binary token stream written by the lexer instead of
+// tokenizing the text again. The stream's strings are interned in id order,
+// so the ids stored in its tokens index `names` directly. Returns 0 if the
+// stream repeats a string, which would shift every later id off its text.
+int load_tokens(const TokenStream *stream) {
+    StatsClock start = statsNow();
+    for (uint32_t id = 0; id < stream->stringCount; id++) {
+        const char *text = stream->stringData + stream->stringOffsets[id];
+        internString(&names, text, tokenStreamLength(stream, id));
     }
+    if (names.count != stream->stringCount) return 0;
+    tokens = stream->tokens;
+    token_count = stream->tokenCount;
+    source_text = NULL;
+    statsPhase(&stats, "load_tokens", start);
+    statsAdd(&stats, STAT_TOKENS, token_count);
+    return 1;
 }
 
+const char *token_text(uint32_t index) {
+    const PackedToken *token = &tokens[index];
+    if (token->id != TOKSTREAM_NO_STRING) return internText(&names, token->id);
+    return tokenSpellings[token->kind] ? tokenSpellings[token->kind] : "";
+}
 
-#define MAX_STACK_SIZE 100
-
-typedef struct {
-    char items[MAX_STACK_SIZE];
-    int top;
-} Stack;
-
-void init_stack(Stack *s) {
-    s->top = -1;
+// Print the outcome of a parse. Returns 1 if the input is syntactically valid.
+int print_result(const Parser *parser, uint32_t root) {
+    if (root == 0) {
+        printf("Syntax analysis failed with %d error%s.\n", parser->errorCount, parser->errorCount == 1 ? "" : "s");
+        return 0;
+    }
+    printf("Syntax analysis completed successfully.\n");
+    return 1;
 }
 
-int is_empty(Stack *s) {
-    return s->top == -1;
+// Parse the tokens into an AST, reporting every syntax error (up to
+// max_errors) in one pass. Returns 1 if the input is syntactically valid.
+int syntax_analysis() {
+    Parser parser;
+    StatsClock start = statsNow();
+    astInit(&ast, token_count + 1);
+    parserInit(&parser, &ast, tokens, token_count, &names, source_text);
+    parser.maxErrors = max_errors;
+    ast_root = parseProgram(&parser);
+    statsPhase(&stats, "syntax_analysis", start);
+    return print_result(&parser, ast_root);
 }
 
-void push(Stack *s, char item) {
-    if (s->top < MAX_STACK_SIZE - 1) {
-        s->items[++(s->top)] = item;
+// Check a source without a token array or a kept syntax tree: the parser
+// pulls tokens from a cursor as it needs them and drops each top-level item
+// once parsed, so memory stays flat however large the input. Syntax errors
+// (at most max_errors) are held back until the whole input has been lexed,
+// because an unclosed comment or string at the end replaces them, as it does
+// when tokenize() runs first.
+int stream_analysis(const char *code, size_t length) {
+    TokenCursor cursor;
+    Parser parser;
+    char *held = NULL;
+    size_t held_length = 0;
+    FILE *diagnostics = open_memstream(&held, &held_length);
+    if (diagnostics == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
     }
-}
+    StatsClock start = statsNow();
+    cursorInit(&cursor, code, length);
+    astInit(&ast, 1024);
+    parserInit(&parser, &ast, NULL, 0, &names, code);
+    parserUseCursor(&parser, &cursor);
+    parser.discardItems = 1;
+    parser.out = diagnostics;
+    parser.maxErrors = max_errors;
+    ast_root = parseProgram(&parser);
+    while (cursorFill(&cursor)) {
+    }
+    fclose(diagnostics);
+    statsPhase(&stats, "stream_analysis", start);
+    statsAdd(&stats, STAT_BYTES, length);
+    statsAdd(&stats, STAT_TOKENS, cursor.count);
 
-char pop(Stack *s) {
-    if (!is_empty(s)) {
-        return s->items[(s->top)--];
+    int ok = 0;
+    if (cursor.error == TK_UNCLOSED_COMMENT) {
+        printf("Error: Unclosed multi-line comment\n");
+    } else if (cursor.error == TK_UNCLOSED_STRING) {
+        printf("Error: Unclosed string literal\n");
+    } else {
+        printf("Syntax Analysis:\n");
+        fwrite(held, 1, held_length, stdout);
+        ok = print_result(&parser, ast_root);
     }
-    return '\0'; // Return null character if stack is empty
+    free(held);
+    cursorFree(&cursor);
+    return ok;
 }
 
-int syntax_analysis() {
-    int expecting_identifier = 0; // Flag to check for identifier after keyword
-    Stack stack;
-    init_stack(&stack);
-    int block_opened = 0; // Track if a block is opened
-
-    for (int i = 0; i < token_count; i++) {
-        // Check for variable declaration
-        if (strcmp(tokens[i].type, "Keyword") == 0) {
-            if (strcmp(tokens[i].token, "int") == 0 || 
-                strcmp(tokens[i].token, "float") == 0 || 
-                strcmp(tokens[i].token, "char") == 0) {
-                expecting_identifier = 1; // Set to expect an identifier next
-            }
-        } else if (strcmp(tokens[i].type, "Identifier") == 0) {
-            if (expecting_identifier) {
-                expecting_identifier = 0; // Identifier found after keyword
-            } else {
-                printf("Syntax Error: Identifier '%s' found where it wasn't expected.\n", tokens[i].token);
-                return 0; // Unexpected identifier
-            }
-        } else if (strcmp(tokens[i].type, "Operator") == 0) {
-            // Check if an operator appears without a preceding identifier
-            if (expecting_identifier) {
-                printf("Syntax Error: Operator '%s' found without preceding identifier.\n", tokens[i].token);
-                return 0; // Unexpected operator
-            }
-            // Reset expecting_identifier as an identifier should follow this operator
-            expecting_identifier = 1; // Expecting an identifier after an assignment
-        }
-
-        // Check for missing semicolon: improved logic
-        if (strcmp(tokens[i].type, "Symbol") == 0) {
-            if (strcmp(tokens[i].token, ";") == 0) {
-                // Reset expecting_identifier flag
-                expecting_identifier = 0;
-            } else if (strcmp(tokens[i].token, "{") == 0) {
-                push(&stack, '{');
-                block_opened = 1; // Mark that a block has started
-            } else if (strcmp(tokens[i].token, "}") == 0) {
-                if (is_empty(&stack)) {
-                    printf("Syntax Error: Unmatched closing brace '}'\n");
-                    return 0;
-                }
-                pop(&stack);
-                // Reset expecting_identifier flag after closing a block
-                expecting_identifier = 0; 
-            } else {
-                // If we encounter any other symbol not recognized as a terminator, check for errors
-                if (block_opened && (strcmp(tokens[i].token, "else") != 0)) {
-                    printf("Syntax Error: Missing semicolon or unexpected symbol '%s'\n", tokens[i].token);
-                    return 0;
-                }
-            }
-        }
-
-        // Check for parentheses matching
-        if (strcmp(tokens[i].token, "(") == 0) {
-            push(&stack, '(');
-        } else if (strcmp(tokens[i].token, ")") == 0) {
-            if (is_empty(&stack)) {
-                printf("Syntax Error: Unmatched closing parenthesis ')'\n");
-                return 0;
-            }
-            pop(&stack);
-        }
+// Write the current tokens as a binary token stream with a single write
+int emit_tokens(const char *path) {
+    StatsClock start = statsNow();
+    TokenStreamWriter writer;
+    tokenStreamInit(&writer, &names);
+    for (uint32_t i = 0; i < token_count; i++) {
+        tokenStreamAddId(&writer, (TokenKind)tokens[i].kind, tokens[i].offset, tokens[i].length, tokens[i].id);
     }
-
-    // Check for unmatched opening parentheses and braces
-    if (!is_empty(&stack)) {
-        if (stack.items[stack.top] == '(') {
-            printf("Syntax Error: Unmatched opening parenthesis '('\n");
-        } else if (stack.items[stack.top] == '{') {
-            printf("Syntax Error: Unmatched opening brace '{'\n");
-        }
-        return 0;
+    int fd = 1;
+    if (strcmp(path, "-") == 0) {
+        fflush(stdout);
+    } else {
+#ifndef _WIN32
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+        fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#endif
     }
+    int ok = fd >= 0 && tokenStreamWrite(&writer, fd);
+    if (fd > 1) close(fd);
+    tokenStreamFree(&writer);
+    statsPhase(&stats, "emit_tokens", start);
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot write token stream to '%s'\n", path);
+    }
+    return ok;
+}
 
-    // Check for missing semicolon at the end of the last statement if it's not empty
-    if (token_count > 0 && strcmp(tokens[token_count - 1].token, ";") != 0 && 
-        strcmp(tokens[token_count - 1].token, "}") != 0) {
-        printf("Syntax Error: Missing semicolon at the end of the statement.\n");
-        return 0;
+void print_tokens() {
+    StatsClock start = statsNow();
+    printf("Tokenized Output:\n");
+    for (uint32_t i = 0; i < token_count; i++) {
+        const char *type = tokenTypeNames[tokens[i].kind];
+        printf("Token: %s, Type: %s\n", token_text(i), type ? type : "Unknown");
     }
+    statsPhase(&stats, "print_tokens", start);
+}
 
-    printf("Syntax analysis completed successfully.\n");
-    return 1;
+// Parse the tokens and report the result; optionally dump the AST
+void analyze(int dump_ast) {
+    printf("Syntax Analysis:\n");
+    if (syntax_analysis() && dump_ast) {
+        Parser parser;
+        parserInit(&parser, &ast, tokens, token_count, &names, source_text);
+        printf("Abstract Syntax Tree:\n");
+        StatsClock start = statsNow();
+        astDump(&parser, ast_root);
+        statsPhase(&stats, "astDump", start);
+    }
 }
 
+// Print the phase times and counters to stderr once (also run at exit)
+void print_time_report(void) {
+    if (time_report < 0) return;
+    stats.counters[STAT_SYMBOLS] = names.count;
+    fflush(stdout);
+    statsPrint(&stats, stderr, time_report);
+    time_report = -1;
+}
 
-void run_test(const char *code) {
+void run_test(const char *code, size_t length, const char *emit_path, int dump_ast) {
     printf("Input:\n%s\n", code);
-    tokenize(code);
-    printf("Tokenized Output:\n");
-    for (int i = 0; i < token_count; i++) {
-        printf("Token: %s, Type: %s\n", tokens[i].token, tokens[i].type);
+    if (!tokenize(code, length)) return;
+    if (emit_path != NULL) {
+        if (!emit_tokens(emit_path)) return;
+    } else {
+        print_tokens();
     }
-    printf("Syntax Analysis:\n");
-    syntax_analysis();
+    analyze(dump_ast);
     printf("\n");
 }
 
-int main() {
-    char code[1000];
-    char line[100];
-    code[0] = '\0'; // Initialize to an empty string
-    printf("Enter your C-like code (type 'END' on a new line to finish input):\n");
-    
-    while (1) {
-        fgets(line, sizeof(line), stdin);
-        if (strcmp(line, "END\n") == 0) {
-            break; // Stop input on 'END'
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--tokens FILE] [--emit-tokens OUT] [--dump-ast] [--max-errors N]\n", program);
+    fprintf(stderr, "       [--time-report | --stats] [SOURCE]\n");
+    fprintf(stderr, "  SOURCE             parse this file (memory-mapped) without echoing it;\n");
+    fprintf(stderr, "                     otherwise read stdin up to a line 'END'\n");
+    fprintf(stderr, "  --tokens FILE      parse a binary token stream written by the lexer;\n");
+    fprintf(stderr, "                     SOURCE, if given, is only used for line numbers\n");
+    fprintf(stderr, "  --emit-tokens OUT  write the tokens as a binary stream instead of text\n");
+    fprintf(stderr, "  --dump-ast         print the syntax tree after a successful parse\n");
+    fprintf(stderr, "  --max-errors N     stop after N syntax errors (default 100, 0 = no limit)\n");
+    fprintf(stderr, "  --time-report      print time per phase and work counters to stderr\n");
+    fprintf(stderr, "  --stats            the same as JSON\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *tokens_path = NULL; // Read tokens from a binary stream instead of text
+    const char *emit_path = NULL;   // Write tokens as a binary stream instead of text
+    const char *source_path = NULL;
+    int dump_ast = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tokens") == 0 && i + 1 < argc) {
+            tokens_path = argv[++i];
+        } else if (strcmp(argv[i], "--emit-tokens") == 0 && i + 1 < argc) {
+            emit_path = argv[++i];
+        } else if (strcmp(argv[i], "--dump-ast") == 0) {
+            dump_ast = 1;
+        } else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc) {
+            max_errors = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            time_report = 0;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            time_report = 1;
+        } else if (argv[i][0] != '-' && source_path == NULL) {
+            source_path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    statsInit(&stats);
+    internInit(&names);
+    if (time_report >= 0) atexit(print_time_report);
+
+    if (tokens_path != NULL) {
+        TokenStream stream;
+        if (!tokenStreamOpen(tokens_path, &stream)) {
+            fprintf(stderr, "Error: Cannot read token stream '%s'\n", tokens_path);
+            return 1;
+        }
+        if (!load_tokens(&stream)) {
+            fprintf(stderr, "Error: '%s' is not a valid token stream\n", tokens_path);
+            tokenStreamClose(&stream);
+            return 1;
         }
-        strcat(code, line); // Append the new line to the code string
+        Source source = {NULL, 0, 0};
+        if (source_path != NULL && sourceOpen(&source, source_path)) {
+            source_text = source.text;  // For line and column numbers in diagnostics
+        }
+        if (emit_path != NULL) {
+            emit_tokens(emit_path);
+        } else if (source_path == NULL) {
+            print_tokens();
+        }
+        analyze(dump_ast);
+        if (source.text != NULL) sourceClose(&source);
+        tokenStreamClose(&stream);
+    } else if (source_path != NULL) {
+        // Large inputs: parse the mapped file and report only the result
+        Source source;
+        if (!sourceOpen(&source, source_path)) {
+            fprintf(stderr, "Error: Cannot open '%s'\n", source_path);
+            return 1;
+        }
+        if (emit_path == NULL && !dump_ast) {
+            stream_analysis(source.text, source.length);   // Nothing needs the tokens or the tree afterwards
+        } else if (tokenize(source.text, source.length)) {
+            if (emit_path != NULL) emit_tokens(emit_path);
+            analyze(dump_ast);
+        }
+        tokenStreamFree(&lexed);
+        sourceClose(&source);
+    } else {
+        Source source;
+        printf("Enter your C-like code (type 'END' on a new line to finish input):\n");
+        if (!sourceReadUntilEnd(&source, stdin)) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        run_test(source.text, source.length, emit_path, dump_ast); // Run the tokenization and syntax analysis on the full input
+        tokenStreamFree(&lexed);
+        sourceClose(&source);
     }
-    
-    run_test(code); // Run the tokenization and syntax analysis on the full input
+
+    print_time_report();   // While the names still exist
+    astFree(&ast);
+    internFree(&names);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,256 @@
+#ifndef TAC_H
+#define TAC_H
+
+// Three-address code buffer.
+//
+// Each instruction is a fixed 16-byte quad: an opcode, a condition for
+// conditional jumps, and three 32-bit operands. Operands are tagged values,
+// not strings, so emitting code never formats or copies text:
+//
+//   bits 31..29  tag (TAC_VAR, TAC_TEMP, TAC_LABEL, TAC_IMM, TAC_CONST)
+//   bits 28..0   interned name id, temporary number, label number,
+//                signed immediate, or interned literal text id
+//
+// The all-zero operand means "no operand". Quads live in one growable
+// array; names and literals live in the buffer's intern table.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "intern.h"
+
+typedef enum {
+    TAC_NOP,
+    TAC_COPY,                // result = arg1
+    TAC_ADD, TAC_SUB, TAC_MUL, TAC_DIV, TAC_MOD,
+    TAC_LT, TAC_LE, TAC_GT, TAC_GE, TAC_EQ, TAC_NE,   // result = arg1 op arg2
+    TAC_NEG, TAC_NOT,        // result = op arg1
+    TAC_LABEL,               // result:
+    TAC_GOTO,                // goto result
+    TAC_IF,                  // if arg1 cond arg2 goto result
+    TAC_PRINT,               // printf(arg1)
+    TAC_OP_COUNT
+} TacOp;
+
+// Spelling of each opcode as an operator in the printed code
+static const char *const tacOpSymbols[TAC_OP_COUNT] = {
+    "nop", "=", "+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=",
+    "-", "!", "label", "goto", "if", "printf",
+};
+
+// Function to tell whether an opcode computes a value into result
+static inline int tacDefines(TacOp op) {
+    return op >= TAC_COPY && op <= TAC_NOT;
+}
+
+typedef struct {
+    uint8_t op;          // TacOp
+    uint8_t cond;        // TacOp comparison for TAC_IF
+    uint16_t flags;
+    uint32_t result;
+    uint32_t arg1;
+    uint32_t arg2;
+} TacQuad;
+
+#define TAC_NONE 0u
+#define TAC_VAR 1u
+#define TAC_TEMP 2u
+#define TAC_LABEL_REF 3u
+#define TAC_IMM 4u
+#define TAC_CONST 5u
+
+#define TAC_TAG_SHIFT 29
+#define TAC_VALUE_MASK 0x1FFFFFFFu
+#define TAC_IMM_MIN (-(1 << 28))
+#define TAC_IMM_MAX ((1 << 28) - 1)
+
+#define TAC_OPERAND(tag, value) (((uint32_t)(tag) << TAC_TAG_SHIFT) | ((uint32_t)(value) & TAC_VALUE_MASK))
+#define TAC_TAG(operand) ((operand) >> TAC_TAG_SHIFT)
+#define TAC_VALUE(operand) ((operand) & TAC_VALUE_MASK)
+
+typedef struct {
+    TacQuad *code;
+    uint32_t count;
+    uint32_t capacity;
+    InternTable names;   // Variable names and non-immediate literals
+    uint32_t tempCount;
+    uint32_t labelCount;
+    uint32_t tempBase;   // Added to temporary and label numbers when printing,
+    uint32_t labelBase;  // so code after a tacReset() carries on the numbering
+} TacBuffer;
+
+static inline void tacInit(TacBuffer *buffer) {
+    memset(buffer, 0, sizeof(*buffer));
+    internInit(&buffer->names);
+}
+
+static inline void tacFree(TacBuffer *buffer) {
+    free(buffer->code);
+    internFree(&buffer->names);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+// Function to empty the buffer for the next part of a program printed in
+// pieces: the quads, names and literals go, the quad array is kept for reuse,
+// and the printed temporary and label numbers carry on from where they were
+static inline void tacReset(TacBuffer *buffer) {
+    buffer->tempBase += buffer->tempCount;
+    buffer->labelBase += buffer->labelCount;
+    buffer->count = 0;
+    buffer->tempCount = 0;
+    buffer->labelCount = 0;
+    internFree(&buffer->names);
+    internInit(&buffer->names);
+}
+
+// Function to append an instruction and return its index
+static inline uint32_t tacEmit(TacBuffer *buffer, TacOp op, uint32_t result, uint32_t arg1, uint32_t arg2) {
+    if (buffer->count == buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 1024;
+        buffer->code = internAlloc(buffer->code, (size_t)buffer->capacity * sizeof(TacQuad));
+    }
+    TacQuad *quad = &buffer->code[buffer->count];
+    quad->op = (uint8_t)op;
+    quad->cond = 0;
+    quad->flags = 0;
+    quad->result = result;
+    quad->arg1 = arg1;
+    quad->arg2 = arg2;
+    return buffer->count++;
+}
+
+static inline uint32_t tacEmitIf(TacBuffer *buffer, TacOp cond, uint32_t arg1, uint32_t arg2, uint32_t label) {
+    uint32_t index = tacEmit(buffer, TAC_IF, label, arg1, arg2);
+    buffer->code[index].cond = (uint8_t)cond;
+    return index;
+}
+
+// Variables (named and temporary) are numbered densely for per-variable
+// arrays: names by intern id, then temporaries after them
+static inline uint32_t tacVarIndex(const TacBuffer *buffer, uint32_t operand) {
+    if (TAC_TAG(operand) == TAC_VAR) return TAC_VALUE(operand);
+    if (TAC_TAG(operand) == TAC_TEMP) return buffer->names.count + TAC_VALUE(operand);
+    return 0xFFFFFFFFu;
+}
+
+static inline uint32_t tacVarOperand(const TacBuffer *buffer, uint32_t var) {
+    return var < buffer->names.count ? TAC_OPERAND(TAC_VAR, var)
+                                     : TAC_OPERAND(TAC_TEMP, var - buffer->names.count);
+}
+
+static inline uint32_t tacVarCount(const TacBuffer *buffer) {
+    return buffer->names.count + buffer->tempCount;
+}
+
+static inline uint32_t tacVar(TacBuffer *buffer, const char *name, uint32_t length) {
+    return TAC_OPERAND(TAC_VAR, internString(&buffer->names, name, length));
+}
+
+static inline uint32_t tacNewTemp(TacBuffer *buffer) {
+    return TAC_OPERAND(TAC_TEMP, buffer->tempCount++);
+}
+
+static inline uint32_t tacNewLabel(TacBuffer *buffer) {
+    return TAC_OPERAND(TAC_LABEL_REF, buffer->labelCount++);
+}
+
+static inline uint32_t tacImm(int32_t value) {
+    return TAC_OPERAND(TAC_IMM, value);
+}
+
+static inline int32_t tacImmValue(uint32_t operand) {
+    // Sign-extend the 29-bit field
+    return (int32_t)(operand << (32 - TAC_TAG_SHIFT)) >> (32 - TAC_TAG_SHIFT);
+}
+
+// Function to turn literal text into an operand: decimal integers that fit
+// become immediates, anything else (floats, large or odd literals) is interned
+static inline uint32_t tacConst(TacBuffer *buffer, const char *text, uint32_t length) {
+    uint32_t i = (length > 0 && text[0] == '-') ? 1 : 0;
+    int64_t value = 0;
+    int isInteger = i < length && length - i <= 9;
+    for (uint32_t j = i; isInteger && j < length; j++) {
+        if (text[j] < '0' || text[j] > '9') isInteger = 0;
+        else value = value * 10 + (text[j] - '0');
+    }
+    if (isInteger) {
+        if (i) value = -value;
+        if (value >= TAC_IMM_MIN && value <= TAC_IMM_MAX) return tacImm((int32_t)value);
+    }
+    return TAC_OPERAND(TAC_CONST, internString(&buffer->names, text, length));
+}
+
+// Function to print one operand
+static inline void tacPrintOperand(const TacBuffer *buffer, uint32_t operand, FILE *out) {
+    switch (TAC_TAG(operand)) {
+        case TAC_VAR: case TAC_CONST:
+            fputs(internText(&buffer->names, TAC_VALUE(operand)), out);
+            break;
+        case TAC_TEMP:
+            fprintf(out, "t%u", buffer->tempBase + TAC_VALUE(operand));
+            break;
+        case TAC_LABEL_REF:
+            fprintf(out, "L%u", buffer->labelBase + TAC_VALUE(operand));
+            break;
+        case TAC_IMM:
+            fprintf(out, "%d", tacImmValue(operand));
+            break;
+    }
+}
+
+// Function to print one instruction in the usual three-address notation
+static inline void tacPrintQuad(const TacBuffer *buffer, const TacQuad *quad, FILE *out) {
+    switch ((TacOp)quad->op) {
+        case TAC_NOP:
+            fputs("nop", out);
+            break;
+        case TAC_COPY:
+            tacPrintOperand(buffer, quad->result, out);
+            fputs(" = ", out);
+            tacPrintOperand(buffer, quad->arg1, out);
+            break;
+        case TAC_NEG: case TAC_NOT:
+            tacPrintOperand(buffer, quad->result, out);
+            fprintf(out, " = %s", tacOpSymbols[quad->op]);
+            tacPrintOperand(buffer, quad->arg1, out);
+            break;
+        case TAC_LABEL:
+            tacPrintOperand(buffer, quad->result, out);
+            fputc(':', out);
+            break;
+        case TAC_GOTO:
+            fputs("goto ", out);
+            tacPrintOperand(buffer, quad->result, out);
+            break;
+        case TAC_IF:
+            fputs("if ", out);
+            tacPrintOperand(buffer, quad->arg1, out);
+            fprintf(out, " %s ", tacOpSymbols[quad->cond]);
+            tacPrintOperand(buffer, quad->arg2, out);
+            fputs(" goto ", out);
+            tacPrintOperand(buffer, quad->result, out);
+            break;
+        case TAC_PRINT:
+            fputs("printf(", out);
+            tacPrintOperand(buffer, quad->arg1, out);
+            fputc(')', out);
+            break;
+        default:
+            tacPrintOperand(buffer, quad->result, out);
+            fputs(" = ", out);
+            tacPrintOperand(buffer, quad->arg1, out);
+            fprintf(out, " %s ", tacOpSymbols[quad->op]);
+            tacPrintOperand(buffer, quad->arg2, out);
+            break;
+    }
+    fputc('\n', out);
+}
+
+static inline void tacPrint(const TacBuffer *buffer, FILE *out) {
+    for (uint32_t i = 0; i < buffer->count; i++) {
+        tacPrintQuad(buffer, &buffer->code[i], out);
+    }
+}
+
+#endif
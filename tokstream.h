@@ -0,0 +1,381 @@
+#ifndef TOKSTREAM_H
+#define TOKSTREAM_H
+
+// Binary token stream shared by the compiler stages.
+//
+// A stream is written once by the lexer and read back by later stages
+// without re-tokenizing any text. Layout (native byte order):
+//
+//   TokenStreamHeader
+//   PackedToken[tokenCount]          13 bytes each, padded to 4 bytes
+//   uint32_t stringOffsets[stringCount]
+//   char stringData[stringBytes]     NUL-terminated interned strings
+//
+// Identifiers, numbers and string literals carry the id of their interned
+// text; every other token has id TOKSTREAM_NO_STRING and is fully described
+// by its kind.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "intern.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+// Token kinds produced by the scanner. Keywords and operators get their own
+// kind so later stages never need to compare token text.
+typedef enum {
+    TK_EOF,
+    TK_IDENTIFIER,
+    TK_NUMBER,
+    TK_STRING,
+    // Keywords
+    TK_INT, TK_FLOAT, TK_CHAR, TK_IF, TK_ELSE, TK_WHILE, TK_FOR, TK_DO,
+    TK_RETURN, TK_BREAK, TK_CONTINUE, TK_SWITCH, TK_CASE,
+    // Operators
+    TK_ASSIGN, TK_EQ, TK_PLUS, TK_PLUS_ASSIGN, TK_MINUS, TK_MINUS_ASSIGN,
+    TK_STAR, TK_STAR_ASSIGN, TK_SLASH, TK_SLASH_ASSIGN, TK_LT, TK_LE,
+    TK_GT, TK_GE, TK_NOT, TK_NE, TK_AMP, TK_AND, TK_PIPE, TK_OR,
+    // Punctuation
+    TK_SEMICOLON, TK_LPAREN, TK_RPAREN, TK_LBRACE, TK_RBRACE, TK_LBRACKET,
+    TK_RBRACKET, TK_COMMA, TK_DOT, TK_COLON, TK_QUESTION,
+    TK_UNKNOWN,
+    // Scanner results that never reach the token stream
+    TK_SKIP, TK_UNCLOSED_COMMENT, TK_UNCLOSED_STRING, TK_INCOMPLETE,
+    TK_COUNT
+} TokenKind;
+
+// Category printed for each kind ("Token: x, Type: <category>")
+static const char *const tokenTypeNames[TK_COUNT] = {
+    [TK_IDENTIFIER] = "Identifier", [TK_NUMBER] = "Number", [TK_STRING] = "String Literal",
+    [TK_INT] = "Keyword", [TK_FLOAT] = "Keyword", [TK_CHAR] = "Keyword", [TK_IF] = "Keyword",
+    [TK_ELSE] = "Keyword", [TK_WHILE] = "Keyword", [TK_FOR] = "Keyword", [TK_DO] = "Keyword",
+    [TK_RETURN] = "Keyword", [TK_BREAK] = "Keyword", [TK_CONTINUE] = "Keyword",
+    [TK_SWITCH] = "Keyword", [TK_CASE] = "Keyword",
+    [TK_ASSIGN] = "Assignment Operator", [TK_EQ] = "Comparison Operator",
+    [TK_PLUS] = "Operator", [TK_PLUS_ASSIGN] = "Compound Assignment Operator",
+    [TK_MINUS] = "Operator", [TK_MINUS_ASSIGN] = "Compound Assignment Operator",
+    [TK_STAR] = "Operator", [TK_STAR_ASSIGN] = "Compound Assignment Operator",
+    [TK_SLASH] = "Operator", [TK_SLASH_ASSIGN] = "Compound Assignment Operator",
+    [TK_LT] = "Comparison Operator", [TK_LE] = "Comparison Operator",
+    [TK_GT] = "Comparison Operator", [TK_GE] = "Comparison Operator",
+    [TK_NOT] = "Logical Operator", [TK_NE] = "Comparison Operator",
+    [TK_AMP] = "Bitwise Operator", [TK_AND] = "Logical Operator",
+    [TK_PIPE] = "Bitwise Operator", [TK_OR] = "Logical Operator",
+    [TK_SEMICOLON] = "Semicolon", [TK_LPAREN] = "Left Parenthesis",
+    [TK_RPAREN] = "Right Parenthesis", [TK_LBRACE] = "Left Brace",
+    [TK_RBRACE] = "Right Brace", [TK_LBRACKET] = "Left Bracket",
+    [TK_RBRACKET] = "Right Bracket", [TK_COMMA] = "Comma", [TK_DOT] = "Dot",
+    [TK_COLON] = "Colon", [TK_QUESTION] = "Question Mark",
+};
+
+// Source text of every kind whose spelling is fixed
+static const char *const tokenSpellings[TK_COUNT] = {
+    [TK_INT] = "int", [TK_FLOAT] = "float", [TK_CHAR] = "char", [TK_IF] = "if",
+    [TK_ELSE] = "else", [TK_WHILE] = "while", [TK_FOR] = "for", [TK_DO] = "do",
+    [TK_RETURN] = "return", [TK_BREAK] = "break", [TK_CONTINUE] = "continue",
+    [TK_SWITCH] = "switch", [TK_CASE] = "case",
+    [TK_ASSIGN] = "=", [TK_EQ] = "==", [TK_PLUS] = "+", [TK_PLUS_ASSIGN] = "+=",
+    [TK_MINUS] = "-", [TK_MINUS_ASSIGN] = "-=", [TK_STAR] = "*", [TK_STAR_ASSIGN] = "*=",
+    [TK_SLASH] = "/", [TK_SLASH_ASSIGN] = "/=", [TK_LT] = "<", [TK_LE] = "<=",
+    [TK_GT] = ">", [TK_GE] = ">=", [TK_NOT] = "!", [TK_NE] = "!=", [TK_AMP] = "&",
+    [TK_AND] = "&&", [TK_PIPE] = "|", [TK_OR] = "||", [TK_SEMICOLON] = ";",
+    [TK_LPAREN] = "(", [TK_RPAREN] = ")", [TK_LBRACE] = "{", [TK_RBRACE] = "}",
+    [TK_LBRACKET] = "[", [TK_RBRACKET] = "]", [TK_COMMA] = ",", [TK_DOT] = ".",
+    [TK_COLON] = ":", [TK_QUESTION] = "?",
+};
+
+#define TOKSTREAM_MAGIC "TOKS"
+#define TOKSTREAM_VERSION 1
+#define TOKSTREAM_NO_STRING 0xFFFFFFFFu
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t tokenCount;
+    uint32_t stringCount;
+    uint32_t stringBytes;
+} TokenStreamHeader;
+
+#pragma pack(push, 1)
+typedef struct {
+    uint8_t kind;      // TokenKind
+    uint32_t offset;   // Byte offset of the token in the source
+    uint32_t length;   // Length of the token in the source
+    uint32_t id;       // Interned string id or TOKSTREAM_NO_STRING
+} PackedToken;
+#pragma pack(pop)
+
+#define TOKSTREAM_TOKEN_BYTES(count) ((((size_t)(count) * sizeof(PackedToken)) + 3) & ~(size_t)3)
+
+// ---------------------------------------------------------------------------
+// Writer
+
+typedef struct {
+    PackedToken *tokens;
+    uint32_t tokenCount;
+    uint32_t tokenCapacity;
+
+    InternTable *strings;      // Token text; ids are written as-is
+    InternTable ownStrings;    // Used when the caller does not share a table
+    SharedInternTable *shared; // Used instead of strings when set
+} TokenStreamWriter;
+
+// Function to start an empty stream. Passing the caller's intern table makes
+// stream ids match the ids the caller already uses; NULL gives a private one.
+static inline void tokenStreamInit(TokenStreamWriter *writer, InternTable *strings) {
+    memset(writer, 0, sizeof(*writer));
+    if (strings == NULL) {
+        internInit(&writer->ownStrings);
+        strings = &writer->ownStrings;
+    }
+    writer->strings = strings;
+}
+
+// Function to start an empty stream whose text goes to a table shared with
+// other threads. Such a stream is for in-process use; it cannot be written
+// out with tokenStreamWrite().
+static inline void tokenStreamInitShared(TokenStreamWriter *writer, SharedInternTable *shared) {
+    memset(writer, 0, sizeof(*writer));
+    writer->shared = shared;
+}
+
+static inline void tokenStreamFree(TokenStreamWriter *writer) {
+    free(writer->tokens);
+    if (writer->strings == &writer->ownStrings) internFree(&writer->ownStrings);
+    memset(writer, 0, sizeof(*writer));
+}
+
+// Function to stop with an error when a token ends past 4 GB, where its
+// offset and length no longer fit a PackedToken
+static inline void tokenStreamCheckRange(size_t offset, size_t length) {
+    if (offset + length > UINT32_MAX) {
+        fprintf(stderr, "Error: Source is larger than 4 GB, the most a token stream can hold\n");
+        exit(1);
+    }
+}
+
+// Function to append one token whose text is already interned
+static inline void tokenStreamAddId(TokenStreamWriter *writer, TokenKind kind, size_t offset,
+                                    size_t length, uint32_t id) {
+    tokenStreamCheckRange(offset, length);
+    if (writer->tokenCount == writer->tokenCapacity) {
+        writer->tokenCapacity = writer->tokenCapacity ? writer->tokenCapacity * 2 : 1024;
+        writer->tokens = internAlloc(writer->tokens, (size_t)writer->tokenCapacity * sizeof(PackedToken));
+    }
+    PackedToken *token = &writer->tokens[writer->tokenCount++];
+    token->kind = (uint8_t)kind;
+    token->offset = (uint32_t)offset;
+    token->length = (uint32_t)length;
+    token->id = id;
+}
+
+// Function to append one token; text is only interned for kinds whose
+// spelling is not fixed (identifiers, numbers, strings, unknown bytes)
+static inline void tokenStreamAdd(TokenStreamWriter *writer, TokenKind kind, size_t offset,
+                                  const char *text, size_t length) {
+    uint32_t id = TOKSTREAM_NO_STRING;
+    if (tokenSpellings[kind] == NULL) {
+        tokenStreamCheckRange(offset, length);
+        id = writer->shared ? sharedInternString(writer->shared, text, (uint32_t)length)
+                            : internString(writer->strings, text, (uint32_t)length);
+    }
+    tokenStreamAddId(writer, kind, offset, length, id);
+}
+
+// Function to write the whole stream to a file descriptor with a single
+// gathered write. The interned strings are packed into one block first; they
+// are deduplicated, so this is small next to the token array. Returns 1 on
+// success.
+static inline int tokenStreamWrite(TokenStreamWriter *writer, int fd) {
+    const InternTable *strings = writer->strings;
+    size_t stringBytes = 0;
+    for (uint32_t id = 0; id < strings->count; id++) {
+        stringBytes += internLength(strings, id) + 1;
+    }
+    uint32_t *stringOffsets = internAlloc(NULL, (size_t)strings->count * sizeof(uint32_t) + stringBytes + 1);
+    char *stringData = (char *)(stringOffsets + strings->count);
+    size_t used = 0;
+    for (uint32_t id = 0; id < strings->count; id++) {
+        stringOffsets[id] = (uint32_t)used;
+        memcpy(stringData + used, internText(strings, id), internLength(strings, id) + 1);
+        used += internLength(strings, id) + 1;
+    }
+
+    TokenStreamHeader header;
+    memcpy(header.magic, TOKSTREAM_MAGIC, 4);
+    header.version = TOKSTREAM_VERSION;
+    header.tokenCount = writer->tokenCount;
+    header.stringCount = strings->count;
+    header.stringBytes = (uint32_t)stringBytes;
+
+    static const char padding[4] = {0};
+    size_t tokenBytes = (size_t)writer->tokenCount * sizeof(PackedToken);
+    const void *parts[5] = {&header, writer->tokens, padding, stringOffsets, stringData};
+    size_t sizes[5] = {sizeof(header), tokenBytes, TOKSTREAM_TOKEN_BYTES(writer->tokenCount) - tokenBytes,
+                       (size_t)strings->count * sizeof(uint32_t), stringBytes};
+    int ok = 1;
+
+#ifndef _WIN32
+    struct iovec vectors[5];
+    int first = 0;
+    for (int i = 0; i < 5; i++) {
+        vectors[i].iov_base = (void *)parts[i];
+        vectors[i].iov_len = sizes[i];
+    }
+    // writev may stop short on very large streams; continue where it left off
+    while (ok && first < 5) {
+        ssize_t written = writev(fd, vectors + first, 5 - first);
+        if (written < 0) {
+            ok = 0;
+            break;
+        }
+        while (first < 5 && (size_t)written >= vectors[first].iov_len) {
+            written -= vectors[first].iov_len;
+            first++;
+        }
+        if (first < 5) {
+            vectors[first].iov_base = (char *)vectors[first].iov_base + written;
+            vectors[first].iov_len -= written;
+        }
+    }
+#else
+    for (int i = 0; i < 5; i++) {
+        if (sizes[i] > 0 && _write(fd, parts[i], (unsigned)sizes[i]) != (int)sizes[i]) ok = 0;
+    }
+#endif
+    free(stringOffsets);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Reader
+
+typedef struct {
+    const PackedToken *tokens;
+    uint32_t tokenCount;
+    const uint32_t *stringOffsets;
+    const char *stringData;
+    uint32_t stringCount;
+
+    void *base;      // Mapped (or loaded) file
+    size_t size;
+    int mapped;
+} TokenStream;
+
+static inline void tokenStreamClose(TokenStream *stream) {
+#ifndef _WIN32
+    if (stream->mapped) {
+        munmap(stream->base, stream->size);
+    } else
+#endif
+    {
+        free(stream->base);
+    }
+    memset(stream, 0, sizeof(*stream));
+}
+
+// Function to map a token stream file and validate its header, tokens and
+// string table. Returns 1 on success; the tokens can then be walked directly
+// from the mapping.
+static inline int tokenStreamOpen(const char *path, TokenStream *stream) {
+    memset(stream, 0, sizeof(*stream));
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void *base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base != MAP_FAILED) {
+                stream->base = base;
+                stream->size = info.st_size;
+                stream->mapped = 1;
+            }
+        }
+        close(fd);
+    }
+#endif
+    if (stream->base == NULL) {
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) return 0;
+        size_t capacity = 1 << 16;
+        char *data = malloc(capacity);
+        size_t bytesRead;
+        while (data != NULL && (bytesRead = fread(data + stream->size, 1, capacity - stream->size, file)) > 0) {
+            stream->size += bytesRead;
+            if (stream->size == capacity) {
+                char *grown = realloc(data, capacity *= 2);
+                if (grown == NULL) free(data);
+                data = grown;
+            }
+        }
+        fclose(file);
+        if (data == NULL) return 0;
+        stream->base = data;
+    }
+
+    const TokenStreamHeader *header = stream->base;
+    size_t tokenBytes = stream->size >= sizeof(*header) ? TOKSTREAM_TOKEN_BYTES(header->tokenCount) : 0;
+    if (stream->size < sizeof(*header) || memcmp(header->magic, TOKSTREAM_MAGIC, 4) != 0 ||
+        header->version != TOKSTREAM_VERSION ||
+        stream->size < sizeof(*header) + tokenBytes + (size_t)header->stringCount * 4 + header->stringBytes) {
+        fprintf(stderr, "Error: '%s' is not a valid token stream\n", path);
+        tokenStreamClose(stream);
+        return 0;
+    }
+    const char *data = (const char *)stream->base + sizeof(*header);
+    stream->tokens = (const PackedToken *)data;
+    stream->tokenCount = header->tokenCount;
+    stream->stringOffsets = (const uint32_t *)(data + tokenBytes);
+    stream->stringData = data + tokenBytes + (size_t)header->stringCount * 4;
+    stream->stringCount = header->stringCount;
+
+    // Readers index the string table with token ids and the spelling tables
+    // with token kinds, so every one of them must be in range. Strings are
+    // stored in id order, each ending with a NUL just before the next one
+    // starts; that gives every string its length even when it holds NULs.
+    int valid = 1;
+    for (uint32_t id = 0; valid && id < header->stringCount; id++) {
+        uint32_t end = id + 1 < header->stringCount ? stream->stringOffsets[id + 1] : header->stringBytes;
+        if (stream->stringOffsets[id] >= end || end > header->stringBytes || stream->stringData[end - 1] != '\0') {
+            valid = 0;
+        }
+    }
+    for (uint32_t i = 0; valid && i < header->tokenCount; i++) {
+        const PackedToken *token = &stream->tokens[i];
+        if (token->kind >= TK_SKIP || (token->id != TOKSTREAM_NO_STRING && token->id >= header->stringCount)) valid = 0;
+    }
+    if (!valid) {
+        fprintf(stderr, "Error: '%s' is not a valid token stream\n", path);
+        tokenStreamClose(stream);
+        return 0;
+    }
+    return 1;
+}
+
+// Function to get the length of a stream string, not counting its final NUL.
+// String literals may contain NULs, so strlen() can stop short.
+static inline uint32_t tokenStreamLength(const TokenStream *stream, uint32_t id) {
+    const TokenStreamHeader *header = stream->base;
+    uint32_t end = id + 1 < stream->stringCount ? stream->stringOffsets[id + 1] : header->stringBytes;
+    return end - stream->stringOffsets[id] - 1;
+}
+
+// Function to get the text of a token: its interned string, or the fixed
+// spelling of its kind
+static inline const char *tokenStreamText(const TokenStream *stream, const PackedToken *token) {
+    if (token->id != TOKSTREAM_NO_STRING && token->id < stream->stringCount) {
+        return stream->stringData + stream->stringOffsets[token->id];
+    }
+    return tokenSpellings[token->kind] ? tokenSpellings[token->kind] : "";
+}
+
+#endif
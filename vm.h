@@ -0,0 +1,352 @@
+#ifndef VM_H
+#define VM_H
+
+// Bytecode VM for running three-address code in process.
+//
+// vmLower() turns a TAC buffer into a dense array of register instructions.
+// Every operand becomes a register index: variables (numbered as in
+// tacVarIndex) come first, then one register per distinct constant, loaded
+// once before the run. Labels disappear and jumps hold the index of the
+// instruction they land on, and each conditional jump is a single opcode
+// per comparison, so running the code never decodes operands or searches
+// for a label.
+//
+// vmRun() dispatches with computed goto (a GCC/Clang extension) so each
+// handler jumps straight to the next one; other compilers get a switch.
+// Arithmetic wraps like the 32-bit ints of the x86 backend.
+
+#include <time.h>
+#include "tac.h"
+
+typedef enum {
+    VM_MOV, VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_MOD,
+    VM_LT, VM_LE, VM_GT, VM_GE, VM_EQ, VM_NE,
+    VM_NEG, VM_NOT,
+    VM_JMP,
+    VM_JLT, VM_JLE, VM_JGT, VM_JGE, VM_JEQ, VM_JNE,   // if r[a] op r[b] goto c
+    VM_PRINT,                                         // print string a
+    VM_HALT,
+    VM_OP_COUNT
+} VmOp;
+
+typedef struct {
+    uint32_t op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+} VmInsn;
+
+typedef struct {
+    VmInsn *code;
+    uint32_t count;
+    uint32_t varCount;
+    uint32_t regCount;
+    int32_t *initial;        // Starting register file: zeros, then constants
+    uint8_t *isNamed;        // Per name id: a program variable, not a literal
+    uint32_t nameCount;
+    char *strings;           // Printed strings with their escapes decoded
+    uint32_t *stringStart;   // Offset of each string, indexed by instruction operand
+    uint32_t stringCount;
+} VmProgram;
+
+typedef struct {
+    int32_t *regs;
+    uint64_t steps;          // Instructions executed
+    uint64_t outputHash;     // FNV-1a over everything printed
+    uint32_t faultAt;        // Instruction that divided by zero, or count if none
+} VmState;
+
+// Function to append the decoded form of a C string literal's body to a
+// growable buffer and return its offset
+static inline uint32_t vmAddString(char **strings, uint32_t *capacity, uint32_t *used, const char *text) {
+    size_t length = strlen(text);
+    if (*used + length + 1 > *capacity) {
+        while (*used + length + 1 > *capacity) *capacity = *capacity ? *capacity * 2 : 256;
+        *strings = internAlloc(*strings, *capacity);
+    }
+    uint32_t start = *used;
+    char *out = *strings + start;
+    for (const char *p = text; *p; p++) {
+        if (*p != '\\' || p[1] == '\0') {
+            *out++ = *p;
+            continue;
+        }
+        switch (*++p) {
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            case 'r': *out++ = '\r'; break;
+            case '0': *out++ = '\0'; break;
+            default: *out++ = *p; break;
+        }
+    }
+    *out++ = '\0';
+    *used = (uint32_t)(out - *strings);
+    return start;
+}
+
+// Function to get the register holding a constant, adding it on first use;
+// the constants are deduplicated through an open-addressing table
+static inline uint32_t vmConstant(VmProgram *program, uint32_t *table, uint32_t tableSize, uint32_t *capacity,
+                                  int32_t value) {
+    uint32_t slot = ((uint32_t)value * 2654435761u) & (tableSize - 1);
+    while (table[slot] != 0xFFFFFFFFu) {
+        if (program->initial[table[slot]] == value) return table[slot];
+        slot = (slot + 1) & (tableSize - 1);
+    }
+    if (program->regCount == *capacity) {
+        *capacity *= 2;
+        program->initial = internAlloc(program->initial, (size_t)*capacity * sizeof(int32_t));
+    }
+    program->initial[program->regCount] = value;
+    return table[slot] = program->regCount++;
+}
+
+static inline void vmLower(VmProgram *program, const TacBuffer *code) {
+    static const VmOp values[TAC_OP_COUNT] = {
+        [TAC_COPY] = VM_MOV, [TAC_ADD] = VM_ADD, [TAC_SUB] = VM_SUB, [TAC_MUL] = VM_MUL,
+        [TAC_DIV] = VM_DIV, [TAC_MOD] = VM_MOD, [TAC_LT] = VM_LT, [TAC_LE] = VM_LE,
+        [TAC_GT] = VM_GT, [TAC_GE] = VM_GE, [TAC_EQ] = VM_EQ, [TAC_NE] = VM_NE,
+        [TAC_NEG] = VM_NEG, [TAC_NOT] = VM_NOT,
+    };
+    static const VmOp jumps[TAC_OP_COUNT] = {
+        [TAC_LT] = VM_JLT, [TAC_LE] = VM_JLE, [TAC_GT] = VM_JGT,
+        [TAC_GE] = VM_JGE, [TAC_EQ] = VM_JEQ, [TAC_NE] = VM_JNE,
+    };
+    memset(program, 0, sizeof(*program));
+    program->varCount = tacVarCount(code);
+    program->nameCount = code->names.count;
+    program->isNamed = calloc((size_t)code->names.count + 1, 1);
+
+    // Each label resolves to the index of the first instruction after it
+    uint32_t *labelTarget = internAlloc(NULL, ((size_t)code->labelCount + 1) * sizeof(uint32_t));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < code->count; i++) {
+        TacOp op = (TacOp)code->code[i].op;
+        if (op == TAC_LABEL) labelTarget[TAC_VALUE(code->code[i].result)] = count;
+        else if (op != TAC_NOP) count++;
+    }
+
+    uint32_t capacity = program->varCount + 64;
+    program->initial = calloc(capacity, sizeof(int32_t));
+    program->regCount = program->varCount;
+    uint32_t tableSize = 64;
+    while (tableSize < code->count * 2) tableSize *= 2;
+    uint32_t *table = internAlloc(NULL, (size_t)tableSize * sizeof(uint32_t));
+    memset(table, 0xFF, (size_t)tableSize * sizeof(uint32_t));
+    program->code = internAlloc(NULL, ((size_t)count + 1) * sizeof(VmInsn));
+    program->stringStart = internAlloc(NULL, ((size_t)count + 1) * sizeof(uint32_t));
+    if (program->isNamed == NULL || program->initial == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    uint32_t stringCapacity = 0, stringUsed = 0;
+
+    for (uint32_t i = 0; i < code->count; i++) {
+        const TacQuad *quad = &code->code[i];
+        TacOp op = (TacOp)quad->op;
+        if (op == TAC_NOP || op == TAC_LABEL) continue;
+        uint32_t operands[3] = {quad->result, quad->arg1, quad->arg2};
+        uint32_t regs[3] = {0, 0, 0};
+        for (int k = 0; k < 3; k++) {
+            uint32_t operand = operands[k];
+            switch (TAC_TAG(operand)) {
+                case TAC_VAR:
+                    program->isNamed[TAC_VALUE(operand)] = 1;
+                    regs[k] = tacVarIndex(code, operand);
+                    break;
+                case TAC_TEMP:
+                    regs[k] = tacVarIndex(code, operand);
+                    break;
+                case TAC_IMM:
+                    regs[k] = vmConstant(program, table, tableSize, &capacity, tacImmValue(operand));
+                    break;
+                case TAC_CONST:
+                    // Non-integer literals run as their integer part
+                    if (op != TAC_PRINT) {
+                        double value = strtod(internText(&code->names, TAC_VALUE(operand)), NULL);
+                        int32_t truncated = value >= 2147483647.0 ? 2147483647
+                                          : value <= -2147483648.0 ? (-2147483647 - 1) : (int32_t)value;
+                        regs[k] = vmConstant(program, table, tableSize, &capacity, truncated);
+                    }
+                    break;
+            }
+        }
+        VmInsn *insn = &program->code[program->count++];
+        if (op == TAC_GOTO) {
+            *insn = (VmInsn){VM_JMP, 0, 0, labelTarget[TAC_VALUE(quad->result)]};
+        } else if (op == TAC_IF) {
+            *insn = (VmInsn){jumps[quad->cond], regs[1], regs[2], labelTarget[TAC_VALUE(quad->result)]};
+        } else if (op == TAC_PRINT) {
+            program->stringStart[program->stringCount] =
+                vmAddString(&program->strings, &stringCapacity, &stringUsed, internText(&code->names, TAC_VALUE(quad->arg1)));
+            *insn = (VmInsn){VM_PRINT, program->stringCount++, 0, 0};
+        } else {
+            *insn = (VmInsn){values[op], regs[0], regs[1], regs[2]};
+        }
+    }
+    program->code[program->count++] = (VmInsn){VM_HALT, 0, 0, 0};
+    free(labelTarget);
+    free(table);
+}
+
+// Function to run a lowered program from a fresh register file, writing its
+// output to out (NULL only hashes it); returns 0, or 1 on division by zero
+static inline int vmRun(const VmProgram *program, VmState *state, FILE *out) {
+    state->regs = internAlloc(state->regs, ((size_t)program->regCount + 1) * sizeof(int32_t));
+    memcpy(state->regs, program->initial, (size_t)program->regCount * sizeof(int32_t));
+    state->outputHash = 1469598103934665603ull;
+    state->faultAt = program->count;
+
+    int32_t *r = state->regs;
+    const VmInsn *code = program->code;
+    const VmInsn *pc = code;
+    uint64_t steps = 0;
+
+#if defined(__GNUC__)
+    static void *const targets[VM_OP_COUNT] = {
+        [VM_MOV] = &&vm_MOV, [VM_ADD] = &&vm_ADD, [VM_SUB] = &&vm_SUB, [VM_MUL] = &&vm_MUL,
+        [VM_DIV] = &&vm_DIV, [VM_MOD] = &&vm_MOD, [VM_LT] = &&vm_LT, [VM_LE] = &&vm_LE,
+        [VM_GT] = &&vm_GT, [VM_GE] = &&vm_GE, [VM_EQ] = &&vm_EQ, [VM_NE] = &&vm_NE,
+        [VM_NEG] = &&vm_NEG, [VM_NOT] = &&vm_NOT, [VM_JMP] = &&vm_JMP,
+        [VM_JLT] = &&vm_JLT, [VM_JLE] = &&vm_JLE, [VM_JGT] = &&vm_JGT,
+        [VM_JGE] = &&vm_JGE, [VM_JEQ] = &&vm_JEQ, [VM_JNE] = &&vm_JNE,
+        [VM_PRINT] = &&vm_PRINT, [VM_HALT] = &&vm_HALT,
+    };
+#define VM_OP(name) vm_##name:
+#define VM_NEXT() do { steps++; goto *targets[pc->op]; } while (0)
+    VM_NEXT();
+#else
+#define VM_OP(name) case VM_##name:
+#define VM_NEXT() do { steps++; goto dispatch; } while (0)
+dispatch:
+    switch (pc->op) {
+#endif
+
+#define VM_BINARY(name, expr) VM_OP(name) { int32_t x = r[pc->b], y = r[pc->c]; r[pc->a] = (expr); pc++; VM_NEXT(); }
+#define VM_BRANCH(name, cmp) VM_OP(name) { pc = (r[pc->a] cmp r[pc->b]) ? code + pc->c : pc + 1; VM_NEXT(); }
+
+    VM_OP(MOV) { r[pc->a] = r[pc->b]; pc++; VM_NEXT(); }
+    VM_BINARY(ADD, (int32_t)((uint32_t)x + (uint32_t)y))
+    VM_BINARY(SUB, (int32_t)((uint32_t)x - (uint32_t)y))
+    VM_BINARY(MUL, (int32_t)((uint32_t)x * (uint32_t)y))
+    VM_OP(DIV) {
+        int32_t x = r[pc->b], y = r[pc->c];
+        if (y == 0) goto fault;
+        r[pc->a] = y == -1 ? (int32_t)(0u - (uint32_t)x) : x / y;
+        pc++;
+        VM_NEXT();
+    }
+    VM_OP(MOD) {
+        int32_t x = r[pc->b], y = r[pc->c];
+        if (y == 0) goto fault;
+        r[pc->a] = y == -1 ? 0 : x % y;
+        pc++;
+        VM_NEXT();
+    }
+    VM_BINARY(LT, x < y)
+    VM_BINARY(LE, x <= y)
+    VM_BINARY(GT, x > y)
+    VM_BINARY(GE, x >= y)
+    VM_BINARY(EQ, x == y)
+    VM_BINARY(NE, x != y)
+    VM_OP(NEG) { r[pc->a] = (int32_t)(0u - (uint32_t)r[pc->b]); pc++; VM_NEXT(); }
+    VM_OP(NOT) { r[pc->a] = r[pc->b] == 0; pc++; VM_NEXT(); }
+    VM_OP(JMP) { pc = code + pc->c; VM_NEXT(); }
+    VM_BRANCH(JLT, <)
+    VM_BRANCH(JLE, <=)
+    VM_BRANCH(JGT, >)
+    VM_BRANCH(JGE, >=)
+    VM_BRANCH(JEQ, ==)
+    VM_BRANCH(JNE, !=)
+    VM_OP(PRINT) {
+        const char *text = program->strings + program->stringStart[pc->a];
+        for (const char *p = text; *p; p++) state->outputHash = (state->outputHash ^ (uint8_t)*p) * 1099511628211ull;
+        if (out != NULL) fputs(text, out);
+        pc++;
+        VM_NEXT();
+    }
+    VM_OP(HALT) {
+        state->steps = steps;
+        return 0;
+    }
+
+#if !defined(__GNUC__)
+    }
+#endif
+#undef VM_BRANCH
+#undef VM_BINARY
+#undef VM_NEXT
+#undef VM_OP
+
+fault:
+    state->steps = steps;
+    state->faultAt = (uint32_t)(pc - code);
+    return 1;
+}
+
+// Function to print the final value of every named variable
+static inline void vmPrintVariables(const VmProgram *program, const VmState *state, const TacBuffer *code, FILE *out) {
+    for (uint32_t var = 0; var < program->nameCount; var++) {
+        if (program->isNamed[var]) fprintf(out, "%s = %d\n", internText(&code->names, var), state->regs[var]);
+    }
+}
+
+static inline void vmFree(VmProgram *program) {
+    free(program->code);
+    free(program->initial);
+    free(program->isNamed);
+    free(program->strings);
+    free(program->stringStart);
+    memset(program, 0, sizeof(*program));
+}
+
+// Function to run the code in the bytecode VM and print what it printed,
+// the final variable values and how long it took, all to out
+static inline void vmExecute(const TacBuffer *code, FILE *out) {
+    VmProgram program;
+    VmState state = {0};
+    vmLower(&program, code);
+    fprintf(out, "\nProgram Output:\n");
+    clock_t start = clock();
+    int status = vmRun(&program, &state, out);
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    fprintf(out, "\n");
+    if (status != 0) {
+        fprintf(out, "Runtime error: division by zero at instruction %u\n", state.faultAt);
+    } else {
+        vmPrintVariables(&program, &state, code, out);
+    }
+    fprintf(out, "(%llu instructions in %.3f ms)\n", (unsigned long long)state.steps, elapsed * 1000.0);
+    free(state.regs);
+    vmFree(&program);
+}
+
+// Function to check the optimized code against the code before optimizing:
+// both must print the same text, fault the same way, and leave every named
+// variable with the same value
+static inline int vmVerify(const VmProgram *reference, const TacBuffer *code, FILE *out) {
+    VmProgram optimized;
+    VmState before = {0}, after = {0};
+    vmLower(&optimized, code);
+    int beforeStatus = vmRun(reference, &before, NULL);
+    int afterStatus = vmRun(&optimized, &after, NULL);
+    int ok = beforeStatus == afterStatus && before.outputHash == after.outputHash;
+    for (uint32_t var = 0; ok && beforeStatus == 0 && var < reference->nameCount; var++) {
+        if (reference->isNamed[var] && before.regs[var] != after.regs[var]) {
+            fprintf(out, "\nOptimizer check failed: %s is %d before and %d after optimizing\n",
+                         internText(&code->names, var), before.regs[var], after.regs[var]);
+            ok = -1;
+        }
+    }
+    if (ok == 0) fprintf(out, "\nOptimizer check failed: the program's output or runtime error changed\n");
+    if (ok == 1) {
+        fprintf(out, "\nOptimizer check passed (%llu instructions before, %llu after).\n",
+                     (unsigned long long)before.steps, (unsigned long long)after.steps);
+    }
+    free(before.regs);
+    free(after.regs);
+    vmFree(&optimized);
+    return ok == 1;
+}
+
+#endif
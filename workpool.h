@@ -0,0 +1,149 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+// Work-stealing thread pool for a fixed batch of jobs.
+//
+// Jobs are numbered 0 .. jobCount-1 and dealt out before any thread starts:
+// each worker owns a deque holding a contiguous share. A worker takes jobs
+// from the bottom of its own deque; when that runs dry it steals from the
+// top of another worker's deque, so one thread stuck on a big input does not
+// leave the others idle. The deques follow Chase and Lev, minus growth, as
+// nothing is pushed once the workers run: owner and thieves only contend for
+// the last job of a deque, settled by a compare-and-swap on top. A worker
+// quits when it finds every deque empty, since no job can appear later.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "intern.h"
+
+typedef void (*PoolJob)(void *context, uint32_t job);
+
+typedef struct {
+    uint32_t base;        // Job number of the first entry
+    atomic_int top;       // Next entry a thief takes
+    atomic_int bottom;    // One past the next entry the owner takes
+    char padding[64 - 3 * sizeof(int)];   // Keep deques on separate cache lines
+} PoolDeque;
+
+typedef struct {
+    PoolDeque *deques;
+    uint32_t workerCount;
+    PoolJob run;
+    void *context;
+} WorkPool;
+
+typedef struct {
+    WorkPool *pool;
+    uint32_t self;
+} PoolWorker;
+
+// Function to take the owner's next job from the bottom. Returns 1 and sets
+// *job, or 0 when the deque is empty.
+static inline int poolTake(PoolDeque *deque, uint32_t *job) {
+    // The store to bottom must be ordered before the load of top (and the
+    // thief's load of top before its load of bottom), hence seq_cst
+    int bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_seq_cst);
+    int top = atomic_load_explicit(&deque->top, memory_order_seq_cst);
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return 0;
+    }
+    *job = deque->base + (uint32_t)bottom;
+    if (top == bottom) {
+        // Last job: a thief may be taking it at the same time
+        int won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                          memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return won;
+    }
+    return 1;
+}
+
+// Function to steal a job from the top of another worker's deque. Returns 1
+// and sets *job, 0 when the deque is empty, or -1 when another thread won
+// the race for the job (the deque may still hold work).
+static inline int poolSteal(PoolDeque *deque, uint32_t *job) {
+    int top = atomic_load_explicit(&deque->top, memory_order_seq_cst);
+    int bottom = atomic_load_explicit(&deque->bottom, memory_order_seq_cst);
+    if (top >= bottom) return 0;
+    *job = deque->base + (uint32_t)top;
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return -1;
+    }
+    return 1;
+}
+
+// Function run by every worker (including the calling thread as worker 0)
+static inline void *poolWork(void *argument) {
+    PoolWorker *worker = argument;
+    WorkPool *pool = worker->pool;
+    uint32_t job;
+    for (;;) {
+        if (poolTake(&pool->deques[worker->self], &job)) {
+            pool->run(pool->context, job);
+            continue;
+        }
+        int contended = 0, stolen = 0;
+        for (uint32_t k = 1; k < pool->workerCount && !stolen; k++) {
+            int result = poolSteal(&pool->deques[(worker->self + k) % pool->workerCount], &job);
+            if (result < 0) contended = 1;
+            stolen = result > 0;
+        }
+        if (stolen) {
+            pool->run(pool->context, job);
+        } else if (!contended) {
+            return NULL;
+        }
+    }
+}
+
+// Function to get the number of online processors (at least 1)
+static inline uint32_t poolProcessorCount(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+// Function to run jobs 0 .. jobCount-1 as run(context, job) on up to
+// workerCount threads and wait for all of them. If a thread cannot be
+// started, the others steal its share.
+static inline void poolRun(uint32_t jobCount, uint32_t workerCount, PoolJob run, void *context) {
+    if (workerCount > jobCount) workerCount = jobCount;
+    if (workerCount == 0) return;
+    WorkPool pool = {NULL, workerCount, run, context};
+    pool.deques = internAlloc(NULL, (size_t)workerCount * sizeof(PoolDeque));
+    PoolWorker *workers = internAlloc(NULL, (size_t)workerCount * sizeof(PoolWorker));
+    pthread_t *threads = internAlloc(NULL, (size_t)workerCount * sizeof(pthread_t));
+    uint8_t *started = calloc(workerCount, 1);
+    if (started == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (uint32_t w = 0; w < workerCount; w++) {
+        uint32_t first = (uint32_t)((uint64_t)jobCount * w / workerCount);
+        uint32_t last = (uint32_t)((uint64_t)jobCount * (w + 1) / workerCount);
+        pool.deques[w].base = first;
+        atomic_init(&pool.deques[w].top, 0);
+        atomic_init(&pool.deques[w].bottom, (int)(last - first));
+        workers[w].pool = &pool;
+        workers[w].self = w;
+    }
+    for (uint32_t w = 1; w < workerCount; w++) {
+        started[w] = pthread_create(&threads[w], NULL, poolWork, &workers[w]) == 0;
+    }
+    poolWork(&workers[0]);
+    for (uint32_t w = 1; w < workerCount; w++) {
+        if (started[w]) pthread_join(threads[w], NULL);
+    }
+    free(started);
+    free(threads);
+    free(workers);
+    free(pool.deques);
+}
+
+#endif
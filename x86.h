@@ -0,0 +1,292 @@
+#ifndef X86_H
+#define X86_H
+
+// x86-64 backend: turns a TAC buffer into a GAS (AT&T syntax) assembly file
+// holding a main() that runs the code and then prints the final value of
+// every named variable as "name = value".
+//
+// Values are 32-bit ints. Variables live in the registers picked by the
+// linear-scan allocator in regalloc.h, or in 4-byte stack slots when
+// spilled. %eax, %ecx, %edx and %r11d are never allocated and serve as
+// scratch. Callee-saved registers are saved once in the prologue; the
+// caller-saved ones that hold live values are saved around each printf.
+//
+// Frame layout after the prologue (%rsp is 16-byte aligned):
+//   -8(%rbp) .. -40(%rbp)   saved %rbx, %r12 .. %r15
+//   -44(%rbp) downwards     spill slots, then save slots for calls
+
+#include "regalloc.h"
+
+#define X86_REG_COUNT 10
+#define X86_CALLEE_SAVED 5      // Registers 0 .. 4 survive calls
+
+static const char *const x86Regs32[X86_REG_COUNT] = {
+    "%ebx", "%r12d", "%r13d", "%r14d", "%r15d", "%esi", "%edi", "%r8d", "%r9d", "%r10d",
+};
+
+static const char *const x86Jumps[TAC_OP_COUNT] = {
+    [TAC_LT] = "jl", [TAC_LE] = "jle", [TAC_GT] = "jg",
+    [TAC_GE] = "jge", [TAC_EQ] = "je", [TAC_NE] = "jne",
+};
+
+static const char *const x86Sets[TAC_OP_COUNT] = {
+    [TAC_LT] = "setl", [TAC_LE] = "setle", [TAC_GT] = "setg",
+    [TAC_GE] = "setge", [TAC_EQ] = "sete", [TAC_NE] = "setne",
+};
+
+typedef struct {
+    const TacBuffer *code;
+    RegAlloc ra;
+    FILE *out;
+    uint32_t frameSize;
+    uint32_t saveSlot;       // First of the slots used to save registers around calls
+    uint8_t *warned;         // Literal already reported as converted to int
+} X86Emitter;
+
+typedef struct {
+    char text[24];
+} X86Operand;
+
+// Function to turn a literal that is not a small integer into an int,
+// warning once per literal since the backend only has 32-bit ints
+static inline int32_t x86Literal(X86Emitter *e, uint32_t operand) {
+    const char *text = internText(&e->code->names, TAC_VALUE(operand));
+    double value = strtod(text, NULL);
+    int32_t result = value >= 2147483647.0 ? 2147483647 : value <= -2147483648.0 ? (-2147483647 - 1) : (int32_t)value;
+    if (!e->warned[TAC_VALUE(operand)]) {
+        e->warned[TAC_VALUE(operand)] = 1;
+        fprintf(stderr, "Warning: literal %s converted to int %d\n", text, result);
+    }
+    return result;
+}
+
+static inline int x86IsRegister(const X86Operand *operand) {
+    return operand->text[0] == '%';
+}
+
+static inline int x86IsImmediate(const X86Operand *operand) {
+    return operand->text[0] == '$';
+}
+
+static inline int x86Same(const X86Operand *a, const X86Operand *b) {
+    return strcmp(a->text, b->text) == 0;
+}
+
+static inline X86Operand x86Slot(uint32_t slot) {
+    X86Operand result;
+    snprintf(result.text, sizeof(result.text), "-%u(%%rbp)", 44 + 4 * slot);
+    return result;
+}
+
+// Function to get where an operand's value is: register, stack slot or immediate
+static inline X86Operand x86Location(X86Emitter *e, uint32_t operand) {
+    X86Operand result;
+    uint32_t var = tacVarIndex(e->code, operand);
+    if (var != RA_NONE) {
+        if (e->ra.reg[var] != RA_SPILLED) {
+            snprintf(result.text, sizeof(result.text), "%s", x86Regs32[e->ra.reg[var]]);
+            return result;
+        }
+        return x86Slot(e->ra.slot[var]);
+    }
+    int32_t value = TAC_TAG(operand) == TAC_CONST ? x86Literal(e, operand) : tacImmValue(operand);
+    snprintf(result.text, sizeof(result.text), "$%d", value);
+    return result;
+}
+
+// Function to copy src to dst, going through %eax when both are in memory
+static inline void x86Move(X86Emitter *e, const X86Operand *dst, const X86Operand *src) {
+    if (x86Same(dst, src)) return;
+    if (!x86IsRegister(dst) && !x86IsRegister(src) && !x86IsImmediate(src)) {
+        fprintf(e->out, "\tmovl\t%s, %%eax\n", src->text);
+        fprintf(e->out, "\tmovl\t%%eax, %s\n", dst->text);
+        return;
+    }
+    fprintf(e->out, "\tmovl\t%s, %s\n", src->text, dst->text);
+}
+
+// Function to save (or restore) the caller-saved registers that hold values
+// live at position i, around a call
+static inline void x86SaveCallerRegs(X86Emitter *e, uint32_t i, int restore) {
+    for (uint32_t var = 0; var < e->ra.varCount; var++) {
+        int reg = e->ra.reg[var];
+        if (reg < X86_CALLEE_SAVED || e->ra.start[var] > i || e->ra.end[var] < i) continue;
+        X86Operand slot = x86Slot(e->saveSlot + (uint32_t)(reg - X86_CALLEE_SAVED));
+        if (restore) fprintf(e->out, "\tmovl\t%s, %s\n", slot.text, x86Regs32[reg]);
+        else fprintf(e->out, "\tmovl\t%s, %s\n", x86Regs32[reg], slot.text);
+    }
+}
+
+static inline void x86EmitQuad(X86Emitter *e, uint32_t i) {
+    const TacQuad *quad = &e->code->code[i];
+    TacOp op = (TacOp)quad->op;
+    X86Operand dst = {""}, a = {""}, b = {""}, target;
+    static const char *const arithmetic[TAC_OP_COUNT] = {
+        [TAC_ADD] = "addl", [TAC_SUB] = "subl", [TAC_MUL] = "imull",
+    };
+    if (tacDefines(op)) dst = x86Location(e, quad->result);
+    if (op != TAC_LABEL && op != TAC_GOTO && op != TAC_PRINT && quad->arg1 != TAC_NONE) a = x86Location(e, quad->arg1);
+    if (quad->arg2 != TAC_NONE) b = x86Location(e, quad->arg2);
+
+    switch (op) {
+        case TAC_NOP:
+            break;
+        case TAC_COPY:
+            x86Move(e, &dst, &a);
+            break;
+        case TAC_ADD: case TAC_SUB: case TAC_MUL:
+            // Work in the destination register unless it also holds arg2
+            if (x86IsRegister(&dst) && !x86Same(&dst, &b)) target = dst;
+            else snprintf(target.text, sizeof(target.text), "%%eax");
+            x86Move(e, &target, &a);
+            fprintf(e->out, "\t%s\t%s, %s\n", arithmetic[op], b.text, target.text);
+            x86Move(e, &dst, &target);
+            break;
+        case TAC_DIV: case TAC_MOD:
+            fprintf(e->out, "\tmovl\t%s, %%eax\n", a.text);
+            fprintf(e->out, "\tmovl\t%s, %%ecx\n", b.text);
+            fputs("\tcltd\n\tidivl\t%ecx\n", e->out);
+            fprintf(e->out, "\tmovl\t%s, %s\n", op == TAC_DIV ? "%eax" : "%edx", dst.text);
+            break;
+        case TAC_LT: case TAC_LE: case TAC_GT: case TAC_GE: case TAC_EQ: case TAC_NE:
+            fprintf(e->out, "\tmovl\t%s, %%ecx\n", a.text);
+            fprintf(e->out, "\txorl\t%%eax, %%eax\n");
+            fprintf(e->out, "\tcmpl\t%s, %%ecx\n", b.text);
+            fprintf(e->out, "\t%s\t%%al\n", x86Sets[op]);
+            fprintf(e->out, "\tmovl\t%%eax, %s\n", dst.text);
+            break;
+        case TAC_NEG:
+            fprintf(e->out, "\tmovl\t%s, %%eax\n", a.text);
+            fputs("\tnegl\t%eax\n", e->out);
+            fprintf(e->out, "\tmovl\t%%eax, %s\n", dst.text);
+            break;
+        case TAC_NOT:
+            fprintf(e->out, "\tmovl\t%s, %%ecx\n", a.text);
+            fputs("\txorl\t%eax, %eax\n\ttestl\t%ecx, %ecx\n", e->out);
+            fputs("\tsete\t%al\n", e->out);
+            fprintf(e->out, "\tmovl\t%%eax, %s\n", dst.text);
+            break;
+        case TAC_LABEL:
+            fprintf(e->out, ".LT%u:\n", TAC_VALUE(quad->result));
+            break;
+        case TAC_GOTO:
+            fprintf(e->out, "\tjmp\t.LT%u\n", TAC_VALUE(quad->result));
+            break;
+        case TAC_IF:
+            // cmpl needs its second operand in a register or memory
+            if (x86IsImmediate(&a) || (!x86IsRegister(&a) && !x86IsRegister(&b) && !x86IsImmediate(&b))) {
+                fprintf(e->out, "\tmovl\t%s, %%eax\n", a.text);
+                snprintf(a.text, sizeof(a.text), "%%eax");
+            }
+            fprintf(e->out, "\tcmpl\t%s, %s\n", b.text, a.text);
+            fprintf(e->out, "\t%s\t.LT%u\n", x86Jumps[quad->cond], TAC_VALUE(quad->result));
+            break;
+        case TAC_PRINT:
+            x86SaveCallerRegs(e, i, 0);
+            if (TAC_TAG(quad->arg1) == TAC_CONST) {
+                fprintf(e->out, "\tleaq\t.LS%u(%%rip), %%rdi\n", TAC_VALUE(quad->arg1));
+            } else {
+                fprintf(e->out, "\tleaq\t.LFD(%%rip), %%rdi\n");
+                a = x86Location(e, quad->arg1);
+                fprintf(e->out, "\tmovl\t%s, %%esi\n", a.text);
+            }
+            fputs("\txorl\t%eax, %eax\n\tcall\tprintf@PLT\n", e->out);
+            x86SaveCallerRegs(e, i, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+// Function to write a string literal, keeping the escapes it was written with
+static inline void x86EmitString(FILE *out, const char *text) {
+    char previous = 0;
+    fputs("\t.string\t\"", out);
+    for (; *text; text++) {
+        if (*text == '"' && previous != '\\') fputc('\\', out);
+        fputc(*text, out);
+        previous = *text;
+    }
+    fputs("\"\n", out);
+}
+
+static inline void x86Emit(const TacBuffer *code, FILE *out) {
+    X86Emitter e;
+    memset(&e, 0, sizeof(e));
+    e.code = code;
+    e.out = out;
+    e.warned = calloc((size_t)code->names.count + 1, 1);
+    if (e.warned == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+
+    Cfg cfg;
+    cfgBuild(&cfg, code);
+    raLiveness(&e.ra, code, &cfg);
+    raLinearScan(&e.ra, code->count, X86_REG_COUNT);
+    cfgFree(&cfg);
+    e.saveSlot = e.ra.slotCount;
+    e.frameSize = (((e.saveSlot + X86_REG_COUNT - X86_CALLEE_SAVED) * 4 + 15) & ~15u) + 8;
+
+    // Literals: printf strings, the variable names and the result format
+    fputs("\t.section\t.rodata\n", out);
+    fputs(".LFD:\n\t.string\t\"%d\"\n", out);
+    fputs(".LFV:\n\t.string\t\"%s = %d\\n\"\n", out);
+    uint8_t *isString = calloc((size_t)code->names.count + 1, 1);
+    if (isString == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < code->count; i++) {
+        uint32_t arg = code->code[i].arg1;
+        if (code->code[i].op != TAC_PRINT || TAC_TAG(arg) != TAC_CONST || isString[TAC_VALUE(arg)]) continue;
+        isString[TAC_VALUE(arg)] = 1;
+        fprintf(out, ".LS%u:\n", TAC_VALUE(arg));
+        x86EmitString(out, internText(&code->names, TAC_VALUE(arg)));
+    }
+    for (uint32_t var = 0; var < code->names.count; var++) {
+        if (!e.ra.isNamed[var]) continue;
+        fprintf(out, ".LN%u:\n", var);
+        x86EmitString(out, internText(&code->names, var));
+    }
+    free(isString);
+
+    fputs("\t.text\n\t.globl\tmain\n\t.type\tmain, @function\nmain:\n", out);
+    fputs("\tpushq\t%rbp\n\tmovq\t%rsp, %rbp\n", out);
+    fputs("\tpushq\t%rbx\n\tpushq\t%r12\n\tpushq\t%r13\n\tpushq\t%r14\n\tpushq\t%r15\n", out);
+    fprintf(out, "\tsubq\t$%u, %%rsp\n", e.frameSize);
+
+    // Variables read before any assignment start out as 0
+    for (uint32_t var = 0; var < e.ra.varCount; var++) {
+        if (!e.ra.liveAtEntry[var]) continue;
+        X86Operand location = x86Location(&e, tacVarOperand(code, var));
+        fprintf(out, "\tmovl\t$0, %s\n", location.text);
+    }
+
+    for (uint32_t i = 0; i < code->count; i++) x86EmitQuad(&e, i);
+
+    // Print the named variables; those in caller-saved registers are moved
+    // to their save slots first since printf clobbers them
+    uint32_t end = code->count > 0 ? code->count - 1 : 0;
+    x86SaveCallerRegs(&e, end, 0);
+    for (uint32_t var = 0; var < code->names.count; var++) {
+        if (!e.ra.isNamed[var] || e.ra.start[var] == RA_NONE) continue;
+        int reg = e.ra.reg[var];
+        X86Operand value = reg >= X86_CALLEE_SAVED ? x86Slot(e.saveSlot + (uint32_t)(reg - X86_CALLEE_SAVED))
+                                                   : x86Location(&e, tacVarOperand(code, var));
+        fprintf(out, "\tmovl\t%s, %%edx\n", value.text);
+        fprintf(out, "\tleaq\t.LN%u(%%rip), %%rsi\n", var);
+        fputs("\tleaq\t.LFV(%rip), %rdi\n\txorl\t%eax, %eax\n\tcall\tprintf@PLT\n", out);
+    }
+
+    fputs("\txorl\t%eax, %eax\n\tleaq\t-40(%rbp), %rsp\n", out);
+    fputs("\tpopq\t%r15\n\tpopq\t%r14\n\tpopq\t%r13\n\tpopq\t%r12\n\tpopq\t%rbx\n\tpopq\t%rbp\n\tret\n", out);
+    fputs("\t.size\tmain, .-main\n", out);
+    fputs("\t.section\t.note.GNU-stack,\"\",@progbits\n", out);
+
+    raFree(&e.ra);
+    free(e.warned);
+}
+
+#endif